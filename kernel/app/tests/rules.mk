@@ -16,12 +16,15 @@ MODULE_SRCS += \
     $(LOCAL_DIR)/fibo.c \
     $(LOCAL_DIR)/mem_tests.cpp \
     $(LOCAL_DIR)/printf_tests.c \
+    $(LOCAL_DIR)/sched_bench.c \
     $(LOCAL_DIR)/sync_ipi_tests.c \
     $(LOCAL_DIR)/sleep_tests.c \
     $(LOCAL_DIR)/tests.c \
     $(LOCAL_DIR)/thread_tests.c \
     $(LOCAL_DIR)/alloc_checker_tests.cpp \
     $(LOCAL_DIR)/timer_tests.c \
+    $(LOCAL_DIR)/vm_fault_bench.cpp \
+    $(LOCAL_DIR)/vm_tlb_bench.cpp \
 
 
 MODULE_DEPS += \
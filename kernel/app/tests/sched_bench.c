@@ -0,0 +1,212 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#include "tests.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+#include <inttypes.h>
+#include <kernel/event.h>
+#include <kernel/mp.h>
+#include <kernel/thread.h>
+#include <platform.h>
+
+#define SCHED_BENCH_DURATION LK_SEC(1)
+
+/* a pair of threads bouncing wakeups back and forth */
+struct sched_bench_pair {
+    event_t ping;
+    event_t pong;
+    volatile int *done;
+
+    /* time the last wakeup was issued, written by the waker */
+    volatile lk_time_t signal_time;
+
+    /* wakeup to run latency, accumulated by both sides */
+    uint64_t wakeups;
+    lk_time_t total_latency;
+    lk_time_t max_latency;
+
+    thread_t *threads[2];
+};
+
+static void sched_bench_record(struct sched_bench_pair *pair)
+{
+    lk_time_t latency = current_time() - pair->signal_time;
+
+    /* the two sides of a pair strictly alternate, so no lock is needed */
+    pair->wakeups++;
+    pair->total_latency += latency;
+    if (latency > pair->max_latency)
+        pair->max_latency = latency;
+}
+
+static void sched_bench_loop(struct sched_bench_pair *pair, event_t *mine, event_t *other)
+{
+    while (!*pair->done) {
+        event_wait(mine);
+        if (*pair->done)
+            break;
+
+        sched_bench_record(pair);
+
+        pair->signal_time = current_time();
+        event_signal(other, true);
+    }
+}
+
+static int sched_bench_ping_thread(void *arg)
+{
+    struct sched_bench_pair *pair = arg;
+
+    sched_bench_loop(pair, &pair->ping, &pair->pong);
+    return 0;
+}
+
+static int sched_bench_pong_thread(void *arg)
+{
+    struct sched_bench_pair *pair = arg;
+
+    sched_bench_loop(pair, &pair->pong, &pair->ping);
+    return 0;
+}
+
+static ulong sched_bench_context_switches(void)
+{
+    ulong total = 0;
+    for (uint i = 0; i < SMP_MAX_CPUS; i++)
+        total += thread_stats[i].context_switches;
+    return total;
+}
+
+static ulong sched_bench_steals(void)
+{
+    ulong total = 0;
+#if WITH_SMP
+    for (uint i = 0; i < SMP_MAX_CPUS; i++)
+        total += thread_stats[i].steals;
+#endif
+    return total;
+}
+
+/* run num_pairs ping-pong pairs for the benchmark duration */
+static status_t sched_bench_run(uint num_pairs)
+{
+    struct sched_bench_pair *pairs = calloc(num_pairs, sizeof(*pairs));
+    if (!pairs)
+        return ERR_NO_MEMORY;
+
+    volatile int done = 0;
+    status_t status = NO_ERROR;
+
+    /* pairs whose events are initialized, which the cleanup below tears down */
+    uint num_started = 0;
+    for (uint i = 0; i < num_pairs; i++) {
+        struct sched_bench_pair *pair = &pairs[i];
+        event_init(&pair->ping, false, EVENT_FLAG_AUTOUNSIGNAL);
+        event_init(&pair->pong, false, EVENT_FLAG_AUTOUNSIGNAL);
+        pair->done = &done;
+
+        char name[THREAD_NAME_LENGTH];
+        snprintf(name, sizeof(name), "sched bench ping %u", i);
+        pair->threads[0] = thread_create(name, sched_bench_ping_thread, pair,
+                                         DEFAULT_PRIORITY, DEFAULT_STACK_SIZE);
+        snprintf(name, sizeof(name), "sched bench pong %u", i);
+        pair->threads[1] = thread_create(name, sched_bench_pong_thread, pair,
+                                         DEFAULT_PRIORITY, DEFAULT_STACK_SIZE);
+        num_started++;
+
+        /* resume even half a pair, so it sees the done flag and can be joined */
+        for (uint j = 0; j < countof(pair->threads); j++) {
+            if (pair->threads[j])
+                thread_resume(pair->threads[j]);
+        }
+        if (!pair->threads[0] || !pair->threads[1]) {
+            status = ERR_NO_MEMORY;
+            break;
+        }
+    }
+
+    ulong start_switches = sched_bench_context_switches();
+    ulong start_steals = sched_bench_steals();
+    lk_time_t start = current_time();
+
+    if (status == NO_ERROR) {
+        /* get every pair going */
+        for (uint i = 0; i < num_pairs; i++) {
+            pairs[i].signal_time = current_time();
+            event_signal(&pairs[i].ping, false);
+        }
+
+        thread_sleep_relative(SCHED_BENCH_DURATION);
+    }
+
+    done = 1;
+    lk_time_t elapsed = current_time() - start;
+    ulong switches = sched_bench_context_switches() - start_switches;
+    ulong steals = sched_bench_steals() - start_steals;
+
+    uint64_t wakeups = 0;
+    lk_time_t total_latency = 0;
+    lk_time_t max_latency = 0;
+    for (uint i = 0; i < num_started; i++) {
+        struct sched_bench_pair *pair = &pairs[i];
+
+        /* kick anyone still blocked so they see the done flag */
+        event_signal(&pair->ping, false);
+        event_signal(&pair->pong, false);
+        for (uint j = 0; j < countof(pair->threads); j++) {
+            if (pair->threads[j])
+                thread_join(pair->threads[j], NULL, INFINITE_TIME);
+        }
+
+        wakeups += pair->wakeups;
+        total_latency += pair->total_latency;
+        if (pair->max_latency > max_latency)
+            max_latency = pair->max_latency;
+
+        event_destroy(&pair->ping);
+        event_destroy(&pair->pong);
+    }
+
+    if (status == NO_ERROR && elapsed > 0) {
+        printf("%3u pairs: %8" PRIu64 " cs/sec %8" PRIu64 " wakeups/sec"
+               " latency avg %6" PRIu64 " ns max %8" PRIu64 " ns, %lu steals\n",
+               num_pairs,
+               (uint64_t)switches * LK_SEC(1) / elapsed,
+               wakeups * LK_SEC(1) / elapsed,
+               wakeups ? total_latency / wakeups : 0,
+               max_latency, steals);
+    }
+
+    free(pairs);
+    return status;
+}
+
+/* measure context switch throughput and wakeup to run latency while the
+ * number of busy cpus grows */
+int sched_bench(int argc, const cmd_args *argv)
+{
+    uint max_pairs = arch_max_num_cpus();
+    if (argc >= 2)
+        max_pairs = argv[1].u;
+
+    printf("scheduler benchmark, %u cpus online, %u ms per run\n",
+           __builtin_popcount(mp_get_online_mask()),
+           (uint)(SCHED_BENCH_DURATION / LK_MSEC(1)));
+
+    for (uint pairs = 1; pairs <= max_pairs; pairs++) {
+        status_t status = sched_bench_run(pairs);
+        if (status != NO_ERROR) {
+            printf("run with %u pairs failed: %d\n", pairs, status);
+            return status;
+        }
+    }
+
+    return 0;
+}
@@ -29,6 +29,10 @@ STATIC_COMMAND("fibo", "threaded fibonacci", (console_cmd)&fibo)
 STATIC_COMMAND("spinner", "create a spinning thread", (console_cmd)&spinner)
 STATIC_COMMAND("sync_ipi_tests", "test synchronous IPIs", (console_cmd)&sync_ipi_tests)
 STATIC_COMMAND("timer_tests", "tests timers", (console_cmd)&timer_tests)
+STATIC_COMMAND("timer_bench", "timer set/cancel throughput on all cpus", (console_cmd)&timer_bench)
+STATIC_COMMAND("sched_bench", "scheduler context switch and wakeup latency benchmark", (console_cmd)&sched_bench)
+STATIC_COMMAND("vm_fault_bench", "page fault count and latency of a linear vmo scan", (console_cmd)&vm_fault_bench)
+STATIC_COMMAND("vm_tlb_bench", "random access cost with small and large pages", (console_cmd)&vm_tlb_bench)
 STATIC_COMMAND_END(tests);
 
 #endif
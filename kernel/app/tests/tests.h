@@ -18,6 +18,7 @@ int port_tests(void);
 void printf_tests(void);
 void clock_tests(void);
 void timer_tests(void);
+int timer_bench(int argc, const cmd_args *argv);
 void benchmarks(void);
 int fibo(int argc, const cmd_args *argv);
 int spinner(int argc, const cmd_args *argv);
@@ -30,6 +31,9 @@ int hash_tests(int argc, const cmd_args *argv);
 int vm_tests(int argc, const cmd_args *argv);
 int auto_call_tests(int argc, const cmd_args *argv);
 int sync_ipi_tests(int argc, const cmd_args *argv);
+int sched_bench(int argc, const cmd_args *argv);
+int vm_fault_bench(int argc, const cmd_args *argv);
+int vm_tlb_bench(int argc, const cmd_args *argv);
 int arena_tests(int argc, const cmd_args *argv);
 int fifo_tests(int argc, const cmd_args *argv);
 int alloc_checker_tests(int argc, const cmd_args* argv);
@@ -503,7 +503,7 @@ static int sleeper_kill_thread(void *arg)
     thread_sleep_relative(LK_MSEC(100));
 
     lk_time_t t = current_time();
-    status_t err = thread_sleep_etc(t + LK_SEC(5), true);
+    status_t err = thread_sleep_etc(t + LK_SEC(5), 0, true);
     t = (current_time() - t) / LK_MSEC(1);
     TRACEF("thread_sleep_etc returns %d after %" PRIu64" msecs\n", err, t);
 
@@ -75,6 +75,83 @@ static void timer_test_all_cpus(void)
     printf("%u threads created, %u threads joined\n", max, joined);
 }
 
+#define TIMER_BENCH_ITERATIONS 100000
+
+static enum handler_return timer_bench_cb(struct timer* timer, lk_time_t now, void* arg)
+{
+    return INT_NO_RESCHEDULE;
+}
+
+struct timer_bench_args {
+    event_t* gate;
+    lk_time_t elapsed;
+};
+
+static int timer_bench_thread(void* arg)
+{
+    struct timer_bench_args* args = arg;
+    timer_t timer;
+    timer_initialize(&timer);
+
+    event_wait(args->gate);
+
+    // set deadlines far enough out that they never fire, so this measures
+    // just the cost of queueing and dequeueing
+    lk_time_t start = current_time();
+    for (uint i = 0; i < TIMER_BENCH_ITERATIONS; i++) {
+        timer_set_oneshot(&timer, start + LK_SEC(60), timer_bench_cb, NULL);
+        timer_cancel(&timer);
+    }
+    args->elapsed = current_time() - start;
+
+    return 0;
+}
+
+static thread_t _timer_bench_threads[SMP_MAX_CPUS];
+
+int timer_bench(int argc, const cmd_args* argv)
+{
+    uint max = arch_max_num_cpus();
+    event_t gate = EVENT_INITIAL_VALUE(gate, false, 0);
+    struct timer_bench_args args[SMP_MAX_CPUS] = { 0 };
+
+    uint started = 0;
+    for (uint i = 0; i < max; i++) {
+        char name[16];
+        snprintf(name, sizeof(name), "timer bench %u", i);
+
+        args[i].gate = &gate;
+        thread_t* t = thread_create_etc(
+                &_timer_bench_threads[i], name, timer_bench_thread, &args[i],
+                DEFAULT_PRIORITY, NULL, NULL, DEFAULT_STACK_SIZE, NULL);
+        if (t == NULL) {
+            printf("failed to create thread for cpu %u\n", i);
+            break;
+        }
+        thread_set_pinned_cpu(t, i);
+        thread_resume(t);
+        started++;
+    }
+
+    // release every cpu at once so they all contend
+    event_signal(&gate, true);
+
+    uint64_t total_ops_per_sec = 0;
+    for (uint i = 0; i < started; i++) {
+        thread_join(&_timer_bench_threads[i], NULL, INFINITE_TIME);
+
+        uint64_t ops_per_sec = args[i].elapsed ?
+            (uint64_t)TIMER_BENCH_ITERATIONS * LK_SEC(1) / args[i].elapsed : 0;
+        printf("cpu %u: %u set/cancel pairs in %" PRIu64 " us, %" PRIu64 " pairs/sec\n",
+               i, TIMER_BENCH_ITERATIONS, args[i].elapsed / LK_USEC(1), ops_per_sec);
+        total_ops_per_sec += ops_per_sec;
+    }
+    printf("total: %" PRIu64 " set/cancel pairs/sec across %u cpus\n", total_ops_per_sec, started);
+
+    event_destroy(&gate);
+    return 0;
+}
+
 void timer_tests(void)
 {
     // timer fires on all cpus
@@ -0,0 +1,94 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#include "tests.h"
+
+#include <stdio.h>
+#include <err.h>
+#include <inttypes.h>
+#include <kernel/auto_lock.h>
+#include <kernel/vm.h>
+#include <kernel/vm/vm_address_region.h>
+#include <kernel/vm/vm_aspace.h>
+#include <kernel/vm/vm_object_paged.h>
+#include <platform.h>
+
+static const size_t kDefaultScanSize = 256 * 1024 * 1024;
+
+// fault-around windows to compare, in pages
+static const uint32_t kWindows[] = { 0, 4, 16, 32, 64 };
+
+// map a committed vmo demand paged and read one byte from every page in order
+static status_t vm_fault_bench_scan(const mxtl::RefPtr<VmObject>& vmo, size_t size,
+                                    uint32_t window) {
+    {
+        AutoLock a(vmo->lock());
+        vmo->set_fault_around_pages_locked(window);
+    }
+
+    auto aspace = VmAspace::kernel_aspace();
+    void* ptr;
+    status_t status = aspace->MapObjectInternal(vmo, "vm_fault_bench", 0, size, &ptr,
+                                                0, 0, ARCH_MMU_FLAG_PERM_READ);
+    if (status != NO_ERROR)
+        return status;
+
+    auto mapping = aspace->FindRegion((vaddr_t)ptr)->as_vm_mapping();
+    DEBUG_ASSERT(mapping);
+
+    volatile const uint8_t* buf = static_cast<volatile const uint8_t*>(ptr);
+    lk_time_t start = current_time();
+    for (size_t offset = 0; offset < size; offset += PAGE_SIZE)
+        (void)buf[offset];
+    lk_time_t elapsed = current_time() - start;
+
+    uint64_t faults = mapping->page_faults();
+    uint64_t around = mapping->fault_around_pages_mapped();
+    size_t pages = size / PAGE_SIZE;
+
+    printf("window %3u: %8" PRIu64 " faults, %8" PRIu64 " pages mapped around,"
+           " %6" PRIu64 " us total, %5" PRIu64 " ns/page, %6" PRIu64 " ns/fault\n",
+           window, faults, around, elapsed / LK_USEC(1), elapsed / pages,
+           faults ? elapsed / faults : 0);
+
+    return aspace->FreeRegion((vaddr_t)ptr);
+}
+
+// measure page fault counts and latency of a linear scan over a resident vmo
+// with different fault-around windows
+int vm_fault_bench(int argc, const cmd_args* argv) {
+    size_t size = kDefaultScanSize;
+    if (argc >= 2)
+        size = ROUNDUP_PAGE_SIZE(argv[1].u * 1024 * 1024);
+    if (size == 0) {
+        printf("usage: %s [size in MB]\n", argv[0].str);
+        return ERR_INVALID_ARGS;
+    }
+
+    auto vmo = VmObjectPaged::Create(PMM_ALLOC_FLAG_ANY, size);
+    if (!vmo)
+        return ERR_NO_MEMORY;
+
+    // make every page resident up front so the scan only measures mapping cost
+    uint64_t committed;
+    status_t status = vmo->CommitRange(0, size, &committed);
+    if (status != NO_ERROR) {
+        printf("failed to commit %zu bytes: %d\n", size, status);
+        return status;
+    }
+
+    printf("vm fault benchmark, linear scan of %zu MB\n", size / (1024 * 1024));
+
+    for (auto window : kWindows) {
+        status = vm_fault_bench_scan(vmo, size, window);
+        if (status != NO_ERROR) {
+            printf("scan with window %u failed: %d\n", window, status);
+            return status;
+        }
+    }
+
+    return 0;
+}
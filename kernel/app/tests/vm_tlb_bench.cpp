@@ -0,0 +1,88 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#include "tests.h"
+
+#include <stdio.h>
+#include <err.h>
+#include <inttypes.h>
+#include <kernel/vm.h>
+#include <kernel/vm/vm_aspace.h>
+#include <kernel/vm/vm_object_paged.h>
+#include <platform.h>
+
+static const size_t kDefaultBufferSize = 256 * 1024 * 1024;
+static const size_t kAccesses = 16 * 1024 * 1024;
+
+// touch one word in a pseudo random page of the buffer for every access, so
+// nearly every access needs a different translation
+static lk_time_t vm_tlb_bench_walk(volatile uint64_t* buf, size_t size) {
+    const size_t pages = size / PAGE_SIZE;
+    const size_t words_per_page = PAGE_SIZE / sizeof(uint64_t);
+    uint32_t state = 1;
+
+    lk_time_t start = current_time();
+    for (size_t i = 0; i < kAccesses; i++) {
+        state = state * 1664525 + 1013904223;
+        size_t page = state % pages;
+        buf[page * words_per_page + (i % words_per_page)]++;
+    }
+    return current_time() - start;
+}
+
+static status_t vm_tlb_bench_run(const char* name, mxtl::RefPtr<VmObject> vmo, size_t size) {
+    if (!vmo)
+        return ERR_NO_MEMORY;
+
+    // commit and map everything up front so the walk only measures translation cost
+    auto aspace = VmAspace::kernel_aspace();
+    void* ptr;
+    status_t status = aspace->MapObjectInternal(mxtl::move(vmo), name, 0, size, &ptr,
+                                                VmObject::kLargePageShift, VMM_FLAG_COMMIT,
+                                                ARCH_MMU_FLAG_PERM_READ |
+                                                    ARCH_MMU_FLAG_PERM_WRITE);
+    if (status != NO_ERROR)
+        return status;
+
+    // run once to warm the caches, then measure
+    vm_tlb_bench_walk(static_cast<volatile uint64_t*>(ptr), size);
+    lk_time_t elapsed = vm_tlb_bench_walk(static_cast<volatile uint64_t*>(ptr), size);
+
+    printf("%-12s: %8" PRIu64 " us for %zu accesses, %4" PRIu64 " ns/access\n",
+           name, elapsed / LK_USEC(1), kAccesses, elapsed / kAccesses);
+
+    return aspace->FreeRegion((vaddr_t)ptr);
+}
+
+// compare random access cost over a buffer backed by small pages against the
+// same buffer backed by large pages
+int vm_tlb_bench(int argc, const cmd_args* argv) {
+    size_t size = kDefaultBufferSize;
+    if (argc >= 2)
+        size = ROUNDUP(argv[1].u * 1024 * 1024, VmObject::kLargePageSize);
+    if (size == 0) {
+        printf("usage: %s [size in MB]\n", argv[0].str);
+        return ERR_INVALID_ARGS;
+    }
+
+    printf("tlb benchmark, random access over %zu MB\n", size / (1024 * 1024));
+
+    status_t status = vm_tlb_bench_run("small pages",
+                                       VmObjectPaged::Create(PMM_ALLOC_FLAG_ANY, size), size);
+    if (status != NO_ERROR) {
+        printf("small page run failed: %d\n", status);
+        return status;
+    }
+
+    status = vm_tlb_bench_run("large pages",
+                              VmObjectPaged::CreateLargePages(PMM_ALLOC_FLAG_ANY, size), size);
+    if (status != NO_ERROR) {
+        printf("large page run failed: %d\n", status);
+        return status;
+    }
+
+    return 0;
+}
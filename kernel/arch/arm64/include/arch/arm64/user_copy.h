@@ -26,4 +26,10 @@ status_t _arm64_copy_to_user(
         size_t len,
         void **fault_return);
 
+status_t _arm64_cmpxchg_user(
+        int *ptr,
+        int *expected,
+        int desired,
+        void **fault_return);
+
 __END_CDECLS
@@ -46,3 +46,16 @@ status_t arch_copy_to_user(void *dst, const void *src, size_t len)
             _arm64_copy_to_user(dst, src, len, &thr->arch.data_fault_resume);
     return status;
 }
+
+status_t arch_cmpxchg_user(int *ptr, int *expected, int desired)
+{
+    // Unlike the copies, this uses ordinary loads and stores, since there
+    // are no unprivileged exclusive accesses; the address check is all that
+    // keeps it to user memory.
+    if (((uintptr_t)ptr % sizeof(int)) || !is_user_address_range((vaddr_t)ptr, sizeof(int))) {
+        return ERR_INVALID_ARGS;
+    }
+
+    thread_t *thr = get_current_thread();
+    return _arm64_cmpxchg_user(ptr, expected, desired, &thr->arch.data_fault_resume);
+}
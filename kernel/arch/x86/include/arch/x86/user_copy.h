@@ -28,4 +28,11 @@ status_t _x86_copy_to_user(
         bool smap_avail,
         void **fault_return);
 
+status_t _x86_cmpxchg_user(
+        int *ptr,
+        int *expected,
+        int desired,
+        bool smap_avail,
+        void **fault_return);
+
 __END_CDECLS
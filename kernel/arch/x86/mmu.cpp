@@ -21,6 +21,7 @@
 #include <kernel/vm.h>
 
 #include <bitmap/rle-bitmap.h>
+#include <mxtl/macros.h>
 
 #define LOCAL_TRACE 0
 
@@ -123,69 +124,153 @@ static void x86_tlb_global_invalidate() {
     }
 }
 
-/* Task used for invalidating a TLB entry on each CPU */
+/**
+ * @brief  invalidate all non-global TLB entries
+ */
+static void x86_tlb_nonglobal_invalidate() {
+    x86_set_cr3(x86_get_cr3());
+}
+
+/* Tracks the TLB invalidations needed by a single page table operation.  Entries
+ * that are changed or removed are only recorded here as the operation walks the
+ * tables; x86_tlb_invalidate() then shoots them all down with a single
+ * mp_sync_exec once the operation is done, rather than one per page. */
+struct PendingTlbInvalidation {
+    /* an address whose translation needs to be flushed, packed into one word
+     * to keep the batch small on the stack: invlpg only needs some address
+     * in the page, so the low bits carry the flags */
+    struct Item {
+        uint64_t raw;
+
+        static constexpr uint64_t kGlobal = 1;
+
+        vaddr_t vaddr() const { return ROUNDDOWN(raw, PAGE_SIZE); }
+        bool is_global() const { return raw & kGlobal; }
+    };
+    static_assert(sizeof(Item) == sizeof(uint64_t), "");
+
+    /* past this many pages a full flush is cheaper than invlpg on each of them */
+    static constexpr size_t kMaxPages = 32;
+
+    PendingTlbInvalidation() {
+        list_initialize(&freed_tables);
+    }
+    ~PendingTlbInvalidation() {
+        DEBUG_ASSERT(count == 0 && !full_shootdown && list_is_empty(&freed_tables));
+    }
+    DISALLOW_COPY_ASSIGN_AND_MOVE(PendingTlbInvalidation);
+
+    void enqueue(vaddr_t vaddr, enum page_table_levels level, bool is_global) {
+        if (is_global)
+            contains_global = true;
+
+        /* dropping a whole top level entry or running out of room means we just
+         * flush everything */
+        if (level == PML4_L || count == kMaxPages) {
+            full_shootdown = true;
+            return;
+        }
+        if (full_shootdown)
+            return;
+
+        items[count].raw = ROUNDDOWN(vaddr, PAGE_SIZE) | (is_global ? Item::kGlobal : 0);
+        count++;
+    }
+
+    /* page tables unlinked by the operation may still be in use by another cpu's
+     * page walk until the invalidation is done, so hold on to them until then */
+    void free_table(pt_entry_t* table) {
+        vm_page_t* page = paddr_to_vm_page(X86_VIRT_TO_PHYS(table));
+        list_add_tail(&freed_tables, &page->free.node);
+    }
+
+    void clear() {
+        count = 0;
+        full_shootdown = false;
+        contains_global = false;
+    }
+
+    Item items[kMaxPages];
+    size_t count = 0;
+    bool full_shootdown = false;
+    bool contains_global = false;
+    list_node freed_tables;
+};
+
+/* Task used for invalidating the pending TLB entries on each CPU */
 struct tlb_invalidate_page_context {
     ulong target_cr3;
-    vaddr_t vaddr;
-    enum page_table_levels level;
-    bool global_page;
+    const PendingTlbInvalidation* pending;
 };
 static void tlb_invalidate_page_task(void* raw_context) {
     DEBUG_ASSERT(arch_ints_disabled());
     tlb_invalidate_page_context* context = (tlb_invalidate_page_context*)raw_context;
+    const PendingTlbInvalidation* pending = context->pending;
 
     ulong cr3 = x86_get_cr3();
-    if (context->target_cr3 != cr3 && !context->global_page) {
+    bool is_target_aspace = (context->target_cr3 == cr3);
+    if (!is_target_aspace && !pending->contains_global) {
         /* This invalidation doesn't apply to this CPU, ignore it */
         return;
     }
 
-    switch (context->level) {
-    case PML4_L:
-        x86_tlb_global_invalidate();
-        break;
-    case PDP_L:
-    case PD_L:
-    case PT_L:
-        __asm__ volatile("invlpg %0" ::"m"(*(uint8_t*)context->vaddr));
-        break;
+    if (pending->full_shootdown) {
+        if (pending->contains_global) {
+            x86_tlb_global_invalidate();
+        } else {
+            x86_tlb_nonglobal_invalidate();
+        }
+        return;
+    }
+
+    for (size_t i = 0; i < pending->count; ++i) {
+        const auto& item = pending->items[i];
+        if (!item.is_global() && !is_target_aspace) {
+            continue;
+        }
+        __asm__ volatile("invlpg %0" ::"m"(*(uint8_t*)item.vaddr()));
     }
 }
 
 /**
- * @brief Invalidate a single page at a given page table level
+ * @brief Execute a batch of pending TLB invalidations
  *
- * @param aspace The aspace we're invalidating for (if NULL, assume for current one)
- * @param vaddr The virtual address we are invalidating the TLB entry for
- * @param level The page table level that maps this vaddr
- * @param global_page True if we are invalidating a global mapping
+ * Sends a single round of IPIs covering every page recorded in *pending*, then
+ * frees any page tables that the operation unlinked.
  *
- * TODO(teisenbe): Optimize this.  This is horribly inefficient.
- * We should also change this to pool invalidations from a single
- * "transaction" and then only execute a single mp_sync_exec for that
- * transaction, rather than one per page.
+ * @param aspace The aspace we're invalidating for (if NULL, assume for current one)
+ * @param pending The invalidations to perform, cleared on return
  */
-void x86_tlb_invalidate_page(arch_aspace_t* aspace, vaddr_t vaddr, enum page_table_levels level,
-                             bool global_page) {
-    ulong cr3 = aspace ? aspace->pt_phys : x86_get_cr3();
-    struct tlb_invalidate_page_context task_context = {
-        .target_cr3 = cr3, .vaddr = vaddr, .level = level, .global_page = global_page,
-    };
+static void x86_tlb_invalidate(arch_aspace_t* aspace, PendingTlbInvalidation* pending) {
+    if (pending->count > 0 || pending->full_shootdown) {
+        ulong cr3 = aspace ? aspace->pt_phys : x86_get_cr3();
+        struct tlb_invalidate_page_context task_context = {
+            .target_cr3 = cr3, .pending = pending,
+        };
+
+        /* Target only CPUs this aspace is active on.  It may be the case that some
+         * other CPU will become active in it after this load, or will have left it
+         * just before this load.  In the former case, it is becoming active after
+         * the write to the page table, so it will see the change.  In the latter
+         * case, it will get a spurious request to flush. */
+        mp_cpu_mask_t targets;
+        if (pending->contains_global || aspace == nullptr) {
+            targets = MP_CPU_ALL;
+        } else {
+            targets = atomic_load(&aspace->active_cpus);
+            static_assert(sizeof(mp_cpu_mask_t) == sizeof(aspace->active_cpus), "err");
+        }
 
-    /* Target only CPUs this aspace is active on.  It may be the case that some
-     * other CPU will become active in it after this load, or will have left it
-     * just before this load.  In the former case, it is becoming active after
-     * the write to the page table, so it will see the change.  In the latter
-     * case, it will get a spurious request to flush. */
-    mp_cpu_mask_t targets;
-    if (global_page || aspace == nullptr) {
-        targets = MP_CPU_ALL;
-    } else {
-        targets = atomic_load(&aspace->active_cpus);
-        static_assert(sizeof(mp_cpu_mask_t) == sizeof(aspace->active_cpus), "err");
+        if (targets != 0) {
+            mp_sync_exec(targets, tlb_invalidate_page_task, &task_context);
+        }
+        pending->clear();
     }
 
-    mp_sync_exec(targets, tlb_invalidate_page_task, &task_context);
+    /* nothing can be walking the unlinked tables anymore */
+    if (!list_is_empty(&pending->freed_tables)) {
+        pmm_free(&pending->freed_tables);
+    }
 }
 
 template <int Level>
@@ -373,10 +458,11 @@ struct PageTable : PageTableBase<Level> {
     }
 
     /**
-     * @brief Invalidate a single page at a given page table level
+     * @brief Queue invalidation of a single page at a given page table level
      */
-    static void tlb_invalidate_page(arch_aspace_t* aspace, vaddr_t vaddr, bool global_page) {
-        x86_tlb_invalidate_page(aspace, vaddr, Base::level, global_page);
+    static void tlb_invalidate_page(vaddr_t vaddr, bool global_page,
+                                    PendingTlbInvalidation* pending) {
+        pending->enqueue(vaddr, Base::level, global_page);
     }
 };
 
@@ -424,9 +510,10 @@ struct ExtendedPageTable : PageTableBase<Level> {
     }
 
     /**
-     * @brief Invalidate a single page at a given page table level
+     * @brief Queue invalidation of a single page at a given page table level
      */
-    static void tlb_invalidate_page(arch_aspace_t* aspace, vaddr_t vaddr, bool global_page) {
+    static void tlb_invalidate_page(vaddr_t vaddr, bool global_page,
+                                    PendingTlbInvalidation* pending) {
         // TODO(abdulla): Implement this.
     }
 };
@@ -504,8 +591,8 @@ struct MappingCursor {
 };
 
 template <typename PageTable>
-static void update_entry(arch_aspace_t* aspace, vaddr_t vaddr, pt_entry_t* pte, paddr_t paddr,
-                         arch_flags_t flags) {
+static void update_entry(PendingTlbInvalidation* pending, vaddr_t vaddr, pt_entry_t* pte,
+                         paddr_t paddr, arch_flags_t flags) {
     DEBUG_ASSERT(pte);
     DEBUG_ASSERT(IS_PAGE_ALIGNED(paddr));
 
@@ -517,12 +604,12 @@ static void update_entry(arch_aspace_t* aspace, vaddr_t vaddr, pt_entry_t* pte,
 
     /* attempt to invalidate the page */
     if (IS_PAGE_PRESENT(olde)) {
-        PageTable::tlb_invalidate_page(aspace, vaddr, is_kernel_address(vaddr));
+        PageTable::tlb_invalidate_page(vaddr, is_kernel_address(vaddr), pending);
     }
 }
 
 template <typename PageTable>
-static void unmap_entry(arch_aspace_t* aspace, vaddr_t vaddr, pt_entry_t* pte) {
+static void unmap_entry(PendingTlbInvalidation* pending, vaddr_t vaddr, pt_entry_t* pte) {
     DEBUG_ASSERT(pte);
 
     pt_entry_t olde = *pte;
@@ -531,7 +618,7 @@ static void unmap_entry(arch_aspace_t* aspace, vaddr_t vaddr, pt_entry_t* pte) {
 
     /* attempt to invalidate the page */
     if (IS_PAGE_PRESENT(olde)) {
-        PageTable::tlb_invalidate_page(aspace, vaddr, is_kernel_address(vaddr));
+        PageTable::tlb_invalidate_page(vaddr, is_kernel_address(vaddr), pending);
     }
 }
 
@@ -555,7 +642,8 @@ static pt_entry_t* _map_alloc_page(void) {
  * @brief Split the given large page into smaller pages
  */
 template <typename PageTable>
-static status_t x86_mmu_split(arch_aspace_t* aspace, vaddr_t vaddr, pt_entry_t* pte) {
+static status_t x86_mmu_split(arch_aspace_t* aspace, vaddr_t vaddr, pt_entry_t* pte,
+                              PendingTlbInvalidation* pending) {
     static_assert(PageTable::level != PT_L, "tried splitting PT_L");
     LTRACEF_LEVEL(2, "splitting table %p at level %d\n", pte, PageTable::level);
 
@@ -576,14 +664,14 @@ static status_t x86_mmu_split(arch_aspace_t* aspace, vaddr_t vaddr, pt_entry_t*
         pt_entry_t* e = m + i;
         // If this is a PDP_L (i.e. huge page), flags will include the
         // PS bit still, so the new PD entries will be large pages.
-        update_entry<typename PageTable::LowerTable>(aspace, new_vaddr, e, new_paddr, flags);
+        update_entry<typename PageTable::LowerTable>(pending, new_vaddr, e, new_paddr, flags);
         new_vaddr += ps;
         new_paddr += ps;
     }
     DEBUG_ASSERT(new_vaddr == vaddr + PageTable::page_size());
 
     flags = PageTable::intermediate_arch_flags();
-    update_entry<PageTable>(aspace, vaddr, pte, X86_VIRT_TO_PHYS(m), flags);
+    update_entry<PageTable>(pending, vaddr, pte, X86_VIRT_TO_PHYS(m), flags);
     return NO_ERROR;
 }
 
@@ -680,7 +768,8 @@ status_t x86_mmu_get_mapping<ExtendedPageTable<PT_L>>(pt_entry_t* table, vaddr_t
  */
 template <typename PageTable>
 static bool x86_mmu_remove_mapping(arch_aspace_t* aspace, pt_entry_t* table,
-                                   const MappingCursor& start_cursor, MappingCursor* new_cursor) {
+                                   const MappingCursor& start_cursor, MappingCursor* new_cursor,
+                                   PendingTlbInvalidation* pending) {
     DEBUG_ASSERT(table);
     LTRACEF("L: %d, %016" PRIxPTR " %016zx\n", PageTable::level, start_cursor.vaddr,
             start_cursor.size);
@@ -714,7 +803,7 @@ static bool x86_mmu_remove_mapping(arch_aspace_t* aspace, pt_entry_t* table,
             bool vaddr_level_aligned = PageTable::page_aligned(new_cursor->vaddr);
             // If the request covers the entire large page, just unmap it
             if (vaddr_level_aligned && new_cursor->size >= ps) {
-                unmap_entry<PageTable>(aspace, new_cursor->vaddr, e);
+                unmap_entry<PageTable>(pending, new_cursor->vaddr, e);
                 unmapped = true;
 
                 new_cursor->vaddr += ps;
@@ -724,11 +813,11 @@ static bool x86_mmu_remove_mapping(arch_aspace_t* aspace, pt_entry_t* table,
             }
             // Otherwise, we need to split it
             vaddr_t page_vaddr = new_cursor->vaddr & ~(ps - 1);
-            status_t status = x86_mmu_split<PageTable>(aspace, page_vaddr, e);
+            status_t status = x86_mmu_split<PageTable>(aspace, page_vaddr, e, pending);
             if (status != NO_ERROR) {
                 // If split fails, just unmap the whole thing, and let a
                 // subsequent page fault clean it up.
-                unmap_entry<PageTable>(aspace, new_cursor->vaddr, e);
+                unmap_entry<PageTable>(pending, new_cursor->vaddr, e);
                 unmapped = true;
 
                 const size_t size = (new_cursor->size > ps) ? ps : new_cursor->size;
@@ -741,7 +830,7 @@ static bool x86_mmu_remove_mapping(arch_aspace_t* aspace, pt_entry_t* table,
         MappingCursor cursor;
         pt_entry_t* next_table = get_next_table_from_entry(*e);
         bool lower_unmapped = x86_mmu_remove_mapping<typename PageTable::LowerTable>(
-            aspace, next_table, *new_cursor, &cursor);
+            aspace, next_table, *new_cursor, &cursor, pending);
 
         // If we were requesting to unmap everything in the lower page table,
         // we know we can unmap the lower level page table.  Otherwise, if
@@ -761,8 +850,8 @@ static bool x86_mmu_remove_mapping(arch_aspace_t* aspace, pt_entry_t* table,
             }
         }
         if (unmap_page_table) {
-            unmap_entry<PageTable>(aspace, new_cursor->vaddr, e);
-            pmm_free_page(paddr_to_vm_page(X86_VIRT_TO_PHYS(next_table)));
+            unmap_entry<PageTable>(pending, new_cursor->vaddr, e);
+            pending->free_table(next_table);
             unmapped = true;
         }
         *new_cursor = cursor;
@@ -778,7 +867,8 @@ static bool x86_mmu_remove_mapping(arch_aspace_t* aspace, pt_entry_t* table,
 template <typename PageTable>
 static bool x86_mmu_remove_mapping_l0(arch_aspace_t* aspace, pt_entry_t* table,
                                       const MappingCursor& start_cursor,
-                                      MappingCursor* new_cursor) {
+                                      MappingCursor* new_cursor,
+                                      PendingTlbInvalidation* pending) {
     static_assert(PageTable::level == PT_L, "x86_mmu_remove_mapping_l0 used with wrong level");
     LTRACEF("%016" PRIxPTR " %016zx\n", start_cursor.vaddr, start_cursor.size);
     DEBUG_ASSERT(IS_PAGE_ALIGNED(start_cursor.size));
@@ -790,7 +880,7 @@ static bool x86_mmu_remove_mapping_l0(arch_aspace_t* aspace, pt_entry_t* table,
     for (; index != NO_OF_PT_ENTRIES && new_cursor->size != 0; ++index) {
         pt_entry_t* e = table + index;
         if (IS_PAGE_PRESENT(*e)) {
-            unmap_entry<PageTable>(aspace, new_cursor->vaddr, e);
+            unmap_entry<PageTable>(pending, new_cursor->vaddr, e);
             unmapped = true;
         }
 
@@ -804,16 +894,19 @@ static bool x86_mmu_remove_mapping_l0(arch_aspace_t* aspace, pt_entry_t* table,
 template <>
 bool x86_mmu_remove_mapping<PageTable<PT_L>>(arch_aspace_t* aspace, pt_entry_t* table,
                                              const MappingCursor& start_cursor,
-                                             MappingCursor* new_cursor) {
-    return x86_mmu_remove_mapping_l0<PageTable<PT_L>>(aspace, table, start_cursor, new_cursor);
+                                             MappingCursor* new_cursor,
+                                             PendingTlbInvalidation* pending) {
+    return x86_mmu_remove_mapping_l0<PageTable<PT_L>>(aspace, table, start_cursor, new_cursor,
+                                                      pending);
 }
 
 template <>
 bool x86_mmu_remove_mapping<ExtendedPageTable<PT_L>>(arch_aspace_t* aspace, pt_entry_t* table,
                                                      const MappingCursor& start_cursor,
-                                                     MappingCursor* new_cursor) {
+                                                     MappingCursor* new_cursor,
+                                                     PendingTlbInvalidation* pending) {
     return x86_mmu_remove_mapping_l0<ExtendedPageTable<PT_L>>(aspace, table, start_cursor,
-                                                              new_cursor);
+                                                              new_cursor, pending);
 }
 
 /**
@@ -834,7 +927,8 @@ bool x86_mmu_remove_mapping<ExtendedPageTable<PT_L>>(arch_aspace_t* aspace, pt_e
  */
 template <typename PageTable>
 static status_t x86_mmu_add_mapping(arch_aspace_t* aspace, pt_entry_t* table, uint mmu_flags,
-                                    const MappingCursor& start_cursor, MappingCursor* new_cursor) {
+                                    const MappingCursor& start_cursor, MappingCursor* new_cursor,
+                                    PendingTlbInvalidation* pending) {
     DEBUG_ASSERT(table);
     DEBUG_ASSERT(x86_mmu_check_vaddr(start_cursor.vaddr));
     DEBUG_ASSERT(x86_mmu_check_paddr(start_cursor.paddr));
@@ -862,7 +956,7 @@ static status_t x86_mmu_add_mapping(arch_aspace_t* aspace, pt_entry_t* table, ui
         if (level_supports_large_pages && !IS_PAGE_PRESENT(*e) && level_valigned &&
             level_paligned && new_cursor->size >= ps) {
 
-            update_entry<PageTable>(aspace, new_cursor->vaddr, table + index, new_cursor->paddr,
+            update_entry<PageTable>(pending, new_cursor->vaddr, table + index, new_cursor->paddr,
                                     arch_flags | X86_MMU_PG_PS);
 
             new_cursor->paddr += ps;
@@ -880,13 +974,13 @@ static status_t x86_mmu_add_mapping(arch_aspace_t* aspace, pt_entry_t* table, ui
 
                 LTRACEF_LEVEL(2, "new table %p at level %d\n", m, PageTable::level);
 
-                update_entry<PageTable>(aspace, new_cursor->vaddr, e, X86_VIRT_TO_PHYS(m),
+                update_entry<PageTable>(pending, new_cursor->vaddr, e, X86_VIRT_TO_PHYS(m),
                                         interm_arch_flags);
             }
 
             MappingCursor cursor;
             ret = x86_mmu_add_mapping<typename PageTable::LowerTable>(
-                aspace, get_next_table_from_entry(*e), mmu_flags, *new_cursor, &cursor);
+                aspace, get_next_table_from_entry(*e), mmu_flags, *new_cursor, &cursor, pending);
             *new_cursor = cursor;
             DEBUG_ASSERT(new_cursor->size <= start_cursor.size);
             if (ret != NO_ERROR) {
@@ -902,7 +996,8 @@ err:
         // new_cursor->size should be how much is left to be mapped still
         cursor.size -= new_cursor->size;
         if (cursor.size > 0) {
-            x86_mmu_remove_mapping<typename PageTable::TopTable>(aspace, table, cursor, &result);
+            x86_mmu_remove_mapping<typename PageTable::TopTable>(aspace, table, cursor, &result,
+                                                                 pending);
             DEBUG_ASSERT(result.size == 0);
         }
     }
@@ -913,7 +1008,8 @@ err:
 template <typename PageTable>
 static status_t x86_mmu_add_mapping_l0(arch_aspace_t* aspace, pt_entry_t* table, uint mmu_flags,
                                        const MappingCursor& start_cursor,
-                                       MappingCursor* new_cursor) {
+                                       MappingCursor* new_cursor,
+                                       PendingTlbInvalidation* pending) {
     static_assert(PageTable::level == PT_L, "x86_mmu_remove_mapping_l0 used with wrong level");
     DEBUG_ASSERT(IS_PAGE_ALIGNED(start_cursor.size));
 
@@ -928,7 +1024,7 @@ static status_t x86_mmu_add_mapping_l0(arch_aspace_t* aspace, pt_entry_t* table,
             return ERR_ALREADY_EXISTS;
         }
 
-        update_entry<PageTable>(aspace, new_cursor->vaddr, table + index, new_cursor->paddr,
+        update_entry<PageTable>(pending, new_cursor->vaddr, table + index, new_cursor->paddr,
                                 arch_flags);
 
         new_cursor->paddr += PAGE_SIZE;
@@ -943,18 +1039,20 @@ static status_t x86_mmu_add_mapping_l0(arch_aspace_t* aspace, pt_entry_t* table,
 template <>
 status_t x86_mmu_add_mapping<PageTable<PT_L>>(arch_aspace_t* aspace, pt_entry_t* table,
                                               uint mmu_flags, const MappingCursor& start_cursor,
-                                              MappingCursor* new_cursor) {
+                                              MappingCursor* new_cursor,
+                                              PendingTlbInvalidation* pending) {
     return x86_mmu_add_mapping_l0<PageTable<PT_L>>(aspace, table, mmu_flags, start_cursor,
-                                                   new_cursor);
+                                                   new_cursor, pending);
 }
 
 template <>
 status_t x86_mmu_add_mapping<ExtendedPageTable<PT_L>>(arch_aspace_t* aspace, pt_entry_t* table,
                                                       uint mmu_flags,
                                                       const MappingCursor& start_cursor,
-                                                      MappingCursor* new_cursor) {
+                                                      MappingCursor* new_cursor,
+                                                      PendingTlbInvalidation* pending) {
     return x86_mmu_add_mapping_l0<ExtendedPageTable<PT_L>>(aspace, table, mmu_flags, start_cursor,
-                                                           new_cursor);
+                                                           new_cursor, pending);
 }
 
 /**
@@ -972,7 +1070,8 @@ status_t x86_mmu_add_mapping<ExtendedPageTable<PT_L>>(arch_aspace_t* aspace, pt_
 template <typename PageTable>
 static status_t x86_mmu_update_mapping(arch_aspace_t* aspace, pt_entry_t* table, uint mmu_flags,
                                        const MappingCursor& start_cursor,
-                                       MappingCursor* new_cursor) {
+                                       MappingCursor* new_cursor,
+                                       PendingTlbInvalidation* pending) {
     DEBUG_ASSERT(table);
     LTRACEF("L: %d, %016" PRIxPTR " %016zx\n", PageTable::level, start_cursor.vaddr,
             start_cursor.size);
@@ -1006,7 +1105,7 @@ static status_t x86_mmu_update_mapping(arch_aspace_t* aspace, pt_entry_t* table,
             // If the request covers the entire large page, just change the
             // permissions
             if (vaddr_level_aligned && new_cursor->size >= ps) {
-                update_entry<PageTable>(aspace, new_cursor->vaddr, e, PageTable::paddr_from_pte(*e),
+                update_entry<PageTable>(pending, new_cursor->vaddr, e, PageTable::paddr_from_pte(*e),
                                         arch_flags | X86_MMU_PG_PS);
 
                 new_cursor->vaddr += ps;
@@ -1016,7 +1115,7 @@ static status_t x86_mmu_update_mapping(arch_aspace_t* aspace, pt_entry_t* table,
             }
             // Otherwise, we need to split it
             vaddr_t page_vaddr = new_cursor->vaddr & ~(ps - 1);
-            ret = x86_mmu_split<PageTable>(aspace, page_vaddr, e);
+            ret = x86_mmu_split<PageTable>(aspace, page_vaddr, e, pending);
             if (ret != NO_ERROR) {
                 // If we failed to split the table, just unmap it.  Subsequent
                 // page faults will bring it back in.
@@ -1025,7 +1124,7 @@ static status_t x86_mmu_update_mapping(arch_aspace_t* aspace, pt_entry_t* table,
                 cursor.size = ps;
 
                 MappingCursor tmp_cursor;
-                x86_mmu_remove_mapping<PageTable>(aspace, table, cursor, &tmp_cursor);
+                x86_mmu_remove_mapping<PageTable>(aspace, table, cursor, &tmp_cursor, pending);
 
                 const size_t size = (new_cursor->size > ps) ? ps : new_cursor->size;
                 new_cursor->vaddr += size;
@@ -1036,7 +1135,8 @@ static status_t x86_mmu_update_mapping(arch_aspace_t* aspace, pt_entry_t* table,
         MappingCursor cursor;
         pt_entry_t* next_table = get_next_table_from_entry(*e);
         ret = x86_mmu_update_mapping<typename PageTable::LowerTable>(aspace, next_table, mmu_flags,
-                                                                     *new_cursor, &cursor);
+                                                                     *new_cursor, &cursor,
+                                                                     pending);
         *new_cursor = cursor;
         if (ret != NO_ERROR) {
             // Currently this can't happen
@@ -1057,7 +1157,8 @@ err:
 template <typename PageTable>
 static status_t x86_mmu_update_mapping_l0(arch_aspace_t* aspace, pt_entry_t* table, uint mmu_flags,
                                           const MappingCursor& start_cursor,
-                                          MappingCursor* new_cursor) {
+                                          MappingCursor* new_cursor,
+                                          PendingTlbInvalidation* pending) {
     static_assert(PageTable::level == PT_L, "x86_mmu_update_mapping_l0 used with wrong level");
     LTRACEF("%016" PRIxPTR " %016zx\n", start_cursor.vaddr, start_cursor.size);
     DEBUG_ASSERT(IS_PAGE_ALIGNED(start_cursor.size));
@@ -1071,7 +1172,7 @@ static status_t x86_mmu_update_mapping_l0(arch_aspace_t* aspace, pt_entry_t* tab
         pt_entry_t* e = table + index;
         // Skip unmapped pages (we may encounter these due to demand paging)
         if (IS_PAGE_PRESENT(*e)) {
-            update_entry<PageTable>(aspace, new_cursor->vaddr, e, PageTable::paddr_from_pte(*e),
+            update_entry<PageTable>(pending, new_cursor->vaddr, e, PageTable::paddr_from_pte(*e),
                                     arch_flags);
         }
 
@@ -1085,18 +1186,20 @@ static status_t x86_mmu_update_mapping_l0(arch_aspace_t* aspace, pt_entry_t* tab
 template <>
 status_t x86_mmu_update_mapping<PageTable<PT_L>>(arch_aspace_t* aspace, pt_entry_t* table,
                                                  uint mmu_flags, const MappingCursor& start_cursor,
-                                                 MappingCursor* new_cursor) {
+                                                 MappingCursor* new_cursor,
+                                                 PendingTlbInvalidation* pending) {
     return x86_mmu_update_mapping_l0<PageTable<PT_L>>(aspace, table, mmu_flags, start_cursor,
-                                                      new_cursor);
+                                                      new_cursor, pending);
 }
 
 template <>
 status_t x86_mmu_update_mapping<ExtendedPageTable<PT_L>>(arch_aspace_t* aspace, pt_entry_t* table,
                                                          uint mmu_flags,
                                                          const MappingCursor& start_cursor,
-                                                         MappingCursor* new_cursor) {
+                                                         MappingCursor* new_cursor,
+                                                         PendingTlbInvalidation* pending) {
     return x86_mmu_update_mapping_l0<ExtendedPageTable<PT_L>>(aspace, table, mmu_flags,
-                                                              start_cursor, new_cursor);
+                                                              start_cursor, new_cursor, pending);
 }
 
 template <template <int> class PageTable>
@@ -1121,7 +1224,10 @@ static status_t mmu_unmap(arch_aspace_t* aspace, vaddr_t vaddr, const size_t cou
     };
 
     MappingCursor result;
-    x86_mmu_remove_mapping<PageTable<MAX_PAGING_LEVEL>>(aspace, aspace->pt_virt, start, &result);
+    PendingTlbInvalidation pending;
+    x86_mmu_remove_mapping<PageTable<MAX_PAGING_LEVEL>>(aspace, aspace->pt_virt, start, &result,
+                                                        &pending);
+    x86_tlb_invalidate(aspace, &pending);
     DEBUG_ASSERT(result.size == 0);
 
     if (unmapped)
@@ -1167,8 +1273,11 @@ static status_t mmu_map(arch_aspace_t* aspace, vaddr_t vaddr, paddr_t paddr, con
         .paddr = paddr, .vaddr = vaddr, .size = count * PAGE_SIZE,
     };
     MappingCursor result;
+    PendingTlbInvalidation pending;
     status_t status = x86_mmu_add_mapping<PageTable<MAX_PAGING_LEVEL>>(aspace, aspace->pt_virt,
-                                                                       mmu_flags, start, &result);
+                                                                       mmu_flags, start, &result,
+                                                                       &pending);
+    x86_tlb_invalidate(aspace, &pending);
     if (status != NO_ERROR) {
         dprintf(SPEW, "Add mapping failed with err=%d\n", status);
         return status;
@@ -1215,8 +1324,10 @@ static status_t mmu_protect(arch_aspace_t* aspace, vaddr_t vaddr, size_t count,
         .paddr = 0, .vaddr = vaddr, .size = count * PAGE_SIZE,
     };
     MappingCursor result;
+    PendingTlbInvalidation pending;
     status_t status = x86_mmu_update_mapping<PageTable<MAX_PAGING_LEVEL>>(
-        aspace, aspace->pt_virt, mmu_flags, start, &result);
+        aspace, aspace->pt_virt, mmu_flags, start, &result, &pending);
+    x86_tlb_invalidate(aspace, &pending);
     if (status != NO_ERROR) {
         return status;
     }
@@ -1238,8 +1349,10 @@ void x86_mmu_early_init() {
     x86_mmu_mem_type_init();
     x86_mmu_percpu_init();
 
-    /* unmap the lower identity mapping */
-    unmap_entry<PageTable<PML4_L>>(nullptr, 0, &pml4[0]);
+    /* unmap the lower identity mapping, only the boot cpu is running so a
+     * local flush is enough */
+    pml4[0] = 0;
+    x86_tlb_global_invalidate();
 
     /* get the address width from the CPU */
     uint8_t vaddr_width = x86_linear_address_width();
@@ -1382,12 +1495,15 @@ void arch_mmu_context_switch(arch_aspace_t* old_aspace, arch_aspace_t* aspace) {
     if (aspace != nullptr) {
         DEBUG_ASSERT(aspace->magic == ARCH_ASPACE_MAGIC);
         LTRACEF_LEVEL(3, "switching to aspace %p, pt %#" PRIXPTR "\n", aspace, aspace->pt_phys);
+
+        /* mark ourselves active before loading the new tables, so a shootdown
+         * that races with the switch can't miss translations we cache */
+        atomic_or(&aspace->active_cpus, cpu_bit);
         x86_set_cr3(aspace->pt_phys);
 
         if (old_aspace != nullptr) {
             atomic_and(&old_aspace->active_cpus, ~cpu_bit);
         }
-        atomic_or(&aspace->active_cpus, cpu_bit);
     } else {
         LTRACEF_LEVEL(3, "switching to kernel aspace, pt %#" PRIxPTR "\n", kernel_pt_phys);
         x86_set_cr3(kernel_pt_phys);
@@ -52,6 +52,22 @@ status_t arch_copy_to_user(void *dst, const void *src, size_t len)
     return status;
 }
 
+status_t arch_cmpxchg_user(int *ptr, int *expected, int desired)
+{
+    DEBUG_ASSERT(!ac_flag());
+
+    if (((uintptr_t)ptr % sizeof(int)) || !_x86_usercopy_can_write(ptr, sizeof(int)))
+        return ERR_INVALID_ARGS;
+
+    bool smap_avail = x86_feature_test(X86_FEATURE_SMAP);
+    thread_t *thr = get_current_thread();
+    status_t status = _x86_cmpxchg_user(ptr, expected, desired, smap_avail,
+                                        &thr->arch.page_fault_resume);
+
+    DEBUG_ASSERT(!ac_flag());
+    return status;
+}
+
 static bool can_access(const void *base, size_t len, bool for_write)
 {
     LTRACEF("can_access: base %p, len %zu\n", base, len);
@@ -39,4 +39,19 @@ status_t arch_copy_from_user(void *dst, const void *src, size_t len);
  */
 status_t arch_copy_to_user(void *dst, const void *src, size_t len);
 
+/*
+ * @brief Atomically compare and swap an int in userspace
+ *
+ * If the int at |ptr| equals |*expected|, replace it with |desired|.  Either
+ * way, |*expected| is set to the value that was found.
+ *
+ * @param ptr The userspace int, which must be aligned.
+ * @param expected The value to compare against, and the value found.
+ * @param desired The value to store.
+ *
+ * @return NO_ERROR if the int could be accessed, whether or not it was
+ * replaced
+ */
+status_t arch_cmpxchg_user(int *ptr, int *expected, int desired);
+
 __END_CDECLS
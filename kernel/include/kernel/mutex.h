@@ -19,18 +19,22 @@ __BEGIN_CDECLS;
 
 #define MUTEX_MAGIC (0x6D757478)  // 'mutx'
 
+/* set in the owner word when there are threads in the wait queue */
+#define MUTEX_FLAG_QUEUED ((uintptr_t)1)
+
 typedef struct TA_CAP("mutex") mutex {
     uint32_t magic;
-    thread_t *holder;
-    int count;
+    /* The owning thread, or 0 if unowned, ORed with MUTEX_FLAG_QUEUED.
+     * Acquiring and releasing an uncontended mutex is a single compare and
+     * swap on this word; the thread lock is only taken to block or wake. */
+    uintptr_t val;
     wait_queue_t wait;
 } mutex_t;
 
 #define MUTEX_INITIAL_VALUE(m) \
 { \
     .magic = MUTEX_MAGIC, \
-    .holder = NULL, \
-    .count = 0, \
+    .val = 0, \
     .wait = WAIT_QUEUE_INITIAL_VALUE((m).wait), \
 }
 
@@ -46,10 +50,16 @@ void mutex_release(mutex_t *m) TA_REL(m);
 /* special version of the above with the thread lock held */
 void mutex_release_thread_locked(mutex_t *m, bool resched) TA_REL(m);
 
+/* the thread holding the mutex, if any */
+static inline thread_t *mutex_holder(const mutex_t *m)
+{
+    return (thread_t *)(__atomic_load_n(&m->val, __ATOMIC_RELAXED) & ~MUTEX_FLAG_QUEUED);
+}
+
 /* does the current thread hold the mutex? */
 static inline bool is_mutex_held(const mutex_t *m)
 {
-    return m->holder == get_current_thread();
+    return mutex_holder(m) == get_current_thread();
 }
 
 __END_CDECLS;
@@ -21,3 +21,13 @@ void sched_unblock_list(struct list_node *list, bool resched);
 
 void sched_yield(void);
 void sched_preempt(void);
+
+/* change a thread's priority, moving it to the matching run queue if it's
+ * waiting to run */
+void sched_change_priority(thread_t *t, int priority);
+
+/* migrate queued threads off of a cpu that is going offline */
+void sched_transition_off_cpu(uint old_cpu);
+
+/* must be called with the thread lock held */
+void sched_dump_run_queues(void);
@@ -74,7 +74,13 @@ typedef struct thread {
 
     /* active bits */
     struct list_node queue_node;
+    /* the priority the thread runs at: the higher of base_priority and
+     * inherited_priority */
     int priority;
+    int base_priority;
+    /* raised while threads of higher priority wait on a lock this thread
+     * holds, -1 otherwise */
+    int inherited_priority;
     enum thread_state state;
     lk_time_t last_started_running;
     lk_time_t remaining_time_slice;
@@ -179,6 +185,7 @@ void thread_construct_first(thread_t *t, const char *name);
 thread_t *thread_create_idle_thread(uint cpu_num);
 void thread_set_name(const char *name);
 void thread_set_priority(int priority);
+void thread_set_inherited_priority(thread_t *t, int priority);
 void thread_set_user_callback(thread_t *t, thread_user_callback_t cb);
 thread_t *thread_create(const char *name, thread_start_routine entry, void *arg, int priority, size_t stack_size);
 thread_t *thread_create_etc(thread_t *t, const char *name, thread_start_routine entry, void *arg, int priority, void *stack, void *unsafe_stack, size_t stack_size, thread_trampoline_routine alt_trampoline);
@@ -209,14 +216,15 @@ static inline bool thread_stopped_in_exception(const thread_t* thread)
     return !!thread->exception_context;
 }
 
-/* wait until after the specified deadline. interruptable may return early with
+/* wait until after the specified deadline, plus up to slack ns so the wakeup can be
+ * coalesced with other timers. interruptable may return early with
  * ERR_INTERRUPTED if thread is signaled for kill.
  */
-status_t thread_sleep_etc(lk_time_t deadline, bool interruptable);
+status_t thread_sleep_etc(lk_time_t deadline, lk_time_t slack, bool interruptable);
 
 /* non interruptable version of thread_sleep_etc */
 static inline status_t thread_sleep(lk_time_t deadline) {
-    return thread_sleep_etc(deadline, false);
+    return thread_sleep_etc(deadline, 0, false);
 }
 
 /* non-interruptable relative delay version of thread_sleep */
@@ -272,6 +280,11 @@ void set_current_thread(thread_t *);
 /* the idle thread(s) (statically allocated) */
 extern thread_t idle_threads[SMP_MAX_CPUS];
 
+/* is the thread running on some cpu right now? This doesn't take the thread
+ * lock and |t| is never dereferenced, so the answer is only a hint, but it
+ * is safe to ask about a thread that may have exited. */
+bool thread_is_running(const thread_t *t);
+
 /* scheduler lock */
 extern spin_lock_t thread_lock;
 
@@ -304,6 +317,9 @@ struct thread_stats {
     /* inter-processor interrupts */
     ulong reschedule_ipis;
     ulong generic_ipis;
+
+    /* threads pulled from other cpus' run queues */
+    ulong steals;
 #endif
 };
 
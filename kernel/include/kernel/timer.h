@@ -27,12 +27,14 @@ typedef struct timer {
     struct list_node node;
 
     lk_time_t scheduled_time;
+    lk_time_t slack;
     lk_time_t period;
 
     timer_callback callback;
     void *arg;
 
     volatile int active_cpu; // <0 if inactive
+    volatile int queued_cpu; // cpu whose queue holds the timer, <0 if not queued
     volatile bool cancel;    // true if cancel is pending
 } timer_t;
 
@@ -41,10 +43,12 @@ typedef struct timer {
     .magic = TIMER_MAGIC, \
     .node = LIST_INITIAL_CLEARED_VALUE, \
     .scheduled_time = 0, \
+    .slack = 0, \
     .period = 0, \
     .callback = NULL, \
     .arg = NULL, \
     .active_cpu = -1, \
+    .queued_cpu = -1, \
     .cancel = false, \
 }
 
@@ -54,9 +58,15 @@ typedef struct timer {
  * - Timers may be canceled or reprogrammed from within their callback
  * - Setting and canceling timers is not thread safe and cannot be done concurrently
  * - timer_cancel() may spin waiting for a pending timer to complete on another cpu
+ * - Timers are queued on the cpu that set them, and setting one only takes that
+ *   cpu's queue lock. Canceling takes the lock of the cpu the timer is queued on.
+ * - A timer with slack may fire up to slack ns late, to share an interrupt with
+ *   another timer that is already due in that window
 */
 void timer_initialize(timer_t *);
 void timer_set_oneshot(timer_t *, lk_time_t deadline, timer_callback, void *arg);
+void timer_set_oneshot_etc(timer_t *, lk_time_t deadline, lk_time_t slack,
+                           timer_callback, void *arg);
 void timer_set_periodic(timer_t *, lk_time_t period, timer_callback, void *arg);
 void timer_cancel(timer_t *);
 
@@ -53,10 +53,14 @@ enum vm_page_state {
     VM_PAGE_STATE_HEAP,
     VM_PAGE_STATE_OBJECT,
     VM_PAGE_STATE_MMU, /* allocated to serve arch-specific mmu purposes */
+    VM_PAGE_STATE_CACHED, /* free, but held in a pmm per cpu cache */
 
     _VM_PAGE_STATE_COUNT
 };
 
+// make sure the states fit in the state bitfield
+static_assert(_VM_PAGE_STATE_COUNT <= (1 << 3), "");
+
 // helpers
 static inline bool page_is_free(const vm_page_t* page) {
     return page->state == VM_PAGE_STATE_FREE;
@@ -413,6 +413,12 @@ public:
     // offset modification and locking.
     status_t DecommitRange(size_t offset, size_t len, size_t* decommitted);
 
+    // Wrappers for vmo()->TakePages() and vmo()->SupplyPages() with the
+    // necessary offset modification and locking. Both need a writable
+    // mapping, since either one changes what the mapping reads back.
+    status_t TakePages(size_t offset, size_t count, vm_page_t** pages);
+    status_t SupplyPages(size_t offset, size_t count, vm_page_t** pages);
+
     // Map in pages from the underlying vm object, optionally committing pages as it goes
     status_t MapRange(size_t offset, size_t len, bool commit);
 
@@ -433,6 +439,16 @@ public:
     void Dump(uint depth, bool verbose) const override;
     status_t PageFault(vaddr_t va, uint pf_flags) override;
 
+    // Override the vm object's fault-around window for this mapping, in pages.
+    // kFaultAroundFromVmo (the default) defers to the object, 0 or 1 disables it.
+    static const uint32_t kFaultAroundFromVmo = UINT32_MAX;
+    static const uint32_t kMaxFaultAroundPages = 4 * VmPageListNode::kPageFanOut;
+    void set_fault_around_pages(uint32_t pages);
+
+    // Fault statistics, for benchmarking.
+    uint64_t page_faults() const;
+    uint64_t fault_around_pages_mapped() const;
+
 protected:
     ~VmMapping() override;
     friend mxtl::RefPtr<VmMapping>;
@@ -472,6 +488,17 @@ private:
 
     void Activate() override;
 
+    // Map the object's large page run around va with a single large page, if the
+    // object holds a complete run and it lines up with this mapping.
+    // Should be annotated TA_REQ(object_->lock()), see ActivateLocked().
+    status_t FaultLargePageLocked(vaddr_t va);
+
+    // Map in the pages around a faulting page that the object already holds.
+    // Should be annotated TA_REQ(object_->lock()), see ActivateLocked().
+    void FaultAroundLocked(vaddr_t va, uint mmu_flags);
+    bool FaultAroundBatchLocked(vaddr_t va, vaddr_t start_va, vm_page_t* const* pages,
+                                size_t count, uint mmu_flags);
+
     // Version of Activate that does not take the object_ lock.
     // Should be annotated TA_REQ(object_->lock()), but due to limitations
     // in Clang around capability aliasing, we need to relax the analysis.
@@ -486,4 +513,11 @@ private:
 
     // used to detect recursions through the vmo fault path
     bool currently_faulting_ = false;
+
+    // fault-around window override, see set_fault_around_pages()
+    uint32_t fault_around_pages_ = kFaultAroundFromVmo;
+
+    // fault statistics, protected by the aspace lock
+    uint64_t page_faults_ = 0;
+    uint64_t fault_around_pages_mapped_ = 0;
 };
@@ -123,6 +123,50 @@ public:
         return ERR_NOT_SUPPORTED;
     }
 
+    // size of the naturally aligned, physically contiguous runs that large page objects
+    // commit at once, matching the smallest large page the mmu can map
+    static const size_t kLargePageSize = PAGE_SIZE << 9;
+    static const uint kLargePageShift = PAGE_SIZE_SHIFT + 9;
+
+    // true if the object backs itself with kLargePageSize runs where it can
+    virtual bool large_pages() const { return false; }
+
+    // if the object holds a complete, physically contiguous kLargePageSize run starting
+    // at the aligned offset, return its physical base address
+    virtual status_t GetLargePageLocked(uint64_t offset, paddr_t* pa) TA_REQ(lock_) {
+        return ERR_NOT_SUPPORTED;
+    }
+
+    // fill pages[0..count) with the pages this object already holds starting at offset,
+    // or nullptr where it has none. never faults in pages or consults the parent.
+    // returns the number of pages found.
+    virtual size_t GetResidentPagesLocked(uint64_t offset, size_t count,
+                                          vm_page_t** pages) TA_REQ(lock_) {
+        return 0;
+    }
+
+    // remove the pages in [offset, offset + count * PAGE_SIZE) from the object and hand
+    // ownership of them to the caller, filling pages[] with nullptr where nothing is
+    // committed. the range reads back as zero afterwards. only objects with no parent
+    // and no children support this, since a clone may be sharing the pages.
+    virtual status_t TakePages(uint64_t offset, size_t count, vm_page_t** pages) {
+        return ERR_NOT_SUPPORTED;
+    }
+
+    // install pages[0..count) at offset, freeing whatever the object held there before.
+    // nullptr entries leave that page decommitted. on success the object owns the pages,
+    // on failure nothing has changed and they still belong to the caller.
+    virtual status_t SupplyPages(uint64_t offset, size_t count, vm_page_t** pages) {
+        return ERR_NOT_SUPPORTED;
+    }
+
+    // number of pages around a faulting page that mappings of this object will try
+    // to map in from already resident pages. 0 or 1 disables fault-around.
+    uint32_t fault_around_pages_locked() const TA_REQ(lock_) { return fault_around_pages_; }
+    void set_fault_around_pages_locked(uint32_t pages) TA_REQ(lock_) {
+        fault_around_pages_ = pages;
+    }
+
     Mutex* lock() TA_RET_CAP(lock_) { return &lock_; }
     Mutex& lock_ref() TA_RET_CAP(lock_) { return lock_; }
 
@@ -173,4 +217,7 @@ protected:
 
     // parent pointer (may be null)
     mxtl::RefPtr<VmObject> parent_ TA_GUARDED(lock_);
+
+    // fault-around window in pages, see fault_around_pages_locked()
+    uint32_t fault_around_pages_ TA_GUARDED(lock_) = VmPageListNode::kPageFanOut;
 };
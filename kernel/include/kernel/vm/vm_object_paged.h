@@ -29,6 +29,10 @@ public:
 
     static mxtl::RefPtr<VmObject> CreateFromROData(const void* data, size_t size);
 
+    // create an object that commits kLargePageSize runs of contiguous memory where
+    // it can, so that aligned mappings of it can use large pages
+    static mxtl::RefPtr<VmObject> CreateLargePages(uint32_t pmm_alloc_flags, uint64_t size);
+
     status_t Resize(uint64_t size) override;
     status_t ResizeLocked(uint64_t size) override TA_REQ(lock_);
     uint64_t size() const override
@@ -67,6 +71,15 @@ public:
         // Calls a Locked method of the parent, which confuses analysis.
         TA_NO_THREAD_SAFETY_ANALYSIS;
 
+    size_t GetResidentPagesLocked(uint64_t offset, size_t count, vm_page_t** pages) override
+        TA_REQ(lock_);
+
+    status_t TakePages(uint64_t offset, size_t count, vm_page_t** pages) override;
+    status_t SupplyPages(uint64_t offset, size_t count, vm_page_t** pages) override;
+
+    bool large_pages() const override { return large_pages_; }
+    status_t GetLargePageLocked(uint64_t offset, paddr_t* pa) override TA_REQ(lock_);
+
     status_t CloneCOW(uint64_t offset, uint64_t size,
                       mxtl::RefPtr<VmObject>* clone_vmo) override
         // Calls a Locked method of the child, which confuses analysis.
@@ -100,6 +113,14 @@ private:
     // internal page list routine
     void AddPageToArray(size_t index, vm_page_t* p);
 
+    // commit a contiguous kLargePageSize run at the aligned offset, if none of it
+    // is committed yet
+    status_t AllocLargePageLocked(uint64_t offset) TA_REQ(lock_);
+
+    // commit every large page run that fits in [start, end), returning the number
+    // of bytes committed
+    uint64_t CommitLargePagesLocked(uint64_t start, uint64_t end) TA_REQ(lock_);
+
     // internal read/write routine that takes a templated copy function to help share some code
     template <typename T>
     status_t ReadWriteInternal(uint64_t offset, size_t len, size_t* bytes_copied, bool write,
@@ -116,6 +137,9 @@ private:
     uint64_t parent_offset_ TA_GUARDED(lock_) = 0;
     uint32_t pmm_alloc_flags_ TA_GUARDED(lock_) = PMM_ALLOC_FLAG_ANY;
 
+    // set at creation, see CreateLargePages()
+    bool large_pages_ = false;
+
     // a tree of pages
     VmPageList page_list_ TA_GUARDED(lock_);
 };
@@ -6,6 +6,7 @@
 
 #pragma once
 
+#include <list.h>
 #include <mxtl/canary.h>
 #include <mxtl/intrusive_wavl_tree.h>
 #include <mxtl/macros.h>
@@ -88,11 +89,40 @@ public:
         }
     }
 
+    // call the passed in function on every page in [start_offset, end_offset),
+    // visiting only the tree nodes that overlap the range
+    template <typename T>
+    void ForEveryPageInRange(T per_page_func, uint64_t start_offset, uint64_t end_offset) {
+        const uint64_t node_size = PAGE_SIZE * VmPageListNode::kPageFanOut;
+        for (auto pln = list_.lower_bound(ROUNDDOWN(start_offset, node_size));
+             pln.IsValid() && pln->offset() < end_offset; ++pln) {
+            pln->ForEveryPage([&](vm_page* p, uint64_t offset) {
+                if (offset >= start_offset && offset < end_offset)
+                    per_page_func(p, offset);
+            });
+        }
+    }
+
     status_t AddPage(vm_page*, uint64_t offset);
     vm_page* GetPage(uint64_t offset);
     status_t FreePage(uint64_t offset);
+    // remove the page at offset from the list without freeing it, returning
+    // nullptr if there is none
+    vm_page* RemovePage(uint64_t offset);
+    // swap p in for the page at offset, which must be present, returning the old page
+    vm_page* ReplacePage(vm_page* p, uint64_t offset);
     size_t FreeAllPages();
 
+    // remove every page in [start_offset, end_offset) and add them to the tail
+    // of removed_list, so the caller can return them to the pmm in one batch.
+    // returns the number of pages removed.
+    size_t RemovePages(uint64_t start_offset, uint64_t end_offset, list_node* removed_list);
+
+    // fill pages[0..count) with the pages held at start_offset and the pages
+    // following it, or nullptr where there is none. returns the number of
+    // pages found.
+    size_t GetPages(uint64_t start_offset, size_t count, vm_page** pages);
+
 private:
     mxtl::WAVLTree<uint64_t, mxtl::unique_ptr<VmPageListNode>> list_;
 };
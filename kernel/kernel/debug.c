@@ -20,6 +20,7 @@
 #include <inttypes.h>
 #include <stdio.h>
 #include <string.h>
+#include <kernel/sched.h>
 #include <kernel/thread.h>
 #include <kernel/timer.h>
 #include <kernel/mp.h>
@@ -51,6 +52,7 @@ static int cmd_thread(int argc, const cmd_args *argv, uint32_t flags)
 usage:
         printf("%s list\n", argv[0].str);
         printf("%s list_full\n", argv[0].str);
+        printf("%s runqueues\n", argv[0].str);
         return -1;
     }
 
@@ -60,6 +62,10 @@ usage:
     } else if (!strcmp(argv[1].str, "list_full")) {
         printf("thread list:\n");
         dump_all_threads(true);
+    } else if (!strcmp(argv[1].str, "runqueues")) {
+        THREAD_LOCK(state);
+        sched_dump_run_queues();
+        THREAD_UNLOCK(state);
     } else {
         printf("invalid args\n");
         goto usage;
@@ -82,6 +88,7 @@ static int cmd_threadstats(int argc, const cmd_args *argv, uint32_t flags)
         printf("\treschedules: %lu\n", thread_stats[i].reschedules);
 #if WITH_SMP
         printf("\treschedule_ipis: %lu\n", thread_stats[i].reschedule_ipis);
+        printf("\tsteals: %lu\n", thread_stats[i].steals);
 #endif
         printf("\tcontext_switches: %lu\n", thread_stats[i].context_switches);
         printf("\tpreempts: %lu\n", thread_stats[i].preempts);
@@ -18,6 +18,7 @@
 #include <kernel/event.h>
 #include <kernel/mp.h>
 #include <kernel/mutex.h>
+#include <kernel/sched.h>
 #include <kernel/spinlock.h>
 #include <kernel/timer.h>
 
@@ -309,8 +310,10 @@ status_t mp_unplug_cpu(uint cpu_id) {
         status = event_wait(&unplug_done);
     } while (status < 0);
 
-    /* Now that the CPU is no longer processing tasks, move all of its timers */
+    /* Now that the CPU is no longer processing tasks, move all of its timers
+     * and any threads still sitting in its run queue */
     timer_transition_off_cpu(cpu_id);
+    sched_transition_off_cpu(cpu_id);
 
     status = platform_mp_cpu_unplug(cpu_id);
     if (status != NO_ERROR) {
@@ -19,7 +19,74 @@
 #include <debug.h>
 #include <assert.h>
 #include <err.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <arch/ops.h>
 #include <kernel/thread.h>
+#include <platform.h>
+
+#if WITH_LIB_CONSOLE
+#include <lib/console.h>
+#endif
+
+/* how long a thread spins on a mutex whose owner is running before blocking */
+#define MUTEX_SPIN_MAX_TIME LK_USEC(50)
+
+/* how many spins between checks of the time and the owner */
+#define MUTEX_SPIN_CHECK_INTERVAL 64
+
+/* Lock statistics are kept per mutex, in a fixed size table indexed by the
+ * mutex's address. Only contended acquires touch it. A mutex that can't find
+ * room is counted in mutex_lockstat_dropped. */
+#define MUTEX_LOCKSTAT_ENTRIES 512
+#define MUTEX_LOCKSTAT_PROBES 8
+
+struct mutex_lockstat {
+    mutex_t *mutex;
+    uint64_t contentions;
+    uint64_t blocks;
+    lk_time_t spin_time;
+    lk_time_t block_time;
+};
+
+static struct mutex_lockstat mutex_lockstats[MUTEX_LOCKSTAT_ENTRIES];
+static uint64_t mutex_lockstat_dropped;
+
+static void mutex_lockstat_record(mutex_t *m, lk_time_t spin_time, lk_time_t block_time,
+                                  bool blocked)
+{
+    uintptr_t hash = ((uintptr_t)m >> 4) * 0x9e3779b1u;
+    for (uint i = 0; i < MUTEX_LOCKSTAT_PROBES; i++) {
+        struct mutex_lockstat *ls = &mutex_lockstats[(hash + i) % MUTEX_LOCKSTAT_ENTRIES];
+        mutex_t *key = __atomic_load_n(&ls->mutex, __ATOMIC_RELAXED);
+        if (key == NULL) {
+            /* claim the free slot, unless someone beat us to it */
+            if (!__atomic_compare_exchange_n(&ls->mutex, &key, m, false,
+                                             __ATOMIC_RELAXED, __ATOMIC_RELAXED) &&
+                key != m) {
+                continue;
+            }
+        } else if (key != m) {
+            continue;
+        }
+        __atomic_fetch_add(&ls->contentions, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&ls->spin_time, spin_time, __ATOMIC_RELAXED);
+        if (blocked) {
+            __atomic_fetch_add(&ls->blocks, 1, __ATOMIC_RELAXED);
+            __atomic_fetch_add(&ls->block_time, block_time, __ATOMIC_RELAXED);
+        }
+        return;
+    }
+    __atomic_fetch_add(&mutex_lockstat_dropped, 1, __ATOMIC_RELAXED);
+}
+
+static inline bool mutex_try_acquire(mutex_t *m, thread_t *ct)
+{
+    uintptr_t old = 0;
+    return __atomic_compare_exchange_n(&m->val, &old, (uintptr_t)ct, false,
+                                       __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
 
 /**
  * @brief  Initialize a mutex_t
@@ -42,19 +109,88 @@ void mutex_destroy(mutex_t *m)
 
     THREAD_LOCK(state);
 #if LK_DEBUGLEVEL > 0
-    if (unlikely(m->count > 0)) {
+    thread_t *holder = mutex_holder(m);
+    if (unlikely(holder != NULL)) {
         panic("mutex_destroy: thread %p (%s) tried to destroy locked mutex %p,"
               " locked by %p (%s)\n",
               get_current_thread(), get_current_thread()->name, m,
-              m->holder, m->holder->name);
+              holder, holder->name);
     }
 #endif
     m->magic = 0;
-    m->count = 0;
+    m->val = 0;
     wait_queue_destroy(&m->wait);
     THREAD_UNLOCK(state);
 }
 
+/* The slow path of mutex_acquire(): spin while the owner is running on
+ * another cpu, since it's likely to let go soon, then block. */
+static void mutex_acquire_contended(mutex_t *m, thread_t *ct)
+{
+#if LK_DEBUGLEVEL > 0
+    if (unlikely(ct == mutex_holder(m)))
+        panic("mutex_acquire: thread %p (%s) tried to acquire mutex %p it already owns.\n",
+              ct, ct->name, m);
+#endif
+
+    lk_time_t start = current_time();
+    lk_time_t spin_time = 0;
+
+#if WITH_SMP
+    for (uint spins = 1;; spins++) {
+        uintptr_t val = __atomic_load_n(&m->val, __ATOMIC_RELAXED);
+        if (val == 0 && mutex_try_acquire(m, ct)) {
+            mutex_lockstat_record(m, current_time() - start, 0, false);
+            return;
+        }
+        if (spins % MUTEX_SPIN_CHECK_INTERVAL == 0) {
+            thread_t *owner = (thread_t *)(val & ~MUTEX_FLAG_QUEUED);
+            if (owner != NULL && !thread_is_running(owner))
+                break;
+            if (current_time() - start > MUTEX_SPIN_MAX_TIME)
+                break;
+        }
+        arch_spinloop_pause();
+    }
+    spin_time = current_time() - start;
+#endif
+
+    THREAD_LOCK(state);
+    uintptr_t val = __atomic_load_n(&m->val, __ATOMIC_RELAXED);
+    for (;;) {
+        if (val == 0) {
+            if (__atomic_compare_exchange_n(&m->val, &val, (uintptr_t)ct, false,
+                                            __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+                THREAD_UNLOCK(state);
+                mutex_lockstat_record(m, spin_time, 0, false);
+                return;
+            }
+        } else if (val & MUTEX_FLAG_QUEUED) {
+            break;
+        } else if (__atomic_compare_exchange_n(&m->val, &val, val | MUTEX_FLAG_QUEUED, false,
+                                               __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            break;
+        }
+        /* val was reloaded by the failed compare and swap */
+    }
+
+    /* The owner now has to take the thread lock to release the mutex, and
+     * will hand it straight to the first thread in the queue. */
+    lk_time_t block_start = current_time();
+    status_t ret = wait_queue_block(&m->wait, INFINITE_TIME);
+    if (unlikely(ret < NO_ERROR)) {
+        /* mutexes are not interruptable and cannot time out, so it
+         * is illegal to return with any error state.
+         */
+        panic("mutex_acquire: wait_queue_block returns with error %d m %p, thr %p, sp %p\n",
+               ret, m, ct, __GET_FRAME());
+    }
+    DEBUG_ASSERT(mutex_holder(m) == ct);
+    THREAD_UNLOCK(state);
+
+    mutex_lockstat_record(m, spin_time, current_time() - block_start, true);
+}
+
 /**
  * @brief  Acquire the mutex
  *
@@ -65,48 +201,51 @@ void mutex_acquire(mutex_t *m) TA_NO_THREAD_SAFETY_ANALYSIS
     DEBUG_ASSERT(m->magic == MUTEX_MAGIC);
     DEBUG_ASSERT(!arch_in_int_handler());
 
-#if LK_DEBUGLEVEL > 0
-    if (unlikely(get_current_thread() == m->holder))
-        panic("mutex_acquire: thread %p (%s) tried to acquire mutex %p it already owns.\n",
-              get_current_thread(), get_current_thread()->name, m);
-#endif
-
-    THREAD_LOCK(state);
-    if (unlikely(++m->count > 1)) {
-        status_t ret = wait_queue_block(&m->wait, INFINITE_TIME);
-        if (unlikely(ret < NO_ERROR)) {
-            /* mutexes are not interruptable and cannot time out, so it
-             * is illegal to return with any error state.
-             */
-            panic("mutex_acquire: wait_queue_block returns with error %d m %p, thr %p, sp %p\n",
-                   ret, m, get_current_thread(), __GET_FRAME());
-        }
-    }
+    thread_t *ct = get_current_thread();
+    if (likely(mutex_try_acquire(m, ct)))
+        return;
 
-    m->holder = get_current_thread();
-    THREAD_UNLOCK(state);
+    mutex_acquire_contended(m, ct);
 }
 
+/* Releases a mutex with waiters, handing it to the first of them. */
+static void mutex_release_queued(mutex_t *m, bool reschedule)
+{
+    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+
+    thread_t *t = list_peek_head_type(&m->wait.list, thread_t, queue_node);
+    DEBUG_ASSERT(t != NULL);
+
+    uintptr_t val = (uintptr_t)t;
+    if (m->wait.count > 1)
+        val |= MUTEX_FLAG_QUEUED;
+    __atomic_store_n(&m->val, val, __ATOMIC_RELEASE);
+
+    wait_queue_wake_one(&m->wait, reschedule, NO_ERROR);
+}
 
 void mutex_release(mutex_t *m) TA_NO_THREAD_SAFETY_ANALYSIS
 {
     DEBUG_ASSERT(m->magic == MUTEX_MAGIC);
     DEBUG_ASSERT(!arch_in_int_handler());
 
+    thread_t *ct = get_current_thread();
 #if LK_DEBUGLEVEL > 0
-    if (unlikely(get_current_thread() != m->holder)) {
+    thread_t *holder = mutex_holder(m);
+    if (unlikely(ct != holder)) {
         panic("mutex_release: thread %p (%s) tried to release mutex %p it doesn't own. owned by %p (%s)\n",
-              get_current_thread(), get_current_thread()->name, m, m->holder, m->holder ? m->holder->name : "none");
+              ct, ct->name, m, holder, holder ? holder->name : "none");
     }
 #endif
 
-    THREAD_LOCK(state);
-    m->holder = 0;
+    uintptr_t old = (uintptr_t)ct;
+    if (likely(__atomic_compare_exchange_n(&m->val, &old, 0, false,
+                                           __ATOMIC_RELEASE, __ATOMIC_RELAXED)))
+        return;
 
-    if (unlikely(--m->count >= 1)) {
-        /* release a thread */
-        wait_queue_wake_one(&m->wait, true, NO_ERROR);
-    }
+    /* there are waiters; the queued flag can only change under the thread lock */
+    THREAD_LOCK(state);
+    mutex_release_queued(m, true);
     THREAD_UNLOCK(state);
 }
 
@@ -117,19 +256,62 @@ void mutex_release_thread_locked(mutex_t *m, bool reschedule) TA_NO_THREAD_SAFET
     DEBUG_ASSERT(arch_ints_disabled());
     DEBUG_ASSERT(spin_lock_held(&thread_lock));
 
+    thread_t *ct = get_current_thread();
 #if LK_DEBUGLEVEL > 0
-    if (unlikely(get_current_thread() != m->holder)) {
+    thread_t *holder = mutex_holder(m);
+    if (unlikely(ct != holder)) {
         panic("mutex_release_thread_locked: thread %p (%s) tried to release mutex %p it doesn't own. "
               "owned by %p (%s)\n",
-              get_current_thread(), get_current_thread()->name, m, m->holder,
-              m->holder ? m->holder->name : "none");
+              ct, ct->name, m, holder, holder ? holder->name : "none");
     }
 #endif
 
-    m->holder = 0;
+    uintptr_t old = (uintptr_t)ct;
+    if (__atomic_compare_exchange_n(&m->val, &old, 0, false,
+                                    __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        return;
+
+    mutex_release_queued(m, reschedule);
+}
+
+#if WITH_LIB_CONSOLE
 
-    if (unlikely(--m->count >= 1)) {
-        /* release a thread */
-        wait_queue_wake_one(&m->wait, reschedule, NO_ERROR);
+static int cmd_lockstat(int argc, const cmd_args *argv, uint32_t flags)
+{
+    if (argc > 1 && !strcmp(argv[1].str, "reset")) {
+        for (uint i = 0; i < MUTEX_LOCKSTAT_ENTRIES; i++)
+            __atomic_store_n(&mutex_lockstats[i].mutex, NULL, __ATOMIC_RELAXED);
+        for (uint i = 0; i < MUTEX_LOCKSTAT_ENTRIES; i++) {
+            mutex_lockstats[i].contentions = 0;
+            mutex_lockstats[i].blocks = 0;
+            mutex_lockstats[i].spin_time = 0;
+            mutex_lockstats[i].block_time = 0;
+        }
+        mutex_lockstat_dropped = 0;
+        return 0;
+    } else if (argc > 1) {
+        printf("usage:\n");
+        printf("%s         : dump contended mutexes\n", argv[0].str);
+        printf("%s reset   : clear the statistics\n", argv[0].str);
+        return -1;
+    }
+
+    printf("%18s %12s %12s %14s %14s\n",
+           "mutex", "contentions", "blocks", "spin ns", "block ns");
+    for (uint i = 0; i < MUTEX_LOCKSTAT_ENTRIES; i++) {
+        const struct mutex_lockstat *ls = &mutex_lockstats[i];
+        if (ls->mutex == NULL)
+            continue;
+        printf("%18p %12" PRIu64 " %12" PRIu64 " %14" PRIu64 " %14" PRIu64 "\n",
+               ls->mutex, ls->contentions, ls->blocks, ls->spin_time, ls->block_time);
     }
+    if (mutex_lockstat_dropped)
+        printf("%" PRIu64 " contended acquires found no room\n", mutex_lockstat_dropped);
+    return 0;
 }
+
+STATIC_COMMAND_START
+STATIC_COMMAND("lockstat", "mutex contention statistics", &cmd_lockstat)
+STATIC_COMMAND_END(mutex);
+
+#endif
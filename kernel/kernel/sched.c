@@ -19,13 +19,25 @@
 /* legacy implementation that just broadcast ipis for every reschedule */
 #define BROADCAST_RESCHEDULE 0
 
-/* the run queue */
-static struct list_node run_queue[NUM_PRIORITIES];
-static uint32_t run_queue_bitmap;
+/* per cpu run queues, protected by thread_lock */
+struct run_queue {
+    struct list_node queue[NUM_PRIORITIES];
+    uint32_t bitmap;
+} __CPU_ALIGN;
+
+static struct run_queue run_queues[SMP_MAX_CPUS];
 
 /* make sure the bitmap is large enough to cover our number of priorities */
-static_assert(NUM_PRIORITIES <= sizeof(run_queue_bitmap) * CHAR_BIT, "");
+static_assert(NUM_PRIORITIES <= sizeof(run_queues[0].bitmap) * CHAR_BIT, "");
+
+/* highest priority with a thread queued in the bitmap, bitmap must be nonzero */
+static inline uint highest_queued_priority(uint32_t bitmap)
+{
+    return HIGHEST_PRIORITY - __builtin_clz(bitmap)
+           - (sizeof(bitmap) * CHAR_BIT - NUM_PRIORITIES);
+}
 
+#if WITH_SMP
 /* pick a 'random' cpu */
 static mp_cpu_mask_t rand_cpu(const mp_cpu_mask_t mask)
 {
@@ -52,102 +64,206 @@ static mp_cpu_mask_t rand_cpu(const mp_cpu_mask_t mask)
             return (1u << rot);
     }
 }
+#endif
 
-/* find a cpu to wake up */
-static mp_cpu_mask_t find_cpu(thread_t *t)
+/* find a cpu whose run queue a newly runnable thread should go on */
+static uint find_cpu(thread_t *t)
 {
-#if BROADCAST_RESCHEDULE
-    return MP_CPU_ALL_BUT_LOCAL;
-#elif WITH_SMP
-    /* get the last cpu the thread ran on */
-    mp_cpu_mask_t last_ran_cpu_mask = (1u << thread_last_cpu(t));
+#if WITH_SMP
+    /* pinned threads only ever go on their own cpu's queue */
+    if (unlikely(thread_pinned_cpu(t) >= 0))
+        return thread_pinned_cpu(t);
 
-    /* the current cpu */
-    mp_cpu_mask_t curr_cpu_mask = (1u << arch_curr_cpu_num());
+    uint curr_cpu = arch_curr_cpu_num();
+    uint last_cpu = thread_last_cpu(t);
+    mp_cpu_mask_t curr_cpu_mask = (1u << curr_cpu);
+    mp_cpu_mask_t last_cpu_mask = (1u << last_cpu);
+    mp_cpu_mask_t active_mask = mp_get_active_mask();
 
     /* get a list of idle cpus */
-    mp_cpu_mask_t idle_cpu_mask = mp_get_idle_mask();
+    mp_cpu_mask_t idle_cpu_mask = mp_get_idle_mask() & active_mask;
     if (idle_cpu_mask != 0) {
         if (idle_cpu_mask & curr_cpu_mask) {
             /* the current cpu is idle, so run it here */
-            return 0;
+            return curr_cpu;
         }
 
-        if (last_ran_cpu_mask & idle_cpu_mask) {
+        if (idle_cpu_mask & last_cpu_mask) {
             /* the last core it ran on is idle and isn't the current cpu */
-            return last_ran_cpu_mask;
+            return last_cpu;
         }
 
         /* pick an idle_cpu */
-        return rand_cpu(idle_cpu_mask);
+        mp_cpu_mask_t mask = rand_cpu(idle_cpu_mask);
+        if (likely(mask != 0))
+            return __builtin_ctz(mask);
     }
 
-    /* no idle cpus */
-    if (last_ran_cpu_mask == curr_cpu_mask) {
-        /* the last cpu it ran on is us */
-        /* pick a random cpu that isn't the current one */
-        return rand_cpu(mp_get_online_mask() & ~(curr_cpu_mask));
-    } else {
-        /* pick the last cpu it ran on */
-        return last_ran_cpu_mask;
-    }
+    /* no idle cpus, keep cache affinity with the last cpu it ran on. if it is
+     * overloaded, idle cpus will pull the thread off of its queue.
+     */
+    if (likely(active_mask & last_cpu_mask))
+        return last_cpu;
+
+    return curr_cpu;
 #else /* !WITH_SMP */
-    /* no smp, dont send an IPI */
     return 0;
 #endif
 }
 
+/* cpu to requeue the currently running thread on */
+static uint local_cpu(thread_t *t)
+{
+#if WITH_SMP
+    if (unlikely(thread_pinned_cpu(t) >= 0))
+        return thread_pinned_cpu(t);
+#endif
+    return arch_curr_cpu_num();
+}
+
+/* kick the target cpu if a thread was queued on a cpu other than ours */
+static void kick_cpu(uint cpu)
+{
+#if BROADCAST_RESCHEDULE
+    mp_reschedule(MP_CPU_ALL_BUT_LOCAL, 0);
+#else
+    /* mp_reschedule masks out the local cpu */
+    mp_reschedule(1u << cpu, 0);
+#endif
+}
+
 /* run queue manipulation */
-static void insert_in_run_queue_head(thread_t *t)
+static void insert_in_run_queue_head(uint cpu, thread_t *t)
 {
     DEBUG_ASSERT(t->magic == THREAD_MAGIC);
     DEBUG_ASSERT(t->state == THREAD_READY);
     DEBUG_ASSERT(!list_in_list(&t->queue_node));
     DEBUG_ASSERT(arch_ints_disabled());
     DEBUG_ASSERT(spin_lock_held(&thread_lock));
+    DEBUG_ASSERT(cpu < SMP_MAX_CPUS);
 
-    list_add_head(&run_queue[t->priority], &t->queue_node);
-    run_queue_bitmap |= (1<<t->priority);
+    struct run_queue *rq = &run_queues[cpu];
+    list_add_head(&rq->queue[t->priority], &t->queue_node);
+    rq->bitmap |= (1u << t->priority);
 }
 
-static void insert_in_run_queue_tail(thread_t *t)
+static void insert_in_run_queue_tail(uint cpu, thread_t *t)
 {
     DEBUG_ASSERT(t->magic == THREAD_MAGIC);
     DEBUG_ASSERT(t->state == THREAD_READY);
     DEBUG_ASSERT(!list_in_list(&t->queue_node));
     DEBUG_ASSERT(arch_ints_disabled());
     DEBUG_ASSERT(spin_lock_held(&thread_lock));
+    DEBUG_ASSERT(cpu < SMP_MAX_CPUS);
 
-    list_add_tail(&run_queue[t->priority], &t->queue_node);
-    run_queue_bitmap |= (1<<t->priority);
+    struct run_queue *rq = &run_queues[cpu];
+    list_add_tail(&rq->queue[t->priority], &t->queue_node);
+    rq->bitmap |= (1u << t->priority);
 }
 
-thread_t *sched_get_top_thread(uint cpu)
+static void remove_from_run_queue(struct run_queue *rq, thread_t *t)
 {
-    thread_t *newthread;
-    uint32_t local_run_queue_bitmap = run_queue_bitmap;
+    list_delete(&t->queue_node);
 
-    while (local_run_queue_bitmap) {
-        /* find the first (remaining) queue with a thread in it */
-        uint next_queue = HIGHEST_PRIORITY - __builtin_clz(local_run_queue_bitmap)
-                          - (sizeof(run_queue_bitmap) * CHAR_BIT - NUM_PRIORITIES);
+    if (list_is_empty(&rq->queue[t->priority]))
+        rq->bitmap &= ~(1u << t->priority);
+}
 
-        list_for_every_entry(&run_queue[next_queue], newthread, thread_t, queue_node) {
+/* is thread t allowed to run on cpu */
+static inline bool thread_can_run_on(thread_t *t, uint cpu)
+{
 #if WITH_SMP
-            if (likely(newthread->pinned_cpu < 0) || (uint)newthread->pinned_cpu == cpu)
+    return likely(thread_pinned_cpu(t) < 0) || (uint)thread_pinned_cpu(t) == cpu;
+#else
+    return true;
+#endif
+}
+
+#if WITH_SMP
+/* look through the other active cpus' run queues for the highest priority
+ * thread that is allowed to run on cpu. threads are taken from the tail of the
+ * victim queue, since those are the least likely to still be cache hot.
+ */
+static thread_t *steal_thread(uint cpu)
+{
+    thread_t *best = NULL;
+    struct run_queue *best_rq = NULL;
+    int min_priority = -1;
+
+    /* start with the cpus after this one, so idle cpus don't all raid the
+     * same victim first */
+    mp_cpu_mask_t victims = mp_get_active_mask() & ~(1u << cpu);
+    mp_cpu_mask_t later = victims & ~((2u << cpu) - 1);
+
+    while (victims) {
+        uint victim = __builtin_ctz(later ? later : victims);
+        victims &= ~(1u << victim);
+        later &= ~(1u << victim);
+        struct run_queue *rq = &run_queues[victim];
+
+        uint32_t bitmap = rq->bitmap;
+        while (bitmap) {
+            uint pri = highest_queued_priority(bitmap);
+            if ((int)pri <= min_priority)
+                break;
+
+            thread_t *t = list_peek_tail_type(&rq->queue[pri], thread_t, queue_node);
+            for (; t; t = list_prev_type(&rq->queue[pri], &t->queue_node, thread_t, queue_node)) {
+                if (thread_can_run_on(t, cpu)) {
+                    best = t;
+                    best_rq = rq;
+                    break;
+                }
+            }
+            if (best_rq == rq) {
+                /* anything found on a later victim has to beat this one */
+                min_priority = pri;
+                break;
+            }
+
+            bitmap &= ~(1u << pri);
+        }
+    }
+
+    if (best) {
+        remove_from_run_queue(best_rq, best);
+        THREAD_STATS_INC(steals);
+    }
+
+    return best;
+}
 #endif
-            {
-                list_delete(&newthread->queue_node);
 
-                if (list_is_empty(&run_queue[next_queue]))
-                    run_queue_bitmap &= ~(1<<next_queue);
+thread_t *sched_get_top_thread(uint cpu)
+{
+    struct run_queue *rq = &run_queues[cpu];
+    uint32_t local_run_queue_bitmap = rq->bitmap;
 
+    while (local_run_queue_bitmap) {
+        /* find the first (remaining) queue with a thread in it */
+        uint next_queue = highest_queued_priority(local_run_queue_bitmap);
+
+        thread_t *newthread;
+        list_for_every_entry(&rq->queue[next_queue], newthread, thread_t, queue_node) {
+            /* a thread may have been pinned elsewhere after it was queued */
+            if (thread_can_run_on(newthread, cpu)) {
+                remove_from_run_queue(rq, newthread);
                 return newthread;
             }
         }
 
-        local_run_queue_bitmap &= ~(1<<next_queue);
+        local_run_queue_bitmap &= ~(1u << next_queue);
     }
+
+#if WITH_SMP
+    /* about to go idle, pull work from another cpu. a thread queued elsewhere
+     * that outranks what we're running is picked up by the cpu it was queued
+     * on, which gets kicked when it's queued */
+    thread_t *stolen = steal_thread(cpu);
+    if (stolen)
+        return stolen;
+#endif
+
     /* no threads to run, select the idle thread for this cpu */
     return &idle_threads[cpu];
 }
@@ -166,6 +282,23 @@ void sched_block(void)
     thread_resched();
 }
 
+/* put a newly woken thread on a run queue and poke the cpu that owns it */
+static void enqueue_woken_thread(thread_t *t, bool resched)
+{
+    DEBUG_ASSERT(t->magic == THREAD_MAGIC);
+
+    /* if the caller is about to reschedule, keep the thread local so it gets
+     * to run right away, otherwise spread it out */
+    uint cpu = (resched && thread_can_run_on(t, arch_curr_cpu_num())) ?
+               arch_curr_cpu_num() : find_cpu(t);
+
+    /* stuff the new thread in the run queue */
+    t->state = THREAD_READY;
+    insert_in_run_queue_head(cpu, t);
+
+    kick_cpu(cpu);
+}
+
 void sched_unblock(thread_t *t, bool resched)
 {
     DEBUG_ASSERT(t->magic == THREAD_MAGIC);
@@ -179,14 +312,10 @@ void sched_unblock(thread_t *t, bool resched)
         thread_t *current_thread = get_current_thread();
 
         current_thread->state = THREAD_READY;
-        insert_in_run_queue_head(current_thread);
+        insert_in_run_queue_head(local_cpu(current_thread), current_thread);
     }
 
-    /* stuff the new thread in the run queue */
-    t->state = THREAD_READY;
-    insert_in_run_queue_head(t);
-
-    mp_reschedule(find_cpu(t), 0);
+    enqueue_woken_thread(t, resched);
 
     if (resched)
         thread_resched();
@@ -205,20 +334,19 @@ void sched_unblock_list(struct list_node *list, bool resched)
         thread_t *current_thread = get_current_thread();
 
         current_thread->state = THREAD_READY;
-        insert_in_run_queue_head(current_thread);
+        insert_in_run_queue_head(local_cpu(current_thread), current_thread);
     }
 
-    /* pop the list of threads and shove into the scheduler */
+    /* pop the list of threads and shove into the scheduler. only the first
+     * one gets to stay local, the rest fan out to other cpus */
     thread_t *t;
+    bool keep_local = resched;
     while ((t = list_remove_tail_type(list, thread_t, queue_node))) {
         DEBUG_ASSERT(t->magic == THREAD_MAGIC);
         DEBUG_ASSERT(!thread_is_idle(t));
 
-        /* stuff the new thread in the run queue */
-        t->state = THREAD_READY;
-        insert_in_run_queue_head(t);
-
-        mp_reschedule(find_cpu(t), 0);
+        enqueue_woken_thread(t, keep_local);
+        keep_local = false;
     }
 
     if (resched)
@@ -234,7 +362,10 @@ void sched_yield(void)
     current_thread->state = THREAD_READY;
     current_thread->remaining_time_slice = 0;
     if (likely(!thread_is_idle(current_thread))) { /* idle thread doesn't go in the run queue */
-        insert_in_run_queue_tail(current_thread);
+        uint cpu = local_cpu(current_thread);
+        insert_in_run_queue_tail(cpu, current_thread);
+        /* we may have just been pinned to another cpu */
+        kick_cpu(cpu);
     }
     thread_resched();
 }
@@ -246,18 +377,100 @@ void sched_preempt(void)
     /* we are being preempted, so we get to go back into the front of the run queue if we have quantum left */
     current_thread->state = THREAD_READY;
     if (likely(!thread_is_idle(current_thread))) { /* idle thread doesn't go in the run queue */
+        uint cpu = local_cpu(current_thread);
         if (current_thread->remaining_time_slice > 0)
-            insert_in_run_queue_head(current_thread);
+            insert_in_run_queue_head(cpu, current_thread);
         else
-            insert_in_run_queue_tail(current_thread); /* if we're out of quantum, go to the tail of the queue */
+            insert_in_run_queue_tail(cpu, current_thread); /* if we're out of quantum, go to the tail of the queue */
     }
     sched_block();
 }
 
+void sched_change_priority(thread_t *t, int priority)
+{
+    DEBUG_ASSERT(t->magic == THREAD_MAGIC);
+    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+    DEBUG_ASSERT(priority >= LOWEST_PRIORITY && priority <= HIGHEST_PRIORITY);
+
+    if (t->state == THREAD_RUNNING) {
+        /* a thread running elsewhere may now outrank, or be outranked by,
+         * what is queued on its cpu, so have that cpu choose again. the
+         * current thread is left to the caller, which blocks or reschedules */
+        t->priority = priority;
+        if (t != get_current_thread())
+            kick_cpu(thread_last_cpu(t));
+        return;
+    }
+    if (t->state != THREAD_READY || !list_in_list(&t->queue_node)) {
+        /* blocked threads pick up the new priority the next time they are
+         * queued */
+        t->priority = priority;
+        return;
+    }
+
+    /* the thread doesn't record which cpu's queue it's on, so fix up the
+     * bitmap of any queue the removal might have emptied */
+    int old_priority = t->priority;
+    list_delete(&t->queue_node);
+    for (uint cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        if (list_is_empty(&run_queues[cpu].queue[old_priority]))
+            run_queues[cpu].bitmap &= ~(1u << old_priority);
+    }
+
+    t->priority = priority;
+    uint cpu = find_cpu(t);
+    insert_in_run_queue_tail(cpu, t);
+    kick_cpu(cpu);
+}
+
 void sched_init_early(void)
 {
     /* initialize the run queues */
-    for (int i=0; i < NUM_PRIORITIES; i++)
-        list_initialize(&run_queue[i]);
+    for (uint cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        for (int i = 0; i < NUM_PRIORITIES; i++)
+            list_initialize(&run_queues[cpu].queue[i]);
+        run_queues[cpu].bitmap = 0;
+    }
 }
 
+void sched_dump_run_queues(void)
+{
+    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+
+    for (uint cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        struct run_queue *rq = &run_queues[cpu];
+        if (rq->bitmap == 0)
+            continue;
+
+        dprintf(INFO, "cpu %u run queue, bitmap %#x:\n", cpu, rq->bitmap);
+        for (int pri = HIGHEST_PRIORITY; pri >= LOWEST_PRIORITY; pri--) {
+            thread_t *t;
+            list_for_every_entry(&rq->queue[pri], t, thread_t, queue_node) {
+                dprintf(INFO, "\tpri %d: %p (%s)\n", pri, t, t->name);
+            }
+        }
+    }
+}
+
+/* move every thread queued on old_cpu that isn't pinned there to other cpus */
+void sched_transition_off_cpu(uint old_cpu)
+{
+    THREAD_LOCK(state);
+
+    struct run_queue *rq = &run_queues[old_cpu];
+    for (int pri = HIGHEST_PRIORITY; pri >= LOWEST_PRIORITY; pri--) {
+        thread_t *t, *temp;
+        list_for_every_entry_safe(&rq->queue[pri], t, temp, thread_t, queue_node) {
+            if (thread_pinned_cpu(t) >= 0)
+                continue;
+
+            remove_from_run_queue(rq, t);
+            /* find_cpu never picks a cpu that has left the active set */
+            uint cpu = find_cpu(t);
+            insert_in_run_queue_tail(cpu, t);
+            kick_cpu(cpu);
+        }
+    }
+
+    THREAD_UNLOCK(state);
+}
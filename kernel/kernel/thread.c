@@ -59,6 +59,9 @@ spin_lock_t thread_lock = SPIN_LOCK_INITIAL_VALUE;
 /* the idle thread(s) (statically allocated) */
 thread_t idle_threads[SMP_MAX_CPUS];
 
+/* the thread on each cpu, for thread_is_running() */
+static thread_t *running_threads[SMP_MAX_CPUS];
+
 /* local routines */
 void thread_resched(void);
 static int idle_thread_routine(void *) __NO_RETURN;
@@ -77,6 +80,7 @@ static void init_thread_struct(thread_t *t, const char *name)
     memset(t, 0, sizeof(thread_t));
     t->magic = THREAD_MAGIC;
     thread_set_pinned_cpu(t, -1);
+    t->inherited_priority = -1;
     strlcpy(t->name, name, sizeof(t->name));
     wait_queue_init(&t->retcode_wait_queue);
 }
@@ -147,6 +151,7 @@ thread_t *thread_create_etc(
     t->entry = entry;
     t->arg = arg;
     t->priority = priority;
+    t->base_priority = priority;
     t->state = THREAD_INITIAL;
     t->signals = 0;
     t->blocking_wait_queue = NULL;
@@ -705,6 +710,7 @@ void thread_resched(void)
 
     /* mark the cpu ownership of the threads */
     thread_set_last_cpu(newthread, cpu);
+    __atomic_store_n(&running_threads[cpu], newthread, __ATOMIC_RELAXED);
 
     /* set the cpu state based on the new thread we've picked */
     if (thread_is_idle(newthread)) {
@@ -914,10 +920,13 @@ static enum handler_return thread_sleep_handler(timer_t *timer, lk_time_t now, v
  * if other threads are running.  When the deadline expires, this thread will
  * be placed at the head of the run queue.
  *
+ * slack allows the wakeup to be delayed by up to that many ns, so it can share a
+ * timer interrupt with other timers that expire shortly after the deadline.
+ *
  * interruptable argument allows this routine to return early if the thread was signaled
  * for something.
  */
-status_t thread_sleep_etc(lk_time_t deadline, bool interruptable)
+status_t thread_sleep_etc(lk_time_t deadline, lk_time_t slack, bool interruptable)
 {
     thread_t *current_thread = get_current_thread();
     status_t blocked_status;
@@ -944,7 +953,7 @@ status_t thread_sleep_etc(lk_time_t deadline, bool interruptable)
 
     if (deadline != INFINITE_TIME) {
         /* set a one shot timer to wake us up and reschedule */
-        timer_set_oneshot(&timer, deadline, thread_sleep_handler, (void *)current_thread);
+        timer_set_oneshot_etc(&timer, deadline, slack, thread_sleep_handler, (void *)current_thread);
     }
     current_thread->state = THREAD_SLEEPING;
     current_thread->blocked_status = NO_ERROR;
@@ -1009,6 +1018,7 @@ void thread_construct_first(thread_t *t, const char *name)
 
     init_thread_struct(t, name);
     t->priority = HIGHEST_PRIORITY;
+    t->base_priority = HIGHEST_PRIORITY;
     t->state = THREAD_RUNNING;
     t->flags = THREAD_FLAG_DETACHED;
     t->signals = 0;
@@ -1020,9 +1030,19 @@ void thread_construct_first(thread_t *t, const char *name)
     THREAD_LOCK(state);
     list_add_head(&thread_list, &t->thread_list_node);
     set_current_thread(t);
+    __atomic_store_n(&running_threads[cpu], t, __ATOMIC_RELAXED);
     THREAD_UNLOCK(state);
 }
 
+bool thread_is_running(const thread_t *t)
+{
+    for (uint i = 0; i < SMP_MAX_CPUS; i++) {
+        if (__atomic_load_n(&running_threads[i], __ATOMIC_RELAXED) == t)
+            return true;
+    }
+    return false;
+}
+
 /**
  * @brief  Initialize threading system
  *
@@ -1087,13 +1107,37 @@ void thread_set_priority(int priority)
         priority = IDLE_PRIORITY + 1;
     if (priority > HIGHEST_PRIORITY)
         priority = HIGHEST_PRIORITY;
-    current_thread->priority = priority;
+    current_thread->base_priority = priority;
+    current_thread->priority = MAX(priority, current_thread->inherited_priority);
 
     sched_preempt();
 
     THREAD_UNLOCK(state);
 }
 
+/**
+ * @brief Set the priority a thread inherits from the threads waiting on it
+ *
+ * The thread runs at the higher of its own priority and |priority|, until
+ * this is called again with a negative |priority|.  This lets the owner of a
+ * priority inheriting lock run at the priority of its highest waiter.
+ *
+ * Must be called with the thread lock held.
+ */
+void thread_set_inherited_priority(thread_t *t, int priority)
+{
+    DEBUG_ASSERT(t->magic == THREAD_MAGIC);
+    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+
+    if (priority > HIGHEST_PRIORITY)
+        priority = HIGHEST_PRIORITY;
+    t->inherited_priority = priority;
+
+    int new_priority = MAX(t->base_priority, priority);
+    if (new_priority != t->priority && !thread_is_idle(t))
+        sched_change_priority(t, new_priority);
+}
+
 /**
  * @brief  Become an idle thread
  *
@@ -1113,6 +1157,7 @@ void thread_become_idle(void)
 
     /* mark ourself as idle */
     t->priority = IDLE_PRIORITY;
+    t->base_priority = IDLE_PRIORITY;
     t->flags |= THREAD_FLAG_IDLE;
     thread_set_pinned_cpu(t, arch_curr_cpu_num());
 
@@ -28,14 +28,15 @@
 #include <kernel/timer.h>
 #include <list.h>
 #include <platform.h>
+#include <stdlib.h>
 #include <platform/timer.h>
 #include <trace.h>
 
 #define LOCAL_TRACE 0
 
-spin_lock_t timer_lock;
-
 struct timer_state {
+    /* protects timer_queue and the queued_cpu field of every timer on it */
+    spin_lock_t lock;
     struct list_node timer_queue;
 } __CPU_ALIGN;
 
@@ -56,11 +57,28 @@ static void insert_timer_in_queue(uint cpu, timer_t *timer)
     timer_t *entry;
 
     DEBUG_ASSERT(arch_ints_disabled());
+    DEBUG_ASSERT(spin_lock_held(&timers[cpu].lock));
+
+    LTRACEF("timer %p, cpu %u, scheduled %" PRIu64 ", periodic %" PRIu64 ", slack %" PRIu64 "\n",
+            timer, cpu, timer->scheduled_time, timer->period, timer->slack);
+
+    /* latest time the timer is allowed to fire, saturating */
+    lk_time_t latest = timer->scheduled_time + timer->slack;
+    if (latest < timer->scheduled_time)
+        latest = INFINITE_TIME;
+    bool coalesced = false;
 
-    LTRACEF("timer %p, cpu %u, scheduled %" PRIu64 ", periodic %" PRIu64 "\n", timer, cpu, timer->scheduled_time, timer->period);
+    timer->queued_cpu = cpu;
 
     list_for_every_entry(&timers[cpu].timer_queue, entry, timer_t, node) {
         if (TIME_GT(entry->scheduled_time, timer->scheduled_time)) {
+            if (!coalesced && timer->slack > 0 && TIME_LTE(entry->scheduled_time, latest)) {
+                /* the next timer fires within our slack, fire along with it
+                 * so that both share a single hardware timer interrupt */
+                timer->scheduled_time = entry->scheduled_time;
+                coalesced = true;
+                continue;
+            }
             list_add_before(&entry->node, &timer->node);
             return;
         }
@@ -70,9 +88,20 @@ static void insert_timer_in_queue(uint cpu, timer_t *timer)
     list_add_tail(&timers[cpu].timer_queue, &timer->node);
 }
 
-static void timer_set(timer_t *timer, lk_time_t deadline, lk_time_t period, timer_callback callback, void *arg)
+static void remove_timer_from_queue(uint cpu, timer_t *timer)
 {
-    LTRACEF("timer %p, deadline %" PRIu64 ", period %" PRIu64 ", callback %p, arg %p\n", timer, deadline, period, callback, arg);
+    DEBUG_ASSERT(spin_lock_held(&timers[cpu].lock));
+    DEBUG_ASSERT(timer->queued_cpu == (int)cpu);
+
+    list_delete(&timer->node);
+    timer->queued_cpu = -1;
+}
+
+static void timer_set(timer_t *timer, lk_time_t deadline, lk_time_t slack, lk_time_t period,
+                      timer_callback callback, void *arg)
+{
+    LTRACEF("timer %p, deadline %" PRIu64 ", slack %" PRIu64 ", period %" PRIu64 ", callback %p, arg %p\n",
+            timer, deadline, slack, period, callback, arg);
 
     DEBUG_ASSERT(timer->magic == TIMER_MAGIC);
 
@@ -80,10 +109,13 @@ static void timer_set(timer_t *timer, lk_time_t deadline, lk_time_t period, time
         panic("timer %p already in list\n", timer);
     }
 
+    /* timers are always queued on the local cpu, so setting a timer only ever
+     * touches this cpu's lock and queue */
     spin_lock_saved_state_t state;
-    spin_lock_irqsave(&timer_lock, state);
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
 
     uint cpu = arch_curr_cpu_num();
+    spin_lock(&timers[cpu].lock);
 
     if (unlikely(timer->active_cpu == (int)cpu)) {
         /* the timer is active on our own cpu, we must be inside the callback */
@@ -95,6 +127,7 @@ static void timer_set(timer_t *timer, lk_time_t deadline, lk_time_t period, time
 
     /* set up the structure */
     timer->scheduled_time = deadline;
+    timer->slack = slack;
     timer->period = period;
     timer->callback = callback;
     timer->arg = arg;
@@ -108,13 +141,14 @@ static void timer_set(timer_t *timer, lk_time_t deadline, lk_time_t period, time
 #if PLATFORM_HAS_DYNAMIC_TIMER
     if (list_peek_head_type(&timers[cpu].timer_queue, timer_t, node) == timer) {
         /* we just modified the head of the timer queue */
-        LTRACEF("setting new timer for %" PRIu64 " nsecs\n", deadline);
-        platform_set_oneshot_timer(timer_tick, NULL, deadline);
+        LTRACEF("setting new timer for %" PRIu64 " nsecs\n", timer->scheduled_time);
+        platform_set_oneshot_timer(timer_tick, NULL, timer->scheduled_time);
     }
 #endif
 
 out:
-    spin_unlock_irqrestore(&timer_lock, state);
+    spin_unlock(&timers[cpu].lock);
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
 }
 
 /**
@@ -133,7 +167,26 @@ out:
  */
 void timer_set_oneshot(timer_t *timer, lk_time_t deadline, timer_callback callback, void *arg)
 {
-    timer_set(timer, deadline, 0, callback, arg);
+    timer_set(timer, deadline, 0, 0, callback, arg);
+}
+
+/**
+ * @brief  Set up a timer that executes once, with some slack
+ *
+ * Same as timer_set_oneshot(), but the timer may fire up to slack ns after
+ * the deadline. This lets it share a hardware timer interrupt with another
+ * timer that is already due to fire in that window.
+ *
+ * @param  timer The timer to use
+ * @param  deadline The deadline, in ns, after which the timer is executed
+ * @param  slack  How late, in ns, past the deadline the timer may fire
+ * @param  callback  The function to call when the timer expires
+ * @param  arg  The argument to pass to the callback
+ */
+void timer_set_oneshot_etc(timer_t *timer, lk_time_t deadline, lk_time_t slack,
+                           timer_callback callback, void *arg)
+{
+    timer_set(timer, deadline, slack, 0, callback, arg);
 }
 
 /**
@@ -154,7 +207,52 @@ void timer_set_periodic(timer_t *timer, lk_time_t period, timer_callback callbac
 {
     if (period == 0)
         period = 1;
-    timer_set(timer, current_time() + period, period, callback, arg);
+    timer_set(timer, current_time() + period, 0, period, callback, arg);
+}
+
+/* pull a timer off of whichever cpu's queue it is on. returns true if it was queued */
+static bool timer_dequeue(timer_t *timer, uint curr_cpu)
+{
+    DEBUG_ASSERT(arch_ints_disabled());
+
+    for (;;) {
+        int cpu = timer->queued_cpu;
+        if (cpu < 0)
+            return false;
+
+        spin_lock(&timers[cpu].lock);
+
+        /* the timer may have fired or been moved to another cpu before we got the lock */
+        if (unlikely(timer->queued_cpu != cpu)) {
+            spin_unlock(&timers[cpu].lock);
+            continue;
+        }
+
+#if PLATFORM_HAS_DYNAMIC_TIMER
+        timer_t *oldhead = list_peek_head_type(&timers[cpu].timer_queue, timer_t, node);
+#endif
+
+        /* remove it from the queue */
+        remove_timer_from_queue(cpu, timer);
+
+#if PLATFORM_HAS_DYNAMIC_TIMER
+        /* see if we've just modified the head of this cpu's timer queue */
+        /* if we modified another cpu's queue, we'll just let it fire and sort itself out */
+        if ((uint)cpu == curr_cpu) {
+            timer_t *newhead = list_peek_head_type(&timers[cpu].timer_queue, timer_t, node);
+            if (newhead == NULL) {
+                LTRACEF("clearing old hw timer, nothing in the queue\n");
+                platform_stop_timer();
+            } else if (newhead != oldhead) {
+                LTRACEF("setting new timer to %" PRIu64 "\n", newhead->scheduled_time);
+                platform_set_oneshot_timer(timer_tick, NULL, newhead->scheduled_time);
+            }
+        }
+#endif
+
+        spin_unlock(&timers[cpu].lock);
+        return true;
+    }
 }
 
 /**
@@ -165,7 +263,7 @@ void timer_cancel(timer_t *timer)
     DEBUG_ASSERT(timer->magic == TIMER_MAGIC);
 
     spin_lock_saved_state_t state;
-    spin_lock_irqsave(&timer_lock, state);
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
 
     uint cpu = arch_curr_cpu_num();
 
@@ -184,37 +282,31 @@ void timer_cancel(timer_t *timer)
         timer->period = 0;
 
         /* we're done, so return back to the callback */
-        spin_unlock_irqrestore(&timer_lock, state);
+        arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
         return;
     }
 
-    /* if the timer is in a queue, remove it and adjust hardware timers if needed */
-    if (list_in_list(&timer->node)) {
-#if PLATFORM_HAS_DYNAMIC_TIMER
-        timer_t *oldhead = list_peek_head_type(&timers[cpu].timer_queue, timer_t, node);
-#endif
+    /* if the timer is in a queue, remove it and adjust hardware timers if needed.
+     * only the lock of the cpu the timer is queued on is taken. */
+    timer_dequeue(timer, cpu);
 
-        /* remove it from the queue */
-        list_delete(&timer->node);
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
 
-#if PLATFORM_HAS_DYNAMIC_TIMER
-        /* see if we've just modified the head of this cpu's timer queue */
-        /* if we modified another cpu's queue, we'll just let it fire and sort itself out */
-        timer_t *newhead = list_peek_head_type(&timers[cpu].timer_queue, timer_t, node);
-        if (newhead == NULL) {
-            LTRACEF("clearing old hw timer, nothing in the queue\n");
-            platform_stop_timer();
-        } else if (newhead != oldhead) {
-            LTRACEF("setting new timer to %" PRIu64 "\n", newhead->scheduled_time);
-            platform_set_oneshot_timer(timer_tick, NULL, newhead->scheduled_time);
+    /* wait for the timer to become un-busy in case a callback is currently active on another cpu.
+     * a periodic timer that fired before it saw the cancel may have been requeued by the time
+     * the callback finishes, so pull it back off of the queue if that happened. */
+    for (;;) {
+        smp_mb();
+        if (timer->active_cpu < 0) {
+            smp_rmb();
+            if (timer->queued_cpu < 0)
+                break;
+
+            arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+            timer_dequeue(timer, arch_curr_cpu_num());
+            arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+            continue;
         }
-#endif
-    }
-
-    spin_unlock_irqrestore(&timer_lock, state);
-
-    /* wait for the timer to become un-busy in case a callback is currently active on another cpu */
-    while (timer->active_cpu >= 0) {
         arch_spinloop_pause();
     }
 
@@ -238,7 +330,7 @@ static enum handler_return timer_tick(void *arg, lk_time_t now)
 
     LTRACEF("cpu %u now %" PRIu64 ", sp %p\n", cpu, now, __GET_FRAME());
 
-    spin_lock(&timer_lock);
+    spin_lock(&timers[cpu].lock);
 
     for (;;) {
         /* see if there's an event to process */
@@ -254,14 +346,15 @@ static enum handler_return timer_tick(void *arg, lk_time_t now)
         DEBUG_ASSERT_MSG(timer && timer->magic == TIMER_MAGIC,
                 "ASSERT: timer failed magic check: timer %p, magic 0x%x\n",
                 timer, (uint)timer->magic);
-        list_delete(&timer->node);
 
-        /* mark the timer busy */
+        /* mark the timer busy before it leaves the queue, so a canceller
+         * never sees it as neither queued nor active */
         timer->active_cpu = cpu;
-        /* spinlock below acts as a memory barrier */
+        smp_wmb();
+        remove_timer_from_queue(cpu, timer);
 
         /* we pulled it off the list, release the list lock to handle it */
-        spin_unlock(&timer_lock);
+        spin_unlock(&timers[cpu].lock);
 
         LTRACEF("dequeued timer %p, scheduled %" PRIu64 " periodic %" PRIu64 "\n", timer, timer->scheduled_time, timer->period);
 
@@ -273,18 +366,11 @@ static enum handler_return timer_tick(void *arg, lk_time_t now)
 
         DEBUG_ASSERT(arch_ints_disabled());
         /* it may have been requeued or periodic, grab the lock so we can safely inspect it */
-        spin_lock(&timer_lock);
+        spin_lock(&timers[cpu].lock);
 
         /* record whether or not we've been cancelled in the meantime */
         bool cancelled = timer->cancel;
 
-        /* mark it not busy */
-        timer->active_cpu = -1;
-        smp_mb();
-
-        /* make sure any spinners wake up */
-        arch_spinloop_signal();
-
         /* if we've been cancelled, it's not okay to touch the timer structure from now on out */
         if (!cancelled) {
             /* if it is a periodic timer and it hasn't been requeued
@@ -296,6 +382,14 @@ static enum handler_return timer_tick(void *arg, lk_time_t now)
                 insert_timer_in_queue(cpu, timer);
             }
         }
+
+        /* mark it not busy, after any requeue is visible */
+        smp_wmb();
+        timer->active_cpu = -1;
+        smp_mb();
+
+        /* make sure any spinners wake up */
+        arch_spinloop_signal();
     }
 
 #if PLATFORM_HAS_DYNAMIC_TIMER
@@ -311,10 +405,10 @@ static enum handler_return timer_tick(void *arg, lk_time_t now)
     }
 
     /* we're done manipulating the timer queue */
-    spin_unlock(&timer_lock);
+    spin_unlock(&timers[cpu].lock);
 #else
     /* release the timer lock before calling the tick handler */
-    spin_unlock(&timer_lock);
+    spin_unlock(&timers[cpu].lock);
 
     /* let the scheduler have a shot to do quantum expiration, etc */
     /* in case of dynamic timer, the scheduler will set up a periodic timer */
@@ -346,15 +440,21 @@ status_t timer_trylock_or_cancel(timer_t *t, spin_lock_t *lock)
 void timer_transition_off_cpu(uint old_cpu)
 {
     spin_lock_saved_state_t state;
-    spin_lock_irqsave(&timer_lock, state);
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
     uint cpu = arch_curr_cpu_num();
 
-    timer_t *old_head = list_peek_head_type(&timers[old_cpu].timer_queue, timer_t, node);
+    DEBUG_ASSERT(cpu != old_cpu);
+
+    /* take both queue locks in cpu order */
+    spin_lock(&timers[MIN(cpu, old_cpu)].lock);
+    spin_lock(&timers[MAX(cpu, old_cpu)].lock);
+
+    timer_t *old_head = list_peek_head_type(&timers[cpu].timer_queue, timer_t, node);
 
     timer_t *entry = NULL, *tmp_entry = NULL;
     /* Move all timers from old_cpu to this cpu */
     list_for_every_entry_safe(&timers[old_cpu].timer_queue, entry, tmp_entry, timer_t, node) {
-        list_delete(&entry->node);
+        remove_timer_from_queue(old_cpu, entry);
         insert_timer_in_queue(cpu, entry);
     }
 
@@ -367,7 +467,9 @@ void timer_transition_off_cpu(uint old_cpu)
     }
 #endif
 
-    spin_unlock_irqrestore(&timer_lock, state);
+    spin_unlock(&timers[MAX(cpu, old_cpu)].lock);
+    spin_unlock(&timers[MIN(cpu, old_cpu)].lock);
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
 }
 
 /* This function is to be invoked after resume on each CPU that may have
@@ -376,9 +478,9 @@ void timer_thaw_percpu(void)
 {
 #if PLATFORM_HAS_DYNAMIC_TIMER
     DEBUG_ASSERT(arch_ints_disabled());
-    spin_lock(&timer_lock);
 
     uint cpu = arch_curr_cpu_num();
+    spin_lock(&timers[cpu].lock);
 
     timer_t *t = list_peek_head_type(&timers[cpu].timer_queue, timer_t, node);
     if (t) {
@@ -386,14 +488,14 @@ void timer_thaw_percpu(void)
         platform_set_oneshot_timer(timer_tick, NULL, t->scheduled_time);
     }
 
-    spin_unlock(&timer_lock);
+    spin_unlock(&timers[cpu].lock);
 #endif
 }
 
 void timer_init(void)
 {
-    timer_lock = SPIN_LOCK_INITIAL_VALUE;
     for (uint i = 0; i < SMP_MAX_CPUS; i++) {
+        timers[i].lock = SPIN_LOCK_INITIAL_VALUE;
         list_initialize(&timers[i].timer_queue);
     }
 #if !PLATFORM_HAS_DYNAMIC_TIMER
@@ -18,6 +18,7 @@
 #include <list.h>
 #include <lk/init.h>
 #include <new.h>
+#include <platform.h>
 #include <pow2.h>
 #include <stdlib.h>
 #include <string.h>
@@ -35,6 +36,38 @@ static Mutex arena_lock;
 static mxtl::DoublyLinkedList<PmmArena*> arena_list TA_GUARDED(arena_lock);
 static size_t arena_cumulative_size TA_GUARDED(arena_lock);
 
+// Per cpu caches of free pages. Single page allocations and frees are served
+// out of the local cache under a local spinlock, and the cache is refilled from
+// and drained to the arenas in batches, so most page faults never touch
+// arena_lock. Cached pages are taken out of their arena's free list and marked
+// VM_PAGE_STATE_CACHED so the contiguous and range allocators skip over them.
+//
+// Only pages from KMAP arenas are cached, so the cache can satisfy any
+// allocation flags.
+#define PMM_PAGE_CACHE_BATCH 32
+#define PMM_PAGE_CACHE_MAX (PMM_PAGE_CACHE_BATCH * 2)
+
+// The free fill checks live in the arena, keep every page going through it.
+#define PMM_PAGE_CACHE_ENABLE !PMM_ENABLE_FREE_FILL
+
+struct pmm_page_cache {
+    spin_lock_t lock;
+    list_node free_list;
+    size_t count;
+
+    // statistics, protected by lock
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t refills;
+    uint64_t frees;
+    uint64_t drains;
+} __CPU_ALIGN;
+
+static pmm_page_cache page_cache[SMP_MAX_CPUS];
+
+// Set once the caches are initialized, before that everything goes to the arenas.
+static bool page_cache_enabled = false;
+
 #if PMM_ENABLE_FREE_FILL
 static void pmm_enforce_fill(uint level) {
     for (auto& a : arena_list) {
@@ -105,7 +138,262 @@ done_add:
     return NO_ERROR;
 }
 
+// Move every node on src to the tail of dst, leaving src empty.
+static void list_splice_tail(list_node* dst, list_node* src) {
+    if (list_is_empty(src))
+        return;
+    src->next->prev = dst->prev;
+    src->prev->next = dst;
+    dst->prev->next = src->next;
+    dst->prev = src->prev;
+    list_initialize(src);
+}
+
+// Find the arena a page belongs to. Like vm_page_to_paddr, this only looks at
+// values that are set once during system initialization.
+static PmmArena* page_to_arena(const vm_page_t* page) TA_NO_THREAD_SAFETY_ANALYSIS {
+    for (auto& a : arena_list) {
+        if (a.page_belongs_to_arena(page))
+            return &a;
+    }
+    return nullptr;
+}
+
+static void page_cache_init(uint level) {
+    for (auto& cache : page_cache) {
+        cache.lock = SPIN_LOCK_INITIAL_VALUE;
+        list_initialize(&cache.free_list);
+        cache.count = 0;
+    }
+    page_cache_enabled = PMM_PAGE_CACHE_ENABLE;
+}
+
+LK_INIT_HOOK(pmm_page_cache, &page_cache_init, LK_INIT_LEVEL_VM);
+
+// Take up to count pages out of the current cpu's cache, adding them to the tail of list.
+static size_t page_cache_alloc(size_t count, list_node* list) {
+    if (!page_cache_enabled)
+        return 0;
+
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+    pmm_page_cache& cache = page_cache[arch_curr_cpu_num()];
+    spin_lock(&cache.lock);
+
+    size_t allocated = 0;
+    while (allocated < count) {
+        vm_page_t* page = list_remove_head_type(&cache.free_list, vm_page_t, free.node);
+        if (!page)
+            break;
+        DEBUG_ASSERT(page->state == VM_PAGE_STATE_CACHED);
+
+        page->state = VM_PAGE_STATE_ALLOC;
+        list_add_tail(list, &page->free.node);
+        allocated++;
+    }
+    cache.count -= allocated;
+    if (allocated == count) {
+        cache.hits++;
+    } else {
+        cache.misses++;
+    }
+
+    spin_unlock(&cache.lock);
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    return allocated;
+}
+
+// Pull a batch of pages out of the KMAP arenas into the current cpu's cache.
+// Returns the number of pages added.
+static size_t page_cache_refill() {
+    if (!page_cache_enabled)
+        return 0;
+
+    list_node list = LIST_INITIAL_VALUE(list);
+    size_t allocated = 0;
+    {
+        AutoLock al(&arena_lock);
+
+        for (auto& a : arena_list) {
+            if ((a.flags() & PMM_ARENA_FLAG_KMAP) == 0)
+                continue;
+
+            allocated += a.AllocPages(PMM_PAGE_CACHE_BATCH - allocated, &list);
+            if (allocated == PMM_PAGE_CACHE_BATCH)
+                break;
+        }
+    }
+
+    if (allocated == 0)
+        return 0;
+
+    vm_page_t* page;
+    list_for_every_entry (&list, page, vm_page_t, free.node) {
+        page->state = VM_PAGE_STATE_CACHED;
+    }
+
+    // we may have migrated while holding the arena lock, that's fine, the pages
+    // go to whatever cpu we're on now
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+    pmm_page_cache& cache = page_cache[arch_curr_cpu_num()];
+    spin_lock(&cache.lock);
+
+    list_splice_tail(&cache.free_list, &list);
+    cache.count += allocated;
+    cache.refills++;
+
+    spin_unlock(&cache.lock);
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    return allocated;
+}
+
+// Move the pages on list that can be cached into the current cpu's cache.
+// If that overflows the cache, a batch of the coldest cached pages is moved
+// onto overflow so the caller can return them to the arenas. Returns the
+// number of pages taken off of list.
+static size_t page_cache_free(list_node* list, list_node* overflow) {
+    if (!page_cache_enabled)
+        return 0;
+
+    size_t taken = 0;
+
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+    pmm_page_cache& cache = page_cache[arch_curr_cpu_num()];
+    spin_lock(&cache.lock);
+
+    vm_page_t* page;
+    vm_page_t* temp;
+    list_for_every_entry_safe (list, page, temp, vm_page_t, free.node) {
+        DEBUG_ASSERT(!page_is_free(page));
+
+        PmmArena* arena = page_to_arena(page);
+        if (!arena || (arena->flags() & PMM_ARENA_FLAG_KMAP) == 0)
+            continue;
+
+        list_delete(&page->free.node);
+        page->state = VM_PAGE_STATE_CACHED;
+        list_add_head(&cache.free_list, &page->free.node);
+        cache.count++;
+        cache.frees++;
+        taken++;
+
+        if (cache.count > PMM_PAGE_CACHE_MAX) {
+            for (size_t i = 0; i < PMM_PAGE_CACHE_BATCH; i++) {
+                vm_page_t* p = list_remove_tail_type(&cache.free_list, vm_page_t, free.node);
+                list_add_tail(overflow, &p->free.node);
+            }
+            cache.count -= PMM_PAGE_CACHE_BATCH;
+            cache.drains++;
+        }
+    }
+
+    spin_unlock(&cache.lock);
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    return taken;
+}
+
+// Move every page in cache onto list.
+static void page_cache_take_all(pmm_page_cache& cache, list_node* list) {
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&cache.lock, state);
+
+    list_splice_tail(list, &cache.free_list);
+    if (cache.count > 0)
+        cache.drains++;
+    cache.count = 0;
+
+    spin_unlock_irqrestore(&cache.lock, state);
+}
+
+// Return the pages on list, taken out of the caches, to their arenas.
+static size_t page_cache_return(list_node* list) {
+    if (list_is_empty(list))
+        return 0;
+
+    AutoLock al(&arena_lock);
+
+    size_t count = 0;
+    vm_page_t* page;
+    while ((page = list_remove_head_type(list, vm_page_t, free.node))) {
+        DEBUG_ASSERT(page->state == VM_PAGE_STATE_CACHED);
+        __UNUSED status_t status = page_to_arena(page)->FreePage(page);
+        DEBUG_ASSERT(status == NO_ERROR);
+        count++;
+    }
+
+    return count;
+}
+
+// Return every cached page on every cpu to the arenas. Used when an allocation
+// that needs specific pages fails.
+static size_t page_cache_drain_all() {
+    if (!page_cache_enabled)
+        return 0;
+
+    list_node list = LIST_INITIAL_VALUE(list);
+    for (auto& cache : page_cache) {
+        page_cache_take_all(cache, &list);
+    }
+    return page_cache_return(&list);
+}
+
+// How often a failed contiguous allocation may empty every cpu's cache.
+// Large page objects fail these routinely once memory is fragmented, and
+// draining all the caches each time would leave none of them warm.
+#define PMM_PAGE_CACHE_GLOBAL_DRAIN_INTERVAL LK_MSEC(100)
+
+// Return the current cpu's cached pages to the arenas, and every other cpu's
+// too if that hasn't been done recently. Used when a contiguous allocation
+// fails.
+static size_t page_cache_drain_for_contiguous() {
+    if (!page_cache_enabled)
+        return 0;
+
+    static lk_time_t last_global_drain;
+    lk_time_t now = current_time();
+    lk_time_t last = atomic_load_u64(&last_global_drain);
+    if (now - last >= PMM_PAGE_CACHE_GLOBAL_DRAIN_INTERVAL &&
+        atomic_cmpxchg_u64(&last_global_drain, &last, now)) {
+        return page_cache_drain_all();
+    }
+
+    list_node list = LIST_INITIAL_VALUE(list);
+    page_cache_take_all(page_cache[arch_curr_cpu_num()], &list);
+    return page_cache_return(&list);
+}
+
+static size_t page_cache_count_free_pages() {
+    size_t count = 0;
+    for (const auto& cache : page_cache) {
+        count += cache.count;
+    }
+    return count;
+}
+
+static vm_page_t* pmm_alloc_page_cached(paddr_t* pa) {
+    list_node list = LIST_INITIAL_VALUE(list);
+
+    if (page_cache_alloc(1, &list) == 0) {
+        if (page_cache_refill() == 0 || page_cache_alloc(1, &list) == 0)
+            return nullptr;
+    }
+
+    vm_page_t* page = list_remove_head_type(&list, vm_page_t, free.node);
+    if (pa)
+        *pa = vm_page_to_paddr(page);
+    return page;
+}
+
 vm_page_t* pmm_alloc_page(uint alloc_flags, paddr_t* pa) {
+    vm_page_t* page = pmm_alloc_page_cached(pa);
+    if (page)
+        return page;
+
     AutoLock al(&arena_lock);
 
     /* walk the arenas in order until we find one with a free page */
@@ -135,10 +423,14 @@ size_t pmm_alloc_pages(size_t count, uint alloc_flags, struct list_node* list) {
     if (count == 0)
         return 0;
 
+    /* use up whatever is sitting in the local cache first */
+    size_t allocated = page_cache_alloc(count, list);
+    if (allocated == count)
+        return allocated;
+
     AutoLock al(&arena_lock);
 
     /* walk the arenas in order, allocating as many pages as we can from each */
-    size_t allocated = 0;
     for (auto& a : arena_list) {
         DEBUG_ASSERT(count > allocated);
 
@@ -158,9 +450,20 @@ size_t pmm_alloc_pages(size_t count, uint alloc_flags, struct list_node* list) {
     return allocated;
 }
 
+static size_t pmm_alloc_range_locked(paddr_t address, size_t count, struct list_node* list);
+
 size_t pmm_alloc_range(paddr_t address, size_t count, struct list_node* list) {
     LTRACEF("address %#" PRIxPTR ", count %zu\n", address, count);
 
+    size_t allocated = pmm_alloc_range_locked(address, count, list);
+    if (allocated < count && page_cache_drain_all() > 0) {
+        /* some of the range may have been sitting in a per cpu cache */
+        allocated += pmm_alloc_range_locked(address + allocated * PAGE_SIZE, count - allocated, list);
+    }
+    return allocated;
+}
+
+static size_t pmm_alloc_range_locked(paddr_t address, size_t count, struct list_node* list) {
     uint allocated = 0;
     if (count == 0)
         return 0;
@@ -190,10 +493,23 @@ size_t pmm_alloc_range(paddr_t address, size_t count, struct list_node* list) {
     return allocated;
 }
 
+static size_t pmm_alloc_contiguous_locked(size_t count, uint alloc_flags, uint8_t alignment_log2,
+                                          paddr_t* pa, struct list_node* list);
+
 size_t pmm_alloc_contiguous(size_t count, uint alloc_flags, uint8_t alignment_log2, paddr_t* pa,
                             struct list_node* list) {
     LTRACEF("count %zu, align %u\n", count, alignment_log2);
 
+    size_t allocated = pmm_alloc_contiguous_locked(count, alloc_flags, alignment_log2, pa, list);
+    if (allocated == 0 && count > 0 && page_cache_drain_for_contiguous() > 0) {
+        /* cached pages may have been breaking up the run, try again without them */
+        allocated = pmm_alloc_contiguous_locked(count, alloc_flags, alignment_log2, pa, list);
+    }
+    return allocated;
+}
+
+static size_t pmm_alloc_contiguous_locked(size_t count, uint alloc_flags, uint8_t alignment_log2,
+                                          paddr_t* pa, struct list_node* list) {
     if (count == 0)
         return 0;
     if (alignment_log2 < PAGE_SIZE_SHIFT)
@@ -288,13 +604,8 @@ size_t pmm_free_kpages(void* _ptr, size_t count) {
     return pmm_free(&list);
 }
 
-size_t pmm_free(struct list_node* list) {
-    LTRACEF("list %p\n", list);
-
-    DEBUG_ASSERT(list);
-
-    AutoLock al(&arena_lock);
-
+// Return a list of pages to the arenas they came from.
+static size_t pmm_free_to_arenas(struct list_node* list) TA_REQ(arena_lock) {
     uint count = 0;
     while (!list_is_empty(list)) {
         vm_page_t* page = list_remove_head_type(list, vm_page_t, free.node);
@@ -310,7 +621,28 @@ size_t pmm_free(struct list_node* list) {
         }
     }
 
-    LTRACEF("returning count %u\n", count);
+    return count;
+}
+
+size_t pmm_free(struct list_node* list) {
+    LTRACEF("list %p\n", list);
+
+    DEBUG_ASSERT(list);
+
+    /* stash what we can in the local cache, the rest goes back to the arenas */
+    list_node overflow = LIST_INITIAL_VALUE(overflow);
+    size_t count = page_cache_free(list, &overflow);
+    if (list_is_empty(list) && list_is_empty(&overflow))
+        return count;
+
+    AutoLock al(&arena_lock);
+
+    count += pmm_free_to_arenas(list);
+
+    /* pages pushed out of the cache were already counted when they were freed */
+    pmm_free_to_arenas(&overflow);
+
+    LTRACEF("returning count %zu\n", count);
 
     return count;
 }
@@ -334,11 +666,11 @@ static size_t pmm_count_free_pages_locked() TA_REQ(arena_lock) {
 
 size_t pmm_count_free_pages() {
     AutoLock al(&arena_lock);
-    return pmm_count_free_pages_locked();
+    return pmm_count_free_pages_locked() + page_cache_count_free_pages();
 }
 
 static void pmm_dump_free() TA_REQ(arena_lock) {
-    auto megabytes_free = pmm_count_free_pages_locked() / 256u;
+    auto megabytes_free = (pmm_count_free_pages_locked() + page_cache_count_free_pages()) / 256u;
     printf(" %zu free MBs\n", megabytes_free);
 }
 
@@ -369,6 +701,24 @@ static void arena_dump(bool is_panic) TA_NO_THREAD_SAFETY_ANALYSIS {
     }
 }
 
+// No lock analysis here either, the counters are only read for display.
+static void page_cache_dump() TA_NO_THREAD_SAFETY_ANALYSIS {
+    printf("page cache: %s, batch %d, max %d\n", page_cache_enabled ? "enabled" : "disabled",
+           PMM_PAGE_CACHE_BATCH, PMM_PAGE_CACHE_MAX);
+    for (uint i = 0; i < SMP_MAX_CPUS; i++) {
+        if (!mp_is_cpu_online(i))
+            continue;
+
+        const pmm_page_cache& cache = page_cache[i];
+        uint64_t allocs = cache.hits + cache.misses;
+        uint64_t hit_percent = allocs ? cache.hits * 100 / allocs : 0;
+        printf("\tcpu %u: %zu pages, hits %" PRIu64 " misses %" PRIu64 " (%" PRIu64 "%% hit)"
+               " refills %" PRIu64 " frees %" PRIu64 " drains %" PRIu64 "\n",
+               i, cache.count, cache.hits, cache.misses, hit_percent, cache.refills,
+               cache.frees, cache.drains);
+    }
+}
+
 static int cmd_pmm(int argc, const cmd_args* argv, uint32_t flags) {
     bool is_panic = flags & CMD_FLAG_PANIC;
 
@@ -386,6 +736,8 @@ static int cmd_pmm(int argc, const cmd_args* argv, uint32_t flags) {
             printf("%s dump_alloced\n", argv[0].str);
             printf("%s free_alloced\n", argv[0].str);
             printf("%s free\n", argv[0].str);
+            printf("%s cache\n", argv[0].str);
+            printf("%s drain_cache\n", argv[0].str);
         }
         return ERR_INTERNAL;
     }
@@ -398,6 +750,11 @@ static int cmd_pmm(int argc, const cmd_args* argv, uint32_t flags) {
         // No other operations will work during a panic.
         printf("Only the \"arenas\" command is available during a panic.\n");
         goto usage;
+    } else if (!strcmp(argv[1].str, "cache")) {
+        page_cache_dump();
+    } else if (!strcmp(argv[1].str, "drain_cache")) {
+        size_t count = page_cache_drain_all();
+        printf("returned %zu cached pages to the arenas\n", count);
     } else if (!strcmp(argv[1].str, "free")) {
         static bool show_mem = false;
         static timer_t timer;
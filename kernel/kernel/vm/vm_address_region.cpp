@@ -224,6 +224,15 @@ status_t VmAddressRegion::CreateVmMapping(size_t mapping_offset, size_t size, ui
         return ERR_INVALID_ARGS;
     }
 
+    // Line large page objects up with large page boundaries so their runs can be
+    // mapped with large pages, unless the caller picked the address.
+    if (vmo->large_pages() && size >= VmObject::kLargePageSize &&
+        IS_ALIGNED(vmo_offset, VmObject::kLargePageSize) &&
+        !(vmar_flags & (VMAR_FLAG_SPECIFIC | VMAR_FLAG_SPECIFIC_OVERWRITE)) &&
+        align_pow2 < VmObject::kLargePageShift) {
+        align_pow2 = VmObject::kLargePageShift;
+    }
+
     // If we're mapping it with a specific permission, we should allow
     // future Protect() calls on the mapping to keep that permission.
     if (arch_mmu_flags & ARCH_MMU_FLAG_PERM_READ) {
@@ -395,6 +395,30 @@ status_t VmMapping::MapRange(size_t offset, size_t len, bool commit) {
     currently_faulting_ = true;
     auto ac = mxtl::MakeAutoCall([&]() { currently_faulting_ = false; });
 
+    // pages are accumulated into physically contiguous runs and each run is mapped with
+    // one call, which lets the arch layer use large pages where the run is aligned
+    vaddr_t run_va = 0;
+    paddr_t run_pa = 0;
+    size_t run_count = 0;
+    auto map_run = [&]() {
+        if (run_count == 0)
+            return;
+
+        LTRACEF_LEVEL(2, "mapping %zu pages pa %#" PRIxPTR " to va %#" PRIxPTR "\n",
+                      run_count, run_pa, run_va);
+
+        size_t mapped;
+        auto ret = arch_mmu_map(&aspace_->arch_aspace(), run_va, run_pa, run_count,
+                                arch_mmu_flags_, &mapped);
+        if (ret < 0) {
+            TRACEF("error %d mapping %zu pages at va %#" PRIxPTR " pa %#" PRIxPTR "\n",
+                   ret, run_count, run_va, run_pa);
+        }
+
+        DEBUG_ASSERT(mapped == run_count);
+        run_count = 0;
+    };
+
     // iterate through the range, grabbing a page from the underlying object and
     // mapping it in
     size_t o;
@@ -406,6 +430,7 @@ status_t VmMapping::MapRange(size_t offset, size_t len, bool commit) {
         status = object_->GetPageLocked(vmo_offset, pf_flags, nullptr, &pa);
         if (status < 0) {
             // no page to map
+            map_run();
             if (commit) {
                 // fail when we can't commit every requested page
                 return status;
@@ -416,16 +441,17 @@ status_t VmMapping::MapRange(size_t offset, size_t len, bool commit) {
         }
 
         vaddr_t va = base_ + o;
-        LTRACEF_LEVEL(2, "mapping pa %#" PRIxPTR " to va %#" PRIxPTR "\n", pa, va);
-
-        size_t mapped;
-        auto ret = arch_mmu_map(&aspace_->arch_aspace(), va, pa, 1, arch_mmu_flags_, &mapped);
-        if (ret < 0) {
-            TRACEF("error %d mapping page at va %#" PRIxPTR " pa %#" PRIxPTR "\n", ret, va, pa);
+        if (run_count > 0 && va == run_va + run_count * PAGE_SIZE &&
+            pa == run_pa + run_count * PAGE_SIZE) {
+            run_count++;
+        } else {
+            map_run();
+            run_va = va;
+            run_pa = pa;
+            run_count = 1;
         }
-
-        DEBUG_ASSERT(mapped == 1);
     }
+    map_run();
 
     return NO_ERROR;
 }
@@ -448,6 +474,46 @@ status_t VmMapping::DecommitRange(size_t offset, size_t len,
     return object_->DecommitRange(object_offset_ + offset, len, decommitted);
 }
 
+status_t VmMapping::TakePages(size_t offset, size_t count, vm_page_t** pages) {
+    canary_.Assert();
+    LTRACEF("%p '%s' [%#zx+%#zx], offset %#zx, count %zu\n",
+            this, name_, base_, size_, offset, count);
+
+    AutoLock guard(aspace_->lock());
+    if (state_ != LifeCycleState::ALIVE) {
+        return ERR_BAD_STATE;
+    }
+    if (count > size_ / PAGE_SIZE || offset > size_ - count * PAGE_SIZE) {
+        return ERR_OUT_OF_RANGE;
+    }
+    if (!(arch_mmu_flags_ & ARCH_MMU_FLAG_PERM_WRITE)) {
+        return ERR_ACCESS_DENIED;
+    }
+    // VmObject::TakePages will call back into our instance's
+    // VmMapping::UnmapVmoRangeLocked.
+    return object_->TakePages(object_offset_ + offset, count, pages);
+}
+
+status_t VmMapping::SupplyPages(size_t offset, size_t count, vm_page_t** pages) {
+    canary_.Assert();
+    LTRACEF("%p '%s' [%#zx+%#zx], offset %#zx, count %zu\n",
+            this, name_, base_, size_, offset, count);
+
+    AutoLock guard(aspace_->lock());
+    if (state_ != LifeCycleState::ALIVE) {
+        return ERR_BAD_STATE;
+    }
+    if (count > size_ / PAGE_SIZE || offset > size_ - count * PAGE_SIZE) {
+        return ERR_OUT_OF_RANGE;
+    }
+    if (!(arch_mmu_flags_ & ARCH_MMU_FLAG_PERM_WRITE)) {
+        return ERR_ACCESS_DENIED;
+    }
+    // VmObject::SupplyPages will call back into our instance's
+    // VmMapping::UnmapVmoRangeLocked.
+    return object_->SupplyPages(object_offset_ + offset, count, pages);
+}
+
 status_t VmMapping::DestroyLocked() {
     canary_.Assert();
     DEBUG_ASSERT(is_mutex_held(aspace_->lock()));
@@ -504,6 +570,8 @@ status_t VmMapping::PageFault(vaddr_t va, const uint pf_flags) {
 
     DEBUG_ASSERT(va >= base_ && va <= base_ + size_ - 1);
 
+    page_faults_++;
+
     va = ROUNDDOWN(va, PAGE_SIZE);
     uint64_t vmo_offset = va - base_ + object_offset_;
 
@@ -536,8 +604,10 @@ status_t VmMapping::PageFault(vaddr_t va, const uint pf_flags) {
     // The specific path we're avoiding is if the VMO calls back into us during vmo->GetPageLocked()
     // via UnmapVmoRangeLocked(). Since we're responsible for that page, signal to ourself to skip
     // the unmap operation.
+    // Large page objects commit a whole run on a fault, replacing zero pages we may have
+    // mapped around the faulting one, so they need the unmap to reach us as well.
     DEBUG_ASSERT(!currently_faulting_);
-    currently_faulting_ = true;
+    currently_faulting_ = !object_->large_pages();
     auto ac = mxtl::MakeAutoCall([&]() { currently_faulting_ = false; });
 
     // fault in or grab an existing page
@@ -550,6 +620,10 @@ status_t VmMapping::PageFault(vaddr_t va, const uint pf_flags) {
         return status;
     }
 
+    // try to map the whole large page run around the fault in one go
+    if (object_->large_pages() && FaultLargePageLocked(va) == NO_ERROR)
+        return NO_ERROR;
+
     // if we read faulted, make sure we map or modify the page without any write permissions
     // this ensures we will fault again if a write is attempted so we can potentially
     // replace this page with a copy or a new one
@@ -624,6 +698,10 @@ status_t VmMapping::PageFault(vaddr_t va, const uint pf_flags) {
             return ERR_NO_MEMORY;
         }
         DEBUG_ASSERT(mapped == 1);
+
+        // while we hold the locks, map the neighbours the object already has so a
+        // sequential scan doesn't take a fault on every page
+        FaultAroundLocked(va, mmu_flags);
     }
 
 // TODO: figure out what to do with this
@@ -634,6 +712,157 @@ status_t VmMapping::PageFault(vaddr_t va, const uint pf_flags) {
     return NO_ERROR;
 }
 
+status_t VmMapping::FaultLargePageLocked(vaddr_t va) TA_NO_THREAD_SAFETY_ANALYSIS {
+    canary_.Assert();
+    DEBUG_ASSERT(is_mutex_held(aspace_->lock()));
+    DEBUG_ASSERT(object_->lock()->IsHeld());
+
+    const size_t large_size = VmObject::kLargePageSize;
+    const vaddr_t large_va = ROUNDDOWN(va, large_size);
+
+    // the run has to fit inside this mapping, and the mapping has to put object runs at
+    // large page aligned virtual addresses
+    if (size_ < large_size || large_va < base_ || large_va - base_ > size_ - large_size)
+        return ERR_NOT_FOUND;
+    const uint64_t large_offset = large_va - base_ + object_offset_;
+    if (!IS_ALIGNED(large_offset, large_size))
+        return ERR_NOT_FOUND;
+
+    paddr_t pa;
+    status_t status = object_->GetLargePageLocked(large_offset, &pa);
+    if (status != NO_ERROR)
+        return status;
+
+    LTRACEF("mapping large page pa %#" PRIxPTR " to va %#" PRIxPTR "\n", pa, large_va);
+
+    // clear out any small pages already mapped in the range, then map the run. the pages
+    // belong to the object itself, so there is no copy-on-write to preserve and the
+    // mapping's full permissions can be used.
+    const size_t count = large_size / PAGE_SIZE;
+    status = arch_mmu_unmap(&aspace_->arch_aspace(), large_va, count, nullptr);
+    if (status < 0) {
+        TRACEF("failed to clear range for large page\n");
+        return status;
+    }
+
+    size_t mapped;
+    status = arch_mmu_map(&aspace_->arch_aspace(), large_va, pa, count, arch_mmu_flags_, &mapped);
+    if (status < 0) {
+        TRACEF("failed to map large page\n");
+        return status;
+    }
+    DEBUG_ASSERT(mapped == count);
+
+#if ARCH_ARM64
+    if (arch_mmu_flags_ & ARCH_MMU_FLAG_PERM_EXECUTE)
+        arch_sync_cache_range(large_va, large_size);
+#endif
+    return NO_ERROR;
+}
+
+void VmMapping::FaultAroundLocked(vaddr_t va, uint mmu_flags) TA_NO_THREAD_SAFETY_ANALYSIS {
+    canary_.Assert();
+    DEBUG_ASSERT(is_mutex_held(aspace_->lock()));
+    DEBUG_ASSERT(object_->lock()->IsHeld());
+
+    uint32_t window = fault_around_pages_;
+    if (window == kFaultAroundFromVmo)
+        window = object_->fault_around_pages_locked();
+    window = MIN(window, kMaxFaultAroundPages);
+    if (window <= 1)
+        return;
+
+    // pick the naturally aligned window of the object containing the fault,
+    // trimmed to the part of the object this mapping covers
+    const uint64_t window_size = (uint64_t)window * PAGE_SIZE;
+    const uint64_t fault_offset = va - base_ + object_offset_;
+    uint64_t start = fault_offset - (fault_offset % window_size);
+    uint64_t end = start + window_size;
+    start = MAX(start, object_offset_);
+    end = MIN(end, object_offset_ + size_);
+
+    // look the window up a page list node's worth at a time, which keeps the
+    // page array small on the fault path's stack. runs don't span batches.
+    vm_page_t* pages[VmPageListNode::kPageFanOut];
+    for (uint64_t batch = start; batch < end; batch += countof(pages) * PAGE_SIZE) {
+        const size_t count = (size_t)MIN((end - batch) / PAGE_SIZE, countof(pages));
+        if (object_->GetResidentPagesLocked(batch, count, pages) == 0)
+            continue;
+        if (!FaultAroundBatchLocked(va, base_ + (vaddr_t)(batch - object_offset_), pages, count,
+                                    mmu_flags)) {
+            return;
+        }
+    }
+}
+
+// Maps the unmapped pages of |pages|, which back |count| pages starting at
+// |start_va|, skipping the faulting address |va|. Returns false if mapping
+// failed and fault-around should give up.
+bool VmMapping::FaultAroundBatchLocked(vaddr_t va, vaddr_t start_va, vm_page_t* const* pages,
+                                       size_t count, uint mmu_flags) TA_NO_THREAD_SAFETY_ANALYSIS {
+    // map runs of physically contiguous, currently unmapped pages with one call each
+    size_t i = 0;
+    while (i < count) {
+        vaddr_t run_va = start_va + i * PAGE_SIZE;
+        if (!pages[i] || run_va == va ||
+            arch_mmu_query(&aspace_->arch_aspace(), run_va, nullptr, nullptr) >= 0) {
+            i++;
+            continue;
+        }
+
+        paddr_t run_pa = vm_page_to_paddr(pages[i]);
+        size_t run = 1;
+        while (i + run < count) {
+            vaddr_t next_va = run_va + run * PAGE_SIZE;
+            if (!pages[i + run] || next_va == va ||
+                vm_page_to_paddr(pages[i + run]) != run_pa + run * PAGE_SIZE ||
+                arch_mmu_query(&aspace_->arch_aspace(), next_va, nullptr, nullptr) >= 0) {
+                break;
+            }
+            run++;
+        }
+
+        LTRACEF_LEVEL(2, "fault-around mapping %zu pages pa %#" PRIxPTR " at va %#" PRIxPTR "\n",
+                      run, run_pa, run_va);
+
+        size_t mapped;
+        status_t status = arch_mmu_map(&aspace_->arch_aspace(), run_va, run_pa, run, mmu_flags,
+                                       &mapped);
+        if (status < 0) {
+            // fault-around is only an optimization, the pages will fault normally
+            LTRACEF("failed to map %zu pages at va %#" PRIxPTR ": %d\n", run, run_va, status);
+            return false;
+        }
+        DEBUG_ASSERT(mapped == run);
+        fault_around_pages_mapped_ += run;
+
+#if ARCH_ARM64
+        if (arch_mmu_flags_ & ARCH_MMU_FLAG_PERM_EXECUTE)
+            arch_sync_cache_range(run_va, run * PAGE_SIZE);
+#endif
+        i += run;
+    }
+    return true;
+}
+
+void VmMapping::set_fault_around_pages(uint32_t pages) {
+    canary_.Assert();
+    AutoLock guard(aspace_->lock());
+    fault_around_pages_ = pages;
+}
+
+uint64_t VmMapping::page_faults() const {
+    canary_.Assert();
+    AutoLock guard(aspace_->lock());
+    return page_faults_;
+}
+
+uint64_t VmMapping::fault_around_pages_mapped() const {
+    canary_.Assert();
+    AutoLock guard(aspace_->lock());
+    return fault_around_pages_mapped_;
+}
+
 // We disable thread safety analysis here because one of the common uses of this
 // function is for splitting one mapping object into several that will be backed
 // by the same VmObject.  In that case, object_->lock() gets aliased across all
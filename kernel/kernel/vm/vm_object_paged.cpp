@@ -174,6 +174,25 @@ status_t VmObjectPaged::AddPageLocked(vm_page_t* p, uint64_t offset) {
     return NO_ERROR;
 }
 
+mxtl::RefPtr<VmObject> VmObjectPaged::CreateLargePages(uint32_t pmm_alloc_flags, uint64_t size) {
+    // there's a max size to keep indexes within range
+    if (size > MAX_SIZE)
+        return nullptr;
+
+    AllocChecker ac;
+    auto vmo = mxtl::AdoptRef<VmObjectPaged>(new (&ac) VmObjectPaged(pmm_alloc_flags, nullptr));
+    if (!ac.check())
+        return nullptr;
+
+    vmo->large_pages_ = true;
+
+    auto err = vmo->Resize(size);
+    if (err != NO_ERROR)
+        return nullptr;
+
+    return vmo;
+}
+
 mxtl::RefPtr<VmObject> VmObjectPaged::CreateFromROData(const void* data, size_t size) {
     auto vmo = Create(PMM_ALLOC_FLAG_ANY, size);
     if (vmo && size > 0) {
@@ -223,6 +242,114 @@ mxtl::RefPtr<VmObject> VmObjectPaged::CreateFromROData(const void* data, size_t
     return vmo;
 }
 
+status_t VmObjectPaged::AllocLargePageLocked(uint64_t offset) {
+    DEBUG_ASSERT(lock_.IsHeld());
+    DEBUG_ASSERT(large_pages_);
+    DEBUG_ASSERT(IS_ALIGNED(offset, kLargePageSize));
+
+    if (offset >= size_ || size_ - offset < kLargePageSize)
+        return ERR_OUT_OF_RANGE;
+
+    // only whole runs are useful, don't try to fill in around existing pages
+    bool empty = true;
+    page_list_.ForEveryPageInRange([&empty](vm_page_t*, uint64_t) { empty = false; },
+                                   offset, offset + kLargePageSize);
+    if (!empty)
+        return ERR_ALREADY_EXISTS;
+
+    const size_t count = kLargePageSize / PAGE_SIZE;
+    list_node page_list;
+    list_initialize(&page_list);
+
+    size_t allocated = pmm_alloc_contiguous(count, pmm_alloc_flags_, kLargePageShift, nullptr,
+                                            &page_list);
+    if (allocated < count) {
+        LTRACEF("failed to allocate a large page at offset %#" PRIx64 "\n", offset);
+        pmm_free(&page_list);
+        return ERR_NO_MEMORY;
+    }
+
+    for (uint64_t o = offset; o < offset + kLargePageSize; o += PAGE_SIZE) {
+        vm_page_t* p = list_remove_head_type(&page_list, vm_page_t, free.node);
+        ASSERT(p);
+
+        p->state = VM_PAGE_STATE_OBJECT;
+
+        // TODO: remove once pmm returns zeroed pages
+        ZeroPage(p);
+
+        status_t status = page_list_.AddPage(p, o);
+        DEBUG_ASSERT(status == NO_ERROR);
+    }
+
+    // mappings may have the zero page mapped anywhere in the run
+    RangeChangeUpdateLocked(offset, kLargePageSize);
+
+    LTRACEF("committed large page at offset %#" PRIx64 "\n", offset);
+
+    return NO_ERROR;
+}
+
+uint64_t VmObjectPaged::CommitLargePagesLocked(uint64_t start, uint64_t end) {
+    DEBUG_ASSERT(lock_.IsHeld());
+
+    uint64_t committed = 0;
+    for (uint64_t o = ROUNDUP(start, kLargePageSize); o < end && end - o >= kLargePageSize;
+         o += kLargePageSize) {
+        // anything we can't get as a large page falls back to the normal path
+        if (AllocLargePageLocked(o) == NO_ERROR)
+            committed += kLargePageSize;
+    }
+    return committed;
+}
+
+status_t VmObjectPaged::GetLargePageLocked(uint64_t offset, paddr_t* pa) {
+    canary_.Assert();
+    DEBUG_ASSERT(lock_.IsHeld());
+    DEBUG_ASSERT(IS_ALIGNED(offset, kLargePageSize));
+
+    if (!large_pages_ || offset >= size_ || size_ - offset < kLargePageSize)
+        return ERR_NOT_FOUND;
+
+    // decommitting part of a run leaves a hole, so check every page is present and
+    // where it should be
+    paddr_t base = 0;
+    size_t count = 0;
+    bool contiguous = true;
+    page_list_.ForEveryPageInRange([&](vm_page_t* p, uint64_t o) {
+        paddr_t page_pa = vm_page_to_paddr(p);
+        if (o == offset)
+            base = page_pa;
+        else if (page_pa != base + (o - offset))
+            contiguous = false;
+        count++;
+    }, offset, offset + kLargePageSize);
+
+    if (!contiguous || count != kLargePageSize / PAGE_SIZE || !IS_ALIGNED(base, kLargePageSize))
+        return ERR_NOT_FOUND;
+
+    *pa = base;
+    return NO_ERROR;
+}
+
+size_t VmObjectPaged::GetResidentPagesLocked(uint64_t offset, size_t count, vm_page_t** pages) {
+    canary_.Assert();
+    DEBUG_ASSERT(lock_.IsHeld());
+    DEBUG_ASSERT(IS_PAGE_ALIGNED(offset));
+
+    // trim the request to the size of the object
+    size_t valid = 0;
+    if (offset < size_)
+        valid = (size_t)MIN((uint64_t)count, (size_ - offset) / PAGE_SIZE);
+    for (size_t i = valid; i < count; i++)
+        pages[i] = nullptr;
+
+    if (valid == 0)
+        return 0;
+
+    return page_list_.GetPages(offset, valid, pages);
+}
+
 status_t VmObjectPaged::GetPageLocked(uint64_t offset, uint pf_flags, vm_page_t** const page_out, paddr_t* const pa_out) {
     canary_.Assert();
     DEBUG_ASSERT(lock_.IsHeld());
@@ -307,6 +434,19 @@ status_t VmObjectPaged::GetPageLocked(uint64_t offset, uint pf_flags, vm_page_t*
     if ((pf_flags & VMM_PF_FLAG_FAULT_MASK) == 0)
         return ERR_NOT_FOUND;
 
+    // large page objects commit the whole run around the offset, even for read faults,
+    // so that it can be mapped with a single large page
+    if (large_pages_ && AllocLargePageLocked(ROUNDDOWN(offset, kLargePageSize)) == NO_ERROR) {
+        p = page_list_.GetPage(offset);
+        DEBUG_ASSERT(p);
+
+        if (page_out)
+            *page_out = p;
+        if (pa_out)
+            *pa_out = vm_page_to_paddr(p);
+        return NO_ERROR;
+    }
+
     // if we're read faulting, we don't already have a page, and the parent doesn't have it,
     // return the single global zero page
     if ((pf_flags & VMM_PF_FLAG_WRITE) == 0) {
@@ -366,6 +506,13 @@ status_t VmObjectPaged::CommitRange(uint64_t offset, uint64_t len, uint64_t* com
     uint64_t end = ROUNDUP_PAGE_SIZE(offset + new_len);
     DEBUG_ASSERT(end > offset);
 
+    // grab whole large page runs first, the rest is filled in with single pages
+    uint64_t large_committed = 0;
+    if (large_pages_)
+        large_committed = CommitLargePagesLocked(offset, end);
+    if (committed)
+        *committed = large_committed;
+
     // make a pass through the list, counting the number of pages we need to allocate
     size_t count = 0;
     for (uint64_t o = offset; o < end; o += PAGE_SIZE) {
@@ -413,7 +560,7 @@ status_t VmObjectPaged::CommitRange(uint64_t offset, uint64_t len, uint64_t* com
     DEBUG_ASSERT(list_is_empty(&page_list));
 
     // for now we only support committing as much as we were asked for
-    DEBUG_ASSERT(!committed || *committed == count * PAGE_SIZE);
+    DEBUG_ASSERT(!committed || *committed == large_committed + count * PAGE_SIZE);
 
     return NO_ERROR;
 }
@@ -520,15 +667,112 @@ status_t VmObjectPaged::DecommitRange(uint64_t offset, uint64_t len, uint64_t* d
     // unmap all of the pages in this range on all the mapping regions
     RangeChangeUpdateLocked(start, page_aligned_len);
 
-    // iterate through the pages, freeing them
-    while (start < end) {
-        auto status = page_list_.FreePage(start);
-        if (status == NO_ERROR && decommitted) {
-            *decommitted += PAGE_SIZE;
+    // pull the pages out of the object and hand them back to the pmm in one batch
+    list_node freed_list;
+    list_initialize(&freed_list);
+
+    size_t count = page_list_.RemovePages(start, end, &freed_list);
+    __UNUSED size_t freed = pmm_free(&freed_list);
+    DEBUG_ASSERT(freed == count);
+
+    if (decommitted)
+        *decommitted = count * PAGE_SIZE;
+
+    return NO_ERROR;
+}
+
+status_t VmObjectPaged::TakePages(uint64_t offset, size_t count, vm_page_t** pages) {
+    canary_.Assert();
+    LTRACEF("offset %#" PRIx64 ", count %zu\n", offset, count);
+
+    AutoLock a(&lock_);
+
+    // a clone or a parent may be looking at these pages through us
+    if (parent_ || !children_list_.is_empty())
+        return ERR_NOT_SUPPORTED;
+
+    if (!IS_PAGE_ALIGNED(offset) || offset > size_ || count > (size_ - offset) / PAGE_SIZE)
+        return ERR_OUT_OF_RANGE;
+
+    if (count == 0)
+        return NO_ERROR;
+
+    // unmap the range everywhere before the pages change hands
+    RangeChangeUpdateLocked(offset, count * PAGE_SIZE);
+
+    for (size_t i = 0; i < count; i++) {
+        vm_page_t* p = page_list_.RemovePage(offset + i * PAGE_SIZE);
+        if (p)
+            p->state = VM_PAGE_STATE_ALLOC;
+        pages[i] = p;
+    }
+
+    return NO_ERROR;
+}
+
+status_t VmObjectPaged::SupplyPages(uint64_t offset, size_t count, vm_page_t** pages) {
+    canary_.Assert();
+    LTRACEF("offset %#" PRIx64 ", count %zu\n", offset, count);
+
+    list_node freed_list;
+    list_initialize(&freed_list);
+
+    {
+        AutoLock a(&lock_);
+
+        // a clone or a parent may be looking at these pages through us
+        if (parent_ || !children_list_.is_empty())
+            return ERR_NOT_SUPPORTED;
+
+        if (!IS_PAGE_ALIGNED(offset) || offset > size_ || count > (size_ - offset) / PAGE_SIZE)
+            return ERR_OUT_OF_RANGE;
+
+        if (count == 0)
+            return NO_ERROR;
+
+        // fill in the holes first, since that is the only step that can fail. if it
+        // does, take back what we added so the caller gets everything back untouched.
+        for (size_t i = 0; i < count; i++) {
+            uint64_t o = offset + i * PAGE_SIZE;
+            if (!pages[i] || page_list_.GetPage(o))
+                continue;
+            if (page_list_.AddPage(pages[i], o) != NO_ERROR) {
+                while (i-- > 0) {
+                    o = offset + i * PAGE_SIZE;
+                    if (pages[i] && page_list_.GetPage(o) == pages[i])
+                        page_list_.RemovePage(o);
+                }
+                return ERR_NO_MEMORY;
+            }
+        }
+
+        // unmap the old pages everywhere before freeing them
+        RangeChangeUpdateLocked(offset, count * PAGE_SIZE);
+
+        for (size_t i = 0; i < count; i++) {
+            uint64_t o = offset + i * PAGE_SIZE;
+            vm_page_t* p = pages[i];
+            vm_page_t* old;
+            if (!p) {
+                old = page_list_.RemovePage(o);
+            } else {
+                old = page_list_.GetPage(o);
+                if (old == p) {
+                    // filled in above
+                    old = nullptr;
+                } else {
+                    old = page_list_.ReplacePage(p, o);
+                }
+                p->state = VM_PAGE_STATE_OBJECT;
+            }
+            if (old)
+                list_add_tail(&freed_list, &old->free.node);
         }
-        start += PAGE_SIZE;
     }
 
+    // hand the replaced pages back to the pmm in one batch
+    pmm_free(&freed_list);
+
     return NO_ERROR;
 }
 
@@ -111,7 +111,7 @@ vm_page* VmPageList::GetPage(uint64_t offset) {
     return pln->GetPage(index);
 }
 
-status_t VmPageList::FreePage(uint64_t offset) {
+vm_page* VmPageList::RemovePage(uint64_t offset) {
     uint64_t node_offset = ROUNDDOWN(offset, PAGE_SIZE * VmPageListNode::kPageFanOut);
     size_t index = (offset >> PAGE_SIZE_SHIFT) % VmPageListNode::kPageFanOut;
 
@@ -121,10 +121,10 @@ status_t VmPageList::FreePage(uint64_t offset) {
     // lookup the tree node that holds this page
     auto pln = list_.find(node_offset);
     if (!pln.IsValid()) {
-        return ERR_NOT_FOUND;
+        return nullptr;
     }
 
-    // free this page
+    // remove this page
     auto page = pln->RemovePage(index);
     if (page) {
         // if it was the last page in the node, remove the node from the tree
@@ -132,13 +132,104 @@ status_t VmPageList::FreePage(uint64_t offset) {
             LTRACEF_LEVEL(2, "%p freeing the list node\n", this);
             list_.erase(*pln);
         }
+    }
+
+    return page;
+}
+
+vm_page* VmPageList::ReplacePage(vm_page* p, uint64_t offset) {
+    uint64_t node_offset = ROUNDDOWN(offset, PAGE_SIZE * VmPageListNode::kPageFanOut);
+    size_t index = (offset >> PAGE_SIZE_SHIFT) % VmPageListNode::kPageFanOut;
+
+    LTRACEF_LEVEL(2, "%p page %p, offset %#" PRIx64 " node_offset %#" PRIx64 " index %zu\n", this, p,
+                  offset, node_offset, index);
 
+    // the node can't go away here, since we put a page right back into the slot
+    auto pln = list_.find(node_offset);
+    DEBUG_ASSERT(pln.IsValid());
+
+    auto old = pln->RemovePage(index);
+    DEBUG_ASSERT(old);
+    __UNUSED auto status = pln->AddPage(p, index);
+    DEBUG_ASSERT(status == NO_ERROR);
+
+    return old;
+}
+
+status_t VmPageList::FreePage(uint64_t offset) {
+    auto page = RemovePage(offset);
+    if (page) {
         pmm_free_page(page);
     }
 
     return NO_ERROR;
 }
 
+size_t VmPageList::RemovePages(uint64_t start_offset, uint64_t end_offset, list_node* removed_list) {
+    LTRACEF("%p start %#" PRIx64 " end %#" PRIx64 "\n", this, start_offset, end_offset);
+
+    DEBUG_ASSERT(IS_PAGE_ALIGNED(start_offset));
+    DEBUG_ASSERT(IS_PAGE_ALIGNED(end_offset));
+
+    const uint64_t node_size = PAGE_SIZE * VmPageListNode::kPageFanOut;
+    size_t count = 0;
+
+    // visit each tree node overlapping the range once, rather than looking up every page
+    for (uint64_t node_offset = ROUNDDOWN(start_offset, node_size); node_offset < end_offset;
+         node_offset += node_size) {
+        auto pln = list_.find(node_offset);
+        if (!pln.IsValid())
+            continue;
+
+        uint64_t start = MAX(start_offset, node_offset);
+        uint64_t end = MIN(end_offset, node_offset + node_size);
+        for (uint64_t offset = start; offset < end; offset += PAGE_SIZE) {
+            auto page = pln->RemovePage((offset - node_offset) >> PAGE_SIZE_SHIFT);
+            if (page) {
+                list_add_tail(removed_list, &page->free.node);
+                count++;
+            }
+        }
+
+        // if we emptied the node, remove it from the tree
+        if (pln->IsEmpty()) {
+            LTRACEF_LEVEL(2, "%p freeing the list node\n", this);
+            list_.erase(*pln);
+        }
+    }
+
+    return count;
+}
+
+size_t VmPageList::GetPages(uint64_t start_offset, size_t count, vm_page** pages) {
+    LTRACEF_LEVEL(2, "%p start %#" PRIx64 " count %zu\n", this, start_offset, count);
+
+    DEBUG_ASSERT(IS_PAGE_ALIGNED(start_offset));
+
+    const uint64_t node_size = PAGE_SIZE * VmPageListNode::kPageFanOut;
+    const uint64_t end_offset = start_offset + count * PAGE_SIZE;
+    size_t found = 0;
+
+    // visit each tree node overlapping the range once, rather than looking up every page
+    for (uint64_t node_offset = ROUNDDOWN(start_offset, node_size); node_offset < end_offset;
+         node_offset += node_size) {
+        uint64_t start = MAX(start_offset, node_offset);
+        uint64_t end = MIN(end_offset, node_offset + node_size);
+
+        auto pln = list_.find(node_offset);
+        for (uint64_t offset = start; offset < end; offset += PAGE_SIZE) {
+            vm_page* p = nullptr;
+            if (pln.IsValid())
+                p = pln->GetPage((offset - node_offset) >> PAGE_SIZE_SHIFT);
+            pages[(offset - start_offset) >> PAGE_SIZE_SHIFT] = p;
+            if (p)
+                found++;
+        }
+    }
+
+    return found;
+}
+
 size_t VmPageList::FreeAllPages() {
     LTRACEF("%p\n", this);
 
@@ -70,6 +70,32 @@ static bool pmm_oversized_alloc_test(void* context) {
     END_TEST;
 }
 
+// Allocates and frees more single pages than fit in the per cpu page cache,
+// making sure none of them are lost along the way.
+static bool pmm_page_cache_churn_test(void* context) {
+    BEGIN_TEST;
+    list_node list = LIST_INITIAL_VALUE(list);
+
+    static const size_t alloc_count = 512;
+
+    for (size_t i = 0; i < alloc_count; i++) {
+        paddr_t pa;
+        vm_page_t* page = pmm_alloc_page(0, &pa);
+        REQUIRE_NONNULL(page, "pmm_alloc_page");
+        EXPECT_EQ(page, paddr_to_vm_page(pa), "paddr_to_vm_page on cached page");
+        EXPECT_EQ(VM_PAGE_STATE_ALLOC, page->state, "allocated page state");
+        list_add_tail(&list, &page->free.node);
+    }
+
+    size_t freed = 0;
+    vm_page_t* page;
+    while ((page = list_remove_head_type(&list, vm_page_t, free.node))) {
+        freed += pmm_free_page(page);
+    }
+    EXPECT_EQ(alloc_count, freed, "pmm_free_page on every page");
+    END_TEST;
+}
+
 static uint32_t test_rand(uint32_t seed) {
     return (seed = seed * 1664525 + 1013904223);
 }
@@ -335,6 +361,31 @@ static bool vmo_commit_test(void* context) {
     END_TEST;
 }
 
+// Creates a vm object, commits memory and decommits part of it.
+static bool vmo_decommit_test(void* context) {
+    BEGIN_TEST;
+    static const size_t alloc_size = PAGE_SIZE * 40;
+    auto vmo = VmObjectPaged::Create(PMM_ALLOC_FLAG_ANY, alloc_size);
+    REQUIRE_NONNULL(vmo, "vmobject creation\n");
+
+    uint64_t committed;
+    auto ret = vmo->CommitRange(0, alloc_size, &committed);
+    EXPECT_EQ(0, ret, "committing vm object\n");
+
+    // straddle several page list nodes
+    uint64_t decommitted;
+    ret = vmo->DecommitRange(PAGE_SIZE * 3, PAGE_SIZE * 30, &decommitted);
+    EXPECT_EQ(0, ret, "decommitting vm object\n");
+    EXPECT_EQ(PAGE_SIZE * 30, decommitted, "decommitting vm object\n");
+    EXPECT_EQ(10u, vmo->AllocatedPages(), "pages left after decommit\n");
+
+    // decommitting again frees nothing
+    ret = vmo->DecommitRange(PAGE_SIZE * 3, PAGE_SIZE * 30, &decommitted);
+    EXPECT_EQ(0, ret, "decommitting vm object again\n");
+    EXPECT_EQ(0u, decommitted, "decommitting vm object again\n");
+    END_TEST;
+}
+
 // Creates a vm object, commits odd sized memory.
 static bool vmo_odd_size_commit_test(void* context) {
     BEGIN_TEST;
@@ -409,6 +460,91 @@ static bool vmo_demand_paged_map_test(void* context) {
     END_TEST;
 }
 
+// Creates a committed vm object, maps it demand paged and checks that a
+// fault maps in the resident neighbours of the faulting page.
+static bool vmo_fault_around_test(void* context) {
+    BEGIN_TEST;
+    static const size_t alloc_size = PAGE_SIZE * VmPageListNode::kPageFanOut * 2;
+    auto vmo = VmObjectPaged::Create(PMM_ALLOC_FLAG_ANY, alloc_size);
+    REQUIRE_NONNULL(vmo, "vmobject creation\n");
+
+    uint64_t committed;
+    auto ret = vmo->CommitRange(0, alloc_size, &committed);
+    EXPECT_EQ(NO_ERROR, ret, "committing vm object\n");
+
+    auto ka = VmAspace::kernel_aspace();
+    void* ptr;
+    ret = ka->MapObjectInternal(vmo, "test", 0, alloc_size, &ptr,
+                                0, 0, kArchRwFlags);
+    EXPECT_EQ(NO_ERROR, ret, "mapping object");
+
+    auto mapping = ka->FindRegion((vaddr_t)ptr)->as_vm_mapping();
+    REQUIRE_NONNULL(mapping, "finding mapping");
+
+    // one fault maps the whole first page list node
+    volatile uint8_t* buf = static_cast<volatile uint8_t*>(ptr);
+    for (size_t i = 0; i < VmPageListNode::kPageFanOut; i++)
+        (void)buf[i * PAGE_SIZE];
+    EXPECT_EQ(1u, mapping->page_faults(), "faults in first window");
+    EXPECT_EQ(VmPageListNode::kPageFanOut - 1, mapping->fault_around_pages_mapped(),
+              "pages mapped around the fault");
+
+    // with fault-around disabled every page faults
+    mapping->set_fault_around_pages(0);
+    for (size_t i = VmPageListNode::kPageFanOut; i < alloc_size / PAGE_SIZE; i++)
+        (void)buf[i * PAGE_SIZE];
+    EXPECT_EQ(1u + VmPageListNode::kPageFanOut, mapping->page_faults(),
+              "faults with fault-around disabled");
+
+    auto err = ka->FreeRegion((vaddr_t)ptr);
+    EXPECT_EQ(NO_ERROR, err, "unmapping object");
+    END_TEST;
+}
+
+// Creates a large page vm object, maps it demand paged, then decommits a
+// page out of the middle of a large page run.
+static bool vmo_large_page_test(void* context) {
+    BEGIN_TEST;
+    static const size_t alloc_size = VmObject::kLargePageSize * 2;
+    auto vmo = VmObjectPaged::CreateLargePages(PMM_ALLOC_FLAG_ANY, alloc_size);
+    REQUIRE_NONNULL(vmo, "vmobject creation\n");
+    EXPECT_TRUE(vmo->large_pages(), "large page object");
+
+    auto ka = VmAspace::kernel_aspace();
+    void* ptr;
+    auto ret = ka->MapObjectInternal(vmo, "test", 0, alloc_size, &ptr,
+                                     0, 0, kArchRwFlags);
+    EXPECT_EQ(NO_ERROR, ret, "mapping object");
+    EXPECT_TRUE(IS_ALIGNED(ptr, VmObject::kLargePageSize), "mapping is large page aligned");
+
+    // fill each run with its own known pattern and test
+    static const size_t run_size = VmObject::kLargePageSize;
+    uint8_t* buf = static_cast<uint8_t*>(ptr);
+    if (!fill_and_test(buf, run_size))
+        all_ok = false;
+    if (!fill_and_test(buf + run_size, run_size))
+        all_ok = false;
+    EXPECT_EQ(alloc_size / PAGE_SIZE, vmo->AllocatedPages(), "whole object committed");
+
+    // punch a hole in the first run, the rest of the object must be untouched
+    static const size_t hole = PAGE_SIZE * 7;
+    uint64_t decommitted;
+    ret = vmo->DecommitRange(hole, PAGE_SIZE, &decommitted);
+    EXPECT_EQ(NO_ERROR, ret, "decommitting page\n");
+    EXPECT_EQ(PAGE_SIZE, decommitted, "decommitting page\n");
+    EXPECT_EQ(alloc_size / PAGE_SIZE - 1, vmo->AllocatedPages(), "pages after decommit");
+
+    bool result = test_region((uintptr_t)buf, buf, hole);
+    EXPECT_TRUE(result, "testing region before the hole");
+    result = test_region((uintptr_t)(buf + run_size), buf + run_size, run_size);
+    EXPECT_TRUE(result, "testing second run");
+    EXPECT_EQ(0u, *reinterpret_cast<volatile uint32_t*>(buf + hole), "hole reads as zero");
+
+    auto err = ka->FreeRegion((vaddr_t)ptr);
+    EXPECT_EQ(NO_ERROR, err, "unmapping object");
+    END_TEST;
+}
+
 // Creates a vm object, maps it, drops ref before unmapping.
 static bool vmo_dropped_ref_test(void* context) {
     BEGIN_TEST;
@@ -619,6 +755,74 @@ static bool vmo_read_write_smoke_test(void* context) {
     END_TEST;
 }
 
+// Moves pages from one vm object to another and checks the data moved with them.
+static bool vmo_move_pages_test(void* context) {
+    BEGIN_TEST;
+    static const size_t alloc_size = PAGE_SIZE * 16;
+    static const size_t move_pages = 8;
+
+    auto src = VmObjectPaged::Create(PMM_ALLOC_FLAG_ANY, alloc_size);
+    REQUIRE_NONNULL(src, "vmobject creation\n");
+    auto dst = VmObjectPaged::Create(PMM_ALLOC_FLAG_ANY, alloc_size);
+    REQUIRE_NONNULL(dst, "vmobject creation\n");
+
+    AllocChecker ac;
+    mxtl::Array<uint8_t> a(new (&ac) uint8_t[alloc_size], alloc_size);
+    REQUIRE_TRUE(ac.check(), "can't allocate buffer");
+    fill_region(42, a.get(), alloc_size);
+
+    // leave the last moved page uncommitted in the source
+    size_t bytes_written;
+    status_t err = src->Write(a.get(), 0, (move_pages - 1) * PAGE_SIZE, &bytes_written);
+    EXPECT_EQ(NO_ERROR, err, "writing to object");
+
+    // the destination has stale data that should get replaced
+    err = dst->Write(a.get(), 0, alloc_size, &bytes_written);
+    EXPECT_EQ(NO_ERROR, err, "writing to object");
+
+    vm_page_t* pages[move_pages];
+    err = src->TakePages(PAGE_SIZE, move_pages + 16, pages);
+    EXPECT_EQ(ERR_OUT_OF_RANGE, err, "taking past the end\n");
+    err = src->TakePages(17, move_pages, pages);
+    EXPECT_EQ(ERR_OUT_OF_RANGE, err, "taking at an unaligned offset\n");
+
+    err = src->TakePages(0, move_pages, pages);
+    EXPECT_EQ(NO_ERROR, err, "taking pages\n");
+    EXPECT_NULL(pages[move_pages - 1], "uncommitted page\n");
+    EXPECT_EQ(0u, src->AllocatedPages(), "pages left after take\n");
+
+    err = dst->SupplyPages(PAGE_SIZE * 4, move_pages, pages);
+    EXPECT_EQ(NO_ERROR, err, "supplying pages\n");
+    EXPECT_EQ(alloc_size / PAGE_SIZE - 1, dst->AllocatedPages(), "pages after supply\n");
+
+    mxtl::Array<uint8_t> b(new (&ac) uint8_t[alloc_size], alloc_size);
+    REQUIRE_TRUE(ac.check(), "can't allocate buffer");
+    size_t bytes_read;
+    err = dst->Read(b.get(), PAGE_SIZE * 4, move_pages * PAGE_SIZE, &bytes_read);
+    EXPECT_EQ(NO_ERROR, err, "reading from object");
+    int cmpres = memcmp(b.get(), a.get(), (move_pages - 1) * PAGE_SIZE);
+    EXPECT_EQ(0, cmpres, "moved data\n");
+    bool zero = true;
+    for (size_t i = (move_pages - 1) * PAGE_SIZE; i < move_pages * PAGE_SIZE; i++)
+        zero = zero && b[i] == 0;
+    EXPECT_TRUE(zero, "uncommitted page reads as zero\n");
+
+    // the source reads back as zero now
+    err = src->Read(b.get(), 0, PAGE_SIZE, &bytes_read);
+    EXPECT_EQ(NO_ERROR, err, "reading from object");
+    EXPECT_EQ(0, b[0], "taken page reads as zero\n");
+
+    // clones may share pages, so moving pages in or out of them is refused
+    mxtl::RefPtr<VmObject> clone;
+    err = dst->CloneCOW(0, alloc_size, &clone);
+    REQUIRE_EQ(NO_ERROR, err, "cloning object\n");
+    err = dst->TakePages(0, move_pages, pages);
+    EXPECT_EQ(ERR_NOT_SUPPORTED, err, "taking pages from a parent\n");
+    err = clone->TakePages(0, move_pages, pages);
+    EXPECT_EQ(ERR_NOT_SUPPORTED, err, "taking pages from a clone\n");
+    END_TEST;
+}
+
 // Use the function name as the test name
 #define VM_UNITTEST(fname) UNITTEST(#fname, fname)
 
@@ -626,6 +830,7 @@ UNITTEST_START_TESTCASE(vm_tests)
 VM_UNITTEST(pmm_smoke_test)
 VM_UNITTEST(pmm_large_alloc_test)
 VM_UNITTEST(pmm_oversized_alloc_test)
+VM_UNITTEST(pmm_page_cache_churn_test)
 VM_UNITTEST(vmm_alloc_smoke_test)
 VM_UNITTEST(vmm_alloc_contiguous_smoke_test)
 VM_UNITTEST(multiple_regions_test)
@@ -637,13 +842,17 @@ VM_UNITTEST(vmaspace_create_smoke_test)
 VM_UNITTEST(vmaspace_alloc_smoke_test)
 VM_UNITTEST(vmo_create_test)
 VM_UNITTEST(vmo_commit_test)
+VM_UNITTEST(vmo_decommit_test)
 VM_UNITTEST(vmo_odd_size_commit_test)
 VM_UNITTEST(vmo_contiguous_commit_test)
 VM_UNITTEST(vmo_precommitted_map_test)
 VM_UNITTEST(vmo_demand_paged_map_test)
+VM_UNITTEST(vmo_fault_around_test)
+VM_UNITTEST(vmo_large_page_test)
 VM_UNITTEST(vmo_dropped_ref_test)
 VM_UNITTEST(vmo_remap_test)
 VM_UNITTEST(vmo_double_remap_test)
 VM_UNITTEST(vmo_read_write_smoke_test)
+VM_UNITTEST(vmo_move_pages_test)
 VM_UNITTEST(dump_all_aspaces) // Run last
 UNITTEST_END_TESTCASE(vm_tests, "vmtests", "Virtual memory tests", nullptr, nullptr);
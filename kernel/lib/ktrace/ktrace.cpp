@@ -12,6 +12,8 @@
 #include <arch/ops.h>
 #include <arch/user_copy.h>
 #include <kernel/cmdline.h>
+#include <kernel/mp.h>
+#include <kernel/spinlock.h>
 #include <kernel/vm/vm_aspace.h>
 #include <lib/ktrace.h>
 #include <lk/init.h>
@@ -82,45 +84,367 @@ static void ktrace_report_probes(void) {
     mutex_release(&probe_list_lock);
 }
 
-typedef struct ktrace_state {
-    // where the next record will be written
-    int offset;
+// The trace buffer is split into a metadata area, holding the version records
+// and the names of threads, processes, syscalls and probes, and fixed size
+// chunks for events. Each cpu fills a chunk of its own with interrupts
+// disabled, so recording an event touches no shared cache lines; only taking
+// a fresh chunk takes the lock. A chunk given up part full is padded out with
+// TAG_PAD records, so each one parses on its own.
+//
+// Readers see the used part of the metadata area followed by the completed
+// chunks, oldest first. In streaming mode, reads instead drain completed
+// chunks, freeing them for reuse.
+static constexpr uint32_t kChunkSize = 64 * 1024;
+static constexpr uint32_t kMetaSize = 256 * 1024;
+
+enum : uint32_t {
+    KTRACE_CHUNK_FREE,
+    KTRACE_CHUNK_ACTIVE,  // being filled by a cpu
+    KTRACE_CHUNK_DONE,    // full, and readable
+    KTRACE_CHUNK_READING, // being drained by a streaming read
+};
+
+typedef struct ktrace_chunk {
+    // the order the chunk was taken in, for reading back oldest first
+    uint64_t seq;
+    uint32_t state;
+} ktrace_chunk_t;
+
+typedef struct ktrace_cpu {
+    // the chunk being filled, nullptr if none
+    uint8_t* ptr;
+    uint32_t chunk;
+    // where the next record will be written, within the chunk
+    uint32_t offset;
+} __CPU_ALIGN ktrace_cpu_t;
 
+typedef struct ktrace_state {
     // mask of groups we allow, 0 == tracing disabled
     int grpmask;
 
-    // total size of the trace buffer
-    uint32_t bufsize;
-
-    // offset where tracing was stopped, 0 if tracing active
-    uint32_t marker;
+    // KTRACE_START_RING or KTRACE_START_STREAM, or 0 to stop when full
+    uint32_t mode;
 
-    // raw trace buffer
+    // raw trace buffer: the metadata area, then the chunks
     uint8_t* buffer;
+    uint32_t meta_size;
+    uint32_t num_chunks;
+
+    // guards the metadata area
+    spin_lock_t meta_lock;
+    // where the next metadata record will be written
+    uint32_t meta_offset;
+
+    // guards everything below
+    spin_lock_t lock;
+    ktrace_chunk_t* chunks;
+    uint32_t free_chunks;
+    uint64_t next_seq;
+    // the total reported by the last TAG_DROPPED record
+    uint64_t dropped_reported;
+
+    // events lost while the reader was behind, updated atomically since it
+    // is counted without the lock
+    uint64_t dropped;
+
+    // set by a rewind while stopped; the rewind happens at the next start,
+    // so the stopped trace can still be read
+    bool rewind_pending;
+
+    // the completed chunks, oldest first, as of the last snapshot
+    uint32_t* order;
+    uint32_t order_count;
+    uint32_t snapshot_meta;
+
+    // how much of the metadata area streaming reads have returned
+    uint32_t stream_meta;
+
+    ktrace_cpu_t cpu[SMP_MAX_CPUS];
 } ktrace_state_t;
 
 static ktrace_state_t KTRACE_STATE;
 
+static inline uint8_t* ktrace_chunk_ptr(ktrace_state_t* ks, uint32_t chunk) {
+    return ks->buffer + ks->meta_size + (size_t)chunk * kChunkSize;
+}
+
+// Fills |len| bytes with records to be skipped.
+static void ktrace_pad(uint8_t* ptr, uint32_t len) {
+    while (len > 0) {
+        uint32_t n = len < KTRACE_LEN(0xF) ? len : KTRACE_LEN(0xF);
+        ktrace_header_t* hdr = (ktrace_header_t*) ptr;
+        hdr->tag = TAG_PAD(n);
+        hdr->tid = 0;
+        ptr += n;
+        len -= n;
+    }
+}
+
+// Pads out and completes the cpu's chunk, if it has one.
+static void ktrace_retire_locked(ktrace_state_t* ks, ktrace_cpu_t* kc) {
+    if (kc->ptr == nullptr) {
+        return;
+    }
+    ktrace_pad(kc->ptr + kc->offset, kChunkSize - kc->offset);
+    ks->chunks[kc->chunk].state = KTRACE_CHUNK_DONE;
+    kc->ptr = nullptr;
+}
+
+// Gives the current cpu a fresh chunk. Interrupts must be disabled.
+static bool ktrace_next_chunk(ktrace_state_t* ks, ktrace_cpu_t* kc) {
+    if ((ks->mode & KTRACE_START_STREAM) && kc->ptr == nullptr &&
+        atomic_load((int*)&ks->free_chunks) == 0) {
+        // the reader is behind; don't fight over the lock to find that out
+        atomic_add_64((int64_t*)&ks->dropped, 1);
+        return false;
+    }
+
+    spin_lock(&ks->lock);
+    ktrace_retire_locked(ks, kc);
+
+    uint32_t chunk = ks->num_chunks;
+    if (ks->free_chunks > 0) {
+        for (uint32_t i = 0; i < ks->num_chunks; i++) {
+            if (ks->chunks[i].state == KTRACE_CHUNK_FREE) {
+                chunk = i;
+                ks->free_chunks--;
+                break;
+            }
+        }
+    } else if (ks->mode & KTRACE_START_RING) {
+        // overwrite the oldest completed chunk
+        for (uint32_t i = 0; i < ks->num_chunks; i++) {
+            if (ks->chunks[i].state == KTRACE_CHUNK_DONE &&
+                (chunk == ks->num_chunks || ks->chunks[i].seq < ks->chunks[chunk].seq)) {
+                chunk = i;
+            }
+        }
+    }
+
+    if (chunk == ks->num_chunks) {
+        if (ks->mode & KTRACE_START_STREAM) {
+            atomic_add_64((int64_t*)&ks->dropped, 1);
+        } else {
+            // if we arrive at the end, stop
+            atomic_store(&ks->grpmask, 0);
+        }
+        spin_unlock(&ks->lock);
+        return false;
+    }
+
+    ks->chunks[chunk].state = KTRACE_CHUNK_ACTIVE;
+    ks->chunks[chunk].seq = ks->next_seq++;
+    kc->chunk = chunk;
+    kc->ptr = ktrace_chunk_ptr(ks, chunk);
+    kc->offset = 0;
+
+    // let the reader know events went missing before this chunk
+    uint64_t dropped = atomic_load_64((int64_t*)&ks->dropped);
+    if (dropped != ks->dropped_reported) {
+        ktrace_rec_32b_t* rec = (ktrace_rec_32b_t*) kc->ptr;
+        rec->tag = TAG_DROPPED;
+        rec->tid = 0;
+        rec->ts = ktrace_timestamp();
+        rec->a = (uint32_t)dropped;
+        rec->b = (uint32_t)(dropped >> 32);
+        kc->offset = KTRACE_RECSIZE;
+        ks->dropped_reported = dropped;
+    }
+    spin_unlock(&ks->lock);
+    return true;
+}
+
+// Claims |len| bytes of the current cpu's chunk. Interrupts must be disabled
+// until the record is written.
+static void* ktrace_claim(ktrace_state_t* ks, uint32_t len) {
+    ktrace_cpu_t* kc = &ks->cpu[arch_curr_cpu_num()];
+    if (kc->ptr == nullptr || kc->offset + len > kChunkSize) {
+        if (!ktrace_next_chunk(ks, kc)) {
+            return nullptr;
+        }
+    }
+    void* ptr = kc->ptr + kc->offset;
+    kc->offset += len;
+    return ptr;
+}
+
+static void ktrace_retire_cpu(void* arg) {
+    ktrace_state_t* ks = (ktrace_state_t*) arg;
+    spin_lock(&ks->lock);
+    ktrace_retire_locked(ks, &ks->cpu[arch_curr_cpu_num()]);
+    spin_unlock(&ks->lock);
+}
+
+// Completes every cpu's chunk. This runs on each cpu with interrupts
+// disabled, so no record can be half written once it returns.
+static void ktrace_retire_all(ktrace_state_t* ks) {
+    mp_sync_exec(MP_CPU_ALL, ktrace_retire_cpu, ks);
+}
+
+// Records which chunks a (non-streaming) read sees, and in what order.
+static void ktrace_snapshot(ktrace_state_t* ks) {
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&ks->meta_lock, state);
+    ks->snapshot_meta = ks->meta_offset;
+    spin_unlock_irqrestore(&ks->meta_lock, state);
+
+    spin_lock_irqsave(&ks->lock, state);
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < ks->num_chunks; i++) {
+        if (ks->chunks[i].state != KTRACE_CHUNK_DONE) {
+            continue;
+        }
+        // insertion sort by seq; chunks are mostly taken in index order
+        uint32_t j = n++;
+        for (; j > 0 && ks->chunks[ks->order[j - 1]].seq > ks->chunks[i].seq; j--) {
+            ks->order[j] = ks->order[j - 1];
+        }
+        ks->order[j] = i;
+    }
+    ks->order_count = n;
+    spin_unlock_irqrestore(&ks->lock, state);
+}
+
+// Writes the version records and the names of syscalls and probes into an
+// empty trace buffer.
+static void ktrace_write_header(ktrace_state_t* ks) {
+    uint64_t n = ktrace_ticks_per_ms();
+    ktrace_rec_32b_t* rec = (ktrace_rec_32b_t*) ks->buffer;
+    rec[0].tag = TAG_VERSION;
+    rec[0].a = KTRACE_VERSION;
+    rec[1].tag = TAG_TICKS_PER_MS;
+    rec[1].a = (uint32_t)n;
+    rec[1].b = (uint32_t)(n >> 32);
+
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&ks->meta_lock, state);
+    ks->meta_offset = KTRACE_RECSIZE * 2;
+    ks->stream_meta = 0;
+    spin_unlock_irqrestore(&ks->meta_lock, state);
+
+    ktrace_report_syscalls(kt_syscall_info);
+    ktrace_report_probes();
+}
+
+// Throws away everything after the metadata.
+static void ktrace_rewind(ktrace_state_t* ks) {
+    ktrace_retire_all(ks);
+
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&ks->lock, state);
+    // chunks taken since the retire above are left to their cpus
+    for (uint32_t i = 0; i < ks->num_chunks; i++) {
+        if (ks->chunks[i].state == KTRACE_CHUNK_DONE) {
+            ks->chunks[i].state = KTRACE_CHUNK_FREE;
+            ks->free_chunks++;
+        }
+    }
+    ks->order_count = 0;
+    ks->rewind_pending = false;
+    atomic_store_64((int64_t*)&ks->dropped, 0);
+    ks->dropped_reported = 0;
+    spin_unlock_irqrestore(&ks->lock, state);
+
+    ktrace_write_header(ks);
+}
+
+// Drains the unread metadata and then whole completed chunks, oldest first.
+static int ktrace_read_stream(ktrace_state_t* ks, void* ptr, uint32_t len) {
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&ks->meta_lock, state);
+    uint32_t meta_end = ks->meta_offset < ks->meta_size ? ks->meta_offset : ks->meta_size;
+    uint32_t meta_start = ks->stream_meta;
+    spin_unlock_irqrestore(&ks->meta_lock, state);
+
+    if (ptr == nullptr) {
+        spin_lock_irqsave(&ks->lock, state);
+        uint32_t done = 0;
+        for (uint32_t i = 0; i < ks->num_chunks; i++) {
+            if (ks->chunks[i].state == KTRACE_CHUNK_DONE) {
+                done++;
+            }
+        }
+        spin_unlock_irqrestore(&ks->lock, state);
+        return (meta_end - meta_start) + done * kChunkSize;
+    }
+
+    uint32_t actual = 0;
+    if (meta_end > meta_start) {
+        uint32_t n = meta_end - meta_start < len ? meta_end - meta_start : len;
+        if (arch_copy_to_user(ptr, ks->buffer + meta_start, n) != NO_ERROR) {
+            return ERR_INVALID_ARGS;
+        }
+        spin_lock_irqsave(&ks->meta_lock, state);
+        ks->stream_meta = meta_start + n;
+        spin_unlock_irqrestore(&ks->meta_lock, state);
+        actual = n;
+    }
+
+    while (len - actual >= kChunkSize) {
+        spin_lock_irqsave(&ks->lock, state);
+        uint32_t chunk = ks->num_chunks;
+        for (uint32_t i = 0; i < ks->num_chunks; i++) {
+            if (ks->chunks[i].state == KTRACE_CHUNK_DONE &&
+                (chunk == ks->num_chunks || ks->chunks[i].seq < ks->chunks[chunk].seq)) {
+                chunk = i;
+            }
+        }
+        if (chunk != ks->num_chunks) {
+            ks->chunks[chunk].state = KTRACE_CHUNK_READING;
+        }
+        spin_unlock_irqrestore(&ks->lock, state);
+        if (chunk == ks->num_chunks) {
+            break;
+        }
+
+        status_t status = arch_copy_to_user((uint8_t*)ptr + actual, ktrace_chunk_ptr(ks, chunk),
+                                            kChunkSize);
+
+        spin_lock_irqsave(&ks->lock, state);
+        if (status == NO_ERROR) {
+            ks->chunks[chunk].state = KTRACE_CHUNK_FREE;
+            ks->free_chunks++;
+        } else {
+            ks->chunks[chunk].state = KTRACE_CHUNK_DONE;
+        }
+        spin_unlock_irqrestore(&ks->lock, state);
+        if (status != NO_ERROR) {
+            return ERR_INVALID_ARGS;
+        }
+        actual += kChunkSize;
+    }
+
+    if (actual == 0 && len < kChunkSize) {
+        return ERR_BUFFER_TOO_SMALL;
+    }
+    return actual;
+}
+
 int ktrace_read_user(void* ptr, uint32_t off, uint32_t len) {
     ktrace_state_t* ks = &KTRACE_STATE;
+    if (ks->buffer == nullptr) {
+        return ptr == nullptr ? 0 : ERR_BAD_STATE;
+    }
 
-    // Buffer size is limited by the marker if set,
-    // otherwise limited by offset (last written point).
-    // Offset can end up pointing past the end, so clip
-    // it to the actual buffer size to be safe.
-    uint32_t max;
-    if (ks->marker) {
-        max = ks->marker;
-    } else {
-        max = ks->offset;
-        if (max > ks->bufsize) {
-            max = ks->bufsize;
-        }
+    if (ks->mode & KTRACE_START_STREAM) {
+        return ktrace_read_stream(ks, ptr, len);
+    }
+
+    // A null read is a query for the trace size, and takes the snapshot that
+    // following reads see. While tracing, that's the chunks completed so
+    // far; stop tracing first for the whole trace.
+    if (ptr == nullptr) {
+        ktrace_snapshot(ks);
+    }
+
+    uint32_t meta = ks->snapshot_meta < ks->meta_size ? ks->snapshot_meta : ks->meta_size;
+    uint64_t max = meta + (uint64_t)ks->order_count * kChunkSize;
+    if (max > UINT32_MAX) {
+        max = UINT32_MAX;
     }
 
-    // null read is a query for trace buffer size
     if (ptr == nullptr) {
-        return max;
+        return (int)max;
     }
 
     // constrain read to available buffer
@@ -128,39 +452,72 @@ int ktrace_read_user(void* ptr, uint32_t off, uint32_t len) {
         return 0;
     }
     if (len > (max - off)) {
-        len = max - off;
+        len = (uint32_t)(max - off);
     }
 
-    if (arch_copy_to_user(ptr, ks->buffer + off, len) != NO_ERROR) {
-        return ERR_INVALID_ARGS;
+    uint32_t actual = 0;
+    while (actual < len) {
+        const uint8_t* src;
+        uint32_t n;
+        if (off < meta) {
+            src = ks->buffer + off;
+            n = meta - off;
+        } else {
+            uint32_t index = (off - meta) / kChunkSize;
+            uint32_t chunk_off = (off - meta) % kChunkSize;
+            src = ktrace_chunk_ptr(ks, ks->order[index]) + chunk_off;
+            n = kChunkSize - chunk_off;
+        }
+        if (n > len - actual) {
+            n = len - actual;
+        }
+        if (arch_copy_to_user((uint8_t*)ptr + actual, src, n) != NO_ERROR) {
+            return ERR_INVALID_ARGS;
+        }
+        actual += n;
+        off += n;
     }
-    return len;
+    return actual;
 }
 
 status_t ktrace_control(uint32_t action, uint32_t options, void* ptr) {
     ktrace_state_t* ks = &KTRACE_STATE;
     switch (action) {
-    case KTRACE_ACTION_START:
-        options = KTRACE_GRP_TO_MASK(options);
-        ks->marker = 0;
-        atomic_store(&ks->grpmask, options ? options : KTRACE_GRP_TO_MASK(KTRACE_GRP_ALL));
+    case KTRACE_ACTION_START: {
+        if (ks->buffer == nullptr) {
+            return ERR_BAD_STATE;
+        }
+        uint32_t mode = options & (KTRACE_START_RING | KTRACE_START_STREAM);
+        if (mode == (KTRACE_START_RING | KTRACE_START_STREAM)) {
+            return ERR_INVALID_ARGS;
+        }
+        uint32_t grpmask = KTRACE_GRP_TO_MASK(options & KTRACE_GRP_ALL);
+        if (ks->rewind_pending) {
+            ktrace_rewind(ks);
+        }
+        ks->mode = mode;
+        atomic_store(&ks->grpmask, grpmask ? grpmask : KTRACE_GRP_TO_MASK(KTRACE_GRP_ALL));
         ktrace_report_live_threads();
         break;
-    case KTRACE_ACTION_STOP: {
+    }
+    case KTRACE_ACTION_STOP:
         atomic_store(&ks->grpmask, 0);
-        uint32_t n = ks->offset;
-        if (n > ks->bufsize) {
-            ks->marker = ks->bufsize;
-        } else {
-            ks->marker = n;
+        if (ks->buffer != nullptr) {
+            ktrace_retire_all(ks);
+            ktrace_snapshot(ks);
         }
         break;
-    }
     case KTRACE_ACTION_REWIND:
-        // roll back to just after the metadata
-        atomic_store(&ks->offset, KTRACE_RECSIZE * 2);
-        ktrace_report_syscalls(kt_syscall_info);
-        ktrace_report_probes();
+        if (ks->buffer == nullptr) {
+            break;
+        }
+        // roll back to just after the metadata; if stopped, keep what
+        // was traced readable until tracing starts again
+        if (atomic_load(&ks->grpmask)) {
+            ktrace_rewind(ks);
+        } else {
+            ks->rewind_pending = true;
+        }
         break;
     case KTRACE_ACTION_NEW_PROBE: {
         ktrace_probe_info_t* probe;
@@ -193,6 +550,7 @@ void ktrace_init(unsigned level) {
 
     uint32_t mb = cmdline_get_uint32("ktrace.bufsize", KTRACE_DEFAULT_BUFSIZE);
     uint32_t grpmask = cmdline_get_uint32("ktrace.grpmask", KTRACE_DEFAULT_GRPMASK);
+    const char* mode = cmdline_get("ktrace.mode");
 
     if (mb == 0) {
         dprintf(INFO, "ktrace: disabled\n");
@@ -201,19 +559,37 @@ void ktrace_init(unsigned level) {
 
     mb *= (1024*1024);
 
+    spin_lock_init(&ks->meta_lock);
+    spin_lock_init(&ks->lock);
+    ks->meta_size = kMetaSize < mb / 4 ? kMetaSize : mb / 4;
+    ks->num_chunks = (mb - ks->meta_size) / kChunkSize;
+    ks->chunks = (ktrace_chunk_t*) calloc(ks->num_chunks, sizeof(ktrace_chunk_t));
+    ks->order = (uint32_t*) calloc(ks->num_chunks, sizeof(uint32_t));
+    if (ks->chunks == nullptr || ks->order == nullptr) {
+        dprintf(INFO, "ktrace: cannot alloc chunk table\n");
+        free(ks->chunks);
+        free(ks->order);
+        return;
+    }
+    ks->free_chunks = ks->num_chunks;
+
+    if (mode != nullptr && !strcmp(mode, "ring")) {
+        ks->mode = KTRACE_START_RING;
+    } else if (mode != nullptr && !strcmp(mode, "stream")) {
+        ks->mode = KTRACE_START_STREAM;
+    }
+
     status_t status;
     VmAspace* aspace = VmAspace::kernel_aspace();
     if ((status = aspace->Alloc("ktrace", mb, (void**)&ks->buffer, 0, VMM_FLAG_COMMIT,
                                 ARCH_MMU_FLAG_PERM_READ | ARCH_MMU_FLAG_PERM_WRITE)) < 0) {
         dprintf(INFO, "ktrace: cannot alloc buffer %d\n", status);
+        ks->buffer = nullptr;
         return;
     }
 
-    // The last packet written can overhang the end of the buffer,
-    // so we reduce the reported size by the max size of a record
-    ks->bufsize = mb - 256;
-
-    dprintf(INFO, "ktrace: buffer at %p (%u bytes)\n", ks->buffer, mb);
+    dprintf(INFO, "ktrace: buffer at %p (%u bytes, %u chunks)\n", ks->buffer, mb,
+            ks->num_chunks);
 
     // register all static probes
     ktrace_probe_info_t *probe;
@@ -223,19 +599,8 @@ void ktrace_init(unsigned level) {
     }
     mutex_release(&probe_list_lock);
 
-    // write metadata to the first two event slots
-    uint64_t n = ktrace_ticks_per_ms();
-    ktrace_rec_32b_t* rec = (ktrace_rec_32b_t*) ks->buffer;
-    rec[0].tag = TAG_VERSION;
-    rec[0].a = KTRACE_VERSION;
-    rec[1].tag = TAG_TICKS_PER_MS;
-    rec[1].a = (uint32_t)n;
-    rec[1].b = (uint32_t)(n >> 32);
-
-    // enable tracing
-    atomic_store(&ks->offset, KTRACE_RECSIZE * 2);
-    ktrace_report_syscalls(kt_syscall_info);
-    ktrace_report_probes();
+    // write metadata, then enable tracing
+    ktrace_write_header(ks);
     atomic_store(&ks->grpmask, KTRACE_GRP_TO_MASK(grpmask));
 
     // report names of existing threads
@@ -247,60 +612,76 @@ void ktrace_tiny(uint32_t tag, uint32_t arg) {
     ktrace_state_t* ks = &KTRACE_STATE;
     if (tag & atomic_load(&ks->grpmask)) {
         tag = (tag & 0xFFFFFFF0) | 2;
-        int off;
-        if ((off = atomic_add(&ks->offset, KTRACE_HDRSIZE)) >= (int)ks->bufsize) {
-            // if we arrive at the end, stop
-            atomic_store(&ks->grpmask, 0);
-        } else {
-            ktrace_header_t* hdr = (ktrace_header_t*) (ks->buffer + off);
+        spin_lock_saved_state_t state;
+        arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+        ktrace_header_t* hdr = (ktrace_header_t*) ktrace_claim(ks, KTRACE_HDRSIZE);
+        if (hdr != nullptr) {
             hdr->ts = ts;
             hdr->tag = tag;
             hdr->tid = arg;
         }
+        arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
     }
 }
 
-void* ktrace_open(uint32_t tag) {
+bool ktrace_write(uint32_t tag, uint32_t a, uint32_t b, uint32_t c, uint32_t d) {
     uint64_t ts = ktrace_timestamp();
     ktrace_state_t* ks = &KTRACE_STATE;
     if (!(tag & atomic_load(&ks->grpmask))) {
-        return nullptr;
+        return false;
     }
 
-    int off;
-    if ((off = atomic_add(&ks->offset, KTRACE_LEN(tag))) >= (int)ks->bufsize) {
-        // if we arrive at the end, stop
-        atomic_store(&ks->grpmask, 0);
-        return nullptr;
+    uint32_t len = KTRACE_LEN(tag);
+    uint32_t tid = (uint32_t)get_current_thread()->user_tid;
+
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+    ktrace_header_t* hdr = (ktrace_header_t*) ktrace_claim(ks, len);
+    if (hdr != nullptr) {
+        hdr->ts = ts;
+        hdr->tag = tag;
+        hdr->tid = tid;
+        uint32_t* args = (uint32_t*) (hdr + 1);
+        uint32_t nargs = (len - KTRACE_HDRSIZE) / sizeof(uint32_t);
+        if (nargs > 0) args[0] = a;
+        if (nargs > 1) args[1] = b;
+        if (nargs > 2) args[2] = c;
+        if (nargs > 3) args[3] = d;
     }
-
-    ktrace_header_t* hdr = (ktrace_header_t*) (ks->buffer + off);
-    hdr->ts = ts;
-    hdr->tag = tag;
-    hdr->tid = (uint32_t)get_current_thread()->user_tid;
-    return hdr + 1;
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+    return hdr != nullptr;
 }
 
 static void ktrace_name_etc(uint32_t tag, uint32_t id, uint32_t arg, const char* name, bool always) {
     ktrace_state_t* ks = &KTRACE_STATE;
+    if (ks->buffer == nullptr) {
+        return;
+    }
     if ((tag & atomic_load(&ks->grpmask)) || always) {
         uint32_t len = static_cast<uint32_t>(strnlen(name, 31));
 
         // set size to: sizeof(hdr) + len + 1, round up to multiple of 8
         tag = (tag & 0xFFFFFFF0) | ((KTRACE_NAMESIZE + len + 1 + 7) >> 3);
 
-        int off;
-        if ((off = atomic_add(&ks->offset, KTRACE_LEN(tag))) >= (int)ks->bufsize) {
-            // if we arrive at the end, stop
-            atomic_store(&ks->grpmask, 0);
-        } else {
-            ktrace_rec_name_t* rec = (ktrace_rec_name_t*) (ks->buffer + off);
+        // names go in the metadata area while there's room, so they
+        // survive the events around them being overwritten
+        spin_lock_saved_state_t state;
+        spin_lock_irqsave(&ks->meta_lock, state);
+        ktrace_rec_name_t* rec = nullptr;
+        if (ks->meta_offset + KTRACE_LEN(tag) <= ks->meta_size) {
+            rec = (ktrace_rec_name_t*) (ks->buffer + ks->meta_offset);
+            ks->meta_offset += KTRACE_LEN(tag);
+        } else if (tag & atomic_load(&ks->grpmask)) {
+            rec = (ktrace_rec_name_t*) ktrace_claim(ks, KTRACE_LEN(tag));
+        }
+        if (rec != nullptr) {
             rec->tag = tag;
             rec->id = id;
             rec->arg = arg;
             memcpy(rec->name, name, len);
             rec->name[len] = 0;
         }
+        spin_unlock_irqrestore(&ks->meta_lock, state);
     }
 }
 
@@ -168,6 +168,41 @@ status_t ChannelDispatcher::Read(uint32_t* msg_size,
     return rv;
 }
 
+status_t ChannelDispatcher::ReadMany(uint32_t* msg_sizes, uint32_t* msg_handle_counts,
+                                     mxtl::unique_ptr<MessagePacket>* msgs, size_t count,
+                                     size_t* actual, bool may_discard) {
+    canary_.Assert();
+
+    *actual = 0u;
+
+    AutoLock lock(&lock_);
+
+    if (messages_.is_empty())
+        return other_ ? ERR_SHOULD_WAIT : ERR_PEER_CLOSED;
+
+    status_t rv = NO_ERROR;
+    size_t ix = 0u;
+    while (ix < count && !messages_.is_empty()) {
+        auto max_size = msg_sizes[ix];
+        auto max_handle_count = msg_handle_counts[ix];
+        msg_sizes[ix] = messages_.front().data_size();
+        msg_handle_counts[ix] = messages_.front().num_handles();
+        if (msg_sizes[ix] > max_size || msg_handle_counts[ix] > max_handle_count) {
+            if (!may_discard) {
+                rv = ERR_BUFFER_TOO_SMALL;
+                break;
+            }
+        }
+        msgs[ix++] = messages_.pop_front();
+    }
+    *actual = ix;
+
+    if (messages_.is_empty())
+        state_tracker_.UpdateState(MX_CHANNEL_READABLE, 0u);
+
+    return rv;
+}
+
 status_t ChannelDispatcher::Write(mxtl::unique_ptr<MessagePacket> msg) {
     canary_.Assert();
 
@@ -189,6 +224,27 @@ status_t ChannelDispatcher::Write(mxtl::unique_ptr<MessagePacket> msg) {
     return NO_ERROR;
 }
 
+status_t ChannelDispatcher::WriteMany(mxtl::unique_ptr<MessagePacket>* msgs, size_t count) {
+    canary_.Assert();
+
+    mxtl::RefPtr<ChannelDispatcher> other;
+    {
+        AutoLock lock(&lock_);
+        if (!other_) {
+            // As in Write(), leave the handles for the caller to put back.
+            for (size_t ix = 0u; ix < count; ix++)
+                msgs[ix]->set_owns_handles(false);
+            return ERR_PEER_CLOSED;
+        }
+        other = other_;
+    }
+
+    if (other->WriteSelfMany(msgs, count) > 0)
+        thread_preempt(false);
+
+    return NO_ERROR;
+}
+
 status_t ChannelDispatcher::Call(mxtl::unique_ptr<MessagePacket> msg,
                                  mx_time_t deadline, bool* return_handles,
                                  mxtl::unique_ptr<MessagePacket>* reply) {
@@ -268,6 +324,20 @@ int ChannelDispatcher::WriteSelf(mxtl::unique_ptr<MessagePacket> msg) {
     canary_.Assert();
 
     AutoLock lock(&lock_);
+    return WriteSelfLocked(mxtl::move(msg));
+}
+
+int ChannelDispatcher::WriteSelfMany(mxtl::unique_ptr<MessagePacket>* msgs, size_t count) {
+    canary_.Assert();
+
+    AutoLock lock(&lock_);
+    int woken = 0;
+    for (size_t ix = 0u; ix < count; ix++)
+        woken += WriteSelfLocked(mxtl::move(msgs[ix]));
+    return woken;
+}
+
+int ChannelDispatcher::WriteSelfLocked(mxtl::unique_ptr<MessagePacket> msg) {
     auto size = msg->data_size();
 
     if (!waiters_.is_empty()) {
@@ -15,6 +15,7 @@
 
 #include <magenta/job_dispatcher.h>
 #include <magenta/magenta.h>
+#include <magenta/message_packet.h>
 #include <magenta/process_dispatcher.h>
 
 // Machinery to walk over a job tree and run a callback on each process.
@@ -459,6 +460,7 @@ static int cmd_diagnostics(int argc, const cmd_args* argv, uint32_t flags) {
         printf("%s asd  <pid>|kernel : dump process/kernel address space\n",
                argv[0].str);
         printf("%s htinfo            : handle table info\n", argv[0].str);
+        printf("%s mpinfo            : message packet allocator info\n", argv[0].str);
         return -1;
     }
 
@@ -499,6 +501,10 @@ static int cmd_diagnostics(int argc, const cmd_args* argv, uint32_t flags) {
         if (argc != 2)
             goto usage;
         internal::DumpHandleTableInfo();
+    } else if (strcmp(argv[1].str, "mpinfo") == 0) {
+        if (argc != 2)
+            goto usage;
+        MessagePacket::DumpAllocatorStats();
     } else {
         printf("unrecognized subcommand '%s'\n", argv[1].str);
         goto usage;
@@ -4,11 +4,14 @@
 // license that can be found in the LICENSE file or at
 // https://opensource.org/licenses/MIT
 
+#include <arch/user_copy.h>
 #include <assert.h>
 #include <kernel/auto_lock.h>
 #include <lib/user_copy.h>
 #include <lib/user_copy/user_ptr.h>
 #include <magenta/futex_context.h>
+#include <magenta/process_dispatcher.h>
+#include <magenta/thread_dispatcher.h>
 #include <magenta/user_copy.h>
 #include <magenta/user_thread.h>
 #include <trace.h>
@@ -24,7 +27,10 @@ FutexContext::~FutexContext() {
 
     // All of the threads should have removed themselves from wait queues
     // by the time the process has exited.
-    DEBUG_ASSERT(futex_table_.is_empty());
+    for (size_t i = 0; i < kNumBuckets; i++) {
+        AutoLock lock(&buckets_[i].lock);
+        DEBUG_ASSERT(buckets_[i].futex_table.is_empty());
+    }
 }
 
 status_t FutexContext::FutexWait(user_ptr<int> value_ptr, int current_value, mx_time_t deadline) {
@@ -34,6 +40,7 @@ status_t FutexContext::FutexWait(user_ptr<int> value_ptr, int current_value, mx_
     if (futex_key % sizeof(int))
         return ERR_INVALID_ARGS;
 
+    Bucket* bucket = GetBucket(futex_key);
     FutexNode* node;
 
     // FutexWait() checks that the address value_ptr still contains
@@ -42,44 +49,44 @@ status_t FutexContext::FutexWait(user_ptr<int> value_ptr, int current_value, mx_
     // If a FutexWake() operation could occur between them, a userland mutex
     // operation built on top of futexes would have a race condition that
     // could miss wakeups.
-    lock_.Acquire();
+    bucket->lock.Acquire();
 
     int value;
     status_t result = value_ptr.copy_from_user(&value);
     if (result != NO_ERROR) {
-        lock_.Release();
+        bucket->lock.Release();
         return result;
     }
     if (value != current_value) {
-        lock_.Release();
+        bucket->lock.Release();
         return ERR_BAD_STATE;
     }
+    if (IsPiFutexLocked(bucket, futex_key)) {
+        bucket->lock.Release();
+        return ERR_INVALID_ARGS;
+    }
 
     UserThread* thread = UserThread::GetCurrent();
     node = thread->futex_node();
     node->set_hash_key(futex_key);
     node->SetAsSingletonList();
 
-    QueueNodesLocked(node);
+    QueueNodesLocked(bucket, node);
 
-    // Block current thread.  This releases lock_ and does not reacquire it.
-    result = node->BlockThread(&lock_, deadline);
+    // Block current thread.  This releases the bucket lock and does not
+    // reacquire it.
+    result = node->BlockThread(&bucket->lock, deadline);
     if (result == NO_ERROR) {
-        // Fix/workaround for MG-624:
-        // We must re-acquire the lock here to force this thread to wait until
-        // the WakeThreads() marks this thread as not in the queue anymore.
-        // Otherwise, this thread can exit before it does that, causing
-        // WakeThreads() to scribble on memory.
-        AutoLock lock(&lock_);
+        // WakeThreads() marks the node as out of the queue before waking
+        // us, and doesn't touch it afterwards (see MG-624), so there's
+        // nothing left to do.
         DEBUG_ASSERT(!node->IsInQueue());
-        // All the work necessary for removing us from the hash table was done by FutexWake()
         return NO_ERROR;
     }
 
-    AutoLock lock(&lock_);
     // If we hit the deadline, we need to remove the thread's node from the
     // wait queue, since FutexWake() didn't do that.
-    if (UnqueueNodeLocked(node)) {
+    if (UnqueueNode(node)) {
         return ERR_TIMED_OUT;
     }
     // The current thread was not found on the wait queue.  This means
@@ -114,61 +121,50 @@ status_t FutexContext::FutexWake(user_ptr<const int> value_ptr,
     if (futex_key % sizeof(int))
         return ERR_INVALID_ARGS;
 
-    {
-        AutoLock lock(&lock_);
-
-        FutexNode* node = futex_table_.erase(futex_key);
-        if (!node) {
-            // nothing blocked on this futex if we can't find it
-            return NO_ERROR;
-        }
-        DEBUG_ASSERT(node->GetKey() == futex_key);
-
-        FutexNode* wake_head = node;
-        node = FutexNode::RemoveFromHead(node, count, futex_key, 0u);
-        // node is now the new blocked thread list head
-
-        if (node != nullptr) {
-            DEBUG_ASSERT(node->GetKey() == futex_key);
-            futex_table_.insert(node);
-        }
-
-        // Traversing this list of threads must be done while holding the
-        // lock, because any of these threads might wake up from a timeout
-        // and call FutexWait(), which would clobber the "next" pointer in
-        // the thread's FutexNode.
-        FutexNode::WakeThreads(wake_head);
-    }
-
-    return NO_ERROR;
+    Bucket* bucket = GetBucket(futex_key);
+    AutoLock lock(&bucket->lock);
+    return WakeLocked(bucket, futex_key, count);
 }
 
 status_t FutexContext::FutexRequeue(user_ptr<int> wake_ptr, uint32_t wake_count, int current_value,
-                                    user_ptr<int> requeue_ptr, uint32_t requeue_count) {
+                                    user_ptr<int> requeue_ptr, uint32_t requeue_count)
+    TA_NO_THREAD_SAFETY_ANALYSIS {
     LTRACE_ENTRY;
 
     if ((requeue_ptr.get() == nullptr) && requeue_count)
         return ERR_INVALID_ARGS;
 
-    AutoLock lock(&lock_);
-
-    int value;
-    status_t result = wake_ptr.copy_from_user(&value);
-    if (result != NO_ERROR) return result;
-    if (value != current_value) return ERR_BAD_STATE;
-
     uintptr_t wake_key = reinterpret_cast<uintptr_t>(wake_ptr.get());
     uintptr_t requeue_key = reinterpret_cast<uintptr_t>(requeue_ptr.get());
     if (wake_key == requeue_key) return ERR_INVALID_ARGS;
     if (wake_key % sizeof(int) || requeue_key % sizeof(int))
         return ERR_INVALID_ARGS;
 
+    Bucket* wake_bucket = GetBucket(wake_key);
+    Bucket* requeue_bucket = GetBucket(requeue_key);
+    LockBuckets(wake_bucket, requeue_bucket);
+
+    int value;
+    status_t result = wake_ptr.copy_from_user(&value);
+    if (result == NO_ERROR && value != current_value)
+        result = ERR_BAD_STATE;
+    // Threads waiting on a priority inheriting futex are only ever handed
+    // the futex by FutexUnlockPi().
+    if (result == NO_ERROR &&
+        (IsPiFutexLocked(wake_bucket, wake_key) || IsPiFutexLocked(requeue_bucket, requeue_key)))
+        result = ERR_INVALID_ARGS;
+    if (result != NO_ERROR) {
+        UnlockBuckets(wake_bucket, requeue_bucket);
+        return result;
+    }
+
     // This must happen before RemoveFromHead() calls set_hash_key() on
-    // nodes below, because operations on futex_table_ look at the GetKey
+    // nodes below, because operations on futex_table look at the GetKey
     // field of the list head nodes for wake_key and requeue_key.
-    FutexNode* node = futex_table_.erase(wake_key);
+    FutexNode* node = wake_bucket->futex_table.erase(wake_key);
     if (!node) {
         // nothing blocked on this futex if we can't find it
+        UnlockBuckets(wake_bucket, requeue_bucket);
         return NO_ERROR;
     }
 
@@ -177,7 +173,7 @@ status_t FutexContext::FutexRequeue(user_ptr<int> wake_ptr, uint32_t wake_count,
         wake_head = nullptr;
     } else {
         wake_head = node;
-        node = FutexNode::RemoveFromHead(node, wake_count, wake_key, 0u);
+        node = FutexNode::RemoveFromHead(node, wake_count, wake_key, wake_key);
     }
 
     // node is now the head of wake_ptr futex after possibly removing some threads to wake
@@ -190,22 +186,345 @@ status_t FutexContext::FutexRequeue(user_ptr<int> wake_ptr, uint32_t wake_count,
 
             // now requeue our nodes to requeue_ptr mutex
             DEBUG_ASSERT(requeue_head->GetKey() == requeue_key);
-            QueueNodesLocked(requeue_head);
+            QueueNodesLocked(requeue_bucket, requeue_head);
         }
     }
 
     // add any remaining nodes back to wake_key futex
     if (node != nullptr) {
         DEBUG_ASSERT(node->GetKey() == wake_key);
-        futex_table_.insert(node);
+        wake_bucket->futex_table.insert(node);
     }
 
     FutexNode::WakeThreads(wake_head);
+    UnlockBuckets(wake_bucket, requeue_bucket);
     return NO_ERROR;
 }
 
-void FutexContext::QueueNodesLocked(FutexNode* head) {
-    DEBUG_ASSERT(lock_.IsHeld());
+// Returns |value| with the operation of a MX_FUTEX_OP applied.
+static uint32_t FutexOpApply(uint32_t opcode, uint32_t value, uint32_t oparg) {
+    switch (opcode) {
+    case MX_FUTEX_OP_SET: return oparg;
+    case MX_FUTEX_OP_ADD: return value + oparg;
+    case MX_FUTEX_OP_OR: return value | oparg;
+    case MX_FUTEX_OP_ANDN: return value & ~oparg;
+    case MX_FUTEX_OP_XOR: return value ^ oparg;
+    }
+    return value;
+}
+
+// Returns whether |value| passes the comparison of a MX_FUTEX_OP.
+static bool FutexOpCompare(uint32_t cmp, int value, int cmparg) {
+    switch (cmp) {
+    case MX_FUTEX_OP_CMP_EQ: return value == cmparg;
+    case MX_FUTEX_OP_CMP_NE: return value != cmparg;
+    case MX_FUTEX_OP_CMP_LT: return value < cmparg;
+    case MX_FUTEX_OP_CMP_LE: return value <= cmparg;
+    case MX_FUTEX_OP_CMP_GT: return value > cmparg;
+    case MX_FUTEX_OP_CMP_GE: return value >= cmparg;
+    }
+    return false;
+}
+
+status_t FutexContext::FutexWakeOp(user_ptr<const int> wake_ptr, uint32_t wake_count,
+                                   user_ptr<int> op_ptr, uint32_t op_count, uint32_t op)
+    TA_NO_THREAD_SAFETY_ANALYSIS {
+    LTRACE_ENTRY;
+
+    uint32_t opcode = op >> 28;
+    uint32_t cmp = (op >> 24) & 0xfu;
+    uint32_t oparg = (op >> 12) & 0xfffu;
+    int cmparg = static_cast<int>(op & 0xfffu);
+    if (opcode > MX_FUTEX_OP_XOR || cmp > MX_FUTEX_OP_CMP_GE)
+        return ERR_INVALID_ARGS;
+
+    uintptr_t wake_key = reinterpret_cast<uintptr_t>(wake_ptr.get());
+    uintptr_t op_key = reinterpret_cast<uintptr_t>(op_ptr.get());
+    if (wake_key % sizeof(int) || op_key % sizeof(int))
+        return ERR_INVALID_ARGS;
+
+    Bucket* wake_bucket = GetBucket(wake_key);
+    Bucket* op_bucket = GetBucket(op_key);
+    LockBuckets(wake_bucket, op_bucket);
+
+    // Userspace may be changing the value with atomics of its own, so the
+    // update has to be a compare and swap rather than a copy in and out.
+    int old_value;
+    status_t result = op_ptr.copy_from_user(&old_value);
+    while (result == NO_ERROR) {
+        int seen = old_value;
+        int new_value = static_cast<int>(
+            FutexOpApply(opcode, static_cast<uint32_t>(old_value), oparg));
+        result = arch_cmpxchg_user(op_ptr.get(), &seen, new_value);
+        if (seen == old_value)
+            break;
+        old_value = seen;
+    }
+
+    if (result == NO_ERROR && wake_count > 0)
+        result = WakeLocked(wake_bucket, wake_key, wake_count);
+    if (result == NO_ERROR && op_count > 0 && FutexOpCompare(cmp, old_value, cmparg))
+        result = WakeLocked(op_bucket, op_key, op_count);
+
+    UnlockBuckets(wake_bucket, op_bucket);
+    return result;
+}
+
+status_t FutexContext::FutexLockPi(user_ptr<int> value_ptr, int new_value, mx_time_t deadline) {
+    LTRACE_ENTRY;
+
+    uintptr_t futex_key = reinterpret_cast<uintptr_t>(value_ptr.get());
+    if (futex_key % sizeof(int))
+        return ERR_INVALID_ARGS;
+    if (new_value == 0 || (new_value & MX_FUTEX_PI_WAITERS))
+        return ERR_INVALID_ARGS;
+
+    Bucket* bucket = GetBucket(futex_key);
+    bucket->lock.Acquire();
+
+    auto iter = bucket->futex_table.find(futex_key);
+    if (iter.IsValid() && !iter->is_pi()) {
+        bucket->lock.Release();
+        return ERR_INVALID_ARGS;
+    }
+
+    // Claim the futex if it's free, or mark it as having waiters so that
+    // the owner's unlock comes to FutexUnlockPi().
+    int value;
+    status_t result = value_ptr.copy_from_user(&value);
+    while (result == NO_ERROR) {
+        int desired = value ? (value | MX_FUTEX_PI_WAITERS) : new_value;
+        if (desired == value)
+            break;
+        int seen = value;
+        result = arch_cmpxchg_user(value_ptr.get(), &seen, desired);
+        if (result == NO_ERROR && seen == value) {
+            if (value == 0) {
+                bucket->lock.Release();
+                return NO_ERROR;
+            }
+            break;
+        }
+        value = seen;
+    }
+    if (result != NO_ERROR) {
+        bucket->lock.Release();
+        return result;
+    }
+
+    mxtl::RefPtr<ThreadDispatcher> owner;
+    mx_handle_t owner_handle = static_cast<mx_handle_t>(value & ~MX_FUTEX_PI_WAITERS);
+    result = ProcessDispatcher::GetCurrent()->GetDispatcherWithRights(owner_handle, 0, &owner);
+    if (result != NO_ERROR) {
+        // The owner will still come to FutexUnlockPi(), which copes with
+        // there being no waiters.
+        bucket->lock.Release();
+        return result;
+    }
+    UserThread* owner_thread = owner->thread();
+    if (owner_thread->kernel_thread() == get_current_thread()) {
+        // We'd wait on ourselves forever.  As above, our unlock will still
+        // come to FutexUnlockPi().
+        bucket->lock.Release();
+        return ERR_BAD_STATE;
+    }
+
+    FutexNode* node = UserThread::GetCurrent()->futex_node();
+    node->set_hash_key(futex_key);
+    node->SetAsSingletonList();
+    node->SetPiWaiter(get_current_thread(), new_value);
+    node->SetPiOwner(mxtl::WrapRefPtr(owner_thread));
+
+    // Boosting the owner requeues it if it's ready, and has its cpu choose
+    // again if it's running elsewhere.  If it's queued on this cpu, blocking
+    // below lets it run.
+    QueueNodesLocked(bucket, node);
+    {
+        THREAD_LOCK(state);
+        node->SetPiOwnerLocked(owner_thread->futex_node(), owner_thread->kernel_thread());
+        THREAD_UNLOCK(state);
+    }
+
+    // Block current thread.  This releases the bucket lock and does not
+    // reacquire it.
+    result = node->BlockThread(&bucket->lock, deadline);
+    if (result == NO_ERROR) {
+        // FutexUnlockPi() handed us the futex, and cleaned up the node.
+        DEBUG_ASSERT(!node->IsInQueue());
+        return NO_ERROR;
+    }
+
+    // Priority inheriting futexes are never requeued, so the node is still
+    // in this bucket if it's queued at all.
+    mxtl::RefPtr<UserThread> old_owner;
+    AutoLock lock(&bucket->lock);
+    if (!node->IsInQueue()) {
+        // As in FutexWait(), we were woken as well as timing out, and so
+        // we now own the futex.
+        return NO_ERROR;
+    }
+
+    UnqueueNodeLocked(bucket, node);
+    {
+        THREAD_LOCK(state);
+        node->ClearPiOwnerLocked();
+        THREAD_UNLOCK(state);
+    }
+    node->ClearPiWaiter();
+    old_owner = node->TakePiOwner();
+
+    // With nobody left waiting, let the owner unlock without a syscall.
+    if (!bucket->futex_table.find(futex_key).IsValid()) {
+        value_ptr.copy_from_user(&value);
+        while (value & MX_FUTEX_PI_WAITERS) {
+            int seen = value;
+            if (arch_cmpxchg_user(value_ptr.get(), &seen, value & ~MX_FUTEX_PI_WAITERS) != NO_ERROR ||
+                seen == value)
+                break;
+            value = seen;
+        }
+    }
+    return ERR_TIMED_OUT;
+}
+
+status_t FutexContext::FutexUnlockPi(user_ptr<int> value_ptr) {
+    LTRACE_ENTRY;
+
+    uintptr_t futex_key = reinterpret_cast<uintptr_t>(value_ptr.get());
+    if (futex_key % sizeof(int))
+        return ERR_INVALID_ARGS;
+
+    Bucket* bucket = GetBucket(futex_key);
+    // released after the bucket lock, in case it's the last reference
+    mxtl::RefPtr<UserThread> old_owner;
+    AutoLock lock(&bucket->lock);
+
+    // Only the owner may hand the futex on.
+    int value;
+    status_t result = value_ptr.copy_from_user(&value);
+    if (result != NO_ERROR)
+        return result;
+    mxtl::RefPtr<ThreadDispatcher> owner;
+    mx_handle_t owner_handle = static_cast<mx_handle_t>(value & ~MX_FUTEX_PI_WAITERS);
+    if (ProcessDispatcher::GetCurrent()->GetDispatcherWithRights(owner_handle, 0, &owner) !=
+            NO_ERROR ||
+        owner->thread()->kernel_thread() != get_current_thread())
+        return ERR_ACCESS_DENIED;
+
+    FutexNode* head = bucket->futex_table.erase(futex_key);
+    if (head != nullptr && !head->is_pi()) {
+        bucket->futex_table.insert(head);
+        return ERR_INVALID_ARGS;
+    }
+
+    FutexNode* next_owner = nullptr;
+    int new_value = 0;
+    if (head != nullptr) {
+        THREAD_LOCK(state);
+        next_owner = FutexNode::FindHighestPriorityLocked(head);
+        THREAD_UNLOCK(state);
+        new_value = next_owner->pi_value();
+        if (!head->IsOnlyNodeInQueue())
+            new_value |= MX_FUTEX_PI_WAITERS;
+    }
+
+    while (result == NO_ERROR) {
+        int seen = value;
+        result = arch_cmpxchg_user(value_ptr.get(), &seen, new_value);
+        if (seen == value)
+            break;
+        value = seen;
+    }
+    if (result != NO_ERROR) {
+        if (head != nullptr)
+            bucket->futex_table.insert(head);
+        return result;
+    }
+    if (head == nullptr)
+        return NO_ERROR;
+
+    UserThread* next_owner_thread =
+        reinterpret_cast<UserThread*>(next_owner->pi_thread()->user_thread);
+    FutexNode* rest = FutexNode::RemoveNodeFromList(head, next_owner);
+    {
+        THREAD_LOCK(state);
+        next_owner->ClearPiOwnerLocked();
+        THREAD_UNLOCK(state);
+    }
+    next_owner->ClearPiWaiter();
+    old_owner = next_owner->TakePiOwner();
+
+    // The other waiters now boost the new owner.
+    if (rest != nullptr) {
+        FutexNode::TransferPiOwner(rest, next_owner_thread);
+        bucket->futex_table.insert(rest);
+    }
+
+    next_owner->SetAsSingletonList();
+    FutexNode::WakeThreads(next_owner);
+    return NO_ERROR;
+}
+
+void FutexContext::LockBuckets(Bucket* b1, Bucket* b2) TA_NO_THREAD_SAFETY_ANALYSIS {
+    // Always lock the lower addressed bucket first, so two threads locking
+    // the same pair can't deadlock.
+    if (b1 > b2) {
+        Bucket* tmp = b1;
+        b1 = b2;
+        b2 = tmp;
+    }
+    b1->lock.Acquire();
+    if (b2 != b1)
+        b2->lock.Acquire();
+}
+
+void FutexContext::UnlockBuckets(Bucket* b1, Bucket* b2) TA_NO_THREAD_SAFETY_ANALYSIS {
+    if (b2 != b1)
+        b2->lock.Release();
+    b1->lock.Release();
+}
+
+bool FutexContext::IsPiFutexLocked(Bucket* bucket, uintptr_t futex_key) {
+    DEBUG_ASSERT(bucket->lock.IsHeld());
+
+    auto iter = bucket->futex_table.find(futex_key);
+    return iter.IsValid() && iter->is_pi();
+}
+
+status_t FutexContext::WakeLocked(Bucket* bucket, uintptr_t futex_key, uint32_t count) {
+    DEBUG_ASSERT(bucket->lock.IsHeld());
+
+    // Threads waiting on a priority inheriting futex are only ever handed
+    // the futex by FutexUnlockPi().
+    if (IsPiFutexLocked(bucket, futex_key))
+        return ERR_INVALID_ARGS;
+
+    FutexNode* node = bucket->futex_table.erase(futex_key);
+    if (!node) {
+        // nothing blocked on this futex if we can't find it
+        return NO_ERROR;
+    }
+    DEBUG_ASSERT(node->GetKey() == futex_key);
+
+    FutexNode* wake_head = node;
+    node = FutexNode::RemoveFromHead(node, count, futex_key, futex_key);
+    // node is now the new blocked thread list head
+
+    if (node != nullptr) {
+        DEBUG_ASSERT(node->GetKey() == futex_key);
+        bucket->futex_table.insert(node);
+    }
+
+    // Traversing this list of threads must be done while holding the
+    // lock, because any of these threads might wake up from a timeout
+    // and call FutexWait(), which would clobber the "next" pointer in
+    // the thread's FutexNode.
+    FutexNode::WakeThreads(wake_head);
+    return NO_ERROR;
+}
+
+void FutexContext::QueueNodesLocked(Bucket* bucket, FutexNode* head) {
+    DEBUG_ASSERT(bucket->lock.IsHeld());
 
     FutexNode::HashTable::iterator iter;
 
@@ -213,29 +532,44 @@ void FutexContext::QueueNodesLocked(FutexNode* head) {
     // succeeds, then the current thread is first to block on this futex and we
     // are finished.  If the insert fails, then there is already a thread
     // waiting on this futex.  Add ourselves to that thread's list.
-    if (!futex_table_.insert_or_find(head, &iter))
+    if (!bucket->futex_table.insert_or_find(head, &iter))
         iter->AppendList(head);
 }
 
-// This attempts to unqueue a thread (which may or may not be waiting on a
-// futex), given its FutexNode.  This returns whether the FutexNode was
-// found and removed from a futex wait queue.
-bool FutexContext::UnqueueNodeLocked(FutexNode* node) {
-    DEBUG_ASSERT(lock_.IsHeld());
-
-    if (!node->IsInQueue())
-        return false;
+// This unqueues a thread's FutexNode, which must be on a futex wait queue
+// in |bucket|.
+void FutexContext::UnqueueNodeLocked(Bucket* bucket, FutexNode* node) {
+    DEBUG_ASSERT(bucket->lock.IsHeld());
+    DEBUG_ASSERT(node->IsInQueue());
 
-    // Note: When UnqueueNode() is called from FutexWait(), it might be
-    // tempting to reuse the futex key that was passed to FutexWait().
-    // However, that could be out of date if the thread was requeued by
-    // FutexRequeue(), so we need to re-get the hash table key here.
     uintptr_t futex_key = node->GetKey();
-
-    FutexNode* old_head = futex_table_.erase(futex_key);
+    FutexNode* old_head = bucket->futex_table.erase(futex_key);
     DEBUG_ASSERT(old_head);
     FutexNode* new_head = FutexNode::RemoveNodeFromList(old_head, node);
     if (new_head)
-        futex_table_.insert(new_head);
-    return true;
+        bucket->futex_table.insert(new_head);
+}
+
+// This attempts to unqueue a thread (which may or may not be waiting on a
+// futex), given its FutexNode.  This returns whether the FutexNode was
+// found and removed from a futex wait queue.
+bool FutexContext::UnqueueNode(FutexNode* node) {
+    for (;;) {
+        // Note: It might be tempting to reuse the futex key that was passed
+        // to FutexWait().  However, that could be out of date if the thread
+        // was requeued by FutexRequeue(), so we need to re-get the hash
+        // table key here, and check it again once we hold the lock of its
+        // bucket, since a requeue may move the node in the meantime.
+        uintptr_t futex_key = node->GetKey();
+        Bucket* bucket = GetBucket(futex_key);
+        AutoLock lock(&bucket->lock);
+
+        if (!node->IsInQueue())
+            return false;
+        if (node->GetKey() != futex_key)
+            continue;
+
+        UnqueueNodeLocked(bucket, node);
+        return true;
+    }
 }
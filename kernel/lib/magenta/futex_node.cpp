@@ -8,6 +8,7 @@
 #include <err.h>
 #include <magenta/futex_node.h>
 #include <magenta/magenta.h>
+#include <magenta/user_thread.h>
 #include <platform.h>
 #include <trace.h>
 
@@ -23,6 +24,8 @@ FutexNode::~FutexNode() {
     LTRACE_ENTRY;
 
     DEBUG_ASSERT(!IsInQueue());
+    DEBUG_ASSERT(pi_owner_node_ == nullptr);
+    DEBUG_ASSERT(list_is_empty(&pi_waiters_));
 
     THREAD_LOCK(state);
     wait_queue_destroy(&wait_queue_);
@@ -133,14 +136,86 @@ void FutexNode::WakeThreads(FutexNode* head) {
     FutexNode* node = head;
     do {
         FutexNode* next = node->queue_next_;
+        // Mark the node first: once woken, its thread may return from
+        // FutexWait() and exit, freeing the node.
+        node->MarkAsNotInQueue();
         THREAD_LOCK(state);
         wait_queue_wake_one(&node->wait_queue_, true, NO_ERROR);
         THREAD_UNLOCK(state);
-        node->MarkAsNotInQueue();
         node = next;
     } while (node != head);
 }
 
+void FutexNode::SetPiOwnerLocked(FutexNode* owner_node, thread_t* owner) {
+    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+    DEBUG_ASSERT(is_pi());
+
+    ClearPiOwnerLocked();
+    pi_owner_node_ = owner_node;
+    pi_owner_thread_ = owner;
+    pi_link_.thread = pi_thread_;
+    list_add_tail(&owner_node->pi_waiters_, &pi_link_.node);
+    if (pi_thread_->priority > owner->priority)
+        thread_set_inherited_priority(owner, pi_thread_->priority);
+}
+
+void FutexNode::SetPiOwner(mxtl::RefPtr<UserThread> owner) {
+    pi_owner_ = mxtl::move(owner);
+}
+
+mxtl::RefPtr<UserThread> FutexNode::TakePiOwner() {
+    return mxtl::move(pi_owner_);
+}
+
+FutexNode* FutexNode::FindHighestPriorityLocked(FutexNode* head) {
+    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+
+    FutexNode* best = head;
+    for (FutexNode* node = head->queue_next_; node != head; node = node->queue_next_) {
+        if (node->pi_thread_->priority > best->pi_thread_->priority)
+            best = node;
+    }
+    return best;
+}
+
+void FutexNode::TransferPiOwner(FutexNode* head, UserThread* owner) {
+    FutexNode* node = head;
+    do {
+        {
+            THREAD_LOCK(state);
+            node->SetPiOwnerLocked(owner->futex_node(), owner->kernel_thread());
+            THREAD_UNLOCK(state);
+        }
+        // The old owner is the calling thread, so this isn't its last
+        // reference.
+        node->pi_owner_ = mxtl::WrapRefPtr(owner);
+        node = node->queue_next_;
+    } while (node != head);
+}
+
+void FutexNode::ClearPiOwnerLocked() {
+    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+
+    if (pi_owner_node_ == nullptr)
+        return;
+    list_delete(&pi_link_.node);
+    pi_owner_node_->UpdateInheritedPriorityLocked(pi_owner_thread_);
+    pi_owner_node_ = nullptr;
+    pi_owner_thread_ = nullptr;
+}
+
+void FutexNode::UpdateInheritedPriorityLocked(thread_t* thread) {
+    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+
+    int priority = -1;
+    PiLink* waiter;
+    list_for_every_entry(&pi_waiters_, waiter, PiLink, node) {
+        if (waiter->thread->priority > priority)
+            priority = waiter->thread->priority;
+    }
+    thread_set_inherited_priority(thread, priority);
+}
+
 // Set |node1| and |node2|'s list pointers so that |node1| is immediately
 // before |node2| in the linked list.
 void FutexNode::RelinkAsAdjacent(FutexNode* node1, FutexNode* node2) {
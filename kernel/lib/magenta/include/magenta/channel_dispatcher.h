@@ -46,8 +46,23 @@ public:
                   mxtl::unique_ptr<MessagePacket>* msg,
                   bool may_disard);
 
+    // Read up to |count| messages from this endpoint's message queue, taking the lock once.
+    // |msg_sizes| and |msg_handle_counts| hold one entry per message and are in-out parameters
+    // like Read()'s. Reading stops early when the queue runs dry or at a message that does not
+    // fit its entry; in the latter case ERR_BUFFER_TOO_SMALL is returned and the entry at
+    // |*actual| holds the message's size and handle count. With |may_discard| set such messages
+    // are returned in |msgs| instead, and the caller must compare sizes to tell them apart.
+    // |*actual| is the number of messages returned in |msgs|.
+    status_t ReadMany(uint32_t* msg_sizes, uint32_t* msg_handle_counts,
+                      mxtl::unique_ptr<MessagePacket>* msgs, size_t count, size_t* actual,
+                      bool may_discard);
+
     // Write to the opposing endpoint's message queue.
     status_t Write(mxtl::unique_ptr<MessagePacket> msg);
+
+    // Write |count| messages to the opposing endpoint's message queue, in order and under one
+    // acquisition of its lock. Either all of them are written or, on ERR_PEER_CLOSED, none are.
+    status_t WriteMany(mxtl::unique_ptr<MessagePacket>* msgs, size_t count);
     status_t Call(mxtl::unique_ptr<MessagePacket> msg,
                   mx_time_t deadline, bool* return_handles,
                   mxtl::unique_ptr<MessagePacket>* reply);
@@ -136,6 +151,8 @@ private:
     ChannelDispatcher(uint32_t flags);
     void Init(mxtl::RefPtr<ChannelDispatcher> other);
     int WriteSelf(mxtl::unique_ptr<MessagePacket> msg);
+    int WriteSelfMany(mxtl::unique_ptr<MessagePacket>* msgs, size_t count);
+    int WriteSelfLocked(mxtl::unique_ptr<MessagePacket> msg) TA_REQ(lock_);
     status_t UserSignalSelf(uint32_t clear_mask, uint32_t set_mask);
     void OnPeerZeroHandles();
 
@@ -13,7 +13,8 @@
 
 // FutexContext is a class that encapsulates support for futex operations.
 // FutexContext uses a hash table keyed on the futex address (a pointer to integer in userspace)
-// to contain all active futexes.
+// to contain all active futexes.  The table is split into buckets by address, each with its
+// own lock, so threads using unrelated futexes don't contend with each other.
 // A futex is considered active if there is one or more threads blocked on the futex.
 // After no threads are left blocked on a futex it is removed from the hash table.
 // The value in the futex hash table is the FutexNode object associated with the head
@@ -47,18 +48,60 @@ public:
     status_t FutexRequeue(user_ptr<int> wake_ptr, uint32_t wake_count, int current_value,
                           user_ptr<int> requeue_ptr, uint32_t requeue_count);
 
+    // FutexWakeOp atomically applies the operation encoded in |op| (see MX_FUTEX_OP) to the
+    // integer pointed to by |op_ptr|, and wakes up to |wake_count| threads blocked on the
+    // |wake_ptr| futex.  If the integer's old value passes the comparison encoded in |op|, it
+    // also wakes up to |op_count| threads blocked on the |op_ptr| futex.
+    status_t FutexWakeOp(user_ptr<const int> wake_ptr, uint32_t wake_count,
+                         user_ptr<int> op_ptr, uint32_t op_count, uint32_t op);
+
+    // FutexLockPi claims the priority inheriting futex |value_ptr| by setting it to
+    // |new_value| if it is 0.  Otherwise it sets MX_FUTEX_PI_WAITERS in it, lends the current
+    // thread's priority to the owner, whose thread handle the futex holds, and blocks until
+    // FutexUnlockPi hands the futex to this thread or the |deadline| passes.
+    status_t FutexLockPi(user_ptr<int> value_ptr, int new_value, mx_time_t deadline);
+
+    // FutexUnlockPi hands the priority inheriting futex |value_ptr| to its highest priority
+    // waiter, by setting it to the waiter's value, or sets it to 0 if there are no waiters.
+    status_t FutexUnlockPi(user_ptr<int> value_ptr);
+
 private:
     FutexContext(const FutexContext&) = delete;
     FutexContext& operator=(const FutexContext&) = delete;
 
-    void QueueNodesLocked(FutexNode* head) TA_REQ(lock_);
+    struct Bucket {
+        // protects futex_table
+        Mutex lock;
+
+        // Hash table for the futexes in this bucket.
+        // Key is futex address, value is the FutexNode for the head of futex's blocked thread
+        // list.
+        FutexNode::HashTable futex_table TA_GUARDED(lock);
+    };
+
+    static constexpr size_t kNumBuckets = 16;
+
+    Bucket* GetBucket(uintptr_t futex_key) {
+        return &buckets_[(futex_key / sizeof(int)) % kNumBuckets];
+    }
+
+    // Locks the buckets of two futexes, which may be the same bucket.
+    static void LockBuckets(Bucket* b1, Bucket* b2);
+    static void UnlockBuckets(Bucket* b1, Bucket* b2);
+
+    // Returns whether threads wait on the futex with FutexLockPi, rather than FutexWait.
+    static bool IsPiFutexLocked(Bucket* bucket, uintptr_t futex_key) TA_REQ(bucket->lock);
+
+    static status_t WakeLocked(Bucket* bucket, uintptr_t futex_key, uint32_t count)
+        TA_REQ(bucket->lock);
+
+    static void QueueNodesLocked(Bucket* bucket, FutexNode* head) TA_REQ(bucket->lock);
 
-    bool UnqueueNodeLocked(FutexNode* node) TA_REQ(lock_);
+    static void UnqueueNodeLocked(Bucket* bucket, FutexNode* node) TA_REQ(bucket->lock);
 
-    // protects futex_table_
-    Mutex lock_;
+    // Removes the node of a thread whose wait ended early from whichever futex it now waits
+    // on.  Returns false if it had already been woken.
+    bool UnqueueNode(FutexNode* node);
 
-    // Hash table for futexes in this context.
-    // Key is futex address, value is the FutexNode for the head of futex's blocked thread list.
-    FutexNode::HashTable futex_table_ TA_GUARDED(lock_);
+    Bucket buckets_[kNumBuckets];
 };
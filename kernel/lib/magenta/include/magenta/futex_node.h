@@ -12,12 +12,17 @@
 #include <list.h>
 #include <magenta/types.h>
 #include <mxtl/intrusive_hash_table.h>
+#include <mxtl/ref_ptr.h>
+
+class UserThread;
 
 // Node for linked list of threads blocked on a futex
 // Intended to be embedded within a UserThread Instance
 class FutexNode : public mxtl::SinglyLinkedListable<FutexNode*> {
 public:
-    using HashTable = mxtl::HashTable<uintptr_t, FutexNode*>;
+    // FutexContext keeps many of these, so each is small.
+    using HashTable = mxtl::HashTable<uintptr_t, FutexNode*,
+                                      mxtl::SinglyLinkedList<FutexNode*>, size_t, 7>;
 
     FutexNode();
     ~FutexNode();
@@ -26,6 +31,7 @@ public:
     FutexNode& operator=(const FutexNode &) = delete;
 
     bool IsInQueue() const;
+    bool IsOnlyNodeInQueue() const { return queue_next_ == this; }
     void SetAsSingletonList();
 
     // adds a list of nodes to our tail
@@ -48,6 +54,42 @@ public:
         hash_key_ = key;
     }
 
+    // Priority inheritance support, for threads waiting in FutexLockPi().
+    // While a node's thread waits, the node is on the |pi_waiters_| list of
+    // the futex owner's node, and the owner runs at the priority of its
+    // highest priority waiter.  |pi_owner_| keeps the owner alive, and may
+    // only be changed with the futex's bucket lock held; the lists are
+    // guarded by the thread lock.
+    bool is_pi() const { return pi_thread_ != nullptr; }
+    void SetPiWaiter(thread_t* thread, int value) {
+        pi_thread_ = thread;
+        pi_value_ = value;
+    }
+    // the futex value that hands the futex to this node's thread
+    int pi_value() const { return pi_value_; }
+    thread_t* pi_thread() const { return pi_thread_; }
+
+    // Makes this node's thread boost |owner|, which is |owner_node|'s thread,
+    // instead of any owner it had before.  Called with the thread lock held.
+    void SetPiOwnerLocked(FutexNode* owner_node, thread_t* owner);
+    void ClearPiWaiter() { SetPiWaiter(nullptr, 0); }
+    // Stops boosting the owner.  Called with the thread lock held.
+    void ClearPiOwnerLocked();
+    // Recomputes the priority this node's thread |thread| inherits from its
+    // waiters.  Called with the thread lock held.
+    void UpdateInheritedPriorityLocked(thread_t* thread);
+
+    void SetPiOwner(mxtl::RefPtr<UserThread> owner);
+    mxtl::RefPtr<UserThread> TakePiOwner();
+
+    // Returns the node of the highest priority thread in the list starting
+    // at |head|, the earliest queued if there's a tie.
+    static FutexNode* FindHighestPriorityLocked(FutexNode* head);
+    // Makes every node in the list starting at |head| boost |owner|
+    // instead, giving each a reference to it.  Called with the futex's bucket
+    // lock held.
+    static void TransferPiOwner(FutexNode* head, UserThread* owner);
+
     // Trait implementation for mxtl::HashTable
     uintptr_t GetKey() const { return hash_key_; }
     static size_t GetHash(uintptr_t key) { return (key >> 3); }
@@ -76,4 +118,25 @@ private:
     //  * When the thread is not waiting on a futex, queue_next_ is null.
     FutexNode* queue_prev_ = nullptr;
     FutexNode* queue_next_ = nullptr;
+
+    // The waiting thread, if waiting on a priority inheriting futex, and
+    // the value that makes it the owner.
+    thread_t* pi_thread_ = nullptr;
+    int pi_value_ = 0;
+
+    // An entry on an owner's |pi_waiters_|.  This is kept apart from the
+    // node so that list_for_every_entry() has a plain struct to work with.
+    struct PiLink {
+        list_node node;
+        thread_t* thread;
+    };
+
+    // The owner being boosted, and the link on its |pi_waiters_|.
+    mxtl::RefPtr<UserThread> pi_owner_;
+    FutexNode* pi_owner_node_ = nullptr;
+    thread_t* pi_owner_thread_ = nullptr;
+    PiLink pi_link_ = {LIST_INITIAL_CLEARED_VALUE, nullptr};
+
+    // The links of the threads waiting on futexes this thread owns.
+    list_node pi_waiters_ = LIST_INITIAL_VALUE(pi_waiters_);
 };
@@ -9,6 +9,7 @@
 #include <stdint.h>
 
 #include <magenta/types.h>
+#include <mxtl/atomic.h>
 #include <mxtl/intrusive_double_list.h>
 #include <mxtl/ref_ptr.h>
 
@@ -28,13 +29,14 @@ public:
 
     // Returns the process that owns this instance. Used to guarantee
     // that one process may not access a handle owned by a different process.
+    // May be read without the owning process' handle table lock.
     mx_koid_t process_id() const {
-        return process_id_;
+        return process_id_.load();
     }
 
     // Sets the value returned by process_id().
     void set_process_id(mx_koid_t pid) {
-        process_id_ = pid;
+        process_id_.store(pid);
     }
 
     // Returns the |rights| parameter that was provided when this instance
@@ -69,7 +71,7 @@ private:
     friend void internal::TearDownHandle(Handle* handle);
     ~Handle();
 
-    mx_koid_t process_id_;
+    mxtl::atomic<mx_koid_t> process_id_;
     mxtl::RefPtr<Dispatcher> dispatcher_;
     const mx_rights_t rights_;
     const uint32_t base_value_;
@@ -8,6 +8,7 @@
 
 #include <stdint.h>
 
+#include <kernel/vm/page.h>
 #include <magenta/types.h>
 #include <mxtl/intrusive_double_list.h>
 #include <mxtl/unique_ptr.h>
@@ -20,9 +21,23 @@ public:
     static mx_status_t Create(uint32_t data_size, uint32_t num_handles,
                               mxtl::unique_ptr<MessagePacket>* msg);
 
+    // Creates a message packet whose payload is |num_pages| whole pages,
+    // handed over by reference through mutable_pages() instead of being
+    // copied into the packet. The packet frees any pages still attached
+    // to it when it is destroyed.
+    static mx_status_t CreateWithPages(uint32_t num_pages, uint32_t num_handles,
+                                       mxtl::unique_ptr<MessagePacket>* msg);
+
+    // Dumps the packet allocator counters using printf().
+    static void DumpAllocatorStats();
+
     uint32_t data_size() const { return data_size_; }
     uint32_t num_handles() const { return num_handles_; }
 
+    // Non-zero for packets made by CreateWithPages(), which have no
+    // data() and carry data_size() bytes in pages() instead.
+    uint32_t num_pages() const { return num_pages_; }
+
     void set_owns_handles(bool own_handles) { owns_handles_ = own_handles; }
 
     const void* data() const { return static_cast<void*>(handles_ + num_handles_); }
@@ -30,27 +45,43 @@ public:
     Handle* const* handles() const { return handles_; }
     Handle** mutable_handles() { return handles_; }
 
+    // The payload pages of a page packet. Entries may be nullptr, which
+    // stands for a page of zeroes. Whoever takes a page out of the array
+    // must replace it with nullptr.
+    vm_page_t* const* pages() const {
+        return reinterpret_cast<vm_page_t* const*>(handles_ + num_handles_);
+    }
+    vm_page_t** mutable_pages() { return reinterpret_cast<vm_page_t**>(handles_ + num_handles_); }
+
     // mx_channel_call treats the leading bytes of the payload as
     // a transaction id of type mx_txid_t.
     mx_txid_t get_txid() const {
         if (data_size_ < sizeof(mx_txid_t)) {
             return 0;
+        } else if (num_pages_ > 0) {
+            return GetPageTxid();
         } else {
             return *(reinterpret_cast<const mx_txid_t*>(data()));
         }
     }
 
 private:
-    MessagePacket(uint32_t data_size, uint32_t num_handles, Handle** handles);
+    MessagePacket(uint32_t data_size, uint32_t num_handles, uint32_t num_pages,
+                  Handle** handles);
     ~MessagePacket();
 
-    static void operator delete(void* ptr) {
-        free(ptr);
-    }
+    static mx_status_t CreateCommon(uint32_t data_size, uint32_t num_handles, uint32_t num_pages,
+                                    size_t payload_size, mxtl::unique_ptr<MessagePacket>* msg);
+
+    mx_txid_t GetPageTxid() const;
+
+    // Returns the packet's memory to the size class it came from.
+    static void operator delete(void* ptr);
     friend class mxtl::unique_ptr<MessagePacket>;
 
     bool owns_handles_;
     uint32_t data_size_;
     uint32_t num_handles_;
+    uint32_t num_pages_;
     Handle** handles_;
 };
@@ -137,6 +137,11 @@ public:
     mx_status_t Queue(PortPacket* port_packet, mx_signals_t observed, uint64_t count);
     mx_status_t QueueUser(const mx_port_packet_t& packet);
     mx_status_t DeQueue(mx_time_t deadline, mx_port_packet_t* packet);
+    // Dequeues up to |count| packets into |packets|, which may be null to
+    // discard them, under one acquisition of the lock. If none are queued,
+    // polls for up to |spin| before blocking until |deadline|.
+    mx_status_t DeQueueMany(mx_time_t deadline, mx_duration_t spin,
+                            mx_port_packet_t* packets, size_t count, size_t* actual);
 
     // Decides who is going to destroy the observer. If it returns |true| it
     // is the duty of the caller. If it is false it is the duty of the port.
@@ -155,4 +160,7 @@ private:
     Semaphore sema_;
     bool zero_handles_ TA_GUARDED(lock_);
     mxtl::DoublyLinkedList<PortPacket*> packets_ TA_GUARDED(lock_);
+    // The length of |packets_|, written with |lock_| held but read without
+    // it while spinning in DeQueueMany().
+    uint32_t num_packets_;
 };
@@ -8,6 +8,7 @@
 
 #include <kernel/event.h>
 #include <kernel/mutex.h>
+#include <kernel/spinlock.h>
 #include <kernel/thread.h>
 #include <kernel/vm/vm_aspace.h>
 
@@ -22,6 +23,7 @@
 #include <magenta/user_thread.h>
 
 #include <mxtl/array.h>
+#include <mxtl/atomic.h>
 #include <mxtl/canary.h>
 #include <mxtl/intrusive_double_list.h>
 #include <mxtl/ref_counted.h>
@@ -249,6 +251,17 @@ private:
                                                 mxtl::RefPtr<Dispatcher>* dispatcher_out,
                                                 mx_rights_t* out_rights);
 
+    // Lockless handle lookups. A lookup runs between BeginHandleLookup() and
+    // EndHandleLookup() with interrupts disabled, and may only use the Handle
+    // returned by GetHandleLockless() inside that window. Anything that takes
+    // a handle out of this process calls WaitForHandleLookupsLocked() after
+    // clearing its process_id, so the Handle stays alive until every lookup
+    // that could have seen it is done.
+    uint32_t BeginHandleLookup(spin_lock_saved_state_t* state);
+    void EndHandleLookup(uint32_t index, spin_lock_saved_state_t state);
+    Handle* GetHandleLockless(mx_handle_t handle_value);
+    void WaitForHandleLookupsLocked() TA_REQ(handle_table_lock_);
+
     // Thread lifecycle support
     friend class UserThread;
     status_t AddThread(UserThread* t, bool initial_thread);
@@ -283,6 +296,12 @@ private:
     mutable Mutex handle_table_lock_; // protects |handles_|.
     mxtl::DoublyLinkedList<Handle*> handles_ TA_GUARDED(handle_table_lock_);
 
+    // Lookups in flight, counted in the slot picked by |handle_lookup_epoch_|.
+    // Writers flip the epoch so they only ever wait for lookups that started
+    // before them.
+    mxtl::atomic<uint32_t> handle_lookup_epoch_{0u};
+    mxtl::atomic<uint32_t> handle_lookups_[2] = {{0u}, {0u}};
+
     StateTracker state_tracker_;
 
     FutexContext futex_context_;
@@ -6,12 +6,14 @@
 
 #include <magenta/magenta.h>
 
+#include <inttypes.h>
 #include <pow2.h>
 #include <trace.h>
 
 #include <kernel/auto_lock.h>
 #include <kernel/cmdline.h>
 #include <kernel/mutex.h>
+#include <kernel/spinlock.h>
 
 #include <lk/init.h>
 
@@ -30,6 +32,7 @@
 #include <magenta/io_mapping_dispatcher.h>
 
 #include <mxtl/arena.h>
+#include <mxtl/atomic.h>
 #include <mxtl/intrusive_double_list.h>
 #include <mxtl/type_support.h>
 
@@ -37,6 +40,10 @@
 
 #define LOCAL_TRACE 0
 
+// How late a user sleep may wake up so that it can share a timer interrupt
+// with other nearby deadlines.
+constexpr lk_time_t kSleepSlack = LK_USEC(50);
+
 // The number of possible handles in the arena.
 constexpr size_t kMaxHandleCount = 256 * 1024u;
 
@@ -47,7 +54,36 @@ constexpr size_t kHighHandleCount = (kMaxHandleCount * 7) / 8;
 // The handle arena and its mutex.
 static Mutex handle_mutex;
 static mxtl::Arena TA_GUARDED(handle_mutex) handle_arena;
-static size_t outstanding_handles TA_GUARDED(handle_mutex) = 0u;
+static mxtl::atomic<size_t> outstanding_handles(0u);
+
+// The first slot of |handle_arena|, fixed once the arena is initialized.
+static Handle* handle_arena_base;
+
+// One past the highest slot index the arena has ever handed out. The arena
+// never decommits slots below this, so MapU32ToHandle() can read any slot
+// under it without taking |handle_mutex|.
+static mxtl::atomic<uint32_t> handle_arena_limit(0u);
+
+// Per cpu caches of free handle slots. MakeHandle, DupHandle and DeleteHandle
+// are served from the local cache under a local spinlock, and the cache is
+// refilled from and drained to |handle_arena| in batches, so handle creation
+// and destruction only take |handle_mutex| once every kHandleCacheBatch
+// operations.
+constexpr size_t kHandleCacheBatch = 16u;
+constexpr size_t kHandleCacheMax = kHandleCacheBatch * 2;
+
+struct HandleCache {
+    spin_lock_t lock;
+    size_t count;
+    void* slots[kHandleCacheMax];
+
+    // statistics, protected by lock
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t drains;
+} __CPU_ALIGN;
+
+static HandleCache handle_cache[SMP_MAX_CPUS];
 
 // The system exception port.
 static mutex_t system_exception_mutex = MUTEX_INITIAL_VALUE(system_exception_mutex);
@@ -66,6 +102,9 @@ static PolicyManager* policy_manager;
 
 void magenta_init(uint level) TA_NO_THREAD_SAFETY_ANALYSIS {
     handle_arena.Init("handles", sizeof(Handle), kMaxHandleCount);
+    handle_arena_base = reinterpret_cast<Handle*>(handle_arena.start());
+    for (auto& cache : handle_cache)
+        cache.lock = SPIN_LOCK_INITIAL_VALUE;
     root_job = JobDispatcher::CreateRootJob();
     fatal_small_deadlines = cmdline_get_bool("magenta.fatal_small_deadlines", false);
     policy_manager = PolicyManager::Create();
@@ -99,10 +138,9 @@ static_assert(((3 << 30) ^ kHandleGenerationMask ^ kHandleIndexMask) ==
 // Returns a new |base_value| based on the value stored in the free
 // |handle_arena| slot pointed to by |addr|. The new value will be different
 // from the last |base_value| used by this slot.
-static uint32_t GetNewHandleBaseValue(void* addr) TA_REQ(handle_mutex) {
+static uint32_t GetNewHandleBaseValue(void* addr) {
     // Get the index of this slot within handle_arena.
-    auto va = reinterpret_cast<Handle*>(addr) -
-              reinterpret_cast<Handle*>(handle_arena.start());
+    auto va = reinterpret_cast<Handle*>(addr) - handle_arena_base;
     uint32_t handle_index = static_cast<uint32_t>(va);
     DEBUG_ASSERT((handle_index & ~kHandleIndexMask) == 0);
 
@@ -143,44 +181,126 @@ void internal::TearDownHandle(Handle *handle) TA_EXCL(handle_mutex) {
     // no process can refer to this slot while it's free. This isn't
     // completely legal since |handle| points to unconstructed memory,
     // but it should be safe enough for an assertion.
-    DEBUG_ASSERT(handle->process_id_ == 0);
+    DEBUG_ASSERT(handle->process_id_.load() == 0);
 }
 
 static void high_handle_count(size_t count) {
     // TODO: Avoid calling this for every handle after kHighHandleCount;
-    // printfs are slow and |handle_mutex| is held by our caller.
+    // printfs are slow.
     printf("WARNING: High handle count: %zu handles\n", count);
 }
 
-Handle* MakeHandle(mxtl::RefPtr<Dispatcher> dispatcher, mx_rights_t rights) {
+// Pulls a batch of slots out of |handle_arena|, returning one and stashing
+// the rest in the current cpu's cache.
+static void* RefillHandleCache() {
+    void* slots[kHandleCacheBatch];
+    size_t count = 0;
+
     AutoLock lock(&handle_mutex);
-    void* addr = handle_arena.Alloc();
-    if (addr == nullptr) {
-        const auto oh = outstanding_handles;
-        lock.release();
-        printf("WARNING: Could not allocate new handle (%zu outstanding)\n",
-               oh);
+    while (count < kHandleCacheBatch) {
+        void* addr = handle_arena.Alloc();
+        if (addr == nullptr)
+            break;
+        uint32_t limit = static_cast<uint32_t>(reinterpret_cast<Handle*>(addr) -
+                                               handle_arena_base) + 1;
+        if (limit > handle_arena_limit.load(mxtl::memory_order_relaxed))
+            handle_arena_limit.store(limit);
+        slots[count++] = addr;
+    }
+    if (count == 0)
         return nullptr;
+
+    // We may have moved cpus since the cache missed; that is fine, the
+    // slots go into whichever cache is local now.
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+    HandleCache& cache = handle_cache[arch_curr_cpu_num()];
+    spin_lock(&cache.lock);
+    size_t next = 1;
+    while (next < count && cache.count < kHandleCacheMax)
+        cache.slots[cache.count++] = slots[next++];
+    spin_unlock(&cache.lock);
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    // Anything that did not fit goes straight back.
+    while (next < count)
+        handle_arena.Free(slots[next++]);
+
+    return slots[0];
+}
+
+// Returns a free slot for a new Handle, or nullptr if the arena is full.
+static void* AllocHandleSlot(const char* what) {
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+    HandleCache& cache = handle_cache[arch_curr_cpu_num()];
+    spin_lock(&cache.lock);
+    void* addr = nullptr;
+    if (cache.count > 0) {
+        addr = cache.slots[--cache.count];
+        cache.hits++;
+    } else {
+        cache.misses++;
+    }
+    spin_unlock(&cache.lock);
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    if (addr == nullptr) {
+        addr = RefillHandleCache();
+        if (addr == nullptr) {
+            printf("WARNING: Could not allocate %s handle (%zu outstanding)\n",
+                   what, outstanding_handles.load());
+            return nullptr;
+        }
+    }
+
+    size_t count = outstanding_handles.fetch_add(1u) + 1;
+    if (count > kHighHandleCount)
+        high_handle_count(count);
+    return addr;
+}
+
+// Returns the slot of a torn down Handle to the current cpu's cache, moving
+// a batch of cached slots back to |handle_arena| if the cache is full.
+static void FreeHandleSlot(void* addr) {
+    void* slots[kHandleCacheBatch];
+    size_t count = 0;
+
+    outstanding_handles.fetch_sub(1u);
+
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+    HandleCache& cache = handle_cache[arch_curr_cpu_num()];
+    spin_lock(&cache.lock);
+    if (cache.count == kHandleCacheMax) {
+        while (count < kHandleCacheBatch)
+            slots[count++] = cache.slots[--cache.count];
+        cache.drains++;
     }
-    if (++outstanding_handles > kHighHandleCount)
-        high_handle_count(outstanding_handles);
+    cache.slots[cache.count++] = addr;
+    spin_unlock(&cache.lock);
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    if (count == 0)
+        return;
+
+    AutoLock lock(&handle_mutex);
+    for (size_t i = 0; i < count; i++)
+        handle_arena.Free(slots[i]);
+}
+
+Handle* MakeHandle(mxtl::RefPtr<Dispatcher> dispatcher, mx_rights_t rights) {
+    void* addr = AllocHandleSlot("new");
+    if (addr == nullptr)
+        return nullptr;
     uint32_t base_value = GetNewHandleBaseValue(addr);
     return new (addr) Handle(mxtl::move(dispatcher), rights, base_value);
 }
 
 Handle* DupHandle(Handle* source, mx_rights_t rights) {
-    AutoLock lock(&handle_mutex);
-    void* addr = handle_arena.Alloc();
-    if (addr == nullptr) {
-        const auto oh = outstanding_handles;
-        lock.release();
-        printf(
-            "WARNING: Could not allocate duplicate handle (%zu outstanding)\n",
-            oh);
+    void* addr = AllocHandleSlot("duplicate");
+    if (addr == nullptr)
         return nullptr;
-    }
-    if (++outstanding_handles > kHighHandleCount)
-        high_handle_count(outstanding_handles);
     uint32_t base_value = GetNewHandleBaseValue(addr);
     return new (addr) Handle(source, rights, base_value);
 }
@@ -211,28 +331,31 @@ void DeleteHandle(Handle* handle) {
     // base_value for reuse the next time this slot is allocated.
     internal::TearDownHandle(handle);
 
-    AutoLock lock(&handle_mutex);
-    --outstanding_handles;
-    handle_arena.Free(handle);
-}
-
-bool HandleInRange(void* addr) {
-    AutoLock lock(&handle_mutex);
-    return handle_arena.in_range(addr);
+    FreeHandleSlot(handle);
 }
 
-Handle* MapU32ToHandle(uint32_t value) TA_NO_THREAD_SAFETY_ANALYSIS {
+Handle* MapU32ToHandle(uint32_t value) {
     auto index = value & kHandleIndexMask;
-    auto va = &reinterpret_cast<Handle*>(handle_arena.start())[index];
-    if (!HandleInRange(va))
+    if (index >= handle_arena_limit.load())
         return nullptr;
-    Handle *handle = reinterpret_cast<Handle*>(va);
+    Handle *handle = &handle_arena_base[index];
     return handle->base_value() == value ? handle : nullptr;
 }
 
 void internal::DumpHandleTableInfo() {
-    AutoLock lock(&handle_mutex);
-    handle_arena.Dump();
+    {
+        AutoLock lock(&handle_mutex);
+        handle_arena.Dump();
+    }
+    printf("%zu outstanding handles, per cpu caches:\n", outstanding_handles.load());
+    for (uint i = 0; i < arch_max_num_cpus(); i++) {
+        HandleCache& cache = handle_cache[i];
+        spin_lock_saved_state_t state;
+        spin_lock_irqsave(&cache.lock, state);
+        printf("  cpu %u: %2zu slots, %" PRIu64 " hits, %" PRIu64 " misses, %" PRIu64 " drains\n",
+               i, cache.count, cache.hits, cache.misses, cache.drains);
+        spin_unlock_irqrestore(&cache.lock, state);
+    }
 }
 
 mx_status_t SetSystemExceptionPort(mxtl::RefPtr<ExceptionPort> eport) {
@@ -280,7 +403,7 @@ bool magenta_rights_check(const Handle* handle, mx_rights_t desired) {
 mx_status_t magenta_sleep(mx_time_t deadline) {
     magenta_check_deadline("sleep", deadline);
     /* sleep with interruptable flag set */
-    return thread_sleep_etc(deadline, true);
+    return thread_sleep_etc(deadline, kSleepSlack, true);
 }
 
 // TODO(teisenbe): Remove this function post-migration
@@ -5,47 +5,343 @@
 // https://opensource.org/licenses/MIT
 
 #include <err.h>
+#include <inttypes.h>
 #include <new.h>
+#include <stdio.h>
+
+#include <kernel/auto_lock.h>
+#include <kernel/mp.h>
+#include <kernel/mutex.h>
+#include <kernel/spinlock.h>
+#include <kernel/vm.h>
 
 #include <magenta/handle_reaper.h>
 #include <magenta/magenta.h>
 #include <magenta/message_packet.h>
 
+#include <mxtl/algorithm.h>
+#include <mxtl/atomic.h>
+#include <mxtl/slab_allocator.h>
+
 constexpr uint32_t kMaxMessageSize = 65536u;
 constexpr uint32_t kMaxMessageHandles = 1024u;
 
+// Packets (the MessagePacket header, the handle array and the data) that fit
+// in one of these size classes are carved out of a slab for that class
+// instead of coming from the heap. Bigger packets, and packets allocated once
+// a class has used up its slab budget, still use malloc.
+constexpr size_t kSizeClasses[] = { 64u, 256u, 1024u, 4096u };
+constexpr size_t kNumSizeClasses = countof(kSizeClasses);
+constexpr uint8_t kHeapSizeClass = UINT8_MAX;
+
+// Every packet is preceded by a prefix holding its size class. It is outside
+// the MessagePacket object, so operator delete can read it after the
+// destructor has run.
+constexpr size_t kPacketPrefixSize = alignof(MessagePacket);
+
+// How much slab memory each size class may grow to.
+constexpr size_t kMaxSlabMemory = 4u * 1024u * 1024u;
+
+// Per cpu free lists in front of the slabs. Allocations and frees are served
+// from the local list under a local spinlock, and the list is refilled from
+// and drained to the slab in batches, so a channel write/read pair usually
+// never touches the slab lock.
+constexpr size_t kPacketCacheBatch = 8u;
+constexpr size_t kPacketCacheMax = kPacketCacheBatch * 2;
+
+namespace {
+
+template <size_t kSize> struct PacketBuffer;
+
+template <size_t kSize>
+using PacketBufferTraits =
+    mxtl::UnlockedManualDeleteSlabAllocatorTraits<
+        PacketBuffer<kSize>*, mxtl::max(mxtl::DEFAULT_SLAB_ALLOCATOR_SLAB_SIZE, kSize * 8)>;
+
+// Raw storage for one packet of a size class.
+template <size_t kSize>
+struct PacketBuffer : public mxtl::SlabAllocated<PacketBufferTraits<kSize>> {
+    alignas(MessagePacket) uint8_t storage[kSize];
+};
+
+// The slab of one size class. The slab allocators themselves are unlocked;
+// |lock| covers a whole batch of refills or drains.
+class PacketSlab {
+public:
+    virtual ~PacketSlab() {}
+
+    virtual void* AllocLocked() TA_REQ(lock) = 0;
+    virtual void FreeLocked(void* ptr) TA_REQ(lock) = 0;
+
+    Mutex lock;
+};
+
+template <size_t kSize>
+class PacketSlabImpl final : public PacketSlab {
+public:
+    using Allocator = mxtl::SlabAllocator<PacketBufferTraits<kSize>>;
+
+    PacketSlabImpl()
+        : allocator_(mxtl::max<size_t>(kMaxSlabMemory / PacketBufferTraits<kSize>::SLAB_SIZE,
+                                       1u)) {}
+
+    void* AllocLocked() TA_REQ(lock) final {
+        return allocator_.New();
+    }
+
+    void FreeLocked(void* ptr) TA_REQ(lock) final {
+        allocator_.Delete(static_cast<PacketBuffer<kSize>*>(ptr));
+    }
+
+private:
+    Allocator allocator_;
+};
+
+PacketSlabImpl<kSizeClasses[0]> slab_64;
+PacketSlabImpl<kSizeClasses[1]> slab_256;
+PacketSlabImpl<kSizeClasses[2]> slab_1k;
+PacketSlabImpl<kSizeClasses[3]> slab_4k;
+
+PacketSlab* const packet_slabs[kNumSizeClasses] = {
+    &slab_64, &slab_256, &slab_1k, &slab_4k,
+};
+
+struct PacketCacheStats {
+    uint64_t allocs;
+    uint64_t misses;
+    uint64_t frees;
+    uint64_t drains;
+};
+
+struct PacketCache {
+    spin_lock_t lock = SPIN_LOCK_INITIAL_VALUE;
+    size_t count[kNumSizeClasses] = {};
+    void* slots[kNumSizeClasses][kPacketCacheMax];
+
+    // statistics, protected by lock
+    PacketCacheStats stats[kNumSizeClasses] = {};
+} __CPU_ALIGN;
+
+PacketCache packet_cache[SMP_MAX_CPUS];
+
+// Packets that did not fit a size class or found their slab exhausted.
+mxtl::atomic<uint64_t> heap_allocs(0u);
+
+uint8_t SizeClassFor(size_t size) {
+    for (uint8_t i = 0; i < kNumSizeClasses; i++) {
+        if (size <= kSizeClasses[i])
+            return i;
+    }
+    return kHeapSizeClass;
+}
+
+// Pulls a batch of buffers out of the slab, returning one and stashing the
+// rest in the current cpu's cache. Returns nullptr if the slab is exhausted.
+void* RefillPacketCache(uint8_t size_class) {
+    PacketSlab* slab = packet_slabs[size_class];
+    void* buffers[kPacketCacheBatch];
+    size_t count = 0;
+
+    AutoLock lock(&slab->lock);
+    while (count < kPacketCacheBatch) {
+        void* ptr = slab->AllocLocked();
+        if (ptr == nullptr)
+            break;
+        buffers[count++] = ptr;
+    }
+    if (count == 0)
+        return nullptr;
+
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+    PacketCache& cache = packet_cache[arch_curr_cpu_num()];
+    spin_lock(&cache.lock);
+    size_t next = 1;
+    while (next < count && cache.count[size_class] < kPacketCacheMax)
+        cache.slots[size_class][cache.count[size_class]++] = buffers[next++];
+    spin_unlock(&cache.lock);
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    while (next < count)
+        slab->FreeLocked(buffers[next++]);
+
+    return buffers[0];
+}
+
+void* AllocPacketBuffer(uint8_t size_class) {
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+    PacketCache& cache = packet_cache[arch_curr_cpu_num()];
+    spin_lock(&cache.lock);
+    void* ptr = nullptr;
+    cache.stats[size_class].allocs++;
+    if (cache.count[size_class] > 0) {
+        ptr = cache.slots[size_class][--cache.count[size_class]];
+    } else {
+        cache.stats[size_class].misses++;
+    }
+    spin_unlock(&cache.lock);
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    return ptr ? ptr : RefillPacketCache(size_class);
+}
+
+// Returns a buffer to the current cpu's cache, moving a batch of cached
+// buffers back to the slab if the cache is full.
+void FreePacketBuffer(void* ptr, uint8_t size_class) {
+    void* buffers[kPacketCacheBatch];
+    size_t count = 0;
+
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+    PacketCache& cache = packet_cache[arch_curr_cpu_num()];
+    spin_lock(&cache.lock);
+    cache.stats[size_class].frees++;
+    if (cache.count[size_class] == kPacketCacheMax) {
+        while (count < kPacketCacheBatch)
+            buffers[count++] = cache.slots[size_class][--cache.count[size_class]];
+        cache.stats[size_class].drains++;
+    }
+    cache.slots[size_class][cache.count[size_class]++] = ptr;
+    spin_unlock(&cache.lock);
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    if (count == 0)
+        return;
+
+    PacketSlab* slab = packet_slabs[size_class];
+    AutoLock lock(&slab->lock);
+    for (size_t i = 0; i < count; i++)
+        slab->FreeLocked(buffers[i]);
+}
+
+} // namespace
+
 // static
-mx_status_t MessagePacket::Create(uint32_t data_size, uint32_t num_handles,
-                                  mxtl::unique_ptr<MessagePacket>* msg) {
+mx_status_t MessagePacket::CreateCommon(uint32_t data_size, uint32_t num_handles,
+                                        uint32_t num_pages, size_t payload_size,
+                                        mxtl::unique_ptr<MessagePacket>* msg) {
     if (data_size > kMaxMessageSize)
         return ERR_OUT_OF_RANGE;
     if (num_handles > kMaxMessageHandles)
         return ERR_OUT_OF_RANGE;
 
-    // Allocate space for the MessagePacket object followed by num_handles
-    // Handle*s followed by data_size bytes.
-    char* ptr = static_cast<char*>(malloc(sizeof(MessagePacket) +
-                                          num_handles * sizeof(Handle*) +
-                                          data_size));
-    if (ptr == nullptr)
-        return ERR_NO_MEMORY;
+    // Allocate space for the size class prefix, the MessagePacket object,
+    // num_handles Handle*s and the payload.
+    size_t size = kPacketPrefixSize + sizeof(MessagePacket) + num_handles * sizeof(Handle*) +
+                  payload_size;
+    uint8_t size_class = SizeClassFor(size);
+    char* ptr = nullptr;
+    if (size_class != kHeapSizeClass) {
+        ptr = static_cast<char*>(AllocPacketBuffer(size_class));
+        if (ptr == nullptr)
+            size_class = kHeapSizeClass;
+    }
+    if (ptr == nullptr) {
+        ptr = static_cast<char*>(malloc(size));
+        if (ptr == nullptr)
+            return ERR_NO_MEMORY;
+        heap_allocs.fetch_add(1u);
+    }
+
+    *reinterpret_cast<uint8_t*>(ptr) = size_class;
+    ptr += kPacketPrefixSize;
+    msg->reset(new (ptr) MessagePacket(data_size, num_handles, num_pages,
+                                       reinterpret_cast<Handle**>(ptr + sizeof(MessagePacket))));
+    return NO_ERROR;
+}
 
+// static
+mx_status_t MessagePacket::Create(uint32_t data_size, uint32_t num_handles,
+                                  mxtl::unique_ptr<MessagePacket>* msg) {
     // The storage space for the Handle*s and bytes is not initialized
     // because the only creators of MessagePackets (sys_channel_write and _call)
     // fill these arrays immediately after creation of the object.
-    msg->reset(new (ptr) MessagePacket(data_size, num_handles,
-                                       reinterpret_cast<Handle**>(ptr + sizeof(MessagePacket))));
+    return CreateCommon(data_size, num_handles, 0u, data_size, msg);
+}
+
+// static
+mx_status_t MessagePacket::CreateWithPages(uint32_t num_pages, uint32_t num_handles,
+                                           mxtl::unique_ptr<MessagePacket>* msg) {
+    if (num_pages == 0 || num_pages > kMaxMessageSize / PAGE_SIZE)
+        return ERR_OUT_OF_RANGE;
+
+    mx_status_t status = CreateCommon(num_pages * PAGE_SIZE, num_handles, num_pages,
+                                      num_pages * sizeof(vm_page_t*), msg);
+    if (status != NO_ERROR)
+        return status;
+
+    // The destructor frees whatever is in the page array, so unlike the
+    // data bytes it has to start out valid.
+    vm_page_t** pages = (*msg)->mutable_pages();
+    for (uint32_t i = 0; i < num_pages; i++)
+        pages[i] = nullptr;
     return NO_ERROR;
 }
 
+// static
+void MessagePacket::operator delete(void* ptr) {
+    uint8_t* raw = static_cast<uint8_t*>(ptr) - kPacketPrefixSize;
+    uint8_t size_class = *raw;
+    if (size_class == kHeapSizeClass) {
+        free(raw);
+    } else {
+        FreePacketBuffer(raw, size_class);
+    }
+}
+
+// static
+void MessagePacket::DumpAllocatorStats() {
+    printf("message packets: %" PRIu64 " heap allocations\n", heap_allocs.load());
+    for (size_t i = 0; i < kNumSizeClasses; i++) {
+        PacketCacheStats total = {};
+        size_t cached = 0;
+        for (uint cpu = 0; cpu < arch_max_num_cpus(); cpu++) {
+            PacketCache& cache = packet_cache[cpu];
+            spin_lock_saved_state_t state;
+            spin_lock_irqsave(&cache.lock, state);
+            cached += cache.count[i];
+            total.allocs += cache.stats[i].allocs;
+            total.misses += cache.stats[i].misses;
+            total.frees += cache.stats[i].frees;
+            total.drains += cache.stats[i].drains;
+            spin_unlock_irqrestore(&cache.lock, state);
+        }
+        printf("  %4zu bytes: %10" PRIu64 " allocs, %8" PRIu64 " cache misses,"
+               " %10" PRIu64 " frees, %8" PRIu64 " drains, %4zu cached\n",
+               kSizeClasses[i], total.allocs, total.misses, total.frees, total.drains, cached);
+    }
+}
+
 MessagePacket::~MessagePacket() {
     if (owns_handles_) {
         // Delete handles out-of-band to avoid the worst case recursive
         // destruction behavior.
         ReapHandles(handles_, num_handles_);
     }
+
+    // Return any pages nobody took to the pmm in one batch.
+    if (num_pages_ > 0) {
+        list_node freed_list;
+        list_initialize(&freed_list);
+        vm_page_t** pages = mutable_pages();
+        for (uint32_t i = 0; i < num_pages_; i++) {
+            if (pages[i])
+                list_add_tail(&freed_list, &pages[i]->free.node);
+        }
+        pmm_free(&freed_list);
+    }
+}
+
+mx_txid_t MessagePacket::GetPageTxid() const {
+    vm_page_t* page = pages()[0];
+    if (page == nullptr)
+        return 0;
+    return *reinterpret_cast<const mx_txid_t*>(paddr_to_kvaddr(vm_page_to_paddr(page)));
 }
 
-MessagePacket::MessagePacket(uint32_t data_size, uint32_t num_handles, Handle** handles)
-    : owns_handles_(false), data_size_(data_size), num_handles_(num_handles), handles_(handles) {
+MessagePacket::MessagePacket(uint32_t data_size, uint32_t num_handles, uint32_t num_pages,
+                             Handle** handles)
+    : owns_handles_(false), data_size_(data_size),
+      num_handles_(num_handles), num_pages_(num_pages), handles_(handles) {
 }
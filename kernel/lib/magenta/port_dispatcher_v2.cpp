@@ -6,6 +6,7 @@
 
 #include <magenta/port_dispatcher_v2.h>
 
+#include <arch/ops.h>
 #include <assert.h>
 #include <err.h>
 #include <new.h>
@@ -17,6 +18,7 @@
 #include <magenta/syscalls/port.h>
 
 #include <kernel/auto_lock.h>
+#include <kernel/timer.h>
 
 constexpr mx_rights_t kDefaultIOPortRightsV2 =
     MX_RIGHT_DUPLICATE | MX_RIGHT_TRANSFER | MX_RIGHT_READ | MX_RIGHT_WRITE;
@@ -107,7 +109,7 @@ mx_status_t PortDispatcherV2::Create(uint32_t options,
 }
 
 PortDispatcherV2::PortDispatcherV2(uint32_t /*options*/)
-    : zero_handles_(false) {
+    : zero_handles_(false), num_packets_(0u) {
 }
 
 PortDispatcherV2::~PortDispatcherV2() {
@@ -160,6 +162,7 @@ mx_status_t PortDispatcherV2::Queue(PortPacket* port_packet,
         }
 
         packets_.push_back(port_packet);
+        __atomic_store_n(&num_packets_, num_packets_ + 1u, __ATOMIC_RELAXED);
         wake_count = sema_.Post();
     }
 
@@ -170,28 +173,61 @@ mx_status_t PortDispatcherV2::Queue(PortPacket* port_packet,
 }
 
 mx_status_t PortDispatcherV2::DeQueue(mx_time_t deadline, mx_port_packet_t* packet) {
+    size_t actual;
+    return DeQueueMany(deadline, 0u, packet, 1u, &actual);
+}
+
+mx_status_t PortDispatcherV2::DeQueueMany(mx_time_t deadline, mx_duration_t spin,
+                                          mx_port_packet_t* packets, size_t count,
+                                          size_t* actual) {
     canary_.Assert();
+    DEBUG_ASSERT(count > 0u);
 
-    PortPacket* port_packet = nullptr;
-    PortObserver* observer = nullptr;
+    // Don't spin past the deadline.
+    lk_time_t now = current_time();
+    lk_time_t spin_end = 0u;
+    if (spin && deadline > now)
+        spin_end = (spin < deadline - now) ? now + spin : deadline;
 
     while (true) {
+        // Packets whose memory the port owns, freed once the lock is dropped.
+        mxtl::DoublyLinkedList<PortPacket*> reap;
+        size_t n = 0u;
         {
             AutoLock al(&lock_);
-            if (packets_.is_empty())
-                goto wait;
+            while (n < count && !packets_.is_empty()) {
+                auto port_packet = packets_.pop_front();
+                if (CopyLocked(port_packet, packets ? &packets[n] : nullptr) ||
+                    port_packet->type() == MX_PKT_TYPE_USER)
+                    reap.push_back(port_packet);
+                ++n;
+            }
+            __atomic_store_n(&num_packets_, num_packets_ - static_cast<uint32_t>(n),
+                             __ATOMIC_RELAXED);
+        }
 
-            port_packet = packets_.pop_front();
-            observer = CopyLocked(port_packet, packet);
+        while (!reap.is_empty()) {
+            auto port_packet = reap.pop_front();
+            if (port_packet->type() == MX_PKT_TYPE_USER)
+                delete port_packet;
+            else
+                delete port_packet->observer;
         }
 
-        if (observer)
-            delete observer;
-        else if (packet && packet->type == MX_PKT_TYPE_USER)
-            delete port_packet;
-        return NO_ERROR;
+        if (n > 0u) {
+            *actual = n;
+            return NO_ERROR;
+        }
+
+        if (current_time() < spin_end) {
+            // A busy server usually gets its next packet within a few
+            // microseconds, much less than it takes to block and be woken.
+            while (__atomic_load_n(&num_packets_, __ATOMIC_RELAXED) == 0u &&
+                   current_time() < spin_end)
+                arch_spinloop_pause();
+            continue;
+        }
 
-wait:
         status_t st = sema_.Wait(deadline);
         if (st != NO_ERROR)
             return st;
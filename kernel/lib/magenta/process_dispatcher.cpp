@@ -15,6 +15,7 @@
 #include <trace.h>
 
 #include <arch/defines.h>
+#include <arch/ops.h>
 
 #include <kernel/auto_lock.h>
 #include <kernel/thread.h>
@@ -329,6 +330,7 @@ void ProcessDispatcher::SetStateLocked(State s) {
             for (auto& handle : handles_) {
                 handle.set_process_id(0u);
             }
+            WaitForHandleLookupsLocked();
             // Delete handles out-of-band to avoid the worst case recursive
             // destruction behavior.
             ReapHandles(&handles_);
@@ -398,6 +400,42 @@ Handle* ProcessDispatcher::GetHandleLocked(mx_handle_t handle_value) {
     return (handle->process_id() == get_koid()) ? handle : nullptr;
 }
 
+uint32_t ProcessDispatcher::BeginHandleLookup(spin_lock_saved_state_t* state) {
+    // Writers spin until the lookup is done, so don't let it be preempted.
+    arch_interrupt_save(state, SPIN_LOCK_FLAG_INTERRUPTS);
+    uint32_t index = handle_lookup_epoch_.load() & 1;
+    handle_lookups_[index].fetch_add(1u);
+    return index;
+}
+
+void ProcessDispatcher::EndHandleLookup(uint32_t index, spin_lock_saved_state_t state) {
+    handle_lookups_[index].fetch_sub(1u);
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+}
+
+Handle* ProcessDispatcher::GetHandleLockless(mx_handle_t handle_value) {
+    // The slot may be freed and reused at any time, so check that it
+    // belongs to us before trusting the rest of it. Once a lookup sees our
+    // koid the handle can't be torn down until EndHandleLookup().
+    auto handle = map_value_to_handle(handle_value, handle_rand_);
+    if (!handle || handle->process_id() != get_koid())
+        return nullptr;
+    return (map_handle_to_value(handle, handle_rand_) == handle_value) ? handle : nullptr;
+}
+
+void ProcessDispatcher::WaitForHandleLookupsLocked() {
+    // The caller has already cleared the process_id of the handles it is
+    // taking, so lookups that start from here on can't return them. Wait
+    // out the stragglers from the previous epoch first, then flip the epoch
+    // and wait for the lookups that were running in the current one.
+    uint32_t index = handle_lookup_epoch_.load() & 1;
+    while (handle_lookups_[index ^ 1].load() != 0)
+        arch_spinloop_pause();
+    handle_lookup_epoch_.fetch_add(1u);
+    while (handle_lookups_[index].load() != 0)
+        arch_spinloop_pause();
+}
+
 void ProcessDispatcher::AddHandle(HandleOwner handle) {
     AutoLock lock(&handle_table_lock_);
     AddHandleLocked(mxtl::move(handle));
@@ -420,6 +458,7 @@ HandleOwner ProcessDispatcher::RemoveHandleLocked(mx_handle_t handle_value) {
 
     handle->set_process_id(0u);
     handles_.erase(*handle);
+    WaitForHandleLookupsLocked();
 
     return HandleOwner(handle);
 }
@@ -430,24 +469,34 @@ void ProcessDispatcher::UndoRemoveHandleLocked(mx_handle_t handle_value) {
 }
 
 mx_koid_t ProcessDispatcher::GetKoidForHandle(mx_handle_t handle_value) {
-    AutoLock lock(&handle_table_lock_);
-    Handle* handle = GetHandleLocked(handle_value);
-    if (!handle)
-        return MX_KOID_INVALID;
-    return handle->dispatcher()->get_koid();
+    spin_lock_saved_state_t state;
+    uint32_t index = BeginHandleLookup(&state);
+    Handle* handle = GetHandleLockless(handle_value);
+    mx_koid_t koid = handle ? handle->dispatcher()->get_koid() : MX_KOID_INVALID;
+    EndHandleLookup(index, state);
+    return koid;
 }
 
 mx_status_t ProcessDispatcher::GetDispatcherInternal(mx_handle_t handle_value,
                                                      mxtl::RefPtr<Dispatcher>* dispatcher,
                                                      mx_rights_t* rights) {
-    AutoLock lock(&handle_table_lock_);
-    Handle* handle = GetHandleLocked(handle_value);
-    if (!handle)
+    spin_lock_saved_state_t state;
+    uint32_t index = BeginHandleLookup(&state);
+    Handle* handle = GetHandleLockless(handle_value);
+    if (!handle) {
+        EndHandleLookup(index, state);
         return ERR_BAD_HANDLE;
+    }
+
+    // Only take references inside the lookup; dropping whatever the out
+    // params held before has to wait until interrupts are back on.
+    mxtl::RefPtr<Dispatcher> disp = handle->dispatcher();
+    mx_rights_t handle_rights = handle->rights();
+    EndHandleLookup(index, state);
 
-    *dispatcher = handle->dispatcher();
+    *dispatcher = mxtl::move(disp);
     if (rights)
-        *rights = handle->rights();
+        *rights = handle_rights;
     return NO_ERROR;
 }
 
@@ -455,17 +504,26 @@ mx_status_t ProcessDispatcher::GetDispatcherWithRightsInternal(mx_handle_t handl
                                                                mx_rights_t desired_rights,
                                                                mxtl::RefPtr<Dispatcher>* dispatcher_out,
                                                                mx_rights_t* out_rights) {
-    AutoLock lock(&handle_table_lock_);
-    Handle* handle = GetHandleLocked(handle_value);
-    if (!handle)
+    spin_lock_saved_state_t state;
+    uint32_t index = BeginHandleLookup(&state);
+    Handle* handle = GetHandleLockless(handle_value);
+    if (!handle) {
+        EndHandleLookup(index, state);
         return ERR_BAD_HANDLE;
+    }
 
-    if (!magenta_rights_check(handle, desired_rights))
+    if (!magenta_rights_check(handle, desired_rights)) {
+        EndHandleLookup(index, state);
         return ERR_ACCESS_DENIED;
+    }
 
-    *dispatcher_out = handle->dispatcher();
+    mxtl::RefPtr<Dispatcher> disp = handle->dispatcher();
+    mx_rights_t handle_rights = handle->rights();
+    EndHandleLookup(index, state);
+
+    *dispatcher_out = mxtl::move(disp);
     if (out_rights)
-        *out_rights = handle->rights();
+        *out_rights = handle_rights;
     return NO_ERROR;
 }
 
@@ -744,6 +802,9 @@ const char* StateToString(ProcessDispatcher::State state) {
 }
 
 bool ProcessDispatcher::IsHandleValid(mx_handle_t handle_value) {
-    AutoLock lock(&handle_table_lock_);
-    return (GetHandleLocked(handle_value) != nullptr);
+    spin_lock_saved_state_t state;
+    uint32_t index = BeginHandleLookup(&state);
+    bool valid = (GetHandleLockless(handle_value) != nullptr);
+    EndHandleLookup(index, state);
+    return valid;
 }
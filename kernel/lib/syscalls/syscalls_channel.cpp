@@ -9,6 +9,9 @@
 #include <trace.h>
 
 #include <kernel/auto_lock.h>
+#include <kernel/vm.h>
+#include <kernel/vm/vm_address_region.h>
+#include <kernel/vm/vm_aspace.h>
 
 #include <lib/ktrace.h>
 #include <lib/user_copy.h>
@@ -31,6 +34,7 @@
 
 constexpr size_t kChannelReadHandlesChunkCount = 16u;
 constexpr size_t kChannelWriteHandlesInlineCount = 8u;
+constexpr size_t kChannelManyInlineCount = 8u;
 
 mx_status_t sys_channel_create(
     uint32_t options, user_ptr<mx_handle_t> _out0, user_ptr<mx_handle_t> _out1) {
@@ -73,6 +77,83 @@ mx_status_t sys_channel_create(
     return NO_ERROR;
 }
 
+// Returns the mapping in |up|'s address space that covers all of the page
+// aligned range [va, va + len), or nullptr if there is no such mapping.
+static mxtl::RefPtr<VmMapping> msg_find_page_mapping(ProcessDispatcher* up, vaddr_t va,
+                                                     size_t len) {
+    if (len == 0 || !IS_PAGE_ALIGNED(va) || !IS_PAGE_ALIGNED(len))
+        return nullptr;
+
+    auto region = up->aspace()->FindRegion(va);
+    if (!region)
+        return nullptr;
+    auto mapping = region->as_vm_mapping();
+    if (!mapping)
+        return nullptr;
+
+    // The mapping may still change under us, so VmMapping::TakePages() and
+    // SupplyPages() check again under the aspace lock.
+    if (va < mapping->base() || len > mapping->size() ||
+        va - mapping->base() > mapping->size() - len)
+        return nullptr;
+    return mapping;
+}
+
+// Makes a page packet out of the pages backing |_bytes|, leaving that range
+// of the caller's buffer reading as zero. Returns an error, with nothing
+// changed, if the pages can't be moved and the message has to be copied.
+static mx_status_t msg_take_pages(ProcessDispatcher* up, user_ptr<const void> _bytes,
+                                  uint32_t num_bytes, uint32_t num_handles,
+                                  mxtl::unique_ptr<MessagePacket>* msg) {
+    vaddr_t va = reinterpret_cast<vaddr_t>(_bytes.get());
+    auto mapping = msg_find_page_mapping(up, va, num_bytes);
+    if (!mapping)
+        return ERR_NOT_SUPPORTED;
+
+    mxtl::unique_ptr<MessagePacket> packet;
+    mx_status_t result = MessagePacket::CreateWithPages(num_bytes / PAGE_SIZE, num_handles,
+                                                        &packet);
+    if (result != NO_ERROR)
+        return result;
+
+    result = mapping->TakePages(va - mapping->base(), packet->num_pages(),
+                                packet->mutable_pages());
+    if (result != NO_ERROR)
+        return result;
+
+    *msg = mxtl::move(packet);
+    return NO_ERROR;
+}
+
+// Copies the payload of |msg| to |_bytes|. The pages of a page packet are
+// moved into the caller's address space instead where possible.
+static mx_status_t msg_get_data(ProcessDispatcher* up, MessagePacket* msg,
+                                user_ptr<void> _bytes, uint32_t num_bytes) {
+    if (msg->num_pages() == 0u)
+        return _bytes.copy_array_to_user(msg->data(), num_bytes);
+
+    vaddr_t va = reinterpret_cast<vaddr_t>(_bytes.get());
+    auto mapping = msg_find_page_mapping(up, va, num_bytes);
+    if (mapping && mapping->SupplyPages(va - mapping->base(), msg->num_pages(),
+                                        msg->mutable_pages()) == NO_ERROR) {
+        // The receiver owns the pages now.
+        for (uint32_t i = 0; i < msg->num_pages(); i++)
+            msg->mutable_pages()[i] = nullptr;
+        return NO_ERROR;
+    }
+
+    // Fall back to copying the pages out one at a time.
+    for (uint32_t i = 0; i < msg->num_pages(); i++) {
+        vm_page_t* page = msg->pages()[i];
+        if (page == nullptr)
+            page = vm_get_zero_page();
+        const void* src = paddr_to_kvaddr(vm_page_to_paddr(page));
+        if (_bytes.byte_offset(i * PAGE_SIZE).copy_array_to_user(src, PAGE_SIZE) != NO_ERROR)
+            return ERR_INVALID_ARGS;
+    }
+    return NO_ERROR;
+}
+
 void msg_get_handles(ProcessDispatcher* up, MessagePacket* msg,
                      user_ptr<mx_handle_t> _handles, uint32_t num_handles) {
     Handle* const* handle_list = msg->handles();
@@ -137,7 +218,7 @@ mx_status_t sys_channel_read(mx_handle_t handle_value, uint32_t options,
         return result;
 
     if (num_bytes > 0u) {
-        if (_bytes.copy_array_to_user(msg->data(), num_bytes) != NO_ERROR)
+        if (msg_get_data(up, msg.get(), _bytes, num_bytes) != NO_ERROR)
             return ERR_INVALID_ARGS;
     }
 
@@ -149,6 +230,102 @@ mx_status_t sys_channel_read(mx_handle_t handle_value, uint32_t options,
     return result;
 }
 
+mx_status_t sys_channel_read_many(mx_handle_t handle_value, uint32_t options,
+                                  user_ptr<mx_channel_msg_t> _msgs, uint32_t num_msgs,
+                                  user_ptr<uint32_t> _actual_msgs) {
+    LTRACEF("handle %d msgs %p num_msgs %u options 0x%x\n",
+            handle_value, _msgs.get(), num_msgs, options);
+
+    auto up = ProcessDispatcher::GetCurrent();
+
+    mxtl::RefPtr<ChannelDispatcher> channel;
+    mx_status_t result = up->GetDispatcherWithRights(handle_value, MX_RIGHT_READ, &channel);
+    if (result != NO_ERROR)
+        return result;
+
+    // Currently MAY_DISCARD is the only allowable option.
+    if (options & ~MX_CHANNEL_READ_MAY_DISCARD)
+        return ERR_NOT_SUPPORTED;
+    if (num_msgs == 0u)
+        return ERR_INVALID_ARGS;
+    if (num_msgs > MX_CHANNEL_MAX_MSGS)
+        return ERR_OUT_OF_RANGE;
+
+    AllocChecker ac;
+    mxtl::InlineArray<mx_channel_msg_t, kChannelManyInlineCount> msgs(&ac, num_msgs);
+    if (!ac.check())
+        return ERR_NO_MEMORY;
+    mxtl::InlineArray<mxtl::unique_ptr<MessagePacket>, kChannelManyInlineCount> packets(
+        &ac, num_msgs);
+    if (!ac.check())
+        return ERR_NO_MEMORY;
+    mxtl::InlineArray<uint32_t, kChannelManyInlineCount> sizes(&ac, num_msgs);
+    if (!ac.check())
+        return ERR_NO_MEMORY;
+    mxtl::InlineArray<uint32_t, kChannelManyInlineCount> handle_counts(&ac, num_msgs);
+    if (!ac.check())
+        return ERR_NO_MEMORY;
+
+    if (_msgs.copy_array_from_user(msgs.get(), num_msgs) != NO_ERROR)
+        return ERR_INVALID_ARGS;
+
+    for (size_t ix = 0; ix < num_msgs; ix++) {
+        sizes[ix] = msgs[ix].num_bytes;
+        handle_counts[ix] = msgs[ix].num_handles;
+    }
+
+    size_t actual;
+    result = channel->ReadMany(sizes.get(), handle_counts.get(), packets.get(), num_msgs,
+                               &actual, options & MX_CHANNEL_READ_MAY_DISCARD);
+    if (result != NO_ERROR && result != ERR_BUFFER_TOO_SMALL)
+        return result;
+
+    // The message that did not fit stays queued, but its sizes are reported.
+    size_t reported = actual;
+    if (result == ERR_BUFFER_TOO_SMALL) {
+        msgs[actual].actual_bytes = sizes[actual];
+        msgs[actual].actual_handles = handle_counts[actual];
+        msgs[actual].status = ERR_BUFFER_TOO_SMALL;
+        reported++;
+    }
+
+    for (size_t ix = 0; ix < actual; ix++) {
+        mx_channel_msg_t& m = msgs[ix];
+        MessagePacket* msg = packets[ix].get();
+        m.actual_bytes = sizes[ix];
+        m.actual_handles = handle_counts[ix];
+
+        // Only MAY_DISCARD hands us messages that are too big.
+        if (m.actual_bytes > m.num_bytes || m.actual_handles > m.num_handles) {
+            m.status = ERR_BUFFER_TOO_SMALL;
+            continue;
+        }
+
+        m.status = NO_ERROR;
+        if (m.actual_bytes > 0u) {
+            if (msg_get_data(up, msg, make_user_ptr(m.bytes), m.actual_bytes) != NO_ERROR) {
+                m.status = ERR_INVALID_ARGS;
+                continue;
+            }
+        }
+        if (m.actual_handles > 0u)
+            msg_get_handles(up, msg, make_user_ptr(m.handles), m.actual_handles);
+
+        ktrace(TAG_CHANNEL_READ, (uint32_t)channel->get_koid(), m.actual_bytes,
+               m.actual_handles, 0);
+    }
+
+    if (_msgs.copy_array_to_user(msgs.get(), reported) != NO_ERROR)
+        return ERR_INVALID_ARGS;
+    if (_actual_msgs) {
+        if (_actual_msgs.copy_to_user(static_cast<uint32_t>(actual)) != NO_ERROR)
+            return ERR_INVALID_ARGS;
+    }
+
+    // As with channel_read, a first message that does not fit fails the call.
+    return actual > 0u ? NO_ERROR : result;
+}
+
 static mx_status_t msg_put_handles(ProcessDispatcher* up, MessagePacket* msg, mx_handle_t* handles,
                                    user_ptr<const mx_handle_t> _handles, uint32_t num_handles,
                                    Dispatcher* channel) {
@@ -198,13 +375,55 @@ static mx_status_t msg_put_handles(ProcessDispatcher* up, MessagePacket* msg, mx
     return NO_ERROR;
 }
 
+// Builds the packet for one outgoing message, moving or copying in the
+// payload and taking the handles out of |up|'s handle table. |handles| is
+// scratch space for |num_handles| handle values, which the caller needs to
+// put the handles back if the packet can't be written after all.
+static mx_status_t msg_create(ProcessDispatcher* up, ChannelDispatcher* channel, uint32_t options,
+                              user_ptr<const void> _bytes, uint32_t num_bytes,
+                              user_ptr<const mx_handle_t> _handles, uint32_t num_handles,
+                              mx_handle_t* handles, mxtl::unique_ptr<MessagePacket>* out) {
+    mxtl::unique_ptr<MessagePacket> msg;
+    if (options & MX_CHANNEL_WRITE_MOVE_PAGES) {
+        // Anything that can't be moved is copied instead.
+        msg_take_pages(up, _bytes, num_bytes, num_handles, &msg);
+    }
+
+    if (!msg) {
+        mx_status_t result = MessagePacket::Create(num_bytes, num_handles, &msg);
+        if (result != NO_ERROR)
+            return result;
+
+        if (num_bytes > 0u) {
+            if (_bytes.copy_array_from_user(msg->mutable_data(), num_bytes) != NO_ERROR)
+                return ERR_INVALID_ARGS;
+        }
+    }
+
+    if (num_handles > 0u) {
+        mx_status_t result = msg_put_handles(up, msg.get(), handles, _handles, num_handles,
+                                             static_cast<Dispatcher*>(channel));
+        if (result) {
+            if (msg->num_pages() > 0u) {
+                // Nothing was sent, so try to give the caller its pages back.
+                msg_get_data(up, msg.get(), make_user_ptr(const_cast<void*>(_bytes.get())),
+                             num_bytes);
+            }
+            return result;
+        }
+    }
+
+    *out = mxtl::move(msg);
+    return NO_ERROR;
+}
+
 mx_status_t sys_channel_write(mx_handle_t handle_value, uint32_t options,
                               user_ptr<const void> _bytes, uint32_t num_bytes,
                               user_ptr<const mx_handle_t> _handles, uint32_t num_handles) {
     LTRACEF("handle %d bytes %p num_bytes %u handles %p num_handles %u options 0x%x\n",
             handle_value, _bytes.get(), num_bytes, _handles.get(), num_handles, options);
 
-    if (options)
+    if (options & ~MX_CHANNEL_WRITE_MOVE_PAGES)
         return ERR_INVALID_ARGS;
 
     auto up = ProcessDispatcher::GetCurrent();
@@ -214,39 +433,124 @@ mx_status_t sys_channel_write(mx_handle_t handle_value, uint32_t options,
     if (result != NO_ERROR)
         return result;
 
+    AllocChecker ac;
+    mxtl::InlineArray<mx_handle_t, kChannelWriteHandlesInlineCount> handles(&ac, num_handles);
+    if (!ac.check())
+        return ERR_NO_MEMORY;
 
     mxtl::unique_ptr<MessagePacket> msg;
-    result = MessagePacket::Create(num_bytes, num_handles, &msg);
+    result = msg_create(up, channel.get(), options, _bytes, num_bytes, _handles, num_handles,
+                        handles.get(), &msg);
     if (result != NO_ERROR)
         return result;
 
-    if (num_bytes > 0u) {
-        if (_bytes.copy_array_from_user(msg->mutable_data(), num_bytes) != NO_ERROR)
+    result = channel->Write(mxtl::move(msg));
+    if (result != NO_ERROR) {
+        // Write failed, put back the handles into this process.
+        AutoLock lock(up->handle_table_lock());
+        for (size_t ix = 0; ix != num_handles; ++ix) {
+            up->UndoRemoveHandleLocked(handles[ix]);
+        }
+    }
+
+    ktrace(TAG_CHANNEL_WRITE, (uint32_t)channel->get_koid(), num_bytes, num_handles, 0);
+    return result;
+}
+
+// Copies the statuses of the first |reported| messages back to the caller,
+// along with how many of them were written.
+static mx_status_t write_many_report(user_ptr<mx_channel_msg_t> _msgs,
+                                     const mx_channel_msg_t* msgs, size_t reported,
+                                     user_ptr<uint32_t> _actual_msgs, uint32_t actual) {
+    if (_msgs.copy_array_to_user(msgs, reported) != NO_ERROR)
+        return ERR_INVALID_ARGS;
+    if (_actual_msgs) {
+        if (_actual_msgs.copy_to_user(actual) != NO_ERROR)
             return ERR_INVALID_ARGS;
     }
+    return NO_ERROR;
+}
+
+mx_status_t sys_channel_write_many(mx_handle_t handle_value, uint32_t options,
+                                   user_ptr<mx_channel_msg_t> _msgs, uint32_t num_msgs,
+                                   user_ptr<uint32_t> _actual_msgs) {
+    LTRACEF("handle %d msgs %p num_msgs %u options 0x%x\n",
+            handle_value, _msgs.get(), num_msgs, options);
+
+    if (options & ~MX_CHANNEL_WRITE_MOVE_PAGES)
+        return ERR_INVALID_ARGS;
+    if (num_msgs == 0u)
+        return ERR_INVALID_ARGS;
+    if (num_msgs > MX_CHANNEL_MAX_MSGS)
+        return ERR_OUT_OF_RANGE;
+
+    auto up = ProcessDispatcher::GetCurrent();
+
+    mxtl::RefPtr<ChannelDispatcher> channel;
+    mx_status_t result = up->GetDispatcherWithRights(handle_value, MX_RIGHT_WRITE, &channel);
+    if (result != NO_ERROR)
+        return result;
 
     AllocChecker ac;
-    mxtl::InlineArray<mx_handle_t, kChannelWriteHandlesInlineCount> handles(&ac, num_handles);
+    mxtl::InlineArray<mx_channel_msg_t, kChannelManyInlineCount> msgs(&ac, num_msgs);
     if (!ac.check())
         return ERR_NO_MEMORY;
-    if (num_handles > 0u) {
-        result = msg_put_handles(up, msg.get(), handles.get(), _handles, num_handles,
-                                 static_cast<Dispatcher*>(channel.get()));
-        if (result)
-            return result;
+    mxtl::InlineArray<mxtl::unique_ptr<MessagePacket>, kChannelManyInlineCount> packets(
+        &ac, num_msgs);
+    if (!ac.check())
+        return ERR_NO_MEMORY;
+
+    if (_msgs.copy_array_from_user(msgs.get(), num_msgs) != NO_ERROR)
+        return ERR_INVALID_ARGS;
+
+    // Build packets until one fails. Everything before it still goes out.
+    size_t built = 0u;
+    for (; built < num_msgs; built++) {
+        mx_channel_msg_t& m = msgs[built];
+        mxtl::InlineArray<mx_handle_t, kChannelWriteHandlesInlineCount> handles(
+            &ac, m.num_handles);
+        if (!ac.check()) {
+            m.status = ERR_NO_MEMORY;
+            break;
+        }
+        m.status = msg_create(up, channel.get(), options,
+                              make_user_ptr<const void>(m.bytes), m.num_bytes,
+                              make_user_ptr<const mx_handle_t>(m.handles), m.num_handles,
+                              handles.get(), &packets[built]);
+        if (m.status != NO_ERROR)
+            break;
+    }
+    // Statuses are reported up to and including the message that failed.
+    size_t reported = mxtl::min<size_t>(built + 1u, num_msgs);
+    if (built == 0u) {
+        write_many_report(_msgs, msgs.get(), reported, _actual_msgs, 0u);
+        return msgs[0].status;
     }
 
-    result = channel->Write(mxtl::move(msg));
+    result = channel->WriteMany(packets.get(), built);
     if (result != NO_ERROR) {
-        // Write failed, put back the handles into this process.
-        AutoLock lock(up->handle_table_lock());
-        for (size_t ix = 0; ix != num_handles; ++ix) {
-            up->UndoRemoveHandleLocked(handles[ix]);
+        // Nothing was written, put back the handles into this process.
+        {
+            AutoLock lock(up->handle_table_lock());
+            for (size_t ix = 0; ix < built; ix++) {
+                Handle* const* handles = packets[ix]->handles();
+                for (size_t hx = 0; hx < packets[ix]->num_handles(); hx++)
+                    up->UndoRemoveHandleLocked(up->MapHandleToValue(handles[hx]));
+            }
         }
+        for (size_t ix = 0; ix < built; ix++)
+            msgs[ix].status = result;
+        write_many_report(_msgs, msgs.get(), reported, _actual_msgs, 0u);
+        return result;
     }
 
-    ktrace(TAG_CHANNEL_WRITE, (uint32_t)channel->get_koid(), num_bytes, num_handles, 0);
-    return result;
+    for (size_t ix = 0; ix < built; ix++) {
+        ktrace(TAG_CHANNEL_WRITE, (uint32_t)channel->get_koid(), msgs[ix].num_bytes,
+               msgs[ix].num_handles, 0);
+    }
+
+    return write_many_report(_msgs, msgs.get(), reported, _actual_msgs,
+                             static_cast<uint32_t>(built));
 }
 
 mx_status_t sys_channel_call(mx_handle_t handle_value, uint32_t options,
@@ -351,7 +655,7 @@ mx_status_t sys_channel_call(mx_handle_t handle_value, uint32_t options,
     }
 
     if (num_bytes > 0u) {
-        if (make_user_ptr(args.rd_bytes).copy_array_to_user(reply->data(), num_bytes) != NO_ERROR) {
+        if (msg_get_data(up, reply.get(), make_user_ptr(args.rd_bytes), num_bytes) != NO_ERROR) {
             result = ERR_INVALID_ARGS;
             goto read_failed;
         }
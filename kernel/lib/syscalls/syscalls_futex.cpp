@@ -37,3 +37,26 @@ mx_status_t sys_futex_requeue(user_ptr<mx_futex_t> wake_ptr, uint32_t wake_count
         wake_ptr, wake_count, current_value,
         requeue_ptr, requeue_count);
 }
+
+mx_status_t sys_futex_wake_op(user_ptr<const mx_futex_t> wake_ptr, uint32_t wake_count,
+                              user_ptr<mx_futex_t> op_ptr, uint32_t op_count, uint32_t op) {
+    LTRACEF("futex %p wake_count %" PRIu32 " op_futex %p op_count %" PRIu32 " op %#" PRIx32 "\n",
+            wake_ptr.get(), wake_count, op_ptr.get(), op_count, op);
+
+    return ProcessDispatcher::GetCurrent()->futex_context()->FutexWakeOp(
+        wake_ptr, wake_count, op_ptr, op_count, op);
+}
+
+mx_status_t sys_futex_lock_pi(user_ptr<mx_futex_t> value_ptr, int new_value, mx_time_t deadline) {
+    LTRACEF("futex %p new_value %d\n", value_ptr.get(), new_value);
+    magenta_check_deadline("futex_lock_pi", deadline);
+
+    return ProcessDispatcher::GetCurrent()->futex_context()->FutexLockPi(
+        value_ptr, new_value, deadline);
+}
+
+mx_status_t sys_futex_unlock_pi(user_ptr<mx_futex_t> value_ptr) {
+    LTRACEF("futex %p\n", value_ptr.get());
+
+    return ProcessDispatcher::GetCurrent()->futex_context()->FutexUnlockPi(value_ptr);
+}
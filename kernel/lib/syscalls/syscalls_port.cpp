@@ -17,12 +17,15 @@
 #include <magenta/process_dispatcher.h>
 #include <magenta/user_copy.h>
 
+#include <mxtl/inline_array.h>
 #include <mxtl/ref_ptr.h>
 
 #include "syscalls_priv.h"
 
 #define LOCAL_TRACE 0
 
+constexpr size_t kPortWaitManyInlineCount = 4u;
+
 mx_status_t sys_port_create(uint32_t options, user_ptr<mx_handle_t> _out) {
     LTRACEF("options %u\n", options);
 
@@ -152,6 +155,43 @@ mx_status_t sys_port_wait(mx_handle_t handle, mx_time_t deadline,
     return NO_ERROR;
 }
 
+mx_status_t sys_port_wait_many(mx_handle_t handle, mx_time_t deadline, mx_duration_t spin,
+                               user_ptr<mx_port_packet_t> _packets, user_ptr<uint32_t> _count) {
+    magenta_check_deadline("port_wait_many", deadline);
+    LTRACEF("handle %d\n", handle);
+
+    uint32_t count;
+    if (_count.copy_from_user(&count) != NO_ERROR)
+        return ERR_INVALID_ARGS;
+    if (count == 0u || count > MX_PORT_WAIT_MANY_MAX)
+        return ERR_INVALID_ARGS;
+    if (spin > MX_PORT_WAIT_MANY_MAX_SPIN)
+        spin = MX_PORT_WAIT_MANY_MAX_SPIN;
+
+    auto up = ProcessDispatcher::GetCurrent();
+
+    mxtl::RefPtr<PortDispatcherV2> port;
+    mx_status_t status = up->GetDispatcherWithRights(handle, MX_RIGHT_WRITE, &port);
+    if (status != NO_ERROR)
+        return status;
+
+    AllocChecker ac;
+    mxtl::InlineArray<mx_port_packet_t, kPortWaitManyInlineCount> packets(&ac, count);
+    if (!ac.check())
+        return ERR_NO_MEMORY;
+
+    size_t actual;
+    status = port->DeQueueMany(deadline, spin, packets.get(), count, &actual);
+    if (status != NO_ERROR)
+        return status;
+
+    if (_packets.copy_array_to_user(packets.get(), actual) != NO_ERROR)
+        return ERR_INVALID_ARGS;
+    if (_count.copy_to_user(static_cast<uint32_t>(actual)) != NO_ERROR)
+        return ERR_INVALID_ARGS;
+    return NO_ERROR;
+}
+
 mx_status_t sys_port_bind(mx_handle_t handle, uint64_t key,
                           mx_handle_t source, mx_signals_t signals) {
     LTRACEF("handle %d source %d\n", handle, source);
@@ -29,11 +29,15 @@
 mx_status_t sys_vmo_create(uint64_t size, uint32_t options, user_ptr<mx_handle_t> _out) {
     LTRACEF("size %#" PRIx64 "\n", size);
 
-    if (options)
+    if (options & ~MX_VMO_CREATE_LARGE_PAGES)
         return ERR_INVALID_ARGS;
 
     // create a vm object
-    mxtl::RefPtr<VmObject> vmo = VmObjectPaged::Create(0, size);
+    mxtl::RefPtr<VmObject> vmo;
+    if (options & MX_VMO_CREATE_LARGE_PAGES)
+        vmo = VmObjectPaged::CreateLargePages(0, size);
+    else
+        vmo = VmObjectPaged::Create(0, size);
     if (!vmo)
         return ERR_NO_MEMORY;
 
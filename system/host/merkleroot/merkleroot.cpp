@@ -30,6 +30,8 @@ int main(int argc, char** argv) {
     mxtl::unique_ptr<uint8_t[]> tree(nullptr);
     char strbuf[merkle::Digest::kLength * 2 + 1];
     merkle::Digest digest;
+    long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t num_threads = num_cpus > 0 ? static_cast<size_t>(num_cpus) : 1;
     for (size_t i = 1; i < argc; ++i) {
         const char* arg = argv[i];
         if (stat(arg, &info) < 0) {
@@ -68,7 +70,8 @@ int main(int argc, char** argv) {
             return 1;
         }
         mx_status_t rc =
-            mt.Create(data, info.st_size, tree.get(), tree_len, &digest);
+            mt.Create(data, info.st_size, tree.get(), tree_len, &digest,
+                      num_threads);
         if (info.st_size != 0 && munmap(data, info.st_size) != 0) {
             perror("munmap");
             fprintf(stderr, "[-] Failed to munmap '%s.\n", arg);
@@ -141,6 +141,10 @@ IOCTL_WRAPPER(ioctl_block_fifo_close, IOCTL_BLOCK_FIFO_CLOSE);
 // 'dev_offset', into the VMO associated with 'vmoid', starting at 'vmo_offset'.
 // If the transaction is out of range, for example if 'length' is too large or if
 // 'dev_offset' is beyond the end of the device, ERR_OUT_OF_RANGE is returned.
+//
+// Reads and writes which arrive on the fifo together may be sorted by device offset and
+// merged with their neighbours, from any txn, into single device operations. Requests
+// which overlap are never reordered if either of them is a write.
 
 #define BLOCKIO_READ      0x0001 // Reads from the Block device into the VMO
 #define BLOCKIO_WRITE     0x0002 // Writes to the Block device from the VMO
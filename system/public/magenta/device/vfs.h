@@ -76,3 +76,25 @@ typedef struct blob_ioctl_config {
 
 // ssize_t ioctl_blobstore_blob_init(int fd, const blob_ioctl_config_t* in);
 IOCTL_WRAPPER_IN(ioctl_blobstore_blob_init, IOCTL_BLOBSTORE_BLOB_INIT, blob_ioctl_config_t);
+
+// Report how well the blobstore's cache of closed blobs is working.
+#define IOCTL_BLOBSTORE_GET_CACHE_INFO \
+    IOCTL(IOCTL_KIND_DEFAULT, IOCTL_FAMILY_VFS, 9)
+// Set the memory (in bytes) the blobstore may keep for closed blobs.
+#define IOCTL_BLOBSTORE_SET_CACHE_LIMIT \
+    IOCTL(IOCTL_KIND_DEFAULT, IOCTL_FAMILY_VFS, 10)
+
+typedef struct blob_cache_info {
+    uint64_t hits;      // Blobs reopened from memory
+    uint64_t misses;    // Blobs reopened from disk
+    uint64_t evictions; // Closed blobs dropped to stay within the limit
+    uint64_t size;      // Memory held by closed blobs
+    uint64_t limit;
+} blob_cache_info_t;
+
+// ssize_t ioctl_blobstore_get_cache_info(int fd, blob_cache_info_t* out);
+IOCTL_WRAPPER_OUT(ioctl_blobstore_get_cache_info, IOCTL_BLOBSTORE_GET_CACHE_INFO,
+                  blob_cache_info_t);
+
+// ssize_t ioctl_blobstore_set_cache_limit(int fd, const uint64_t* in);
+IOCTL_WRAPPER_IN(ioctl_blobstore_set_cache_limit, IOCTL_BLOBSTORE_SET_CACHE_LIMIT, uint64_t);
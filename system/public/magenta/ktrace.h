@@ -34,7 +34,7 @@ __BEGIN_CDECLS
 #define KTRACE_NAMESIZE           (12)
 #define KTRACE_NAMEOFF            (8)
 
-#define KTRACE_VERSION            (0x00020000)
+#define KTRACE_VERSION            (0x00030000)
 
 // Filter Groups
 #define KTRACE_GRP_ALL            0xFFF
@@ -83,10 +83,22 @@ enum {
 #define TAG_PROBE_16(n) KTRACE_TAG(((n)|0x800),KTRACE_GRP_PROBE,16)
 #define TAG_PROBE_24(n) KTRACE_TAG(((n)|0x800),KTRACE_GRP_PROBE,24)
 
+// Filler at the end of a per-cpu chunk of the trace; skip |len| bytes
+#define TAG_PAD(len) KTRACE_TAG(0x002,KTRACE_GRP_META,len)
+
 // Actions for ktrace control
-#define KTRACE_ACTION_START     1 // options = grpmask, 0 = all
+#define KTRACE_ACTION_START     1 // options = grpmask, 0 = all, | a mode flag below
 #define KTRACE_ACTION_STOP      2 // options ignored
 #define KTRACE_ACTION_REWIND    3 // options ignored
 #define KTRACE_ACTION_NEW_PROBE 4 // options ignored, ptr = name
 
+// Modes for KTRACE_ACTION_START. By default, tracing stops when the buffer
+// fills. In ring mode the oldest events are overwritten instead. In stream
+// mode, reads drain whole chunks of the trace (ignoring the offset, and
+// needing room for at least one chunk) and events are dropped while the
+// reader is behind. A TAG_DROPPED record at the start of the next chunk
+// written then gives the total number dropped so far.
+#define KTRACE_START_RING       0x10000
+#define KTRACE_START_STREAM     0x20000
+
 __END_CDECLS
@@ -76,5 +76,10 @@ typedef struct mx_port_packet {
     };
 } mx_port_packet_t;
 
+// The most packets a single mx_port_wait_many() call returns, and the
+// longest it spins before blocking.
+#define MX_PORT_WAIT_MANY_MAX       64u
+#define MX_PORT_WAIT_MANY_MAX_SPIN  MX_USEC(100)
+
 
 __END_CDECLS
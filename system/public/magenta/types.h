@@ -172,6 +172,20 @@ typedef struct {
     uint32_t rd_num_handles;
 } mx_channel_call_args_t;
 
+// Structure for mx_channel_read_many() and mx_channel_write_many(), one per
+// message. The first four fields describe the message buffers and are
+// inputs; the rest are filled in by the kernel.
+typedef struct {
+    void* bytes;
+    mx_handle_t* handles;
+    uint32_t num_bytes;
+    uint32_t num_handles;
+    uint32_t actual_bytes;
+    uint32_t actual_handles;
+    mx_status_t status;
+    uint32_t reserved;
+} mx_channel_msg_t;
+
 // Structure for mx_object_wait_many():
 typedef struct {
     mx_handle_t handle;
@@ -214,6 +228,9 @@ typedef uint32_t mx_rights_t;
 #define MX_VMO_OP_CACHE_CLEAN            8u
 #define MX_VMO_OP_CACHE_CLEAN_INVALIDATE 9u
 
+// VM Object creation options
+#define MX_VMO_CREATE_LARGE_PAGES        1u
+
 // VM Object clone flags
 #define MX_VMO_CLONE_COPY_ON_WRITE       1u
 
@@ -257,6 +274,8 @@ typedef int64_t mx_rel_off_t;
 
 // Channel options and limits.
 #define MX_CHANNEL_READ_MAY_DISCARD         1u
+#define MX_CHANNEL_WRITE_MOVE_PAGES         1u
+#define MX_CHANNEL_MAX_MSGS                 64u
 
 // Socket options and limits.
 #define MX_SOCKET_HALF_CLOSE                1u
@@ -299,8 +318,9 @@ typedef enum {
 // be used in both C and C++. C++ <atomic> defines names which are equivalent
 // to those in <stdatomic.h>, but these are contained in the std namespace.
 //
-// In kernel, the only operation done is a user_copy (of sizeof(int)) inside a
-// lock; otherwise the futex address is treated as a key.
+// In kernel, the only operations done are a user_copy (of sizeof(int)) or an
+// atomic compare and swap inside a lock; otherwise the futex address is
+// treated as a key.
 typedef int mx_futex_t;
 #else
 #ifdef _KERNEL
@@ -310,4 +330,29 @@ typedef atomic_int mx_futex_t;
 #endif
 #endif
 
+// The operation for mx_futex_wake_op(): |op| is applied to the futex at
+// op_ptr with |oparg|, and its waiters are woken if the old value compares
+// to |cmparg| by |cmp|.  Both arguments are 12 bit unsigned values.
+#define MX_FUTEX_OP(op, oparg, cmp, cmparg) \
+    ((((op) & 0xfu) << 28) | (((cmp) & 0xfu) << 24) | \
+     (((oparg) & 0xfffu) << 12) | ((cmparg) & 0xfffu))
+
+#define MX_FUTEX_OP_SET     0u  // *op_ptr = oparg
+#define MX_FUTEX_OP_ADD     1u  // *op_ptr += oparg
+#define MX_FUTEX_OP_OR      2u  // *op_ptr |= oparg
+#define MX_FUTEX_OP_ANDN    3u  // *op_ptr &= ~oparg
+#define MX_FUTEX_OP_XOR     4u  // *op_ptr ^= oparg
+
+#define MX_FUTEX_OP_CMP_EQ  0u  // old == cmparg
+#define MX_FUTEX_OP_CMP_NE  1u  // old != cmparg
+#define MX_FUTEX_OP_CMP_LT  2u  // old < cmparg
+#define MX_FUTEX_OP_CMP_LE  3u  // old <= cmparg
+#define MX_FUTEX_OP_CMP_GT  4u  // old > cmparg
+#define MX_FUTEX_OP_CMP_GE  5u  // old >= cmparg
+
+// A priority inheriting futex holds 0 when unlocked, and otherwise the
+// owning thread's handle, with this bit set while other threads wait in
+// mx_futex_lock_pi().
+#define MX_FUTEX_PI_WAITERS 0x80000000u
+
 __END_CDECLS
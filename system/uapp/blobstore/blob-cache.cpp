@@ -0,0 +1,91 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <string.h>
+
+#include <magenta/process.h>
+#include <magenta/syscalls.h>
+#include <merkle/tree.h>
+
+#include "blob-cache.h"
+
+namespace blobstore {
+
+mx_status_t CopyBitmap(const BlockBitmap& src, BlockBitmap* dst) {
+    mx_status_t status;
+    if ((status = dst->Reset(src.size())) != NO_ERROR) {
+        return status;
+    }
+    // Copy runs of set bits
+    size_t i = src.Scan(0, src.size(), false);
+    while (i < src.size()) {
+        size_t end = src.Scan(i, src.size(), true);
+        dst->Set(i, end);
+        i = src.Scan(end, src.size(), false);
+    }
+    return NO_ERROR;
+}
+
+CachedBlob::~CachedBlob() {
+    if (vmo_merkle_tree_addr != 0) {
+        uint64_t size_merkle = merkle::Tree::GetTreeLength(blob_size);
+        mx_vmar_unmap(mx_vmar_root_self(), vmo_merkle_tree_addr, size_merkle);
+    }
+    if (vmo_blob_addr != 0) {
+        mx_vmar_unmap(mx_vmar_root_self(), vmo_blob_addr, blob_size);
+    }
+    if (vmo_merkle_tree != MX_HANDLE_INVALID) {
+        mx_handle_close(vmo_merkle_tree);
+    }
+    if (vmo_blob != MX_HANDLE_INVALID) {
+        mx_handle_close(vmo_blob);
+    }
+}
+
+mxtl::unique_ptr<CachedBlob> BlobCache::Take(const uint8_t* digest) {
+    mxtl::unique_ptr<CachedBlob> blob = lru_.erase_if([digest](const CachedBlob& b) {
+        return memcmp(b.digest, digest, merkle::Digest::kLength) == 0;
+    });
+    if (blob == nullptr) {
+        misses_++;
+        return nullptr;
+    }
+    hits_++;
+    size_ -= blob->bytes;
+    return blob;
+}
+
+void BlobCache::Put(mxtl::unique_ptr<CachedBlob> blob) {
+    size_ += blob->bytes;
+    lru_.push_front(mxtl::move(blob));
+    Shrink();
+}
+
+void BlobCache::Clear() {
+    lru_.clear();
+    size_ = 0;
+}
+
+void BlobCache::SetLimit(uint64_t bytes) {
+    limit_ = bytes;
+    Shrink();
+}
+
+void BlobCache::GetInfo(blob_cache_info_t* info) const {
+    info->hits = hits_;
+    info->misses = misses_;
+    info->evictions = evictions_;
+    info->size = size_;
+    info->limit = limit_;
+}
+
+void BlobCache::Shrink() {
+    while (size_ > limit_) {
+        mxtl::unique_ptr<CachedBlob> blob = lru_.pop_back();
+        size_ -= blob->bytes;
+        evictions_++;
+    }
+}
+
+} // namespace blobstore
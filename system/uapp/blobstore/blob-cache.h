@@ -0,0 +1,81 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <stdint.h>
+
+#include <bitmap/raw-bitmap.h>
+#include <bitmap/storage.h>
+#include <magenta/device/vfs.h>
+#include <magenta/types.h>
+#include <merkle/digest.h>
+#include <mxtl/intrusive_double_list.h>
+#include <mxtl/macros.h>
+#include <mxtl/unique_ptr.h>
+
+namespace blobstore {
+
+// Memory kept for the contents of blobs which nobody has open, by default
+constexpr uint64_t kBlobCacheDefaultLimit = 64 * (1 << 20);
+
+// One bit per block of a blob
+using BlockBitmap = bitmap::RawBitmapGeneric<bitmap::DefaultStorage>;
+
+// Copies every bit of 'src' into 'dst', which is resized to match.
+mx_status_t CopyBitmap(const BlockBitmap& src, BlockBitmap* dst);
+
+// The in-memory contents of a closed blob: its VMOs (still mapped), and
+// which of their blocks have been read in and verified. Reopening the blob
+// adopts them, so nothing needs to be read or hashed again.
+struct CachedBlob : public mxtl::DoublyLinkedListable<mxtl::unique_ptr<CachedBlob>> {
+    DISALLOW_COPY_ASSIGN_AND_MOVE(CachedBlob);
+    CachedBlob() = default;
+    ~CachedBlob();
+
+    uint8_t digest[merkle::Digest::kLength];
+    uint64_t blob_size = 0;
+    mx_handle_t vmo_merkle_tree = MX_HANDLE_INVALID;
+    uintptr_t vmo_merkle_tree_addr = 0;
+    mx_handle_t vmo_blob = MX_HANDLE_INVALID;
+    uintptr_t vmo_blob_addr = 0;
+
+    BlockBitmap verified;
+    uint64_t verified_blocks = 0;
+    uint64_t bytes = 0;    // Memory the contents hold
+    bool resident = false; // Every block is in memory (see kBlobFlagResident)
+};
+
+// Closed blobs, most recently closed first. Once they hold more than the
+// limit, the least recently closed are dropped.
+//
+// Blobs which are open are not counted against the limit: their pages may be
+// mapped by clients, so they stay until the blob is closed.
+class BlobCache {
+public:
+    DISALLOW_COPY_ASSIGN_AND_MOVE(BlobCache);
+    BlobCache() = default;
+
+    // Removes and returns the contents of blob 'digest', if they are cached.
+    // Counts a hit or a miss.
+    mxtl::unique_ptr<CachedBlob> Take(const uint8_t* digest);
+    void Put(mxtl::unique_ptr<CachedBlob> blob);
+    // Drops every cached blob.
+    void Clear();
+
+    void SetLimit(uint64_t bytes);
+    void GetInfo(blob_cache_info_t* info) const;
+
+private:
+    void Shrink();
+
+    mxtl::DoublyLinkedList<mxtl::unique_ptr<CachedBlob>> lru_;
+    uint64_t size_ = 0;
+    uint64_t limit_ = kBlobCacheDefaultLimit;
+    uint64_t hits_ = 0;
+    uint64_t misses_ = 0;
+    uint64_t evictions_ = 0;
+};
+
+} // namespace blobstore
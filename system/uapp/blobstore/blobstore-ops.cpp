@@ -25,6 +25,7 @@
 namespace blobstore {
 
 VnodeBlob::~VnodeBlob() {
+    blobstore_->CacheBlob(this);
     BlobCloseHandles();
     blobstore_->ReleaseBlob(this);
 }
@@ -153,6 +154,20 @@ ssize_t VnodeBlob::Ioctl(uint32_t op, const void* in_buf, size_t in_len, void* o
             const blob_ioctl_config_t* config = static_cast<const blob_ioctl_config_t*>(in_buf);
             return SpaceAllocate(config->size_data);
         }
+        case IOCTL_BLOBSTORE_GET_CACHE_INFO: {
+            if ((in_len != 0) || (out_len < sizeof(blob_cache_info_t))) {
+                return ERR_INVALID_ARGS;
+            }
+            blobstore_->cache_.GetInfo(static_cast<blob_cache_info_t*>(out_buf));
+            return sizeof(blob_cache_info_t);
+        }
+        case IOCTL_BLOBSTORE_SET_CACHE_LIMIT: {
+            if ((in_len != sizeof(uint64_t)) || (out_len != 0)) {
+                return ERR_INVALID_ARGS;
+            }
+            blobstore_->cache_.SetLimit(*static_cast<const uint64_t*>(in_buf));
+            return NO_ERROR;
+        }
         default: {
             return ERR_NOT_SUPPORTED;
         }
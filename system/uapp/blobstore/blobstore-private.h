@@ -4,10 +4,12 @@
 
 #pragma once
 
+#include "blob-cache.h"
 #include "blobstore.h"
 
 #include <bitmap/raw-bitmap.h>
 #include <merkle/digest.h>
+#include <merkle/tree.h>
 #include <mxtl/algorithm.h>
 #include <mxtl/macros.h>
 #include <mxtl/ref_counted.h>
@@ -40,6 +42,7 @@ constexpr BlobFlags kBlobStateMask        = 0x00FF0000;
 constexpr BlobFlags kBlobFlagSync         = 0x01000000; // The blob is being written to disk
 constexpr BlobFlags kBlobFlagDeletable    = 0x02000000; // This node should be unlinked when closed
 constexpr BlobFlags kBlobFlagDirectory    = 0x04000000; // This node represents the root directory
+constexpr BlobFlags kBlobFlagResident     = 0x08000000; // The VMOs hold the whole blob, as written
 constexpr BlobFlags kBlobOtherMask        = 0xFF000000;
 
 static_assert(((kBlobStateMask | kBlobOtherMask) & V_FLAG_RESERVED_MASK) == 0,
@@ -83,6 +86,13 @@ public:
 
     uint64_t SizeData() const;
 
+    // When a readable blob is closed, its in-memory contents move to the
+    // blob cache; they move back if the blob is reopened before they are
+    // evicted. If AdoptContents fails, the blob takes none of them.
+    bool HasContents() const { return vmo_blob_ != MX_HANDLE_INVALID; }
+    mx_status_t StashContents(CachedBlob* out);
+    mx_status_t AdoptContents(CachedBlob* blob);
+
     // Constructs the "directory" blob
     VnodeBlob(mxtl::RefPtr<Blobstore> bs);
     // Constructs actual blobs
@@ -134,14 +144,27 @@ private:
     mx_status_t Mmap(int flags, size_t len, size_t* off, mx_handle_t* out) final;
     mx_status_t Sync() final;
 
-    // Read both VMOs into memory, if we haven't already.
+    // Create both VMOs, if we haven't already. Their contents are read from
+    // disk lazily, by VerifyRange.
     //
     // TODO(smklein): When we have can register the Blob Store as a pager
     // service, and it can properly handle pages faults on a vnode's contents,
-    // then we can avoid reading the entire blob up-front. Until then, read
-    // the contents of a VMO into memory when it is opened.
+    // then mappings of the blob could fault in (and verify) blocks on demand
+    // too. Until then, CopyVmo must read the whole blob.
     mx_status_t InitVmos();
 
+    // Prepare to verify the blob node by node, once its size is known.
+    mx_status_t InitVerifier();
+
+    // Ensure the blocks of blob data covering [off, off + len) are in the
+    // data VMO and verified, reading them (and the parts of the Merkle tree
+    // above them) from disk if they have not been already.
+    mx_status_t VerifyRange(uint64_t off, uint64_t len);
+
+    // Ensure node 'index' of Merkle tree level 'level' (and every node
+    // above it) is in the Merkle tree VMO and verified.
+    mx_status_t VerifyTreeNode(uint64_t level, uint64_t index);
+
     mx_status_t WriteShared(const void** data, size_t* len, size_t* actual,
                             uint64_t maxlen, mx_handle_t vmo, uint64_t start_block);
 
@@ -157,6 +180,12 @@ private:
     mx_handle_t vmo_blob_;
     uintptr_t   vmo_blob_addr_;
 
+    // One bit per block of the blob on disk (the Merkle tree, then the data),
+    // set once the block has been verified.
+    merkle::Tree tree_;
+    BlockBitmap verified_;
+    uint64_t verified_blocks_;
+
     mx_handle_t readable_event_;
     uint64_t bytes_written_;
 
@@ -209,6 +238,10 @@ public:
     // Removes blob from 'active' hashmap.
     mx_status_t ReleaseBlob(VnodeBlob* blob);
 
+    // Moves the contents of a closing blob into the blob cache, if it is
+    // readable and is not about to be deleted.
+    void CacheBlob(VnodeBlob* blob);
+
     mx_status_t Readdir(void* cookie, void* dirents, size_t len);
 
     int blockfd_;
@@ -244,6 +277,7 @@ private:
                                             MerkleRootTraits,
                                             VnodeBlob::TypeWavlTraits>;
     WAVLTreeByMerkle hash_; // Map of all 'in use' blobs
+    BlobCache cache_;       // Contents of recently closed blobs
 
     RawBitmap block_map_;
     mxtl::unique_ptr<blobstore_inode_t[]> node_map_;
@@ -24,6 +24,11 @@
 
 namespace {
 
+// Blobs are verified lazily, one Merkle tree node (and so one block) at a time
+static_assert(merkle::Tree::kNodeSize == kBlobstoreBlockSize,
+              "Merkle tree nodes must be blobstore blocks");
+constexpr uint64_t kDigestsPerNode = merkle::Tree::kNodeSize / merkle::Digest::kLength;
+
 mx_status_t vmo_read_exact(mx_handle_t h, void* data, uint64_t offset, size_t len) {
     size_t actual;
     mx_status_t status = mx_vmo_read(h, data, offset, len, &actual);
@@ -176,7 +181,6 @@ mx_status_t VnodeBlob::InitVmos() {
     }
 
     mx_status_t status;
-    int fd = blobstore_->blockfd_;
     blobstore_inode_t* inode = &blobstore_->node_map_[map_index_];
     uint64_t merkle_vmo_size = MerkleTreeBlocks(*inode) * kBlobstoreBlockSize;
     uint64_t data_vmo_size = BlobDataBlocks(*inode) * kBlobstoreBlockSize;
@@ -187,14 +191,6 @@ mx_status_t VnodeBlob::InitVmos() {
             goto fail;
         }
 
-        for (uint64_t n = 0; n < MerkleTreeBlocks(*inode); n++) {
-            uint64_t bno = inode->start_block + n;
-            if ((status = vn_fill_block(fd, vmo_merkle_tree_, n, bno)) != NO_ERROR) {
-                error("Failed to fill bno\n");
-                goto fail;
-            }
-        }
-
         if ((status = mx_vmar_map(mx_vmar_root_self(), 0, vmo_merkle_tree_, 0,
                                   merkle_vmo_size,
                                   MX_VM_FLAG_PERM_READ,
@@ -208,14 +204,6 @@ mx_status_t VnodeBlob::InitVmos() {
         goto fail;
     }
 
-    for (uint64_t n = 0; n < BlobDataBlocks(*inode); n++) {
-        uint64_t bno = inode->start_block + n + MerkleTreeBlocks(*inode);
-        if ((status = vn_fill_block(fd, vmo_blob_, n, bno)) != NO_ERROR) {
-            error("Failed to fill bno\n");
-            goto fail;
-        }
-    }
-
     if ((status = mx_vmar_map(mx_vmar_root_self(), 0, vmo_blob_, 0,
                               data_vmo_size,
                               MX_VM_FLAG_PERM_READ,
@@ -223,12 +211,75 @@ mx_status_t VnodeBlob::InitVmos() {
         goto fail;
     }
 
+    if ((status = InitVerifier()) != NO_ERROR) {
+        goto fail;
+    }
+
     return NO_ERROR;
 fail:
     BlobCloseHandles();
     return status;
 }
 
+mx_status_t VnodeBlob::InitVerifier() {
+    auto inode = &blobstore_->node_map_[map_index_];
+    uint64_t size_merkle = merkle::Tree::GetTreeLength(inode->blob_size);
+    mx_status_t status;
+    if ((status = tree_.SetLengths(inode->blob_size, size_merkle)) != NO_ERROR) {
+        return status;
+    }
+    verified_blocks_ = 0;
+    return verified_.Reset(inode->num_blocks);
+}
+
+mx_status_t VnodeBlob::StashContents(CachedBlob* out) {
+    mx_status_t status;
+    if ((status = CopyBitmap(verified_, &out->verified)) != NO_ERROR) {
+        return status;
+    }
+    auto inode = &blobstore_->node_map_[map_index_];
+    memcpy(out->digest, digest_, sizeof(digest_));
+    out->blob_size = inode->blob_size;
+    out->resident = flags_ & kBlobFlagResident;
+    out->verified_blocks = verified_blocks_;
+    out->bytes = (out->resident ? inode->num_blocks : verified_blocks_) * kBlobstoreBlockSize;
+    out->vmo_merkle_tree = vmo_merkle_tree_;
+    out->vmo_merkle_tree_addr = vmo_merkle_tree_addr_;
+    out->vmo_blob = vmo_blob_;
+    out->vmo_blob_addr = vmo_blob_addr_;
+
+    vmo_merkle_tree_addr_ = 0;
+    vmo_blob_addr_ = 0;
+    vmo_merkle_tree_ = MX_HANDLE_INVALID;
+    vmo_blob_ = MX_HANDLE_INVALID;
+    flags_ &= ~kBlobFlagResident;
+    return NO_ERROR;
+}
+
+mx_status_t VnodeBlob::AdoptContents(CachedBlob* blob) {
+    assert(!HasContents());
+    mx_status_t status;
+    if ((status = InitVerifier()) != NO_ERROR) {
+        return status;
+    } else if ((status = CopyBitmap(blob->verified, &verified_)) != NO_ERROR) {
+        return status;
+    }
+    verified_blocks_ = blob->verified_blocks;
+    if (blob->resident) {
+        flags_ |= kBlobFlagResident;
+    }
+    vmo_merkle_tree_ = blob->vmo_merkle_tree;
+    vmo_merkle_tree_addr_ = blob->vmo_merkle_tree_addr;
+    vmo_blob_ = blob->vmo_blob;
+    vmo_blob_addr_ = blob->vmo_blob_addr;
+
+    blob->vmo_merkle_tree_addr = 0;
+    blob->vmo_blob_addr = 0;
+    blob->vmo_merkle_tree = MX_HANDLE_INVALID;
+    blob->vmo_blob = MX_HANDLE_INVALID;
+    return NO_ERROR;
+}
+
 uint64_t VnodeBlob::SizeData() const {
     if (GetState() == kBlobStateReadable) {
         auto inode = &blobstore_->node_map_[map_index_];
@@ -243,6 +294,7 @@ VnodeBlob::VnodeBlob(mxtl::RefPtr<Blobstore> bs, const merkle::Digest& digest) :
     vmo_merkle_tree_addr_(0),
     vmo_blob_(MX_HANDLE_INVALID),
     vmo_blob_addr_(0),
+    verified_blocks_(0),
     readable_event_(MX_HANDLE_INVALID),
     bytes_written_(0),
     flags_(kBlobStateEmpty) {
@@ -256,6 +308,7 @@ VnodeBlob::VnodeBlob(mxtl::RefPtr<Blobstore> bs) :
     vmo_merkle_tree_addr_(0),
     vmo_blob_(MX_HANDLE_INVALID),
     vmo_blob_addr_(0),
+    verified_blocks_(0),
     readable_event_(MX_HANDLE_INVALID),
     bytes_written_(0),
     flags_(kBlobStateEmpty | kBlobFlagDirectory) {}
@@ -324,6 +377,8 @@ mx_status_t VnodeBlob::SpaceAllocate(uint64_t size_data) {
                                      MX_VM_FLAG_PERM_READ | MX_VM_FLAG_PERM_WRITE,
                                      &vmo_blob_addr_)) != NO_ERROR) {
         goto fail;
+    } else if ((status = InitVerifier()) != NO_ERROR) {
+        goto fail;
     }
 
     // Allocate space for the blob
@@ -331,6 +386,8 @@ mx_status_t VnodeBlob::SpaceAllocate(uint64_t size_data) {
         goto fail;
     }
 
+    // Everything read from this blob will have been written through these VMOs
+    flags_ |= kBlobFlagResident;
     SetState(size_merkle != 0 ? kBlobStateMerkleWrite : kBlobStateDataWrite);
     return NO_ERROR;
 
@@ -505,16 +562,10 @@ mx_status_t VnodeBlob::CopyVmo(mx_rights_t rights, mx_handle_t* out) {
     // 1) We could fault in pages on-demand, or
     // 2) We could create a COW subsection of the original VMO.
     //
-    // For now, we aggressively verify the entire VMO up front.
-    merkle::Tree mt;
-    merkle::Digest d;
-    d = ((const uint8_t*) &digest_[0]);
+    // For now, we aggressively verify the entire VMO up front (skipping any
+    // blocks which earlier reads have already verified).
     auto inode = &blobstore_->node_map_[map_index_];
-    uint64_t size_merkle = merkle::Tree::GetTreeLength(inode->blob_size);
-    status = mt.Verify((const void*)vmo_blob_addr_, inode->blob_size,
-                       (const void*)vmo_merkle_tree_addr_, size_merkle,
-                       0, inode->blob_size, d);
-    if (status != NO_ERROR) {
+    if ((status = VerifyRange(0, inode->blob_size)) != NO_ERROR) {
         return status;
     }
 
@@ -531,21 +582,92 @@ mx_status_t VnodeBlob::ReadInternal(void* data, size_t len, size_t off, size_t*
         return status;
     }
 
-    merkle::Tree mt;
-    merkle::Digest d;
-    d = ((const uint8_t*) &digest_[0]);
     auto inode = &blobstore_->node_map_[map_index_];
-    uint64_t size_merkle = merkle::Tree::GetTreeLength(inode->blob_size);
-    status = mt.Verify((const void*)vmo_blob_addr_, inode->blob_size,
-                       (const void*)vmo_merkle_tree_addr_, size_merkle,
-                       off, len, d);
-    if (status != NO_ERROR) {
+    if (off >= inode->blob_size) {
+        *actual = 0;
+        return NO_ERROR;
+    }
+    len = mxtl::min(len, inode->blob_size - off);
+    if ((status = VerifyRange(off, len)) != NO_ERROR) {
         return status;
     }
 
     return mx_vmo_read(vmo_blob_, data, off, len, actual);
 }
 
+mx_status_t VnodeBlob::VerifyRange(uint64_t off, uint64_t len) {
+    if (len == 0) {
+        return NO_ERROR;
+    }
+    auto inode = &blobstore_->node_map_[map_index_];
+    uint64_t merkle_blocks = MerkleTreeBlocks(*inode);
+    merkle::Digest d;
+    d = ((const uint8_t*) &digest_[0]);
+
+    mx_status_t status;
+    uint64_t n_end = (off + len - 1) / kBlobstoreBlockSize + 1;
+    for (uint64_t n = off / kBlobstoreBlockSize; n < n_end; n++) {
+        if (verified_.Get(merkle_blocks + n, merkle_blocks + n + 1)) {
+            continue;
+        }
+        // The data node's digest must be trusted before the node itself
+        if (tree_.levels() != 0) {
+            if ((status = VerifyTreeNode(1, n / kDigestsPerNode)) != NO_ERROR) {
+                return status;
+            }
+        }
+        if (!(flags_ & kBlobFlagResident)) {
+            uint64_t bno = inode->start_block + merkle_blocks + n;
+            if ((status = vn_fill_block(blobstore_->blockfd_, vmo_blob_, n, bno)) != NO_ERROR) {
+                return status;
+            }
+        }
+        if ((status = tree_.VerifyNode((const void*)vmo_blob_addr_,
+                                       (const void*)vmo_merkle_tree_addr_,
+                                       0, n, d)) != NO_ERROR) {
+            error("blobstore: data block %lu failed verification\n", n);
+            return status;
+        }
+        verified_.Set(merkle_blocks + n, merkle_blocks + n + 1);
+        verified_blocks_++;
+    }
+    return NO_ERROR;
+}
+
+mx_status_t VnodeBlob::VerifyTreeNode(uint64_t level, uint64_t index) {
+    uint64_t n = tree_.GetNodeOffset(level, index) / kBlobstoreBlockSize;
+    if (verified_.Get(n, n + 1)) {
+        return NO_ERROR;
+    }
+
+    // The top node is checked against the root digest, the others against
+    // their parents.
+    mx_status_t status;
+    if (level < tree_.levels()) {
+        if ((status = VerifyTreeNode(level + 1, index / kDigestsPerNode)) != NO_ERROR) {
+            return status;
+        }
+    }
+    auto inode = &blobstore_->node_map_[map_index_];
+    if (!(flags_ & kBlobFlagResident)) {
+        uint64_t bno = inode->start_block + n;
+        if ((status = vn_fill_block(blobstore_->blockfd_, vmo_merkle_tree_, n, bno)) != NO_ERROR) {
+            return status;
+        }
+    }
+    merkle::Digest d;
+    d = ((const uint8_t*) &digest_[0]);
+    if ((status = tree_.VerifyNode((const void*)vmo_blob_addr_,
+                                   (const void*)vmo_merkle_tree_addr_,
+                                   level, index, d)) != NO_ERROR) {
+        error("blobstore: merkle block %lu failed verification\n", n);
+        return status;
+    }
+    verified_.Set(n, n + 1);
+    verified_blocks_++;
+    return NO_ERROR;
+}
+
 void VnodeBlob::QueueUnlink() {
     flags_ |= kBlobFlagDeletable;
 }
@@ -588,6 +710,7 @@ void Blobstore::FreeNode(size_t node_index) {
 }
 
 mx_status_t Blobstore::Unmount() {
+    cache_.Clear();
     close(blockfd_);
     return NO_ERROR;
 }
@@ -675,6 +798,19 @@ mx_status_t Blobstore::ReleaseBlob(VnodeBlob* vn) {
     return ERR_NOT_SUPPORTED;
 }
 
+void Blobstore::CacheBlob(VnodeBlob* vn) {
+    if ((vn->GetState() != kBlobStateReadable) || vn->DeletionQueued() || !vn->HasContents()) {
+        return;
+    }
+    // If the contents cannot be cached, they are simply released
+    AllocChecker ac;
+    mxtl::unique_ptr<CachedBlob> blob(new (&ac) CachedBlob);
+    if (!ac.check() || (vn->StashContents(blob.get()) != NO_ERROR)) {
+        return;
+    }
+    cache_.Put(mxtl::move(blob));
+}
+
 typedef struct dircookie {
     size_t index;      // Index into node map
     uint64_t reserved; // Unused
@@ -730,7 +866,15 @@ mx_status_t Blobstore::LookupBlob(const merkle::Digest& digest, mxtl::RefPtr<Vno
                     }
                     vn->SetState(kBlobStateReadable);
                     vn->SetMapIndex(i);
-                    // Delay reading any data from disk until read.
+                    // Pick up whatever is left of the blob from when it was
+                    // last open. Otherwise, delay reading any data from disk
+                    // until read.
+                    mxtl::unique_ptr<CachedBlob> cached = cache_.Take(vn->GetKey());
+                    if (cached != nullptr && vn->AdoptContents(cached.get()) != NO_ERROR) {
+                        // The vnode took none of the contents, so dropping
+                        // them leaves it to be loaded like any uncached blob.
+                        cached.reset();
+                    }
                     hash_.insert(vn.get());
                     *out = mxtl::move(vn);
                 }
@@ -12,6 +12,7 @@ MODULE_NAME := blobstore
 
 # app main
 MODULE_SRCS := \
+    $(LOCAL_DIR)/blob-cache.cpp \
     $(LOCAL_DIR)/blobstore.cpp \
     $(LOCAL_DIR)/blobstore-ops.cpp \
     $(LOCAL_DIR)/main.cpp \
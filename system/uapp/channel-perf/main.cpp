@@ -6,11 +6,14 @@
 #include <errno.h>
 #include <getopt.h>
 #include <inttypes.h>
+#include <limits.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <threads.h>
 
 #include <magenta/compiler.h>
+#include <magenta/process.h>
 #include <magenta/syscalls.h>
 #include <mxtl/unique_ptr.h>
 
@@ -31,12 +34,70 @@ struct TestArgs {
     uint32_t size;
     uint32_t handles;
     uint32_t queue;
+    // Write with MX_CHANNEL_WRITE_MOVE_PAGES from (and read into) a page
+    // aligned buffer, so whole page messages are moved instead of copied.
+    bool move_pages;
+    // With more than one, write and read this many messages per
+    // mx_channel_write_many/mx_channel_read_many call.
+    uint32_t batch;
 };
 
-void do_test(uint32_t duration, const TestArgs& test_args) {
+// Page aligned message storage, mapped from a VMO of our own so the kernel
+// can move its pages in and out.
+class PageBuffer {
+public:
+    PageBuffer() = default;
+    ~PageBuffer() {
+        if (addr_)
+            mx_vmar_unmap(mx_vmar_root_self(), addr_, len_);
+    }
+
+    uint8_t* Map(uint32_t size) {
+        len_ = (size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+        mx_handle_t vmo;
+        __UNUSED mx_status_t status = mx_vmo_create(len_, 0u, &vmo);
+        assert(status == NO_ERROR);
+        status = mx_vmar_map(mx_vmar_root_self(), 0u, vmo, 0u, len_,
+                             MX_VM_FLAG_PERM_READ | MX_VM_FLAG_PERM_WRITE, &addr_);
+        assert(status == NO_ERROR);
+        mx_handle_close(vmo);
+        return reinterpret_cast<uint8_t*>(addr_);
+    }
+
+private:
+    uintptr_t addr_ = 0u;
+    size_t len_ = 0u;
+};
+
+// Writes |test_args.batch| messages in one mx_channel_write_many call and
+// reads them back in one mx_channel_read_many call. Message |i| uses the
+// |test_args.handles| handles starting at |handles[i * test_args.handles]|.
+void write_read_batch(mx_handle_t wr, mx_handle_t rd, uint32_t write_options, uint8_t* data,
+                      mx_handle_t* handles, mx_channel_msg_t* msgs, const TestArgs& test_args) {
     __UNUSED mx_status_t status;
+    for (uint32_t i = 0; i < test_args.batch; i++) {
+        msgs[i] = {data, handles ? &handles[i * test_args.handles] : nullptr,
+                   test_args.size, test_args.handles, 0u, 0u, NO_ERROR, 0u};
+    }
+    uint32_t actual = 0u;
+    status = mx_channel_write_many(wr, write_options, msgs, test_args.batch, &actual);
+    assert(status == NO_ERROR);
+    assert(actual == test_args.batch);
 
-    uint64_t duration_ns = duration * 1000000000ull;
+    status = mx_channel_read_many(rd, 0u, msgs, test_args.batch, &actual);
+    assert(status == NO_ERROR);
+    assert(actual == test_args.batch);
+    for (uint32_t i = 0; i < test_args.batch; i++) {
+        assert(msgs[i].status == NO_ERROR);
+        assert(msgs[i].actual_bytes == test_args.size);
+        assert(msgs[i].actual_handles == test_args.handles);
+    }
+}
+
+// Writes and reads messages on one channel for |duration_ns|. Returns the
+// number of messages written and read.
+uint64_t run_channel(uint64_t duration_ns, const TestArgs& test_args) {
+    __UNUSED mx_status_t status;
 
     // We'll write to mp[0] (and read from mp[1]).
     mx_handle_t mp[2] = {MX_HANDLE_INVALID, MX_HANDLE_INVALID};
@@ -48,25 +109,37 @@ void do_test(uint32_t duration, const TestArgs& test_args) {
     assert(mx_event_create(0u, &event) == NO_ERROR);
 
     // Storage space for our messages' stuff.
-    mxtl::unique_ptr<uint8_t[]> data;
+    mxtl::unique_ptr<uint8_t[]> heap_data;
+    PageBuffer page_data;
+    uint8_t* data = nullptr;
     if (test_args.size) {
-        data.reset(new uint8_t[test_args.size]);
+        if (test_args.move_pages) {
+            data = page_data.Map(test_args.size);
+        } else {
+            heap_data.reset(new uint8_t[test_args.size]);
+            data = heap_data.get();
+        }
         for (uint32_t i = 0; i < test_args.size; i++)
             data[i] = static_cast<uint8_t>(i);
     }
+    const uint32_t write_options = test_args.move_pages ? MX_CHANNEL_WRITE_MOVE_PAGES : 0u;
+    const uint32_t batch = test_args.batch > 1u ? test_args.batch : 1u;
     mxtl::unique_ptr<mx_handle_t[]> handles;
     if (test_args.handles)
-        handles.reset(new mx_handle_t[test_args.handles]);
+        handles.reset(new mx_handle_t[test_args.handles * batch]);
+    mxtl::unique_ptr<mx_channel_msg_t[]> msgs;
+    if (batch > 1u)
+        msgs.reset(new mx_channel_msg_t[batch]);
 
     // Pre-queue |test_args.queue| messages (there'll always be this many messages in the queue).
     for (uint32_t i = 0; i < test_args.queue; i++) {
         duplicate_handles(test_args.handles, event, handles.get());
-        status = mx_channel_write(mp[0], 0u, data.get(), test_args.size,
+        status = mx_channel_write(mp[0], write_options, data, test_args.size,
                                   handles.get(), test_args.handles);
         assert(status == NO_ERROR);
     }
 
-    duplicate_handles(test_args.handles, event, handles.get());
+    duplicate_handles(test_args.handles * batch, event, handles.get());
 
     static constexpr uint32_t big_it_size = 10000;
     uint64_t big_its = 0;
@@ -75,13 +148,19 @@ void do_test(uint32_t duration, const TestArgs& test_args) {
     for (;;) {
         big_its++;
         for (uint32_t i = 0; i < big_it_size; i++) {
-            status = mx_channel_write(mp[0], 0, data.get(), test_args.size,
+            if (batch > 1u) {
+                write_read_batch(mp[0], mp[1], write_options, data, handles.get(),
+                                 msgs.get(), test_args);
+                continue;
+            }
+
+            status = mx_channel_write(mp[0], write_options, data, test_args.size,
                                       handles.get(), test_args.handles);
             assert(status == NO_ERROR);
 
             uint32_t r_size = test_args.size;
             uint32_t r_handles = test_args.handles;
-            status = mx_channel_read(mp[1], 0u, data.get(), handles.get(), r_size,
+            status = mx_channel_read(mp[1], 0u, data, handles.get(), r_size,
                                      r_handles, &r_size, &r_handles);
             assert(status == NO_ERROR);
             assert(r_size == test_args.size);
@@ -93,7 +172,7 @@ void do_test(uint32_t duration, const TestArgs& test_args) {
             break;
     }
 
-    for (uint32_t i = 0; i < test_args.handles; i++) {
+    for (uint32_t i = 0; i < test_args.handles * batch; i++) {
         status = mx_handle_close(handles[i]);
         assert(status == NO_ERROR);
     }
@@ -104,13 +183,62 @@ void do_test(uint32_t duration, const TestArgs& test_args) {
     status = mx_handle_close(mp[1]);
     assert(status == NO_ERROR);
 
+    return big_its * big_it_size * batch;
+}
+
+struct ThreadArgs {
+    uint64_t duration_ns;
+    const TestArgs* test_args;
+    uint64_t its;
+};
+
+int channel_thread(void* arg) {
+    auto args = static_cast<ThreadArgs*>(arg);
+    args->its = run_channel(args->duration_ns, *args->test_args);
+    return 0;
+}
+
+void do_test(uint32_t duration, uint32_t threads, const TestArgs& test_args) {
+    uint64_t duration_ns = duration * 1000000000ull;
+
+    // Each thread gets its own channel, so the threads only contend on
+    // kernel-wide state such as the message packet allocator.
+    uint64_t start_ns = mx_time_get(MX_CLOCK_MONOTONIC);
+    uint64_t its = 0;
+    if (threads == 1u) {
+        its = run_channel(duration_ns, test_args);
+    } else {
+        mxtl::unique_ptr<thrd_t[]> thread_ids(new thrd_t[threads]);
+        mxtl::unique_ptr<ThreadArgs[]> args(new ThreadArgs[threads]);
+        for (uint32_t i = 0; i < threads; i++) {
+            args[i] = {duration_ns, &test_args, 0};
+            __UNUSED int result = thrd_create(&thread_ids[i], channel_thread, &args[i]);
+            assert(result == thrd_success);
+        }
+        for (uint32_t i = 0; i < threads; i++) {
+            thrd_join(thread_ids[i], nullptr);
+            its += args[i].its;
+        }
+    }
+    uint64_t end_ns = mx_time_get(MX_CLOCK_MONOTONIC);
+
     double real_duration = static_cast<double>(end_ns - start_ns) / 1000000000.0;
-    double its_per_second = static_cast<double>(big_its) * big_it_size / real_duration;
-    printf("write/read %" PRIu32 " bytes, %" PRIu32 " handles (%" PRIu32 " pre-queued): "
-               "%.0f iterations/second\n",
-           test_args.size, test_args.handles, test_args.queue, its_per_second);
+    double msgs_per_second = static_cast<double>(its) / real_duration;
+    printf("write/read %" PRIu32 " bytes, %" PRIu32 " handles (%" PRIu32 " pre-queued)",
+           test_args.size, test_args.handles, test_args.queue);
+    if (test_args.move_pages)
+        printf(", moving pages");
+    if (test_args.batch > 1u)
+        printf(", %" PRIu32 " per call", test_args.batch);
+    if (threads > 1u)
+        printf(", %" PRIu32 " threads", threads);
+    printf(": %.0f messages/second\n", msgs_per_second);
 }
 
+// Message sizes compared by the page moving suite.
+constexpr uint32_t kPageSuiteMin = PAGE_SIZE;
+constexpr uint32_t kPageSuiteMax = 65536u;
+
 }  // namespace
 
 int main(int argc, char** argv) {
@@ -121,24 +249,32 @@ int main(int argc, char** argv) {
         "  -h    show help (this)\n"
         "  -o    run single test (default)\n"
         "  -s    run suite (ignores -S/-H/-Q)\n"
+        "  -m    move whole pages instead of copying them; with -s, compare\n"
+        "        copying and moving %" PRIu32 " to %" PRIu32 " byte messages\n"
         "  -n N  set test repetition count to N (default: 1)\n"
         "  -d N  set test duration to N seconds (default: 5)\n"
+        "  -t N  run N writer/reader threads, one channel each (default: 1)\n"
+        "  -b N  write/read N messages per batched call (default: 1)\n"
         "  -S N  set message size to N bytes (default: 10)\n"
         "  -H N  set message handle count to N handles (default: 0)\n"
         "  -Q N  set message pre-queue count to N messages (default: 0)\n";
 
     bool run_suite = false;  // -o/-s
+    bool move_pages = false; // -m
     uint32_t duration = 5;   // -d
     uint32_t repeats = 1;    // -n
+    uint32_t threads = 1;    // -t
     // Ignored when running a suite:
     TestArgs test_args = {
         10,                  // -S (size)
         0,                   // -H (handles)
-        0                    // -Q (queue)
+        0,                   // -Q (queue)
+        false,               // -m (move pages)
+        1                    // -b (batch)
     };
 
     int opt;
-    while ((opt = getopt(argc, argv, "+hosn:d:S:H:Q:")) != -1) {
+    while ((opt = getopt(argc, argv, "+hosmn:d:t:b:S:H:Q:")) != -1) {
         // Our option values are always unsigned numbers.
         uint32_t value = 0;
         if (optarg) {
@@ -152,7 +288,7 @@ int main(int argc, char** argv) {
 
         switch (opt) {
             case 'h':
-                printf(help, argv[0]);
+                printf(help, argv[0], kPageSuiteMin, kPageSuiteMax);
                 return EXIT_SUCCESS;
             case 'o':
                 run_suite = false;
@@ -160,6 +296,10 @@ int main(int argc, char** argv) {
             case 's':
                 run_suite = true;
                 break;
+            case 'm':
+                move_pages = true;
+                test_args.move_pages = true;
+                break;
             case 'n':
                 assert(optarg);
                 repeats = value;
@@ -168,6 +308,14 @@ int main(int argc, char** argv) {
                 assert(optarg);
                 duration = value;
                 break;
+            case 't':
+                assert(optarg);
+                threads = value;
+                break;
+            case 'b':
+                assert(optarg);
+                test_args.batch = value;
+                break;
             case 'S':
                 assert(optarg);
                 test_args.size = value;
@@ -187,6 +335,10 @@ int main(int argc, char** argv) {
     }
     if (optind < argc)
         argument_error(argv[0], "unexpected positional argument");
+    if (threads == 0u)
+        argument_error(argv[0], "thread count must be non-zero");
+    if (test_args.batch == 0u || test_args.batch > MX_CHANNEL_MAX_MSGS)
+        argument_error(argv[0], "batch size must be between 1 and MX_CHANNEL_MAX_MSGS");
 
     for (uint32_t i = 0; i < repeats; i++) {
         if (repeats > 1u) {
@@ -196,7 +348,12 @@ int main(int argc, char** argv) {
                    repeats);
         }
 
-        if (run_suite) {
+        if (run_suite && move_pages) {
+            for (uint32_t size = kPageSuiteMin; size <= kPageSuiteMax; size *= 2) {
+                do_test(duration, threads, {size, 0, 0, false, test_args.batch});
+                do_test(duration, threads, {size, 0, 0, true, test_args.batch});
+            }
+        } else if (run_suite) {
             static constexpr TestArgs suite[] = {
                 {10, 0, 0},
                 {100, 0, 0},
@@ -213,11 +370,13 @@ int main(int argc, char** argv) {
                 {10, 0, 1},
                 {100, 0, 1},
                 {1000, 0, 1},
+                {4000, 0, 0},
+                {16000, 0, 0},
             };
             for (size_t i = 0; i < countof(suite); i++)
-                do_test(duration, suite[i]);
+                do_test(duration, threads, suite[i]);
         } else {
-            do_test(duration, test_args);
+            do_test(duration, threads, test_args);
         }
     }
 
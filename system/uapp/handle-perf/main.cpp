@@ -0,0 +1,259 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <assert.h>
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+
+#include <launchpad/launchpad.h>
+#include <magenta/compiler.h>
+#include <magenta/process.h>
+#include <magenta/processargs.h>
+#include <magenta/syscalls.h>
+#include <mxtl/unique_ptr.h>
+
+// Measures mx_handle_duplicate + mx_handle_close throughput as the number of
+// workers grows. Workers are either separate processes, which only contend on
+// the global handle arena, or threads in this process, which also share one
+// handle table.
+
+namespace {
+
+constexpr char kChildArg[] = "--child";
+
+// How many duplicate/close pairs to run between looking at the clock.
+constexpr uint32_t kBatch = 1000;
+
+void argument_error(const char* argv0, const char* message) {
+    fprintf(stderr, "%s: error: %s\nRun with -h for help.\n", argv0, message);
+    exit(EXIT_FAILURE);
+}
+
+// Waits for |start| to be signaled, then duplicates and closes a handle to a
+// private event for |duration_ns|. Returns the number of pairs done.
+uint64_t run_worker(mx_handle_t start, uint64_t duration_ns) {
+    __UNUSED mx_status_t status;
+
+    mx_handle_t event;
+    status = mx_event_create(0u, &event);
+    assert(status == NO_ERROR);
+
+    status = mx_object_wait_one(start, MX_USER_SIGNAL_0, MX_TIME_INFINITE, nullptr);
+    assert(status == NO_ERROR);
+
+    uint64_t pairs = 0;
+    uint64_t start_ns = mx_time_get(MX_CLOCK_MONOTONIC);
+    do {
+        for (uint32_t i = 0; i < kBatch; i++) {
+            mx_handle_t dup;
+            status = mx_handle_duplicate(event, MX_RIGHT_SAME_RIGHTS, &dup);
+            assert(status == NO_ERROR);
+            status = mx_handle_close(dup);
+            assert(status == NO_ERROR);
+        }
+        pairs += kBatch;
+    } while (mx_time_get(MX_CLOCK_MONOTONIC) - start_ns < duration_ns);
+
+    mx_handle_close(event);
+    return pairs;
+}
+
+// Entry point of a worker process: runs the loop and reports its count back
+// over the channel it was started with.
+int child_main(uint64_t duration_ns) {
+    mx_handle_t start = mx_get_startup_handle(PA_HND(PA_USER0, 0));
+    mx_handle_t report = mx_get_startup_handle(PA_HND(PA_USER1, 0));
+    if (start == MX_HANDLE_INVALID || report == MX_HANDLE_INVALID)
+        return EXIT_FAILURE;
+
+    uint64_t pairs = run_worker(start, duration_ns);
+    if (mx_channel_write(report, 0u, &pairs, sizeof(pairs), nullptr, 0u) != NO_ERROR)
+        return EXIT_FAILURE;
+    return EXIT_SUCCESS;
+}
+
+mx_handle_t launch_child(const char* argv0, uint64_t duration_ns, mx_handle_t start,
+                         mx_handle_t report) {
+    char duration_arg[24];
+    snprintf(duration_arg, sizeof(duration_arg), "%" PRIu64, duration_ns);
+    const char* args[] = {argv0, kChildArg, duration_arg};
+
+    mx_handle_t handles[2];
+    uint32_t ids[2] = {PA_HND(PA_USER0, 0), PA_HND(PA_USER1, 0)};
+    handles[1] = report;
+    if (mx_handle_duplicate(start, MX_RIGHT_SAME_RIGHTS, &handles[0]) != NO_ERROR) {
+        mx_handle_close(report);
+        return MX_HANDLE_INVALID;
+    }
+
+    launchpad_t* lp;
+    launchpad_create(MX_HANDLE_INVALID, "handle-perf worker", &lp);
+    launchpad_load_from_file(lp, argv0);
+    launchpad_set_args(lp, countof(args), args);
+    launchpad_add_handles(lp, countof(handles), handles, ids);
+
+    mx_handle_t proc;
+    const char* errmsg;
+    mx_status_t status = launchpad_go(lp, &proc, &errmsg);
+    if (status != NO_ERROR) {
+        fprintf(stderr, "launch failed (%d): %s\n", status, errmsg);
+        return MX_HANDLE_INVALID;
+    }
+    return proc;
+}
+
+struct ThreadArgs {
+    mx_handle_t start;
+    uint64_t duration_ns;
+    uint64_t pairs;
+};
+
+int worker_thread(void* arg) {
+    auto args = static_cast<ThreadArgs*>(arg);
+    args->pairs = run_worker(args->start, args->duration_ns);
+    return 0;
+}
+
+// Runs |workers| workers at once and returns the total number of pairs done,
+// or 0 on failure.
+uint64_t do_test(const char* argv0, uint32_t workers, bool processes, uint64_t duration_ns) {
+    __UNUSED mx_status_t status;
+
+    mx_handle_t start;
+    status = mx_event_create(0u, &start);
+    assert(status == NO_ERROR);
+
+    uint64_t total = 0;
+    if (processes) {
+        mxtl::unique_ptr<mx_handle_t[]> procs(new mx_handle_t[workers]);
+        mxtl::unique_ptr<mx_handle_t[]> reports(new mx_handle_t[workers]);
+        for (uint32_t i = 0; i < workers; i++) {
+            mx_handle_t report;
+            status = mx_channel_create(0u, &reports[i], &report);
+            assert(status == NO_ERROR);
+            procs[i] = launch_child(argv0, duration_ns, start, report);
+            if (procs[i] == MX_HANDLE_INVALID)
+                return 0;
+        }
+
+        // Let everyone go at once, so the launches are not measured.
+        mx_object_signal(start, 0u, MX_USER_SIGNAL_0);
+
+        for (uint32_t i = 0; i < workers; i++) {
+            status = mx_object_wait_one(reports[i], MX_CHANNEL_READABLE, MX_TIME_INFINITE,
+                                        nullptr);
+            assert(status == NO_ERROR);
+            uint64_t pairs = 0;
+            uint32_t actual;
+            status = mx_channel_read(reports[i], 0u, &pairs, nullptr, sizeof(pairs), 0u,
+                                     &actual, nullptr);
+            if (status != NO_ERROR || actual != sizeof(pairs))
+                pairs = 0;
+            total += pairs;
+
+            mx_object_wait_one(procs[i], MX_PROCESS_SIGNALED, MX_TIME_INFINITE, nullptr);
+            mx_handle_close(procs[i]);
+            mx_handle_close(reports[i]);
+        }
+    } else {
+        mxtl::unique_ptr<thrd_t[]> threads(new thrd_t[workers]);
+        mxtl::unique_ptr<ThreadArgs[]> args(new ThreadArgs[workers]);
+        for (uint32_t i = 0; i < workers; i++) {
+            args[i] = {start, duration_ns, 0};
+            if (thrd_create(&threads[i], worker_thread, &args[i]) != thrd_success)
+                return 0;
+        }
+
+        mx_object_signal(start, 0u, MX_USER_SIGNAL_0);
+
+        for (uint32_t i = 0; i < workers; i++) {
+            thrd_join(threads[i], nullptr);
+            total += args[i].pairs;
+        }
+    }
+
+    mx_handle_close(start);
+    return total;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    if (argc == 3 && strcmp(argv[1], kChildArg) == 0)
+        return child_main(strtoull(argv[2], nullptr, 10));
+
+    static constexpr char help[] =
+        "Usage: %s [options ...]\n"
+        "\n"
+        "Options:\n"
+        "  -h    show help (this)\n"
+        "  -p    run each worker in its own process (default)\n"
+        "  -t    run each worker as a thread in this process\n"
+        "  -n N  run with 1 to N workers (default: number of cpus)\n"
+        "  -d N  set test duration to N seconds (default: 2)\n";
+
+    bool processes = true;                           // -p/-t
+    uint32_t max_workers = mx_system_get_num_cpus(); // -n
+    uint32_t duration = 2;                           // -d
+
+    int opt;
+    while ((opt = getopt(argc, argv, "hptn:d:")) != -1) {
+        // Our option values are always unsigned numbers.
+        uint32_t value = 0;
+        if (optarg) {
+            errno = 0;
+            char* endptr = nullptr;
+            unsigned long long v = strtoull(optarg, &endptr, 10);
+            if (errno != 0 || *endptr != '\0' || v > UINT32_MAX)
+                argument_error(argv[0], "invalid numeric optional value");
+            value = static_cast<uint32_t>(v);
+        }
+
+        switch (opt) {
+            case 'h':
+                printf(help, argv[0]);
+                return EXIT_SUCCESS;
+            case 'p':
+                processes = true;
+                break;
+            case 't':
+                processes = false;
+                break;
+            case 'n':
+                max_workers = value;
+                break;
+            case 'd':
+                duration = value;
+                break;
+            default:  // '?'
+                argument_error(argv[0], "invalid option");
+                break;
+        }
+    }
+    if (optind < argc)
+        argument_error(argv[0], "unexpected positional argument");
+    if (max_workers == 0 || duration == 0)
+        argument_error(argv[0], "worker count and duration must be non-zero");
+
+    uint64_t duration_ns = duration * 1000000000ull;
+    for (uint32_t workers = 1; workers <= max_workers; workers++) {
+        uint64_t pairs = do_test(argv[0], workers, processes, duration_ns);
+        if (pairs == 0) {
+            fprintf(stderr, "run with %" PRIu32 " workers failed\n", workers);
+            return EXIT_FAILURE;
+        }
+        double per_second = static_cast<double>(pairs) / duration;
+        printf("%3" PRIu32 " %s: %12.0f duplicate+close/second, %10.0f per worker\n",
+               workers, processes ? "processes" : "threads  ", per_second,
+               per_second / workers);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -4,6 +4,7 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -175,13 +176,20 @@ int iotime_bread(int argc, char** argv) {
     return 0;
 }
 
-int iotime_fread(int argc, char** argv) {
+// Reads 'total' bytes through the block fifo, 'bufsz' at a time, either
+// linearly or from random (bufsz aligned) offsets below 'total'.
+int iotime_fread(int argc, char** argv, bool random) {
     if (argc != 5) {
         return usage();
     }
     size_t total = number(argv[3]);
     size_t bufsz = number(argv[4]);
 
+    if (random && ((bufsz == 0) || (bufsz > total))) {
+        fprintf(stderr, "error: buffer size must be non-zero and at most the total\n");
+        return -1;
+    }
+
     mx_handle_t vmo;
     if (mx_vmo_create(bufsz, 0, &vmo) != NO_ERROR) {
         fprintf(stderr, "error: out of memory\n");
@@ -224,17 +232,22 @@ int iotime_fread(int argc, char** argv) {
         return -1;
     }
 
+    unsigned int seed = 0;
     mx_time_t t0 = mx_time_get(MX_CLOCK_MONOTONIC);
     size_t n = total;
     while (n > 0) {
         size_t xfer = (n > bufsz) ? bufsz : n;
+        uint64_t dev_offset = total - n;
+        if (random) {
+            dev_offset = (rand_r(&seed) % (total / bufsz)) * bufsz;
+        }
         block_fifo_request_t request = {
             .txnid = txnid,
             .vmoid = vmoid,
             .opcode = BLOCKIO_READ,
             .length = xfer,
             .vmo_offset = 0,
-            .dev_offset = total - n,
+            .dev_offset = dev_offset,
         };
         if (block_fifo_txn(client, &request, 1) != NO_ERROR) {
             fprintf(stderr, "error: block_fifo_txn error\n");
@@ -254,7 +267,8 @@ int usage(void) {
             "usage: iotime <op>...\n\n"
             "   op: lread <device> <bytes> <bufsize>   posix linear read\n"
             "       bread <device> <bytes> <bufsize>   block linear read\n"
-            "       fread <device> <bytes> <bufsize>   fifo linear read\n");
+            "       fread <device> <bytes> <bufsize>   fifo linear read\n"
+            "       frand <device> <bytes> <bufsize>   fifo random read\n");
     return -1;
 }
 
@@ -268,7 +282,9 @@ int main(int argc, char** argv) {
     } else if (!strcmp(argv[1], "bread")) {
         return iotime_bread(argc, argv);
     } else if (!strcmp(argv[1], "fread")) {
-        return iotime_fread(argc, argv);
+        return iotime_fread(argc, argv, false);
+    } else if (!strcmp(argv[1], "frand")) {
+        return iotime_fread(argc, argv, true);
     } else {
         return usage();
     }
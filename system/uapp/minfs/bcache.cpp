@@ -10,15 +10,64 @@
 #include <fs/trace.h>
 
 #include <magenta/new.h>
+#include <mxtl/algorithm.h>
 #include <mxtl/ref_ptr.h>
 #include <mxtl/unique_ptr.h>
 
+#ifdef __Fuchsia__
+#include <magenta/syscalls.h>
+#endif
+
+#include "journal.h"
 #include "minfs.h"
 #include "minfs-private.h"
 
 namespace minfs {
 
+constexpr uint32_t kModeFind = 0;
+constexpr uint32_t kModeLoad = 1;
+constexpr uint32_t kModeZero = 2;
+
+static const char* modestr(uint32_t mode) {
+    switch (mode) {
+    case kModeFind: return "FIND";
+    case kModeLoad: return "LOAD";
+    case kModeZero: return "ZERO";
+    default: return "????";
+    }
+}
+
 mx_status_t Bcache::Readblk(uint32_t bno, void* data) {
+    auto iter = hash_.find(bno);
+    if (iter.IsValid()) {
+        // possibly dirty, and newer than what the device has
+        memcpy(data, iter->data(), blocksize_);
+        return NO_ERROR;
+    }
+    return DevRead(bno, data);
+}
+
+mx_status_t Bcache::Writeblk(uint32_t bno, const void* data, uint32_t flags) {
+    mxtl::RefPtr<BlockNode> blk = Get(bno, kModeZero);
+    if (blk == nullptr) {
+        error("minfs: cannot write block %u\n", bno);
+        return ERR_IO;
+    }
+    memcpy(blk->data(), data, blocksize_);
+    Put(mxtl::move(blk), kBlockDirty | flags);
+    return NO_ERROR;
+}
+
+mx_status_t Bcache::DevRead(uint32_t bno, void* data) {
+    if ((journal_ != nullptr) && journal_->Lookup(bno, data)) {
+        // not written in place yet
+        return NO_ERROR;
+    }
+#ifdef __Fuchsia__
+    if (fifo_client_ != nullptr) {
+        return FifoTransfer(BLOCKIO_READ, bno, 1, data);
+    }
+#endif
     off_t off = bno * kMinfsBlockSize;
     trace(IO, "readblk() bno=%u off=%#llx\n", bno, (unsigned long long)off);
     if (lseek(fd_, off, SEEK_SET) < 0) {
@@ -32,7 +81,12 @@ mx_status_t Bcache::Readblk(uint32_t bno, void* data) {
     return NO_ERROR;
 }
 
-mx_status_t Bcache::Writeblk(uint32_t bno, const void* data) {
+mx_status_t Bcache::DevWrite(uint32_t bno, const void* data) {
+#ifdef __Fuchsia__
+    if (fifo_client_ != nullptr) {
+        return FifoTransfer(BLOCKIO_WRITE, bno, 1, const_cast<void*>(data));
+    }
+#endif
     off_t off = bno * kMinfsBlockSize;
     trace(IO, "writeblk() bno=%u off=%#llx\n", bno, (unsigned long long)off);
     if (lseek(fd_, off, SEEK_SET) < 0) {
@@ -46,34 +100,306 @@ mx_status_t Bcache::Writeblk(uint32_t bno, const void* data) {
     return NO_ERROR;
 }
 
-constexpr uint32_t kModeFind = 0;
-constexpr uint32_t kModeLoad = 1;
-constexpr uint32_t kModeZero = 2;
+mx_status_t Bcache::Readblks(uint32_t bno, uint32_t count, void* data) {
+    // The device must have any dirty block in the range
+    mx_status_t status;
+    if ((status = Writeback()) != NO_ERROR) {
+        return status;
+    }
+#ifdef __Fuchsia__
+    if (fifo_client_ != nullptr) {
+        if ((status = FifoTransfer(BLOCKIO_READ, bno, count, data)) != NO_ERROR) {
+            return status;
+        }
+        if (journal_ != nullptr) {
+            for (uint32_t n = 0; n < count; n++) {
+                journal_->Lookup(bno + n, (void*)((uintptr_t)data + n * blocksize_));
+            }
+        }
+        return NO_ERROR;
+    }
+#endif
+    for (uint32_t n = 0; n < count; n++) {
+        if ((status = DevRead(bno + n, (void*)((uintptr_t)data + n * blocksize_))) != NO_ERROR) {
+            return status;
+        }
+    }
+    return NO_ERROR;
+}
 
-static const char* modestr(uint32_t mode) {
-    switch (mode) {
-    case kModeFind: return "FIND";
-    case kModeLoad: return "LOAD";
-    case kModeZero: return "ZERO";
-    default: return "????";
+#ifdef __Fuchsia__
+mx_status_t Bcache::FifoTransfer(uint16_t opcode, uint32_t bno, uint32_t count, void* data) {
+    assert((data != nullptr) || (count <= kMinfsMaxTransferBlocks));
+    char* iodata = static_cast<char*>(iobuf_->GetData());
+    while (count > 0) {
+        uint32_t xfer = mxtl::min(count, kMinfsMaxTransferBlocks);
+        size_t len = xfer * blocksize_;
+        trace(IO, "fifo %s bno=%u count=%u\n", opcode == BLOCKIO_READ ? "read" : "write",
+              bno, xfer);
+        if (opcode == BLOCKIO_WRITE) {
+            memcpy(iodata, data, len);
+        }
+
+        block_fifo_request_t request;
+        request.vmoid = iobuf_vmoid_;
+        request.opcode = opcode;
+        request.length = len;
+        request.vmo_offset = 0;
+        request.dev_offset = static_cast<uint64_t>(bno) * blocksize_;
+        if (Txn(&request, 1) != NO_ERROR) {
+            error("minfs: cannot %s block %u\n", opcode == BLOCKIO_READ ? "read" : "write", bno);
+            return ERR_IO;
+        }
+
+        if (data == nullptr) {
+            break;
+        } else if (opcode == BLOCKIO_READ) {
+            memcpy(data, iodata, len);
+        }
+        data = (void*)((uintptr_t)data + len);
+        bno += xfer;
+        count -= xfer;
+    }
+    return NO_ERROR;
+}
+
+mx_status_t Bcache::Txn(block_fifo_request_t* requests, size_t count) {
+    mx_status_t status;
+    if ((status = WritebackWait()) != NO_ERROR) {
+        return status;
+    }
+    for (size_t i = 0; i < count; i++) {
+        requests[i].txnid = txnid_;
+    }
+    return block_fifo_txn(fifo_client_, requests, count);
+}
+
+mx_status_t Bcache::AttachVmo(mx_handle_t vmo, vmoid_t* out) {
+    if (fifo_client_ == nullptr) {
+        return ERR_NOT_SUPPORTED;
+    }
+    mx_handle_t xfer_vmo;
+    mx_status_t status = mx_handle_duplicate(vmo, MX_RIGHT_SAME_RIGHTS, &xfer_vmo);
+    if (status != NO_ERROR) {
+        return status;
     }
+    ssize_t r = ioctl_block_attach_vmo(fd_, &xfer_vmo, out);
+    if (r < 0) {
+        return static_cast<mx_status_t>(r);
+    }
+    return NO_ERROR;
+}
+
+mx_status_t Bcache::DetachVmo(vmoid_t vmoid) {
+    block_fifo_request_t request;
+    request.vmoid = vmoid;
+    request.opcode = BLOCKIO_CLOSE_VMO;
+    return Txn(&request, 1);
+}
+
+mx_status_t Bcache::AttachFifo() {
+    mx_handle_t fifo;
+    ssize_t r;
+    if ((r = ioctl_block_get_fifos(fd_, &fifo)) < 0) {
+        return static_cast<mx_status_t>(r);
+    }
+    if ((r = ioctl_block_alloc_txn(fd_, &txnid_)) < 0) {
+        mx_handle_close(fifo);
+        ioctl_block_fifo_close(fd_);
+        return static_cast<mx_status_t>(r);
+    }
+    mx_status_t status;
+    if ((status = block_fifo_create_client(fifo, &fifo_client_)) != NO_ERROR) {
+        mx_handle_close(fifo);
+        ioctl_block_free_txn(fd_, &txnid_);
+        ioctl_block_fifo_close(fd_);
+        return status;
+    }
+    if (((status = MappedVmo::Create(kMinfsMaxTransferBlocks * blocksize_, &iobuf_)) != NO_ERROR) ||
+        ((status = AttachVmo(iobuf_->GetVmo(), &iobuf_vmoid_)) != NO_ERROR)) {
+        ReleaseFifo();
+        return status;
+    }
+    return NO_ERROR;
+}
+
+void Bcache::ReleaseFifo() {
+    if (fifo_client_ == nullptr) {
+        return;
+    }
+    block_fifo_release_client(fifo_client_);
+    fifo_client_ = nullptr;
+    ioctl_block_free_txn(fd_, &txnid_);
+    ioctl_block_fifo_close(fd_);
+    iobuf_.reset();
+}
+
+mx_status_t Bcache::StartWritebackThread() {
+    ssize_t r;
+    if ((r = ioctl_block_alloc_txn(fd_, &wb_txnid_)) < 0) {
+        return static_cast<mx_status_t>(r);
+    }
+    mx_status_t status;
+    if ((status = AttachVmo(wb_buf_->GetVmo(), &wb_vmoid_)) != NO_ERROR) {
+        goto fail;
+    }
+    mtx_init(&wb_lock_, mtx_plain);
+    cnd_init(&wb_cond_);
+    if (thrd_create_with_name(&wb_thread_, WritebackThread, this,
+                              "minfs-writeback") != thrd_success) {
+        status = ERR_NO_RESOURCES;
+        goto fail;
+    }
+    wb_thread_running_ = true;
+    return NO_ERROR;
+
+fail:
+    ioctl_block_free_txn(fd_, &wb_txnid_);
+    return status;
+}
+
+void Bcache::StopWritebackThread() {
+    if (!wb_thread_running_) {
+        return;
+    }
+    WritebackWait();
+    mtx_lock(&wb_lock_);
+    wb_exit_ = true;
+    cnd_broadcast(&wb_cond_);
+    mtx_unlock(&wb_lock_);
+    thrd_join(wb_thread_, nullptr);
+    wb_thread_running_ = false;
+    ioctl_block_free_txn(fd_, &wb_txnid_);
 }
 
+int Bcache::WritebackThread(void* arg) {
+    Bcache* bc = static_cast<Bcache*>(arg);
+    while (true) {
+        mtx_lock(&bc->wb_lock_);
+        while (!bc->wb_pending_ && !bc->wb_exit_) {
+            cnd_wait(&bc->wb_cond_, &bc->wb_lock_);
+        }
+        bool exit = bc->wb_exit_;
+        mtx_unlock(&bc->wb_lock_);
+        if (exit) {
+            return 0;
+        }
+        mx_status_t status = bc->WbIssue();
+        mtx_lock(&bc->wb_lock_);
+        bc->wb_status_ = status;
+        bc->wb_pending_ = false;
+        cnd_broadcast(&bc->wb_cond_);
+        mtx_unlock(&bc->wb_lock_);
+    }
+}
+
+uint32_t Bcache::ReadaheadCount(uint32_t bno) {
+    bool sequential = (bno == last_miss_ + 1);
+    last_miss_ = bno;
+    if (!sequential || (fifo_client_ == nullptr)) {
+        return 0;
+    }
+    uint32_t count = 0;
+    while ((count < kMinfsReadaheadBlocks) && (bno + 1 + count < blockmax_) &&
+           !hash_.find(bno + 1 + count).IsValid()) {
+        count++;
+    }
+    return count;
+}
+
+void Bcache::InstallReadahead(uint32_t bno, uint32_t count) {
+    const char* iodata = static_cast<const char*>(iobuf_->GetData());
+    for (uint32_t n = 1; n <= count; n++) {
+        mxtl::RefPtr<BlockNode> blk;
+        if ((blk = lists_.PopFront(kBlockFree)) != nullptr) {
+            // nothing extra to do
+        } else if (lists_.FrontFlags(kBlockLRU) & kBlockDirty) {
+            // not worth a write-back; the rest of the readahead is dropped
+            return;
+        } else if ((blk = lists_.PopFront(kBlockLRU)) != nullptr) {
+            hash_.erase(*blk);
+        } else {
+            // every block is busy; the rest of the readahead is dropped
+            return;
+        }
+        blk->bno_ = bno + n;
+        hash_.insert(blk);
+        if ((journal_ == nullptr) || !journal_->Lookup(bno + n, blk->data())) {
+            memcpy(blk->data(), iodata + n * blocksize_, blocksize_);
+        }
+        lists_.PushBack(mxtl::move(blk), kBlockLRU);
+    }
+    trace(BCACHE, "[ %u blocks read ahead of bno=%u ]\n", count, bno);
+}
+
+BlockTxn::BlockTxn(Bcache* bc, vmoid_t vmoid) : bc_(bc), vmoid_(vmoid), count_(0) {}
+
+BlockTxn::~BlockTxn() {
+    assert(count_ == 0);
+}
+
+mx_status_t BlockTxn::Enqueue(uint16_t opcode, uint32_t vmo_bno, uint32_t dev_bno,
+                              uint32_t nblocks) {
+    const uint64_t vmo_offset = static_cast<uint64_t>(vmo_bno) * kMinfsBlockSize;
+    const uint64_t dev_offset = static_cast<uint64_t>(dev_bno) * kMinfsBlockSize;
+    const uint64_t length = static_cast<uint64_t>(nblocks) * kMinfsBlockSize;
+    if (count_ > 0) {
+        block_fifo_request_t* last = &requests_[count_ - 1];
+        if ((last->opcode == opcode) &&
+            (last->vmo_offset + last->length == vmo_offset) &&
+            (last->dev_offset + last->length == dev_offset)) {
+            last->length += length;
+            return NO_ERROR;
+        }
+    }
+    if (count_ == MAX_TXN_MESSAGES) {
+        mx_status_t status;
+        if ((status = Flush()) != NO_ERROR) {
+            return status;
+        }
+    }
+    block_fifo_request_t* request = &requests_[count_++];
+    request->vmoid = vmoid_;
+    request->opcode = opcode;
+    request->length = length;
+    request->vmo_offset = vmo_offset;
+    request->dev_offset = dev_offset;
+    return NO_ERROR;
+}
+
+mx_status_t BlockTxn::Flush() {
+    size_t count = count_;
+    count_ = 0;
+    if (count == 0) {
+        return NO_ERROR;
+    }
+    return bc_->Txn(requests_, count);
+}
+#endif
+
 void Bcache::Invalidate() {
+    if (Flush() != NO_ERROR) {
+        error("minfs: write-back failed, dropping dirty blocks\n");
+    }
     mxtl::RefPtr<BlockNode> blk;
     uint32_t n = 0;
     while ((blk = lists_.PopFront(kBlockLRU)) != nullptr) {
         // remove from hash, bno to be reassigned
         assert(!(blk->flags_ & kBlockBusy));
+        blk->flags_ &= ~kBlockDirty;
         hash_.erase(*blk);
         lists_.PushBack(mxtl::move(blk), kBlockFree);
         n++;
     }
+    dirty_count_ = 0;
     trace(BCACHE, "[ %d blocks dropped ]\n", n);
 }
 
 mxtl::RefPtr<BlockNode> Bcache::Get(uint32_t bno, uint32_t mode) {
     trace(BCACHE,"bcache_get() bno=%u %s\n", bno, modestr(mode));
+#ifdef __Fuchsia__
+    uint32_t readahead = 0;
+#endif
     if (bno >= blockmax_) {
         return nullptr;
     }
@@ -83,6 +409,10 @@ mxtl::RefPtr<BlockNode> Bcache::Get(uint32_t bno, uint32_t mode) {
         assert(blk->flags_ & kBlockLRU);
         assert(!(blk->flags_ & kBlockBusy));
         lists_.Erase(blk, kBlockLRU);
+        if (blk->flags_ & kBlockDirty) {
+            // counted again when it is put back
+            dirty_count_--;
+        }
         if (mode == kModeZero) {
             blk->flags_ |= kBlockDirty;
             memset(blk->data(), 0, blocksize_);
@@ -92,13 +422,8 @@ mxtl::RefPtr<BlockNode> Bcache::Get(uint32_t bno, uint32_t mode) {
     if (mode == kModeFind) {
         blk = nullptr;
     } else {
-        if ((blk = lists_.PopFront(kBlockFree)) != nullptr) {
-            // nothing extra to do
-        } else if ((blk = lists_.PopFront(kBlockLRU)) != nullptr) {
-            // remove from hash, bno to be reassigned
-            hash_.erase(*blk);
-        } else {
-            panic("bcache: out of blocks\n");
+        if ((blk = lists_.PopFront(kBlockFree)) == nullptr) {
+            blk = Evict();
         }
         blk->bno_ = bno;
         hash_.insert(blk);
@@ -106,8 +431,22 @@ mxtl::RefPtr<BlockNode> Bcache::Get(uint32_t bno, uint32_t mode) {
         if (mode == kModeZero) {
             blk->flags_ |= kBlockDirty;
             memset(blk->data(), 0, blocksize_);
-        } else if (Readblk(bno, blk->data()) < 0) {
-            panic("bcache: bno %u read error!\n", bno);
+        } else {
+#ifdef __Fuchsia__
+            if ((readahead = ReadaheadCount(bno)) > 0) {
+                // read the whole run with one request, it stays in iobuf_
+                if (FifoTransfer(BLOCKIO_READ, bno, 1 + readahead, nullptr) < 0) {
+                    panic("bcache: bno %u read error!\n", bno);
+                }
+                if ((journal_ == nullptr) || !journal_->Lookup(bno, blk->data())) {
+                    memcpy(blk->data(), iobuf_->GetData(), blocksize_);
+                }
+                goto done;
+            }
+#endif
+            if (DevRead(bno, blk->data()) < 0) {
+                panic("bcache: bno %u read error!\n", bno);
+            }
         }
     }
 done:
@@ -115,6 +454,11 @@ done:
         lists_.PushBack(blk, kBlockBusy);
         trace(BCACHE, "bcache_get bno=%u %p\n", bno, blk.get());
     }
+#ifdef __Fuchsia__
+    if (readahead > 0) {
+        InstallReadahead(bno, readahead);
+    }
+#endif
     return blk;
 }
 
@@ -131,13 +475,313 @@ void Bcache::Put(mxtl::RefPtr<BlockNode> blk, uint32_t flags) {
     assert(blk->flags_ & kBlockBusy);
     // remove from busy list
     lists_.Erase(blk, kBlockBusy);
-    if ((flags | blk->flags_) & kBlockDirty) {
-        if (Writeblk(blk->bno_, blk->data()) < 0) {
+    if (flags & kBlockDirty) {
+        // whoever wrote it last decides whether it is journaled
+        blk->flags_ = (blk->flags_ & ~kBlockData) | (flags & kBlockData);
+    }
+    bool dirty = (flags | blk->flags_) & kBlockDirty;
+    if (dirty) {
+        // written back later, along with its neighbors
+        blk->flags_ |= kBlockDirty;
+        dirty_count_++;
+    }
+    lists_.PushBack(mxtl::move(blk), kBlockLRU);
+    // Within an operation, the journal holds back metadata; leave write-back
+    // to EndOp, or to eviction if the operation is large.
+    if (dirty && (dirty_count_ >= dirty_limit_) && ((op_depth_ == 0) || (journal_ == nullptr))) {
+        if (Writeback() != NO_ERROR) {
+            error("block write error!\n");
+        }
+    }
+}
+
+void Bcache::EndOp() {
+    assert(op_depth_ > 0);
+    if ((--op_depth_ == 0) && (dirty_count_ >= dirty_limit_)) {
+        if (Writeback() != NO_ERROR) {
             error("block write error!\n");
         }
-        blk->flags_ &= ~kBlockDirty;
     }
-    lists_.PushBack(mxtl::move(blk), kBlockLRU);
+}
+
+mxtl::RefPtr<BlockNode> Bcache::Evict() {
+    if (lists_.FrontFlags(kBlockLRU) & kBlockDirty) {
+        // The oldest block must be written before it can be reused;
+        // write back everything which is dirty along with it.
+        if (Writeback() != NO_ERROR) {
+            panic("bcache: write-back error!\n");
+        }
+    }
+    // Metadata held back by the operation in progress is still dirty; pass
+    // over it to the oldest clean block.
+    mxtl::RefPtr<BlockNode> blk;
+    for (uint32_t n = 0; n < kMinfsBlockCacheSize; n++) {
+        if ((blk = lists_.PopFront(kBlockLRU)) == nullptr) {
+            panic("bcache: out of blocks\n");
+        }
+        if (!(blk->flags_ & kBlockDirty)) {
+            // remove from hash, bno to be reassigned
+            hash_.erase(*blk);
+            return blk;
+        }
+        lists_.PushBack(mxtl::move(blk), kBlockLRU);
+    }
+    // The operation has dirtied the whole cache: commit what it has done so
+    // far, giving up its atomicity rather than failing it.
+    error("minfs: operation too large for one journal transaction\n");
+    if (Writeback(true) != NO_ERROR) {
+        panic("bcache: write-back error!\n");
+    }
+    if ((blk = lists_.PopFront(kBlockLRU)) == nullptr) {
+        panic("bcache: out of blocks\n");
+    }
+    hash_.erase(*blk);
+    return blk;
+}
+
+static int bno_compare(const void* a, const void* b) {
+    uint32_t bno_a = (*static_cast<BlockNode* const*>(a))->GetKey();
+    uint32_t bno_b = (*static_cast<BlockNode* const*>(b))->GetKey();
+    return (bno_a > bno_b) - (bno_a < bno_b);
+}
+
+mx_status_t Bcache::Writeback(bool force) {
+    if (dirty_count_ == 0) {
+        return NO_ERROR;
+    }
+    // The previous batch goes out first, so a block written back twice lands
+    // in order (and the staging buffer is free again).
+    mx_status_t status;
+    if ((status = WritebackWait()) != NO_ERROR) {
+        return status;
+    }
+
+    // Metadata is only committed between operations, so that each operation
+    // is in the journal whole or not at all.
+    const bool commit = (journal_ == nullptr) || (op_depth_ == 0) || force;
+    BlockNode* dirty[kMinfsBlockCacheSize];
+    size_t count = 0;
+    uint32_t meta = 0;
+    for (auto& blk : hash_) {
+        if ((blk.flags_ & (kBlockDirty | kBlockLRU)) != (kBlockDirty | kBlockLRU)) {
+            continue;
+        }
+        if ((journal_ != nullptr) && !(blk.flags_ & kBlockData)) {
+            if (!commit) {
+                continue;
+            }
+            meta++;
+        }
+        dirty[count++] = &blk;
+    }
+    if (count == 0) {
+        return NO_ERROR;
+    }
+    qsort(dirty, count, sizeof(dirty[0]), bno_compare);
+    trace(BCACHE, "[ writing back %zu blocks, %u journaled ]\n", count, meta);
+
+    if ((journal_ != nullptr) && (meta > journal_->MaxTxnBlocks())) {
+        error("minfs: %u blocks do not fit in the journal, writing them in place\n", meta);
+        meta = 0;
+    }
+
+    // Blocks written in place go out in the same batch as the journal
+    // transaction, before its commit block. Any that still have a live copy
+    // in the journal need a checkpoint first, or replaying the journal would
+    // overwrite them. The checkpoint is written (and waited for) on its own,
+    // since the transaction may reuse the ring blocks it writes from.
+    bool checkpoint = (meta > 0) && !journal_->Fits(meta);
+    for (size_t i = 0; (journal_ != nullptr) && !checkpoint && (i < count); i++) {
+        bool in_place = (meta == 0) || (dirty[i]->flags_ & kBlockData);
+        checkpoint = in_place && journal_->Contains(dirty[i]->bno_);
+    }
+    if (checkpoint && ((status = CheckpointJournal()) != NO_ERROR)) {
+        return status;
+    }
+
+    BlockNode* journaled[kMinfsBlockCacheSize];
+    uint32_t njournaled = 0;
+    wb_count_ = 0;
+    for (size_t i = 0; i < count; i++) {
+        dirty[i]->flags_ &= ~kBlockDirty;
+        if ((meta > 0) && !(dirty[i]->flags_ & kBlockData)) {
+            journaled[njournaled++] = dirty[i];
+            continue;
+        }
+        dirty[i]->flags_ &= ~kBlockData;
+        uint32_t slot = static_cast<uint32_t>(i - njournaled);
+        memcpy(WbData(kWbStaging, slot), dirty[i]->data(), blocksize_);
+        WbQueue(kWbStaging, slot, dirty[i]->bno_);
+    }
+    if (njournaled > 0) {
+        journal_->Commit(this, journaled, njournaled);
+    }
+    dirty_count_ -= static_cast<uint32_t>(count);
+    return WbSubmit();
+}
+
+mx_status_t Bcache::WritebackWait() {
+#ifdef __Fuchsia__
+    if (wb_thread_running_) {
+        mtx_lock(&wb_lock_);
+        while (wb_pending_) {
+            cnd_wait(&wb_cond_, &wb_lock_);
+        }
+        mx_status_t status = wb_status_;
+        wb_status_ = NO_ERROR;
+        mtx_unlock(&wb_lock_);
+        if (status != NO_ERROR) {
+            error("minfs: write-back failed: %d\n", status);
+            return status;
+        }
+    }
+#endif
+    return NO_ERROR;
+}
+
+mx_status_t Bcache::Flush() {
+    mx_status_t status;
+    if ((status = Writeback()) != NO_ERROR) {
+        return status;
+    }
+    return WritebackWait();
+}
+
+void* Bcache::WbData(uint32_t buf, uint32_t slot) const {
+    if (buf == kWbJournal) {
+        return journal_->Data(slot);
+    }
+#ifdef __Fuchsia__
+    char* data = static_cast<char*>(wb_buf_->GetData());
+#else
+    char* data = wb_buf_.get();
+#endif
+    return data + slot * blocksize_;
+}
+
+void Bcache::WbQueue(uint32_t buf, uint32_t slot, uint32_t bno) {
+    if (wb_count_ > 0) {
+        WbWrite* last = &wb_writes_[wb_count_ - 1];
+        if (!last->barrier && (last->buf == buf) && (last->slot + last->count == slot) &&
+            (last->bno + last->count == bno)) {
+            last->count++;
+            return;
+        }
+    }
+    assert(wb_count_ < wb_writes_.size());
+    WbWrite* write = &wb_writes_[wb_count_++];
+    write->buf = buf;
+    write->slot = slot;
+    write->bno = bno;
+    write->count = 1;
+    write->barrier = false;
+}
+
+void Bcache::WbBarrier() {
+    if (wb_count_ > 0) {
+        wb_writes_[wb_count_ - 1].barrier = true;
+    }
+}
+
+mx_status_t Bcache::WbSubmit() {
+    if (wb_count_ == 0) {
+        return NO_ERROR;
+    }
+#ifdef __Fuchsia__
+    if (wb_thread_running_) {
+        mtx_lock(&wb_lock_);
+        wb_pending_ = true;
+        cnd_broadcast(&wb_cond_);
+        mtx_unlock(&wb_lock_);
+        return NO_ERROR;
+    }
+#endif
+    return WbIssue();
+}
+
+mx_status_t Bcache::WbIssue() {
+#ifdef __Fuchsia__
+    if (wb_thread_running_) {
+        // Send up to MAX_TXN_MESSAGES requests at a time, and no further
+        // than the next barrier, waiting for each group to complete.
+        block_fifo_request_t requests[MAX_TXN_MESSAGES];
+        size_t n = 0;
+        for (size_t i = 0; i < wb_count_; i++) {
+            const WbWrite& write = wb_writes_[i];
+            block_fifo_request_t* request = &requests[n++];
+            request->txnid = wb_txnid_;
+            request->vmoid = (write.buf == kWbJournal) ? jnl_vmoid_ : wb_vmoid_;
+            request->opcode = BLOCKIO_WRITE;
+            request->length = write.count * blocksize_;
+            request->vmo_offset = static_cast<uint64_t>(write.slot) * blocksize_;
+            request->dev_offset = static_cast<uint64_t>(write.bno) * blocksize_;
+            if (write.barrier || (n == MAX_TXN_MESSAGES) || (i + 1 == wb_count_)) {
+                mx_status_t status;
+                if ((status = block_fifo_txn(fifo_client_, requests, n)) != NO_ERROR) {
+                    return status;
+                }
+                n = 0;
+            }
+        }
+        return NO_ERROR;
+    }
+#endif
+    // Synchronous writes are ordered anyway
+    for (size_t i = 0; i < wb_count_; i++) {
+        const WbWrite& write = wb_writes_[i];
+        for (uint32_t n = 0; n < write.count; n++) {
+            mx_status_t status;
+            if ((status = DevWrite(write.bno + n, WbData(write.buf, write.slot + n))) != NO_ERROR) {
+                return status;
+            }
+        }
+    }
+    return NO_ERROR;
+}
+
+mx_status_t Bcache::SetJournal(mxtl::unique_ptr<Journal> journal) {
+    mx_status_t status;
+    if ((status = Flush()) != NO_ERROR) {
+        return status;
+    }
+    // Room for a checkpoint of the whole journal, plus a batch of blocks
+    // both journaled and written in place
+    size_t count = journal->MaxTxnBlocks() + 2 * kMinfsBlockCacheSize + 8;
+    AllocChecker ac;
+    mxtl::Array<WbWrite> writes(new (&ac) WbWrite[count], count);
+    if (!ac.check()) {
+        return ERR_NO_MEMORY;
+    }
+#ifdef __Fuchsia__
+    if (wb_thread_running_ &&
+        ((status = AttachVmo(journal->GetVmo(), &jnl_vmoid_)) != NO_ERROR)) {
+        return status;
+    }
+#endif
+    wb_writes_ = mxtl::move(writes);
+    journal_ = mxtl::move(journal);
+    return NO_ERROR;
+}
+
+mx_status_t Bcache::CheckpointJournal() {
+    if ((journal_ == nullptr) || journal_->Empty()) {
+        return NO_ERROR;
+    }
+    mx_status_t status;
+    if ((status = WritebackWait()) != NO_ERROR) {
+        return status;
+    }
+    wb_count_ = 0;
+    journal_->Checkpoint(this);
+    if ((status = WbSubmit()) != NO_ERROR) {
+        return status;
+    }
+    return WritebackWait();
+}
+
+void Bcache::SetDirtyLimit(uint32_t blocks) {
+    // Leave room in the cache for blocks which are being read
+    dirty_limit_ = mxtl::max(1u, mxtl::min(blocks, kMinfsBlockCacheSize / 2));
 }
 
 mx_status_t Bcache::Read(uint32_t bno, void* data, uint32_t off, uint32_t len) {
@@ -173,6 +817,9 @@ mx_status_t Bcache::Write(uint32_t bno, const void* data, uint32_t off, uint32_t
 }
 
 int Bcache::Sync() {
+    if (Flush() != NO_ERROR) {
+        return -1;
+    }
     return fsync(fd_);
 }
 
@@ -183,23 +830,55 @@ mx_status_t Bcache::Create(Bcache** out, int fd, uint32_t blockmax, uint32_t blo
     if (!ac.check()) {
         return ERR_NO_MEMORY;
     }
+    mx_status_t status;
     while (num > 0) {
-        mx_status_t status;
         if ((status = BlockNode::Create(bc.get())) != NO_ERROR) {
             return status;
         }
         num--;
     }
+    // The staging buffer holds one copy of every block in the cache
+    size_t count = kMinfsBlockCacheSize + 8;
+    bc->wb_writes_.reset(new (&ac) WbWrite[count], count);
+    if (!ac.check()) {
+        return ERR_NO_MEMORY;
+    }
+#ifdef __Fuchsia__
+    if ((status = MappedVmo::Create(kMinfsBlockCacheSize * blocksize, &bc->wb_buf_)) != NO_ERROR) {
+        return status;
+    }
+#else
+    bc->wb_buf_.reset(new (&ac) char[kMinfsBlockCacheSize * blocksize]);
+    if (!ac.check()) {
+        return ERR_NO_MEMORY;
+    }
+#endif
+#ifdef __Fuchsia__
+    if (bc->AttachFifo() != NO_ERROR) {
+        trace(IO, "minfs: no block fifo, using fd I/O\n");
+    } else if (bc->StartWritebackThread() != NO_ERROR) {
+        trace(IO, "minfs: no write-back thread, writing back synchronously\n");
+    }
+#endif
     *out = bc.release();
     return NO_ERROR;
 }
 
 int Bcache::Close() {
-    return close(fd_);
+    mx_status_t status = Flush();
+    if (status == NO_ERROR) {
+        status = CheckpointJournal();
+    }
+#ifdef __Fuchsia__
+    StopWritebackThread();
+    ReleaseFifo();
+#endif
+    int r = close(fd_);
+    return (status != NO_ERROR) ? -1 : r;
 }
 
 Bcache::Bcache(int fd, uint32_t blockmax, uint32_t blocksize) :
-    fd_(fd), blockmax_(blockmax), blocksize_(blocksize) {}
+    dirty_limit_(kMinfsDirtyLimit), fd_(fd), blockmax_(blockmax), blocksize_(blocksize) {}
 Bcache::~Bcache() {}
 
 size_t BcacheLists::SizeAllSlow() const {
@@ -234,6 +913,11 @@ mxtl::RefPtr<BlockNode> BcacheLists::Erase(mxtl::RefPtr<BlockNode> blk, uint32_t
     return ptr;
 }
 
+uint32_t BcacheLists::FrontFlags(uint32_t block_type) {
+    auto ll = GetList(block_type & kBlockLLFlags);
+    return ll->is_empty() ? 0 : ll->front().flags_;
+}
+
 BcacheLists::LinkedList* BcacheLists::GetList(uint32_t block_type) {
     switch (block_type) {
         case kBlockBusy : return &list_busy_;
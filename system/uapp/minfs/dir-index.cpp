@@ -0,0 +1,164 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <string.h>
+
+#include <magenta/new.h>
+
+#include "dir-index.h"
+#include "misc.h"
+
+namespace minfs {
+namespace {
+
+// Directory offsets never reach these, so they mark unused slots
+constexpr uint32_t kSlotEmpty   = UINT32_MAX;
+constexpr uint32_t kSlotRemoved = UINT32_MAX - 1;
+
+constexpr size_t kMinSlots = 64;
+
+} // namespace anonymous
+
+mx_status_t DirIndex::Create(uint32_t ino, mxtl::unique_ptr<DirIndex>* out) {
+    AllocChecker ac;
+    mxtl::unique_ptr<DirIndex> index(new (&ac) DirIndex(ino));
+    if (!ac.check()) {
+        return ERR_NO_MEMORY;
+    }
+    mx_status_t status;
+    if ((status = index->Resize(kMinSlots)) != NO_ERROR) {
+        return status;
+    }
+    *out = mxtl::move(index);
+    return NO_ERROR;
+}
+
+uint32_t DirIndex::Hash(const char* name, size_t len) {
+    return fnv1a32(name, len);
+}
+
+// Returns the slot holding (hash, off), or with off == kSlotEmpty, the first
+// slot that (hash, off) could be inserted into.
+DirIndex::Slot* DirIndex::Probe(uint32_t hash, uint32_t off) {
+    const size_t mask = slots_.size() - 1;
+    Slot* free_slot = nullptr;
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+        Slot* slot = &slots_[i];
+        if (slot->off == kSlotEmpty) {
+            return free_slot ? free_slot : slot;
+        } else if (slot->off == kSlotRemoved) {
+            if (free_slot == nullptr) {
+                free_slot = slot;
+            }
+        } else if ((slot->hash == hash) && (slot->off == off)) {
+            return slot;
+        }
+    }
+}
+
+mx_status_t DirIndex::Resize(size_t count) {
+    AllocChecker ac;
+    Slot* slots = new (&ac) Slot[count];
+    if (!ac.check()) {
+        return ERR_NO_MEMORY;
+    }
+    for (size_t i = 0; i < count; i++) {
+        slots[i].off = kSlotEmpty;
+    }
+    mxtl::Array<Slot> old(mxtl::move(slots_));
+    slots_.reset(slots, count);
+    tombstones_ = 0;
+    for (size_t i = 0; i < old.size(); i++) {
+        if ((old[i].off != kSlotEmpty) && (old[i].off != kSlotRemoved)) {
+            *Probe(old[i].hash, old[i].off) = old[i];
+        }
+    }
+    return NO_ERROR;
+}
+
+mx_status_t DirIndex::Insert(const char* name, size_t len, uint32_t off) {
+    // Keep the table at most half full, counting removed slots
+    if ((used_ + tombstones_ + 1) * 2 > slots_.size()) {
+        size_t count = slots_.size();
+        if ((used_ + 1) * 4 > count) {
+            count *= 2;
+        }
+        mx_status_t status;
+        if ((status = Resize(count)) != NO_ERROR) {
+            return status;
+        }
+    }
+    uint32_t hash = Hash(name, len);
+    Slot* slot = Probe(hash, off);
+    if (slot->off == kSlotRemoved) {
+        tombstones_--;
+    } else if (slot->off != kSlotEmpty) {
+        return NO_ERROR;
+    }
+    slot->hash = hash;
+    slot->off = off;
+    used_++;
+    return NO_ERROR;
+}
+
+void DirIndex::Remove(const char* name, size_t len, uint32_t off) {
+    Slot* slot = Probe(Hash(name, len), off);
+    if ((slot->off == kSlotEmpty) || (slot->off == kSlotRemoved)) {
+        return;
+    }
+    slot->off = kSlotRemoved;
+    used_--;
+    tombstones_++;
+}
+
+bool DirIndex::Next(uint32_t hash, size_t* cursor, uint32_t* off) const {
+    const size_t mask = slots_.size() - 1;
+    // '*cursor' counts the slots of the probe chain already visited
+    for (size_t i = (hash + *cursor) & mask; *cursor < slots_.size(); i = (i + 1) & mask) {
+        const Slot* slot = &slots_[i];
+        (*cursor)++;
+        if (slot->off == kSlotEmpty) {
+            break;
+        } else if ((slot->off != kSlotRemoved) && (slot->hash == hash)) {
+            *off = slot->off;
+            return true;
+        }
+    }
+    *cursor = slots_.size();
+    return false;
+}
+
+DirIndex* DirIndexCache::Get(uint32_t ino, uint32_t seq) {
+    auto iter = lru_.find_if([ino](const DirIndex& index) { return index.Ino() == ino; });
+    if (iter == lru_.end()) {
+        return nullptr;
+    }
+    mxtl::unique_ptr<DirIndex> index = lru_.erase(iter);
+    if (index->Seq() != seq) {
+        // The directory changed behind the index's back
+        count_--;
+        return nullptr;
+    }
+    DirIndex* raw = index.get();
+    lru_.push_front(mxtl::move(index));
+    return raw;
+}
+
+void DirIndexCache::Put(mxtl::unique_ptr<DirIndex> index) {
+    Evict(index->Ino());
+    if (count_ == kMinfsDirIndexCacheSize) {
+        lru_.pop_back();
+        count_--;
+    }
+    lru_.push_front(mxtl::move(index));
+    count_++;
+}
+
+void DirIndexCache::Evict(uint32_t ino) {
+    if (lru_.erase_if([ino](const DirIndex& index) { return index.Ino() == ino; }) != nullptr) {
+        count_--;
+    }
+}
+
+} // namespace minfs
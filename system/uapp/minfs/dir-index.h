@@ -0,0 +1,100 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <stdint.h>
+
+#include <magenta/types.h>
+#include <mxtl/array.h>
+#include <mxtl/intrusive_double_list.h>
+#include <mxtl/macros.h>
+#include <mxtl/unique_ptr.h>
+
+namespace minfs {
+
+// Directories smaller than this are scanned linearly rather than indexed
+constexpr uint32_t kMinfsDirIndexMinSize = 8192;
+// Number of directory indices kept by the filesystem at once
+constexpr uint32_t kMinfsDirIndexCacheSize = 8;
+
+// An in-memory index of the live entries of one directory, mapping a hash of
+// each name to the offset of its dirent. It is built by a single scan of the
+// directory, and kept up to date by the operations that modify it; the
+// on-disk format is unchanged.
+//
+// The index is only a hint: every candidate offset must be checked against
+// the dirent found there. It is valid as long as 'Seq()' matches the seq_num
+// of the directory inode.
+class DirIndex : public mxtl::DoublyLinkedListable<mxtl::unique_ptr<DirIndex>> {
+public:
+    DISALLOW_COPY_ASSIGN_AND_MOVE(DirIndex);
+    static mx_status_t Create(uint32_t ino, mxtl::unique_ptr<DirIndex>* out);
+
+    static uint32_t Hash(const char* name, size_t len);
+
+    // Record that the entry 'name' lives at directory offset 'off'.
+    mx_status_t Insert(const char* name, size_t len, uint32_t off);
+    void Remove(const char* name, size_t len, uint32_t off);
+
+    // Iterate over the offsets of entries whose name has the hash 'hash',
+    // starting with '*cursor' set to zero. Returns false when done.
+    bool Next(uint32_t hash, size_t* cursor, uint32_t* off) const;
+
+    uint32_t Ino() const { return ino_; }
+    uint32_t Seq() const { return seq_; }
+    void SetSeq(uint32_t seq) { seq_ = seq; }
+
+    // Offset of the last record in the directory, which holds all the space
+    // past the end of the directory.
+    uint32_t LastOffset() const { return last_off_; }
+    void SetLastOffset(uint32_t off) { last_off_ = off; }
+
+    // Rough count of the free dirent space before the last record. New
+    // entries are appended after the last record until enough has built up to
+    // be worth searching for.
+    bool ShouldFillHoles() const { return hole_bytes_ >= kMinfsDirIndexMinSize; }
+    void AddHole(uint32_t bytes) { hole_bytes_ += bytes; }
+    void FillHole(uint32_t bytes) { hole_bytes_ -= (bytes < hole_bytes_) ? bytes : hole_bytes_; }
+    void ClearHoles() { hole_bytes_ = 0; }
+
+private:
+    struct Slot {
+        uint32_t hash;
+        uint32_t off;
+    };
+
+    DirIndex(uint32_t ino) : ino_(ino) {}
+    Slot* Probe(uint32_t hash, uint32_t off);
+    mx_status_t Resize(size_t count);
+
+    uint32_t ino_;
+    uint32_t seq_ = 0;
+    uint32_t last_off_ = 0;
+    uint32_t hole_bytes_ = 0;
+    size_t used_ = 0;       // Live slots
+    size_t tombstones_ = 0; // Removed slots, which probes step over
+    mxtl::Array<Slot> slots_;
+};
+
+// The most recently used directory indices, keyed by inode number. Indices
+// are owned here rather than by vnodes, which come and go with each operation
+// on a directory which is not held open.
+class DirIndexCache {
+public:
+    DISALLOW_COPY_ASSIGN_AND_MOVE(DirIndexCache);
+    DirIndexCache() = default;
+
+    // Returns the index of directory 'ino' if it is cached and current.
+    DirIndex* Get(uint32_t ino, uint32_t seq);
+    // Add an index, evicting the least recently used one if the cache is full.
+    void Put(mxtl::unique_ptr<DirIndex> index);
+    void Evict(uint32_t ino);
+
+private:
+    mxtl::DoublyLinkedList<mxtl::unique_ptr<DirIndex>> lru_;
+    size_t count_ = 0;
+};
+
+} // namespace minfs
@@ -0,0 +1,360 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <fs/trace.h>
+
+#include "minfs.h"
+#include "minfs-private.h"
+
+namespace minfs {
+namespace {
+
+// Index of the last of the 'count' sorted entries which starts at or before
+// logical block 'n', or 0 if there is none.
+uint32_t ExtentFind(const minfs_extent_t* ext, uint32_t count, uint32_t n) {
+    uint32_t lo = 0;
+    uint32_t hi = count;
+    while (hi - lo > 1) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (ext[mid].start <= n) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// Look up logical block 'n' in 'count' sorted extents. Blocks past the last
+// extent are a hole which ends at 'limit'.
+void ExtentArrayLookup(const minfs_extent_t* ext, uint32_t count, uint32_t limit,
+                       uint32_t n, uint32_t* bno, uint32_t* run) {
+    *bno = 0;
+    if (count == 0) {
+        *run = limit - n;
+        return;
+    }
+    uint32_t i = ExtentFind(ext, count, n);
+    if (ext[i].start > n) {
+        *run = ext[i].start - n;
+    } else if (n - ext[i].start < ext[i].count) {
+        *bno = ext[i].bno + (n - ext[i].start);
+        *run = ext[i].count - (n - ext[i].start);
+    } else {
+        *run = ((i + 1 < count) ? ext[i + 1].start : limit) - n;
+    }
+}
+
+// Map the unmapped logical block 'n' to disk block 'bno' in an array of
+// 'count' sorted extents, growing a neighboring extent when the block
+// continues it. Returns false, leaving the array alone, if a new extent is
+// needed and the array already holds 'capacity'.
+bool ExtentArrayInsert(minfs_extent_t* ext, uint32_t* count, uint32_t capacity,
+                       uint32_t n, uint32_t bno) {
+    uint32_t c = *count;
+    uint32_t next = 0;
+    if (c > 0) {
+        uint32_t i = ExtentFind(ext, c, n);
+        if (ext[i].start < n) {
+            minfs_extent_t* prev = &ext[i];
+            if ((prev->start + prev->count == n) && (prev->bno + prev->count == bno)) {
+                prev->count++;
+                // the gap to the next extent may now be closed
+                if ((i + 1 < c) && (ext[i + 1].start == n + 1) && (ext[i + 1].bno == bno + 1)) {
+                    prev->count += ext[i + 1].count;
+                    memmove(&ext[i + 1], &ext[i + 2], (c - i - 2) * sizeof(minfs_extent_t));
+                    *count = c - 1;
+                }
+                return true;
+            }
+            next = i + 1;
+        } else {
+            next = i;
+        }
+        if ((next < c) && (ext[next].start == n + 1) && (ext[next].bno == bno + 1)) {
+            ext[next].start--;
+            ext[next].bno--;
+            ext[next].count++;
+            return true;
+        }
+    }
+    if (c == capacity) {
+        return false;
+    }
+    memmove(&ext[next + 1], &ext[next], (c - next) * sizeof(minfs_extent_t));
+    ext[next].start = n;
+    ext[next].count = 1;
+    ext[next].bno = bno;
+    *count = c + 1;
+    return true;
+}
+
+// Unmap every block at or past logical block 'start' from 'count' sorted
+// extents, releasing the disk blocks and adding their number to 'released'.
+mx_status_t ExtentArrayTrim(Minfs* fs, minfs_extent_t* ext, uint32_t* count, uint32_t start,
+                            mxtl::RefPtr<BlockNode>* bitmap_blk, uint32_t* released) {
+    uint32_t c = *count;
+    while (c > 0) {
+        minfs_extent_t* e = &ext[c - 1];
+        if (e->start + e->count <= start) {
+            break;
+        }
+        uint32_t keep = (e->start < start) ? start - e->start : 0;
+        mx_status_t status;
+        if ((status = fs->BlocksFree(e->bno + keep, e->count - keep, bitmap_blk)) != NO_ERROR) {
+            *count = c;
+            return status;
+        }
+        *released += e->count - keep;
+        if (keep > 0) {
+            e->count = keep;
+            break;
+        }
+        c--;
+    }
+    *count = c;
+    return NO_ERROR;
+}
+
+} // namespace anonymous
+
+mx_status_t ExtentLookup(Bcache* bc, const minfs_inode_t* inode, uint32_t n,
+                         uint32_t* bno, uint32_t* run) {
+    const minfs_extent_t* ext = InodeExtents(inode);
+    uint32_t count = inode->extent_count;
+    if (!(inode->flags & kMinfsInodeFlagExtentIndex)) {
+        ExtentArrayLookup(ext, count, static_cast<uint32_t>(kMinfsMaxExtentFileBlock), n, bno, run);
+        return NO_ERROR;
+    }
+
+    uint32_t i = ExtentFind(ext, count, n);
+    uint32_t limit = (i + 1 < count) ? ext[i + 1].start :
+                                       static_cast<uint32_t>(kMinfsMaxExtentFileBlock);
+    mxtl::RefPtr<BlockNode> leaf;
+    if ((leaf = bc->Get(ext[i].bno)) == nullptr) {
+        return ERR_IO;
+    }
+    ExtentArrayLookup(static_cast<minfs_extent_t*>(leaf->data()), ext[i].count, limit,
+                      n, bno, run);
+    bc->Put(mxtl::move(leaf), 0);
+    return NO_ERROR;
+}
+
+mx_status_t Minfs::BlocksFree(uint32_t bno, uint32_t count, mxtl::RefPtr<BlockNode>* bitmap_blk) {
+    while (count > 0) {
+        // Clear no further than the end of the bitmap block holding 'bno'
+        uint32_t xfer = mxtl::min(count, kMinfsBlockBits - (bno % kMinfsBlockBits));
+        if ((*bitmap_blk = BitmapBlockGet(*bitmap_blk, bno)) == nullptr) {
+            return ERR_IO;
+        }
+        block_map_.Clear(bno, bno + xfer);
+        bno += xfer;
+        count -= xfer;
+    }
+    return NO_ERROR;
+}
+
+mx_status_t Minfs::ExtentsFree(const minfs_inode_t& inode, mxtl::RefPtr<BlockNode>* bitmap_blk) {
+    const minfs_extent_t* ext = InodeExtents(&inode);
+    mx_status_t status;
+    if (!(inode.flags & kMinfsInodeFlagExtentIndex)) {
+        for (uint32_t i = 0; i < inode.extent_count; i++) {
+            if ((status = BlocksFree(ext[i].bno, ext[i].count, bitmap_blk)) != NO_ERROR) {
+                return status;
+            }
+        }
+        return NO_ERROR;
+    }
+
+    for (uint32_t i = 0; i < inode.extent_count; i++) {
+        mxtl::RefPtr<BlockNode> leaf;
+        if ((leaf = bc_->Get(ext[i].bno)) == nullptr) {
+            return ERR_IO;
+        }
+        const minfs_extent_t* lext = static_cast<const minfs_extent_t*>(leaf->data());
+        for (uint32_t j = 0; j < ext[i].count; j++) {
+            if ((status = BlocksFree(lext[j].bno, lext[j].count, bitmap_blk)) != NO_ERROR) {
+                bc_->Put(leaf, 0);
+                return status;
+            }
+        }
+        bc_->Put(leaf, 0);
+        // release the leaf block itself
+        if ((status = BlocksFree(ext[i].bno, 1, bitmap_blk)) != NO_ERROR) {
+            return status;
+        }
+    }
+    return NO_ERROR;
+}
+
+mx_status_t VnodeMinfs::ExtentAlloc(uint32_t n, uint32_t* bno) {
+    mx_status_t status;
+    uint32_t run;
+    if ((status = ExtentLookup(fs_->bc_, &inode_, n, bno, &run)) != NO_ERROR) {
+        return status;
+    } else if (*bno != 0) {
+        return NO_ERROR;
+    }
+
+    // Prefer the disk block right after the one holding the previous logical
+    // block, so sequentially written files end up as a few long extents.
+    uint32_t hint = 0;
+    if (n > 0) {
+        uint32_t prev;
+        if ((status = ExtentLookup(fs_->bc_, &inode_, n - 1, &prev, &run)) != NO_ERROR) {
+            return status;
+        }
+        if (prev != 0) {
+            hint = prev + 1;
+        }
+    }
+    if ((status = fs_->BlockNew(hint, bno, nullptr)) != NO_ERROR) {
+        return status;
+    }
+    if ((status = ExtentInsert(n, *bno)) != NO_ERROR) {
+        mxtl::RefPtr<BlockNode> bitmap_blk;
+        fs_->BlocksFree(*bno, 1, &bitmap_blk);
+        fs_->BitmapBlockPut(bitmap_blk);
+        return status;
+    }
+    inode_.block_count++;
+    InodeSync(kMxFsSyncDefault);
+    return NO_ERROR;
+}
+
+mx_status_t VnodeMinfs::ExtentInsert(uint32_t n, uint32_t bno) {
+    minfs_extent_t* ext = InodeExtents(&inode_);
+    mx_status_t status;
+    if (!(inode_.flags & kMinfsInodeFlagExtentIndex)) {
+        if (ExtentArrayInsert(ext, &inode_.extent_count, kMinfsInlineExtents, n, bno)) {
+            return NO_ERROR;
+        }
+        // Out of inline extents: move them all into a leaf block, which
+        // becomes the only index entry.
+        uint32_t leaf_bno;
+        mxtl::RefPtr<BlockNode> leaf;
+        if ((status = fs_->BlockNew(0, &leaf_bno, &leaf)) != NO_ERROR) {
+            return status;
+        }
+        memcpy(leaf->data(), ext, inode_.extent_count * sizeof(minfs_extent_t));
+        fs_->bc_->Put(leaf, kBlockDirty);
+        ext[0].count = inode_.extent_count;
+        ext[0].bno = leaf_bno;
+        inode_.extent_count = 1;
+        inode_.flags |= kMinfsInodeFlagExtentIndex;
+        inode_.block_count++;
+    }
+
+    while (true) {
+        uint32_t i = ExtentFind(ext, inode_.extent_count, n);
+        mxtl::RefPtr<BlockNode> leaf;
+        if ((leaf = fs_->bc_->Get(ext[i].bno)) == nullptr) {
+            return ERR_IO;
+        }
+        minfs_extent_t* lext = static_cast<minfs_extent_t*>(leaf->data());
+        if (ExtentArrayInsert(lext, &ext[i].count, kMinfsExtentsPerBlock, n, bno)) {
+            ext[i].start = lext[0].start;
+            fs_->bc_->Put(leaf, kBlockDirty);
+            return NO_ERROR;
+        }
+        if (inode_.extent_count == kMinfsInlineExtents) {
+            fs_->bc_->Put(leaf, 0);
+            return ERR_FILE_BIG;
+        }
+
+        // Split the full leaf, moving its upper half to a new one.
+        uint32_t split_bno;
+        mxtl::RefPtr<BlockNode> split;
+        if ((status = fs_->BlockNew(ext[i].bno, &split_bno, &split)) != NO_ERROR) {
+            fs_->bc_->Put(leaf, 0);
+            return status;
+        }
+        uint32_t keep = ext[i].count / 2;
+        uint32_t moved = ext[i].count - keep;
+        minfs_extent_t* sext = static_cast<minfs_extent_t*>(split->data());
+        memcpy(sext, &lext[keep], moved * sizeof(minfs_extent_t));
+        memmove(&ext[i + 2], &ext[i + 1], (inode_.extent_count - i - 1) * sizeof(minfs_extent_t));
+        ext[i].count = keep;
+        ext[i + 1].start = sext[0].start;
+        ext[i + 1].count = moved;
+        ext[i + 1].bno = split_bno;
+        inode_.extent_count++;
+        inode_.block_count++;
+        fs_->bc_->Put(split, kBlockDirty);
+        fs_->bc_->Put(leaf, kBlockDirty);
+        // and try again, now that there is room
+    }
+}
+
+mx_status_t VnodeMinfs::ExtentsShrink(uint32_t start) {
+    minfs_extent_t* ext = InodeExtents(&inode_);
+    mxtl::RefPtr<BlockNode> bitmap_blk;
+    uint32_t released = 0;
+    mx_status_t status = NO_ERROR;
+
+    if (!(inode_.flags & kMinfsInodeFlagExtentIndex)) {
+        status = ExtentArrayTrim(fs_, ext, &inode_.extent_count, start, &bitmap_blk, &released);
+        inode_.block_count -= released;
+        goto done;
+    }
+
+    while (inode_.extent_count > 0) {
+        uint32_t i = inode_.extent_count - 1;
+        mxtl::RefPtr<BlockNode> leaf;
+        if ((leaf = fs_->bc_->Get(ext[i].bno)) == nullptr) {
+            status = ERR_IO;
+            goto done;
+        }
+        uint32_t leaf_released = 0;
+        status = ExtentArrayTrim(fs_, static_cast<minfs_extent_t*>(leaf->data()), &ext[i].count,
+                                 start, &bitmap_blk, &leaf_released);
+        released += leaf_released;
+        inode_.block_count -= leaf_released;
+        fs_->bc_->Put(leaf, leaf_released ? kBlockDirty : 0);
+        if (status != NO_ERROR) {
+            goto done;
+        }
+        if (ext[i].count > 0) {
+            break;
+        }
+        // the leaf is empty; release it
+        if ((status = fs_->BlocksFree(ext[i].bno, 1, &bitmap_blk)) != NO_ERROR) {
+            goto done;
+        }
+        inode_.extent_count--;
+        inode_.block_count--;
+        released++;
+    }
+
+    // Move the extents of a lone leaf back into the inode if they fit
+    if ((inode_.extent_count == 1) && (ext[0].count <= kMinfsInlineExtents)) {
+        mxtl::RefPtr<BlockNode> leaf;
+        if ((leaf = fs_->bc_->Get(ext[0].bno)) != nullptr) {
+            uint32_t leaf_bno = ext[0].bno;
+            uint32_t count = ext[0].count;
+            memcpy(ext, leaf->data(), count * sizeof(minfs_extent_t));
+            fs_->bc_->Put(leaf, 0);
+            inode_.extent_count = count;
+            inode_.flags &= ~kMinfsInodeFlagExtentIndex;
+            if (fs_->BlocksFree(leaf_bno, 1, &bitmap_blk) == NO_ERROR) {
+                inode_.block_count--;
+                released++;
+            }
+        }
+    } else if (inode_.extent_count == 0) {
+        inode_.flags &= ~kMinfsInodeFlagExtentIndex;
+    }
+
+done:
+    if (released > 0) {
+        InodeSync(kMxFsSyncDefault);
+    }
+    fs_->BitmapBlockPut(bitmap_blk);
+    return status;
+}
+
+} // namespace minfs
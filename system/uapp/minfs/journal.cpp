@@ -0,0 +1,266 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <fs/trace.h>
+#include <magenta/new.h>
+#include <mxtl/algorithm.h>
+
+#include "journal.h"
+#include "misc.h"
+
+namespace minfs {
+namespace {
+
+int entry_compare(const void* a, const void* b) {
+    uint32_t bno_a = *static_cast<const uint32_t*>(a);
+    uint32_t bno_b = *static_cast<const uint32_t*>(b);
+    return (bno_a > bno_b) - (bno_a < bno_b);
+}
+
+} // namespace anonymous
+
+Journal::Journal(const minfs_info_t& info) :
+    jnl_block_(info.jnl_block), ring_(info.jnl_blocks - 1) {}
+
+mx_status_t Journal::Create(const minfs_info_t& info, uint32_t blockmax,
+                            mxtl::unique_ptr<Journal>* out) {
+    if (info.jnl_blocks < 4) {
+        return ERR_INVALID_ARGS;
+    }
+    AllocChecker ac;
+    mxtl::unique_ptr<Journal> journal(new (&ac) Journal(info));
+    if (!ac.check()) {
+        return ERR_NO_MEMORY;
+    }
+    journal->entries_.reset(new (&ac) Entry[journal->ring_], journal->ring_);
+    if (!ac.check()) {
+        return ERR_NO_MEMORY;
+    }
+    mx_status_t status;
+    if ((status = journal->live_.Reset(blockmax)) != NO_ERROR) {
+        return status;
+    }
+    size_t size = static_cast<size_t>(info.jnl_blocks) * kMinfsBlockSize;
+#ifdef __Fuchsia__
+    if ((status = MappedVmo::Create(size, &journal->buf_)) != NO_ERROR) {
+        return status;
+    }
+#else
+    journal->buf_.reset(new (&ac) char[size]);
+    if (!ac.check()) {
+        return ERR_NO_MEMORY;
+    }
+#endif
+    *out = mxtl::move(journal);
+    return NO_ERROR;
+}
+
+mx_status_t Journal::Format(Bcache* bc, const minfs_info_t& info) {
+    // Zero the ring, so that no stale block can pass for a transaction
+    char data[kMinfsBlockSize];
+    memset(data, 0, sizeof(data));
+    mx_status_t status;
+    for (uint32_t n = 1; n < info.jnl_blocks; n++) {
+        if ((status = bc->Writeblk(info.jnl_block + n, data)) != NO_ERROR) {
+            return status;
+        }
+    }
+    minfs_journal_info_t* ji = reinterpret_cast<minfs_journal_info_t*>(data);
+    ji->magic = kMinfsJournalMagic;
+    ji->seq = 1;
+    ji->start = 0;
+    return bc->Writeblk(info.jnl_block, data);
+}
+
+uint32_t Journal::MaxTxnBlocks() const {
+    return mxtl::min(kMinfsJournalMaxTxnBlocks, ring_ - 2);
+}
+
+void* Journal::Data(uint32_t slot) const {
+#ifdef __Fuchsia__
+    char* data = static_cast<char*>(buf_->GetData());
+#else
+    char* data = buf_.get();
+#endif
+    return data + slot * kMinfsBlockSize;
+}
+
+mx_status_t Journal::Replay(Bcache* bc) {
+    mx_status_t status;
+    const minfs_journal_info_t* ji = static_cast<const minfs_journal_info_t*>(Data(0));
+    if ((status = bc->Readblk(jnl_block_, Data(0))) != NO_ERROR) {
+        return status;
+    }
+    if ((ji->magic != kMinfsJournalMagic) || (ji->start >= ring_)) {
+        error("minfs: bad journal info block\n");
+        return ERR_IO_DATA_INTEGRITY;
+    }
+    uint32_t pos = ji->start;
+    uint64_t seq = ji->seq;
+
+    // Walk forward from the tail until a transaction is missing, torn, or
+    // would wrap onto the first one.
+    uint32_t walked = 0;
+    uint32_t replayed = 0;
+    while (walked + 3 <= ring_) {
+        minfs_journal_block_t* hdr = static_cast<minfs_journal_block_t*>(Data(Slot(pos)));
+        if ((status = bc->Readblk(jnl_block_ + Slot(pos), hdr)) != NO_ERROR) {
+            return status;
+        }
+        if ((hdr->magic != kMinfsJournalMagic) || (hdr->seq != seq) ||
+            (hdr->type != kMinfsJournalHeader) || (hdr->count == 0) ||
+            (hdr->count > MaxTxnBlocks()) || (walked + hdr->count + 2 > ring_)) {
+            break;
+        }
+        uint32_t count = hdr->count;
+        uint32_t checksum = FNV32_OFFSET_BASIS;
+        for (uint32_t i = 0; i < count; i++) {
+            uint32_t slot = Slot(pos + 1 + i);
+            if ((status = bc->Readblk(jnl_block_ + slot, Data(slot))) != NO_ERROR) {
+                return status;
+            }
+            checksum ^= fnv1a32(Data(slot), kMinfsBlockSize);
+        }
+        uint32_t slot = Slot(pos + count + 1);
+        const minfs_journal_block_t* cmt = static_cast<const minfs_journal_block_t*>(Data(slot));
+        if ((status = bc->Readblk(jnl_block_ + slot, Data(slot))) != NO_ERROR) {
+            return status;
+        }
+        if ((cmt->magic != kMinfsJournalMagic) || (cmt->seq != seq) ||
+            (cmt->type != kMinfsJournalCommit) || (cmt->count != count) ||
+            (cmt->checksum != (checksum ^ fnv1a32(hdr->bno, count * sizeof(uint32_t)))) ||
+            (hdr->checksum != cmt->checksum)) {
+            break;
+        }
+        for (uint32_t i = 0; i < count; i++) {
+            if ((status = bc->Writeblk(hdr->bno[i], Data(Slot(pos + 1 + i)))) != NO_ERROR) {
+                return status;
+            }
+        }
+        pos = (pos + count + 2) % ring_;
+        walked += count + 2;
+        seq++;
+        replayed++;
+    }
+    tail_ = head_ = pos;
+    tail_seq_ = seq_ = seq;
+    if (replayed == 0) {
+        return NO_ERROR;
+    }
+    trace(MINFS, "minfs: replayed %u journal transactions\n", replayed);
+
+    // Once the blocks are in place, restart the (empty) journal where the
+    // walk stopped, with sequence numbers no stale block can match.
+    if ((status = bc->Flush()) != NO_ERROR) {
+        return status;
+    }
+    tail_seq_ = seq_ = seq + 1;
+    minfs_journal_info_t* info = static_cast<minfs_journal_info_t*>(Data(0));
+    memset(info, 0, kMinfsBlockSize);
+    info->magic = kMinfsJournalMagic;
+    info->seq = seq_;
+    info->start = head_;
+    if ((status = bc->Writeblk(jnl_block_, info)) != NO_ERROR) {
+        return status;
+    }
+    return bc->Flush();
+}
+
+bool Journal::Lookup(uint32_t bno, void* data) const {
+    if (!Contains(bno)) {
+        return false;
+    }
+    for (size_t i = count_; i > 0; i--) {
+        if (entries_[i - 1].bno == bno) {
+            memcpy(data, Data(entries_[i - 1].slot), kMinfsBlockSize);
+            return true;
+        }
+    }
+    return false;
+}
+
+void Journal::Commit(Bcache* bc, BlockNode* const* blks, uint32_t count) {
+    assert(Fits(count) && (count <= MaxTxnBlocks()));
+    minfs_journal_block_t* hdr = static_cast<minfs_journal_block_t*>(Data(Slot(head_)));
+    memset(hdr, 0, kMinfsBlockSize);
+    hdr->magic = kMinfsJournalMagic;
+    hdr->seq = seq_;
+    hdr->type = kMinfsJournalHeader;
+    hdr->count = count;
+    bc->WbQueue(Bcache::kWbJournal, Slot(head_), jnl_block_ + Slot(head_));
+
+    uint32_t checksum = FNV32_OFFSET_BASIS;
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t bno = blks[i]->GetKey();
+        uint32_t slot = Slot(head_ + 1 + i);
+        memcpy(Data(slot), blks[i]->data(), kMinfsBlockSize);
+        checksum ^= fnv1a32(Data(slot), kMinfsBlockSize);
+        hdr->bno[i] = bno;
+        bc->WbQueue(Bcache::kWbJournal, slot, jnl_block_ + slot);
+
+        entries_[count_].bno = bno;
+        entries_[count_].slot = slot;
+        count_++;
+        live_.Set(bno, bno + 1);
+    }
+    // The checksum covers the copies and where they belong
+    checksum ^= fnv1a32(hdr->bno, count * sizeof(uint32_t));
+    hdr->checksum = checksum;
+
+    // Everything before the commit block (including blocks written in place
+    // by the same batch) must be on the device before it.
+    bc->WbBarrier();
+    uint32_t slot = Slot(head_ + count + 1);
+    minfs_journal_block_t* cmt = static_cast<minfs_journal_block_t*>(Data(slot));
+    memset(cmt, 0, kMinfsBlockSize);
+    cmt->magic = kMinfsJournalMagic;
+    cmt->seq = seq_;
+    cmt->type = kMinfsJournalCommit;
+    cmt->count = count;
+    cmt->checksum = checksum;
+    bc->WbQueue(Bcache::kWbJournal, slot, jnl_block_ + slot);
+    bc->WbBarrier();
+
+    head_ = (head_ + count + 2) % ring_;
+    used_ += count + 2;
+    seq_++;
+}
+
+void Journal::Checkpoint(Bcache* bc) {
+    // Keep only the newest copy of each block, then write them in order
+    size_t first = count_;
+    for (size_t i = count_; i > 0; i--) {
+        uint32_t bno = entries_[i - 1].bno;
+        if (live_.GetOne(bno)) {
+            live_.Clear(bno, bno + 1);
+            entries_[--first] = entries_[i - 1];
+        }
+    }
+    qsort(&entries_[first], count_ - first, sizeof(Entry), entry_compare);
+    for (size_t i = first; i < count_; i++) {
+        bc->WbQueue(Bcache::kWbJournal, entries_[i].slot, entries_[i].bno);
+    }
+    bc->WbBarrier();
+
+    count_ = 0;
+    used_ = 0;
+    tail_ = head_;
+    tail_seq_ = seq_;
+    WriteInfo(bc);
+    bc->WbBarrier();
+}
+
+void Journal::WriteInfo(Bcache* bc) {
+    minfs_journal_info_t* info = static_cast<minfs_journal_info_t*>(Data(0));
+    memset(info, 0, kMinfsBlockSize);
+    info->magic = kMinfsJournalMagic;
+    info->seq = tail_seq_;
+    info->start = tail_;
+    bc->WbQueue(Bcache::kWbJournal, 0, jnl_block_);
+}
+
+} // namespace minfs
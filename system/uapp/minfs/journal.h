@@ -0,0 +1,111 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <stdint.h>
+
+#include <bitmap/raw-bitmap.h>
+#include <magenta/types.h>
+#include <mxtl/array.h>
+#include <mxtl/macros.h>
+#include <mxtl/unique_ptr.h>
+
+#ifdef __Fuchsia__
+#include <fs/mapped-vmo.h>
+#endif
+
+#include "minfs.h"
+
+namespace minfs {
+
+// The in-memory side of the metadata journal: a copy of the on-disk ring,
+// and an index of the blocks in its live (committed, but not yet written in
+// place) transactions.
+//
+// Bcache decides when to commit and checkpoint; the journal lays out the
+// blocks and queues their writes on the block cache's write-back batch. A
+// block with a live copy is read from the journal, since its home location
+// is stale until the next checkpoint.
+class Journal {
+public:
+    DISALLOW_COPY_ASSIGN_AND_MOVE(Journal);
+    static mx_status_t Create(const minfs_info_t& info, uint32_t blockmax,
+                              mxtl::unique_ptr<Journal>* out);
+
+    // Write an empty journal for a new filesystem.
+    static mx_status_t Format(Bcache* bc, const minfs_info_t& info);
+
+    // Write the blocks of every complete transaction on disk in place, then
+    // start an empty journal after them. Runs before the journal is handed
+    // to the block cache, using its ordinary (in place) write path.
+    mx_status_t Replay(Bcache* bc);
+
+    // Largest number of blocks a transaction can hold.
+    uint32_t MaxTxnBlocks() const;
+    // True if a transaction of 'count' blocks fits without a checkpoint.
+    bool Fits(uint32_t count) const { return used_ + count + 2 <= ring_; }
+    bool Empty() const { return used_ == 0; }
+
+    bool Contains(uint32_t bno) const { return live_.GetOne(bno); }
+    // Copy out the newest live copy of 'bno', if there is one.
+    bool Lookup(uint32_t bno, void* data) const;
+
+    // Queue the writes which commit 'count' blocks as one transaction:
+    // header and copies, then (after a barrier) the commit block.
+    // Fits(count) must be true.
+    void Commit(Bcache* bc, BlockNode* const* blks, uint32_t count);
+    // Queue the writes which put every live block in place, then (after a
+    // barrier) the info block recording that the journal is empty.
+    void Checkpoint(Bcache* bc);
+
+    // Block 'slot' of the journal, in memory. Slot 0 is the info block.
+    void* Data(uint32_t slot) const;
+#ifdef __Fuchsia__
+    mx_handle_t GetVmo() const { return buf_->GetVmo(); }
+#endif
+
+private:
+    struct Entry {
+        uint32_t bno;   // home location
+        uint32_t slot;  // where its copy is
+    };
+
+    Journal(const minfs_info_t& info);
+    uint32_t Slot(uint32_t pos) const { return 1 + (pos % ring_); }
+    void WriteInfo(Bcache* bc);
+
+    uint32_t jnl_block_;
+    uint32_t ring_;          // Blocks after the info block
+    uint32_t tail_ = 0;      // Ring position of the oldest live transaction
+    uint64_t tail_seq_ = 0;
+    uint32_t head_ = 0;      // Ring position of the next transaction
+    uint64_t seq_ = 0;       // Sequence number of the next transaction
+    uint32_t used_ = 0;      // Ring blocks in live transactions
+
+    mxtl::Array<Entry> entries_; // Live copies, oldest first
+    size_t count_ = 0;
+    RawBitmap live_;             // Blocks with a live copy
+
+#ifdef __Fuchsia__
+    mxtl::unique_ptr<MappedVmo> buf_;
+#else
+    mxtl::unique_ptr<char[]> buf_;
+#endif
+};
+
+// Keeps the metadata updated by one filesystem operation in one journal
+// transaction: while any JournalOp is alive, the block cache writes back
+// only file data.
+class JournalOp {
+public:
+    DISALLOW_COPY_ASSIGN_AND_MOVE(JournalOp);
+    explicit JournalOp(Bcache* bc) : bc_(bc) { bc_->BeginOp(); }
+    ~JournalOp() { bc_->EndOp(); }
+
+private:
+    Bcache* bc_;
+};
+
+} // namespace minfs
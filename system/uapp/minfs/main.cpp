@@ -239,8 +239,8 @@ struct {
 } CMDS[] = {
     {"create", do_minfs_mkfs, O_RDWR | O_CREAT, "initialize filesystem"},
     {"mkfs", do_minfs_mkfs, O_RDWR | O_CREAT, "initialize filesystem"},
-    {"check", do_minfs_check, O_RDONLY, "check filesystem integrity"},
-    {"fsck", do_minfs_check, O_RDONLY, "check filesystem integrity"},
+    {"check", do_minfs_check, O_RDWR, "check filesystem integrity"},
+    {"fsck", do_minfs_check, O_RDWR, "check filesystem integrity"},
 #ifdef __Fuchsia__
     {"mount", do_minfs_mount, O_RDWR, "mount filesystem"},
 #else
@@ -386,7 +386,13 @@ found:
 
     for (unsigned i = 0; i < countof(CMDS); i++) {
         if (!strcmp(cmd, CMDS[i].name)) {
-            return CMDS[i].func(bc, argc - 3, argv + 3);
+            int r = CMDS[i].func(bc, argc - 3, argv + 3);
+            // Blocks are written back lazily; make sure they reach the disk
+            if (bc->Sync() < 0) {
+                fprintf(stderr, "error: cannot write back block cache\n");
+                return -1;
+            }
+            return r;
         }
     }
     return -1;
@@ -35,8 +35,22 @@ mx_status_t get_inode(const Minfs* fs, minfs_inode_t* inode, uint32_t ino) {
 #define CD_DUMP 1
 #define CD_RECURSE 2
 
+uint32_t inode_max_file_block(const minfs_inode_t* inode) {
+    if (inode->flags & kMinfsInodeFlagExtents) {
+        return static_cast<uint32_t>(kMinfsMaxExtentFileBlock);
+    }
+    return static_cast<uint32_t>(kMinfsMaxFileBlock);
+}
+
 mx_status_t get_inode_nth_bno(const Minfs* fs, minfs_inode_t* inode, uint32_t n,
                               uint32_t* bno_out) {
+    if (inode->flags & kMinfsInodeFlagExtents) {
+        if (n >= kMinfsMaxExtentFileBlock) {
+            return ERR_OUT_OF_RANGE;
+        }
+        uint32_t run;
+        return ExtentLookup(fs->bc_, inode, n, bno_out, &run);
+    }
     if (n < kMinfsDirect) {
         *bno_out = inode->dnum[n];
         return NO_ERROR;
@@ -79,7 +93,7 @@ mx_status_t file_read(const Minfs* fs, minfs_inode_t* inode, void* data, size_t
     uint32_t n = static_cast<uint32_t>(off / kMinfsBlockSize);
     uint32_t adjust = off % kMinfsBlockSize;
 
-    while ((len > 0) && (n < kMinfsMaxFileBlock)) {
+    while ((len > 0) && (n < inode_max_file_block(inode))) {
         uint32_t xfer;
         if (len > (kMinfsBlockSize - adjust)) {
             xfer = kMinfsBlockSize - adjust;
@@ -122,7 +136,7 @@ mx_status_t file_write(const Minfs* fs, minfs_inode_t* inode, const void* data,
     uint32_t n = static_cast<uint32_t>(off / kMinfsBlockSize);
     uint32_t adjust = off % kMinfsBlockSize;
 
-    while ((len > 0) && (n < kMinfsMaxFileBlock)) {
+    while ((len > 0) && (n < inode_max_file_block(inode))) {
         uint32_t xfer;
         if (len > (kMinfsBlockSize - adjust)) {
             xfer = kMinfsBlockSize - adjust;
@@ -194,7 +208,7 @@ mx_status_t check_directory(CheckMaps* chk, const Minfs* fs, minfs_inode_t* inod
             }
         }
         minfs_dirent_t* de = reinterpret_cast<minfs_dirent_t*>(data);
-        uint32_t rlen = static_cast<uint32_t>(MinfsReclen(de, off));
+        uint32_t rlen = static_cast<uint32_t>(MinfsReclen(de, off, fs->MaxDirectorySize()));
         bool is_last = de->reclen & kMinfsReclenLast;
         if (!is_last && ((rlen < MINFS_DIRENT_SIZE) ||
                          (rlen > kMinfsMaxDirentSize) || (rlen & 3))) {
@@ -287,16 +301,106 @@ const char* check_data_block(CheckMaps* chk, const Minfs* fs, uint32_t bno) {
     return nullptr;
 }
 
+// Sanity-check 'count' extents, which must be sorted, non-overlapping, lie
+// below 'limit' and map blocks of the data area. Counts their blocks into
+// 'blocks' and the end of the last one into 'max'.
+mx_status_t check_extents(CheckMaps* chk, const Minfs* fs, const minfs_extent_t* ext,
+                          uint32_t count, uint32_t limit, uint32_t ino, uint32_t* blocks,
+                          uint32_t* max) {
+    uint32_t end = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        if ((ext[i].count == 0) || (ext[i].start < end) ||
+            (static_cast<uint64_t>(ext[i].start) + ext[i].count > limit)) {
+            warn("check: ino#%u: extent [%u, +%u) out of order\n",
+                 ino, ext[i].start, ext[i].count);
+            return ERR_IO_DATA_INTEGRITY;
+        }
+        if ((ext[i].bno < fs->info_.dat_block) ||
+            (static_cast<uint64_t>(ext[i].bno) + ext[i].count > fs->info_.block_count)) {
+            warn("check: ino#%u: extent [%u, +%u)(@%u) out of range\n",
+                 ino, ext[i].start, ext[i].count, ext[i].bno);
+            return ERR_IO_DATA_INTEGRITY;
+        }
+        for (uint32_t j = 0; j < ext[i].count; j++) {
+            const char* msg;
+            if ((msg = check_data_block(chk, fs, ext[i].bno + j)) != nullptr) {
+                warn("check: ino#%u: block %u(@%u): %s\n",
+                     ino, ext[i].start + j, ext[i].bno + j, msg);
+            }
+        }
+        *blocks += ext[i].count;
+        end = ext[i].start + ext[i].count;
+    }
+    if (end > *max) {
+        *max = end;
+    }
+    return NO_ERROR;
+}
+
+// Count and sanity-check the blocks of an extent inode, and its leaf blocks.
+mx_status_t check_file_extents(CheckMaps* chk, const Minfs* fs, minfs_inode_t* inode,
+                               uint32_t ino, uint32_t* blocks, uint32_t* max) {
+    const minfs_extent_t* ext = InodeExtents(inode);
+    const uint32_t limit = static_cast<uint32_t>(kMinfsMaxExtentFileBlock);
+    info("Extents: %u%s\n", inode->extent_count,
+         (inode->flags & kMinfsInodeFlagExtentIndex) ? " (indexed)" : "");
+    if (inode->extent_count > kMinfsInlineExtents) {
+        warn("check: ino#%u: too many extents (%u)\n", ino, inode->extent_count);
+        return ERR_IO_DATA_INTEGRITY;
+    }
+    if (!(inode->flags & kMinfsInodeFlagExtentIndex)) {
+        return check_extents(chk, fs, ext, inode->extent_count, limit, ino, blocks, max);
+    }
+
+    for (uint32_t i = 0; i < inode->extent_count; i++) {
+        const char* msg;
+        if ((msg = check_data_block(chk, fs, ext[i].bno)) != nullptr) {
+            warn("check: ino#%u: extent leaf %u(@%u): %s\n", ino, i, ext[i].bno, msg);
+        }
+        (*blocks)++;
+        if ((ext[i].count == 0) || (ext[i].count > kMinfsExtentsPerBlock)) {
+            warn("check: ino#%u: extent leaf %u holds %u extents\n", ino, i, ext[i].count);
+            return ERR_IO_DATA_INTEGRITY;
+        }
+        mxtl::RefPtr<BlockNode> leaf;
+        if ((leaf = fs->bc_->Get(ext[i].bno)) == nullptr) {
+            return ERR_IO;
+        }
+        const minfs_extent_t* lext = static_cast<const minfs_extent_t*>(leaf->data());
+        if (lext[0].start != ext[i].start) {
+            warn("check: ino#%u: extent leaf %u starts at %u, not %u\n",
+                 ino, i, lext[0].start, ext[i].start);
+        }
+        uint32_t leaf_limit = (i + 1 < inode->extent_count) ? ext[i + 1].start : limit;
+        mx_status_t status = check_extents(chk, fs, lext, ext[i].count, leaf_limit, ino,
+                                           blocks, max);
+        fs->bc_->Put(mxtl::move(leaf), 0);
+        if (status != NO_ERROR) {
+            return status;
+        }
+    }
+    return NO_ERROR;
+}
+
 mx_status_t check_file(CheckMaps* chk, const Minfs* fs,
                        minfs_inode_t* inode, uint32_t ino) {
+    uint32_t blocks = 0;
+    unsigned max = 0;
+
+    if (inode->flags & kMinfsInodeFlagExtents) {
+        mx_status_t status;
+        if ((status = check_file_extents(chk, fs, inode, ino, &blocks, &max)) != NO_ERROR) {
+            return status;
+        }
+        goto check_size;
+    }
+
     info("Direct blocks: \n");
     for (unsigned n = 0; n < kMinfsDirect; n++) {
         info(" %d,", inode->dnum[n]);
     }
     info(" ...\n");
 
-    uint32_t blocks = 0;
-
     // count and sanity-check indirect blocks
     for (unsigned n = 0; n < kMinfsIndirect; n++) {
         if (inode->inum[n]) {
@@ -311,7 +415,6 @@ mx_status_t check_file(CheckMaps* chk, const Minfs* fs,
 
     // count and sanity-check data blocks
 
-    unsigned max = 0;
     for (unsigned n = 0;;n++) {
         mx_status_t status;
         uint32_t bno;
@@ -331,6 +434,8 @@ mx_status_t check_file(CheckMaps* chk, const Minfs* fs,
             max = n + 1;
         }
     }
+
+check_size:
     if (max) {
         unsigned sizeblocks = inode->size / kMinfsBlockSize;
         if (sizeblocks > max) {
@@ -398,7 +503,7 @@ mx_status_t minfs_check(Bcache* bc) {
         return -1;
     }
     minfs_dump_info(&info);
-    if (minfs_check_info(&info, bc->Maxblk())) {
+    if (minfs_journal_load(bc, &info)) {
         return -1;
     }
 
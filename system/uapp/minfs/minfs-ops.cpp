@@ -19,6 +19,7 @@
 #include <mxio/vfs.h>
 #endif
 
+#include "journal.h"
 #include "minfs-private.h"
 
 namespace {
@@ -99,6 +100,7 @@ mx_status_t VnodeMinfs::InodeDestroy() {
     minfs_inode_t inode;
 
     trace(MINFS, "InodeDestroy() ino=%u\n", ino_);
+    fs_->dir_indices_.Evict(ino_);
 
     // save local copy, destroy inode on disk
     memcpy(&inode, &inode_, sizeof(inode));
@@ -126,6 +128,9 @@ void VnodeMinfs::InodeSync(uint32_t flags) {
 // Delete all blocks (relative to a file) from "start" (inclusive) to the end of
 // the file. Does not update mtime/atime.
 mx_status_t VnodeMinfs::BlocksShrink(uint32_t start) {
+    if (HasExtents()) {
+        return ExtentsShrink(start);
+    }
     mxtl::RefPtr<BlockNode> bitmap_blk = nullptr;
 
     bool doSync = false;
@@ -215,9 +220,12 @@ mx_status_t VnodeMinfs::BlocksShrink(uint32_t start) {
 
 #ifdef __Fuchsia__
 // Read data from disk at block 'bno', into the 'nth' logical block of the file.
-mx_status_t VnodeMinfs::FillBlock(uint32_t n, uint32_t bno) {
-    // TODO(smklein): read directly from block device into vmo; no need to copy
-    // into an intermediate buffer.
+mx_status_t VnodeMinfs::FillBlock(BlockTxn* txn, uint32_t n, uint32_t bno) {
+    if (txn != nullptr) {
+        // Adjacent blocks are merged into a single request by the txn.
+        return txn->Enqueue(BLOCKIO_READ, n, bno, 1);
+    }
+
     char bdata[kMinfsBlockSize];
     if (fs_->bc_->Readblk(bno, bdata)) {
         return ERR_IO;
@@ -229,29 +237,44 @@ mx_status_t VnodeMinfs::FillBlock(uint32_t n, uint32_t bno) {
     return NO_ERROR;
 }
 
-// Since we cannot yet register the filesystem as a paging service (and cleanly
-// fault on pages when they are actually needed), we currently read an entire
-// file to a VMO when a file's data block are accessed.
-//
-// TODO(smklein): Even this hack can be optimized; a bitmap could be used to
-// track all 'empty/read/dirty' blocks for each vnode, rather than reading
-// the entire file.
-mx_status_t VnodeMinfs::InitVmo() {
-    if (vmo_ != MX_HANDLE_INVALID) {
-        return NO_ERROR;
-    }
-
+mx_status_t VnodeMinfs::FillVmo(BlockTxn* txn) {
     mx_status_t status;
-    if ((status = mx_vmo_create(mxtl::roundup(inode_.size, kMinfsBlockSize), 0, &vmo_)) != NO_ERROR) {
-        error("Failed to initialize vmo; error: %d\n", status);
-        return status;
+    uint32_t bno;
+
+    if (HasExtents()) {
+        // Read whole extents at a time
+        uint32_t nblocks = static_cast<uint32_t>(mxtl::roundup(inode_.size, kMinfsBlockSize) /
+                                                 kMinfsBlockSize);
+        uint32_t run;
+        for (uint32_t n = 0; n < nblocks; n += run) {
+            if ((status = GetBnoRun(n, &bno, &run)) != NO_ERROR) {
+                return status;
+            }
+            run = mxtl::min(run, nblocks - n);
+            if (bno == 0) {
+                continue;
+            }
+            if (txn != nullptr) {
+                status = txn->Enqueue(BLOCKIO_READ, n, bno, run);
+            } else {
+                for (uint32_t i = 0; i < run; i++) {
+                    if ((status = FillBlock(nullptr, n + i, bno + i)) != NO_ERROR) {
+                        break;
+                    }
+                }
+            }
+            if (status != NO_ERROR) {
+                error("Failed to fill bno %u; error: %d\n", bno, status);
+                return status;
+            }
+        }
+        return (txn != nullptr) ? txn->Flush() : NO_ERROR;
     }
 
     // Initialize all direct blocks
-    uint32_t bno;
     for (uint32_t d = 0; d < kMinfsDirect; d++) {
         if ((bno = inode_.dnum[d]) != 0) {
-            if ((status = FillBlock(d, bno)) != NO_ERROR) {
+            if ((status = FillBlock(txn, d, bno)) != NO_ERROR) {
                 error("Failed to fill bno %u; error: %d\n", bno, status);
                 return status;
             }
@@ -273,7 +296,7 @@ mx_status_t VnodeMinfs::InitVmo() {
             for (uint32_t j = 0; j < direct_per_indirect; j++) {
                 if ((bno = ientry[j]) != 0) {
                     uint32_t n = kMinfsDirect + i * direct_per_indirect + j;
-                    if ((status = FillBlock(n, bno)) != NO_ERROR) {
+                    if ((status = FillBlock(txn, n, bno)) != NO_ERROR) {
                         fs_->bc_->Put(iblk, 0);
                         return status;
                     }
@@ -283,12 +306,65 @@ mx_status_t VnodeMinfs::InitVmo() {
         }
     }
 
+    if (txn != nullptr) {
+        return txn->Flush();
+    }
     return NO_ERROR;
 }
+
+// Since we cannot yet register the filesystem as a paging service (and cleanly
+// fault on pages when they are actually needed), we currently read an entire
+// file to a VMO when a file's data block are accessed.
+//
+// TODO(smklein): Even this hack can be optimized; a bitmap could be used to
+// track all 'empty/read/dirty' blocks for each vnode, rather than reading
+// the entire file.
+mx_status_t VnodeMinfs::InitVmo() {
+    if (vmo_ != MX_HANDLE_INVALID) {
+        return NO_ERROR;
+    }
+
+    mx_status_t status;
+    if ((status = mx_vmo_create(mxtl::roundup(inode_.size, kMinfsBlockSize), 0, &vmo_)) != NO_ERROR) {
+        error("Failed to initialize vmo; error: %d\n", status);
+        return status;
+    }
+
+    // With a block FIFO, read straight from the device into the vmo.
+    // Directory blocks are metadata, which may be newer in the journal (or
+    // the cache, mid-operation) than on the device; they go through the cache.
+    vmoid_t vmoid;
+    if (IsDirectory() || (fs_->bc_->AttachVmo(vmo_, &vmoid) != NO_ERROR)) {
+        return FillVmo(nullptr);
+    }
+    // That bypasses the block cache, so the device must be up to date.
+    if ((status = fs_->bc_->Flush()) != NO_ERROR) {
+        fs_->bc_->DetachVmo(vmoid);
+        return status;
+    }
+    BlockTxn txn(fs_->bc_, vmoid);
+    status = FillVmo(&txn);
+    if (status != NO_ERROR) {
+        // Drop whatever was queued but not sent.
+        txn.Cancel();
+    }
+    mx_status_t detach_status = fs_->bc_->DetachVmo(vmoid);
+    return status != NO_ERROR ? status : detach_status;
+}
 #endif
 
 // Get the bno corresponding to the nth logical block within the file.
 mx_status_t VnodeMinfs::GetBno(uint32_t n, uint32_t* bno, bool alloc) {
+    if (HasExtents()) {
+        if (n >= MaxFileBlock()) {
+            return ERR_OUT_OF_RANGE;
+        } else if (alloc) {
+            return ExtentAlloc(n, bno);
+        }
+        uint32_t run;
+        return ExtentLookup(fs_->bc_, &inode_, n, bno, &run);
+    }
+
     uint32_t hint = 0;
     // direct blocks are simple... is there an entry in dnum[]?
     if (n < kMinfsDirect) {
@@ -364,6 +440,17 @@ mx_status_t VnodeMinfs::GetBno(uint32_t n, uint32_t* bno, bool alloc) {
     return NO_ERROR;
 }
 
+mx_status_t VnodeMinfs::GetBnoRun(uint32_t n, uint32_t* bno, uint32_t* run) {
+    if (n >= MaxFileBlock()) {
+        return ERR_OUT_OF_RANGE;
+    } else if (HasExtents()) {
+        return ExtentLookup(fs_->bc_, &inode_, n, bno, run);
+    }
+    // The direct / indirect map doesn't know about runs; report single blocks.
+    *run = 1;
+    return GetBno(n, bno, false);
+}
+
 // Immediately stop iterating over the directory.
 #define DIR_CB_DONE 0
 // Access the next direntry in the directory. Offsets updated.
@@ -393,13 +480,15 @@ mx_status_t VnodeMinfs::WriteExactInternal(const void* data, size_t len, size_t
     return NO_ERROR;
 }
 
-static mx_status_t validate_dirent(minfs_dirent_t* de, size_t bytes_read, size_t off) {
-    uint32_t reclen = static_cast<uint32_t>(MinfsReclen(de, off));
+static mx_status_t validate_dirent(const Minfs* fs, minfs_dirent_t* de, size_t bytes_read,
+                                   size_t off) {
+    uint32_t max_dir_size = fs->MaxDirectorySize();
+    uint32_t reclen = static_cast<uint32_t>(MinfsReclen(de, off, max_dir_size));
     if ((bytes_read < MINFS_DIRENT_SIZE) || (reclen < MINFS_DIRENT_SIZE)) {
         error("vn_dir: Could not read dirent at offset: %zd\n", off);
         return ERR_IO;
-    } else if ((off + reclen > kMinfsMaxDirectorySize) || (reclen & 3)) {
-        error("vn_dir: bad reclen %u > %u\n", reclen, kMinfsMaxDirectorySize);
+    } else if ((off + reclen > max_dir_size) || (reclen & 3)) {
+        error("vn_dir: bad reclen %u > %u\n", reclen, max_dir_size);
         return ERR_IO;
     } else if (de->ino != 0) {
         if ((de->namelen == 0) ||
@@ -412,9 +501,9 @@ static mx_status_t validate_dirent(minfs_dirent_t* de, size_t bytes_read, size_t
 }
 
 // Updates offset information to move to the next direntry in the directory.
-static mx_status_t do_next_dirent(minfs_dirent_t* de, DirectoryOffset* offs) {
+static mx_status_t do_next_dirent(const Minfs* fs, minfs_dirent_t* de, DirectoryOffset* offs) {
     offs->off_prev = offs->off;
-    offs->off += MinfsReclen(de, offs->off);
+    offs->off += MinfsReclen(de, offs->off, fs->MaxDirectorySize());
     return DIR_CB_NEXT;
 }
 
@@ -426,7 +515,7 @@ static mx_status_t cb_dir_find(mxtl::RefPtr<VnodeMinfs> vndir, minfs_dirent_t* d
         args->type = de->type;
         return DIR_CB_DONE;
     } else {
-        return do_next_dirent(de, offs);
+        return do_next_dirent(vndir->fs_, de, offs);
     }
 }
 
@@ -446,13 +535,13 @@ mx_status_t VnodeMinfs::UnlinkChild(mxtl::RefPtr<VnodeMinfs> childvn, minfs_dire
     // (1) exist and (2) are free.
     size_t off_prev = offs->off_prev;
     size_t off = offs->off;
-    size_t off_next = off + MinfsReclen(de, off);
+    size_t off_next = off + MinfsReclen(de, off, fs_->MaxDirectorySize());
     minfs_dirent_t de_prev, de_next;
     mx_status_t status;
 
     // Read the direntries we're considering merging with.
     // Verify they are free and small enough to merge.
-    size_t coalesced_size = MinfsReclen(de, off);
+    size_t coalesced_size = MinfsReclen(de, off, fs_->MaxDirectorySize());
     // Coalesce with "next" first, so the kMinfsReclenLast bit can easily flow
     // back to "de" and "de_prev".
     if (!(de->reclen & kMinfsReclenLast)) {
@@ -460,12 +549,12 @@ mx_status_t VnodeMinfs::UnlinkChild(mxtl::RefPtr<VnodeMinfs> childvn, minfs_dire
         if ((status = ReadExactInternal(&de_next, len, off_next)) != NO_ERROR) {
             error("unlink: Failed to read next dirent\n");
             return status;
-        } else if ((status = validate_dirent(&de_next, len, off_next)) != NO_ERROR) {
+        } else if ((status = validate_dirent(fs_, &de_next, len, off_next)) != NO_ERROR) {
             error("unlink: Read invalid dirent\n");
             return status;
         }
         if (de_next.ino == 0) {
-            coalesced_size += MinfsReclen(&de_next, off_next);
+            coalesced_size += MinfsReclen(&de_next, off_next, fs_->MaxDirectorySize());
             // If the next entry *was* last, then 'de' is now last.
             de->reclen |= (de_next.reclen & kMinfsReclenLast);
         }
@@ -475,12 +564,12 @@ mx_status_t VnodeMinfs::UnlinkChild(mxtl::RefPtr<VnodeMinfs> childvn, minfs_dire
         if ((status = ReadExactInternal(&de_prev, len, off_prev)) != NO_ERROR) {
             error("unlink: Failed to read previous dirent\n");
             return status;
-        } else if ((status = validate_dirent(&de_prev, len, off_prev)) != NO_ERROR) {
+        } else if ((status = validate_dirent(fs_, &de_prev, len, off_prev)) != NO_ERROR) {
             error("unlink: Read invalid dirent\n");
             return status;
         }
         if (de_prev.ino == 0) {
-            coalesced_size += MinfsReclen(&de_prev, off_prev);
+            coalesced_size += MinfsReclen(&de_prev, off_prev, fs_->MaxDirectorySize());
             off = off_prev;
         }
     }
@@ -497,6 +586,16 @@ mx_status_t VnodeMinfs::UnlinkChild(mxtl::RefPtr<VnodeMinfs> childvn, minfs_dire
         return status;
     }
 
+    DirIndex* index;
+    if ((index = DirIndexCached()) != nullptr) {
+        index->Remove(de->name, de->namelen, static_cast<uint32_t>(offs->off));
+        if (de->reclen & kMinfsReclenLast) {
+            index->SetLastOffset(static_cast<uint32_t>(off));
+        } else {
+            index->AddHole(static_cast<uint32_t>(coalesced_size));
+        }
+    }
+
     if (de->reclen & kMinfsReclenLast) {
         // Truncating the directory merely removed unused space; if it fails,
         // the directory contents are still valid.
@@ -534,7 +633,7 @@ static mx_status_t cb_dir_unlink(mxtl::RefPtr<VnodeMinfs> vndir, minfs_dirent_t*
                                  DirArgs* args, DirectoryOffset* offs) {
     if ((de->ino == 0) || (args->len != de->namelen) ||
         memcmp(args->name, de->name, args->len)) {
-        return do_next_dirent(de, offs);
+        return do_next_dirent(vndir->fs_, de, offs);
     }
 
     mxtl::RefPtr<VnodeMinfs> vn;
@@ -558,7 +657,7 @@ static mx_status_t cb_dir_force_unlink(mxtl::RefPtr<VnodeMinfs> vndir, minfs_dir
                                        DirArgs* args, DirectoryOffset* offs) {
     if ((de->ino == 0) || (args->len != de->namelen) ||
         memcmp(args->name, de->name, args->len)) {
-        return do_next_dirent(de, offs);
+        return do_next_dirent(vndir->fs_, de, offs);
     }
 
     mxtl::RefPtr<VnodeMinfs> vn;
@@ -582,7 +681,7 @@ static mx_status_t cb_dir_attempt_rename(mxtl::RefPtr<VnodeMinfs> vndir, minfs_d
                                          DirArgs* args, DirectoryOffset* offs) {
     if ((de->ino == 0) || (args->len != de->namelen) ||
         memcmp(args->name, de->name, args->len)) {
-        return do_next_dirent(de, offs);
+        return do_next_dirent(vndir->fs_, de, offs);
     }
 
     mxtl::RefPtr<VnodeMinfs> vn;
@@ -619,7 +718,7 @@ static mx_status_t cb_dir_update_inode(mxtl::RefPtr<VnodeMinfs> vndir, minfs_dir
                                        DirArgs* args, DirectoryOffset* offs) {
     if ((de->ino == 0) || (args->len != de->namelen) ||
         memcmp(args->name, de->name, args->len)) {
-        return do_next_dirent(de, offs);
+        return do_next_dirent(vndir->fs_, de, offs);
     }
 
     de->ino = args->ino;
@@ -630,32 +729,44 @@ static mx_status_t cb_dir_update_inode(mxtl::RefPtr<VnodeMinfs> vndir, minfs_dir
     return DIR_CB_SAVE_SYNC;
 }
 
-static mx_status_t add_dirent(mxtl::RefPtr<VnodeMinfs> vndir, minfs_dirent_t* de, DirArgs* args, size_t off) {
+mx_status_t VnodeMinfs::AddChild(minfs_dirent_t* de, DirArgs* args, size_t off) {
     de->ino = args->ino;
     de->type = static_cast<uint8_t>(args->type);
     de->namelen = static_cast<uint8_t>(args->len);
     memcpy(de->name, args->name, args->len);
-    mx_status_t status = vndir->WriteExactInternal(de, DirentSize(de->namelen), off);
+    mx_status_t status = WriteExactInternal(de, DirentSize(de->namelen), off);
     if (status != NO_ERROR) {
         return status;
     }
-    vndir->inode_.dirent_count++;
+    inode_.dirent_count++;
     if (args->type == kMinfsTypeDir) {
         // Child directory has '..' which will point to parent directory
-        vndir->inode_.link_count++;
+        inode_.link_count++;
+    }
+
+    DirIndex* index;
+    if ((index = DirIndexCached()) != nullptr) {
+        if (index->Insert(de->name, de->namelen, static_cast<uint32_t>(off)) != NO_ERROR) {
+            fs_->dir_indices_.Evict(ino_);
+        } else if (off > index->LastOffset()) {
+            index->SetLastOffset(static_cast<uint32_t>(off));
+        } else if (off < index->LastOffset()) {
+            index->FillHole(MinfsReclen(de, off, fs_->MaxDirectorySize()));
+        }
     }
     return DIR_CB_SAVE_SYNC;
 }
 
 static mx_status_t cb_dir_append(mxtl::RefPtr<VnodeMinfs> vndir, minfs_dirent_t* de,
                                  DirArgs* args, DirectoryOffset* offs) {
-    uint32_t reclen = static_cast<uint32_t>(MinfsReclen(de, offs->off));
+    uint32_t reclen = static_cast<uint32_t>(MinfsReclen(de, offs->off,
+                                                        vndir->fs_->MaxDirectorySize()));
     if (de->ino == 0) {
         // empty entry, do we fit?
         if (args->reclen > reclen) {
-            return do_next_dirent(de, offs);
+            return do_next_dirent(vndir->fs_, de, offs);
         }
-        return add_dirent(mxtl::move(vndir), de, args, offs->off);
+        return vndir->AddChild(de, args, offs->off);
     } else {
         // filled entry, can we sub-divide?
         uint32_t size = static_cast<uint32_t>(DirentSize(de->namelen));
@@ -665,7 +776,7 @@ static mx_status_t cb_dir_append(mxtl::RefPtr<VnodeMinfs> vndir, minfs_dirent_t*
         }
         uint32_t extra = reclen - size;
         if (extra < args->reclen) {
-            return do_next_dirent(de, offs);
+            return do_next_dirent(vndir->fs_, de, offs);
         }
         // shrink existing entry
         bool was_last_record = de->reclen & kMinfsReclenLast;
@@ -680,7 +791,7 @@ static mx_status_t cb_dir_append(mxtl::RefPtr<VnodeMinfs> vndir, minfs_dirent_t*
         char data[kMinfsMaxDirentSize];
         de = (minfs_dirent_t*) data;
         de->reclen = extra | (was_last_record ? kMinfsReclenLast : 0);
-        return add_dirent(mxtl::move(vndir), de, args, offs->off);
+        return vndir->AddChild(de, args, offs->off);
     }
 }
 
@@ -696,42 +807,158 @@ static mx_status_t cb_dir_append(mxtl::RefPtr<VnodeMinfs> vndir, minfs_dirent_t*
 //  'offs': Offset info about where in the directory this direntry is located.
 //          Since 'func' may create / remove surrounding dirents, it is responsible for
 //          updating the offset information to access the next dirent.
-mx_status_t VnodeMinfs::ForEachDirent(DirArgs* args,
-                                      mx_status_t (*func)(mxtl::RefPtr<VnodeMinfs>, minfs_dirent_t*,
-                                                          DirArgs*, DirectoryOffset*)) {
+mx_status_t VnodeMinfs::ForEachDirent(DirArgs* args, DirentCallback func) {
     char data[kMinfsMaxDirentSize];
     minfs_dirent_t* de = (minfs_dirent_t*) data;
     DirectoryOffset offs = {
         .off = 0,
         .off_prev = 0,
     };
-    while (offs.off + MINFS_DIRENT_SIZE < kMinfsMaxDirectorySize) {
+    while (offs.off + MINFS_DIRENT_SIZE < fs_->MaxDirectorySize()) {
         trace(MINFS, "Reading dirent at offset %zd\n", offs.off);
         size_t r;
         mx_status_t status = ReadInternal(data, kMinfsMaxDirentSize, offs.off, &r);
         if (status != NO_ERROR) {
             return status;
-        } else if ((status = validate_dirent(de, r, offs.off)) != NO_ERROR) {
+        } else if ((status = validate_dirent(fs_, de, r, offs.off)) != NO_ERROR) {
             return status;
         }
 
-        switch ((status = func(mxtl::RefPtr<VnodeMinfs>(this), de, args, &offs))) {
-        case DIR_CB_NEXT:
-            break;
-        case DIR_CB_SAVE_SYNC:
-            inode_.seq_num++;
-            InodeSync(kMxFsSyncMtime);
-            return NO_ERROR;
-        case DIR_CB_DONE:
-        default:
+        if ((status = CallDirentFunc(args, func, de, &offs)) != DIR_CB_NEXT) {
             return status;
         }
     }
     return ERR_NOT_FOUND;
 }
 
+mx_status_t VnodeMinfs::ForDirentAt(DirArgs* args, DirentCallback func, size_t off) {
+    char data[kMinfsMaxDirentSize];
+    minfs_dirent_t* de = (minfs_dirent_t*) data;
+    DirectoryOffset offs = {
+        .off = off,
+        .off_prev = off,
+    };
+    size_t r;
+    mx_status_t status = ReadInternal(data, kMinfsMaxDirentSize, offs.off, &r);
+    if (status != NO_ERROR) {
+        return status;
+    } else if ((status = validate_dirent(fs_, de, r, offs.off)) != NO_ERROR) {
+        return status;
+    }
+    return CallDirentFunc(args, func, de, &offs);
+}
+
+// Calls 'func' on one dirent, and handles its result for ForEachDirent.
+mx_status_t VnodeMinfs::CallDirentFunc(DirArgs* args, DirentCallback func, minfs_dirent_t* de,
+                                       DirectoryOffset* offs) {
+    mx_status_t status;
+    switch ((status = func(mxtl::RefPtr<VnodeMinfs>(this), de, args, offs))) {
+    case DIR_CB_NEXT:
+        return DIR_CB_NEXT;
+    case DIR_CB_SAVE_SYNC: {
+        // Any index was updated along with the directory; keep it current.
+        DirIndex* index = DirIndexCached();
+        inode_.seq_num++;
+        if (index != nullptr) {
+            index->SetSeq(inode_.seq_num);
+        }
+        args->offs = *offs;
+        InodeSync(kMxFsSyncMtime);
+        return NO_ERROR;
+    }
+    case DIR_CB_DONE:
+        args->offs = *offs;
+        return status;
+    default:
+        // The callback may have failed halfway through changing the directory
+        fs_->dir_indices_.Evict(ino_);
+        return status;
+    }
+}
+
+static mx_status_t cb_dir_index(mxtl::RefPtr<VnodeMinfs> vndir, minfs_dirent_t* de,
+                                DirArgs* args, DirectoryOffset* offs) {
+    uint32_t off = static_cast<uint32_t>(offs->off);
+    if (de->ino != 0) {
+        if (args->index->Insert(de->name, de->namelen, off) != NO_ERROR) {
+            return ERR_NO_MEMORY;
+        }
+    }
+    if (de->reclen & kMinfsReclenLast) {
+        args->index->SetLastOffset(off);
+    } else if (de->ino == 0) {
+        args->index->AddHole(MinfsReclen(de, off, vndir->fs_->MaxDirectorySize()));
+    }
+    return do_next_dirent(vndir->fs_, de, offs);
+}
+
+DirIndex* VnodeMinfs::DirIndexGet() {
+    if (inode_.size < kMinfsDirIndexMinSize) {
+        // Small directories are cheaper to scan
+        return nullptr;
+    }
+    DirIndex* index;
+    if ((index = DirIndexCached()) != nullptr) {
+        return index;
+    }
+
+    mxtl::unique_ptr<DirIndex> built;
+    if (DirIndex::Create(ino_, &built) != NO_ERROR) {
+        return nullptr;
+    }
+    DirArgs args = DirArgs();
+    args.index = built.get();
+    if (ForEachDirent(&args, cb_dir_index) != ERR_NOT_FOUND) {
+        return nullptr;
+    }
+    built->SetSeq(inode_.seq_num);
+    index = built.get();
+    fs_->dir_indices_.Put(mxtl::move(built));
+    return index;
+}
+
+mx_status_t VnodeMinfs::ForNamedDirent(DirArgs* args, DirentCallback func) {
+    DirIndex* index;
+    if ((index = DirIndexGet()) == nullptr) {
+        return ForEachDirent(args, func);
+    }
+    uint32_t hash = DirIndex::Hash(args->name, args->len);
+    size_t cursor = 0;
+    uint32_t off;
+    while (index->Next(hash, &cursor, &off)) {
+        // 'func' checks the name; a hash collision just moves on.
+        mx_status_t status;
+        if ((status = ForDirentAt(args, func, off)) != DIR_CB_NEXT) {
+            return status;
+        }
+    }
+    return ERR_NOT_FOUND;
+}
+
+mx_status_t VnodeMinfs::AppendDirent(DirArgs* args) {
+    DirIndex* index = DirIndexGet();
+    mx_status_t status;
+    if ((index != nullptr) && !index->ShouldFillHoles()) {
+        // The last dirent holds all the space up to the maximum directory size
+        if ((status = ForDirentAt(args, cb_dir_append, index->LastOffset())) != DIR_CB_NEXT) {
+            return status;
+        }
+    }
+
+    uint32_t last = (index != nullptr) ? index->LastOffset() : 0;
+    if ((status = ForEachDirent(args, cb_dir_append)) != NO_ERROR) {
+        return status;
+    }
+    if ((index = DirIndexCached()) != nullptr && (args->offs.off >= last)) {
+        // None of the free space before the end was large enough
+        index->ClearHoles();
+    }
+    return NO_ERROR;
+}
+
 VnodeMinfs::~VnodeMinfs() {
     if (inode_.link_count == 0) {
+        JournalOp op(fs_->bc_);
         InodeDestroy();
     }
 
@@ -785,7 +1012,11 @@ mx_status_t VnodeMinfs::ReadInternal(void* data, size_t len, size_t off, size_t*
     uint32_t n = off / kMinfsBlockSize;
     size_t adjust = off % kMinfsBlockSize;
 
-    while ((len > 0) && (n < kMinfsMaxFileBlock)) {
+    // Disk block of logical block 'n', and how many blocks from 'n' on
+    // follow it contiguously; only looked up again when the run ends.
+    uint32_t bno = 0;
+    uint32_t run = 0;
+    while ((len > 0) && (n < MaxFileBlock())) {
         size_t xfer;
         if (len > (kMinfsBlockSize - adjust)) {
             xfer = kMinfsBlockSize - adjust;
@@ -793,9 +1024,10 @@ mx_status_t VnodeMinfs::ReadInternal(void* data, size_t len, size_t off, size_t*
             xfer = len;
         }
 
-        uint32_t bno;
-        if ((status = GetBno(n, &bno, false)) != NO_ERROR) {
-            return status;
+        if (run == 0) {
+            if ((status = GetBnoRun(n, &bno, &run)) != NO_ERROR) {
+                return status;
+            }
         }
         if (bno != 0) {
             char bdata[kMinfsBlockSize];
@@ -812,6 +1044,10 @@ mx_status_t VnodeMinfs::ReadInternal(void* data, size_t len, size_t off, size_t*
         len -= xfer;
         data = (void*)((uintptr_t)data + xfer);
         n++;
+        run--;
+        if (bno != 0) {
+            bno++;
+        }
     }
     *actual = (uintptr_t)data - (uintptr_t)start;
 #endif
@@ -823,6 +1059,7 @@ ssize_t VnodeMinfs::Write(const void* data, size_t len, size_t off) {
     if (IsDirectory()) {
         return ERR_NOT_FILE;
     }
+    JournalOp op(fs_->bc_);
     size_t actual;
     mx_status_t status = WriteInternal(data, len, off, &actual);
     if (status != NO_ERROR) {
@@ -848,10 +1085,12 @@ mx_status_t VnodeMinfs::WriteInternal(const void* data, size_t len, size_t off,
     }
 #endif
     const void* const start = data;
+    // File data is written in place; directory contents are journaled
+    const uint32_t wflags = IsDirectory() ? 0 : kBlockData;
     uint32_t n = static_cast<uint32_t>(off / kMinfsBlockSize);
     size_t adjust = off % kMinfsBlockSize;
 
-    while ((len > 0) && (n < kMinfsMaxFileBlock)) {
+    while ((len > 0) && (n < MaxFileBlock())) {
         size_t xfer;
         if (len > (kMinfsBlockSize - adjust)) {
             xfer = kMinfsBlockSize - adjust;
@@ -895,7 +1134,7 @@ mx_status_t VnodeMinfs::WriteInternal(const void* data, size_t len, size_t off,
             return status;
         }
         assert(bno != 0);
-        if (fs_->bc_->Writeblk(bno, wdata)) {
+        if (fs_->bc_->Writeblk(bno, wdata, wflags)) {
             return ERR_IO;
         }
 #else
@@ -909,7 +1148,7 @@ mx_status_t VnodeMinfs::WriteInternal(const void* data, size_t len, size_t off,
             return ERR_IO;
         }
         memcpy(wdata + adjust, data, xfer);
-        if (fs_->bc_->Writeblk(bno, wdata)) {
+        if (fs_->bc_->Writeblk(bno, wdata, wflags)) {
             return ERR_IO;
         }
 #endif
@@ -925,7 +1164,7 @@ done:
     if (len == 0) {
         // If more than zero bytes were requested, but zero bytes were written,
         // return an error explicitly (rather than zero).
-        if (off >= kMinfsMaxFileSize) {
+        if (off >= MaxFileSize()) {
             return ERR_FILE_BIG;
         }
 
@@ -964,7 +1203,7 @@ mx_status_t VnodeMinfs::LookupInternal(mxtl::RefPtr<fs::Vnode>* out, const char*
     args.name = name;
     args.len = len;
     mx_status_t status;
-    if ((status = ForEachDirent(&args, cb_dir_find)) < 0) {
+    if ((status = ForNamedDirent(&args, cb_dir_find)) < 0) {
         return status;
     }
     mxtl::RefPtr<VnodeMinfs> vn;
@@ -1002,6 +1241,7 @@ mx_status_t VnodeMinfs::Setattr(vnattr_t* a) {
     }
     if (dirty) {
         // write to disk, but don't overwrite the time
+        JournalOp op(fs_->bc_);
         InodeSync(kMxFsSyncDefault);
     }
     return NO_ERROR;
@@ -1037,23 +1277,23 @@ mx_status_t VnodeMinfs::Readdir(void* cookie, void* dirents, size_t len) {
 
         size_t off_recovered = 0;
         while (off_recovered < off) {
-            if (off_recovered + MINFS_DIRENT_SIZE >= kMinfsMaxDirectorySize) {
+            if (off_recovered + MINFS_DIRENT_SIZE >= fs_->MaxDirectorySize()) {
                 goto fail;
             }
             mx_status_t status = ReadInternal(de, kMinfsMaxDirentSize, off_recovered, &r);
-            if ((status != NO_ERROR) || (validate_dirent(de, r, off_recovered) != NO_ERROR)) {
+            if ((status != NO_ERROR) || (validate_dirent(fs_, de, r, off_recovered) != NO_ERROR)) {
                 goto fail;
             }
-            off_recovered += MinfsReclen(de, off_recovered);
+            off_recovered += MinfsReclen(de, off_recovered, fs_->MaxDirectorySize());
         }
         off = off_recovered;
     }
 
-    while (off + MINFS_DIRENT_SIZE < kMinfsMaxDirectorySize) {
+    while (off + MINFS_DIRENT_SIZE < fs_->MaxDirectorySize()) {
         mx_status_t status = ReadInternal(de, kMinfsMaxDirentSize, off, &r);
         if (status != NO_ERROR) {
             goto fail;
-        } else if (validate_dirent(de, r, off) != NO_ERROR) {
+        } else if (validate_dirent(fs_, de, r, off) != NO_ERROR) {
             goto fail;
         }
 
@@ -1065,7 +1305,7 @@ mx_status_t VnodeMinfs::Readdir(void* cookie, void* dirents, size_t len) {
             }
         }
 
-        off += MinfsReclen(de, off);
+        off += MinfsReclen(de, off, fs_->MaxDirectorySize());
     }
 
 done:
@@ -1102,6 +1342,9 @@ mx_status_t VnodeMinfs::Allocate(Minfs* fs, uint32_t type, mxtl::RefPtr<VnodeMin
     (*out)->inode_.magic = MinfsMagic(type);
     (*out)->inode_.create_time = (*out)->inode_.modify_time = minfs_gettime_utc();
     (*out)->inode_.link_count = (type == kMinfsTypeDir ? 2 : 1);
+    if (fs->UseExtents()) {
+        (*out)->inode_.flags = kMinfsInodeFlagExtents;
+    }
     return NO_ERROR;
 }
 
@@ -1126,12 +1369,13 @@ mx_status_t VnodeMinfs::Create(mxtl::RefPtr<fs::Vnode>* out, const char* name, s
         return ERR_BAD_STATE;
     }
 
+    JournalOp op(fs_->bc_);
     DirArgs args = DirArgs();
     args.name = name;
     args.len = len;
     // ensure file does not exist
     mx_status_t status;
-    if ((status = ForEachDirent(&args, cb_dir_find)) != ERR_NOT_FOUND) {
+    if ((status = ForNamedDirent(&args, cb_dir_find)) != ERR_NOT_FOUND) {
         return ERR_ALREADY_EXISTS;
     }
 
@@ -1160,7 +1404,7 @@ mx_status_t VnodeMinfs::Create(mxtl::RefPtr<fs::Vnode>* out, const char* name, s
     args.ino = vn->ino_;
     args.type = type;
     args.reclen = static_cast<uint32_t>(DirentSize(static_cast<uint8_t>(len)));
-    if ((status = ForEachDirent(&args, cb_dir_append)) < 0) {
+    if ((status = AppendDirent(&args)) < 0) {
         return status;
     }
 
@@ -1210,7 +1454,8 @@ mx_status_t VnodeMinfs::Unlink(const char* name, size_t len, bool must_be_dir) {
     args.name = name;
     args.len = len;
     args.type = must_be_dir ? kMinfsTypeDir : 0;
-    return ForEachDirent(&args, cb_dir_unlink);
+    JournalOp op(fs_->bc_);
+    return ForNamedDirent(&args, cb_dir_unlink);
 }
 
 mx_status_t VnodeMinfs::Truncate(size_t len) {
@@ -1218,8 +1463,9 @@ mx_status_t VnodeMinfs::Truncate(size_t len) {
         return ERR_NOT_FILE;
     }
 
+    JournalOp op(fs_->bc_);
     mx_status_t status = TruncateInternal(len);
-    if (status != NO_ERROR) {
+    if (status == NO_ERROR) {
         // Successful truncates update inode
         InodeSync(kMxFsSyncMtime);
     }
@@ -1279,7 +1525,7 @@ mx_status_t VnodeMinfs::TruncateInternal(size_t len) {
                 memset(bdata + adjust, 0, kMinfsBlockSize - adjust);
 #endif
 
-                if (fs_->bc_->Writeblk(bno, bdata)) {
+                if (fs_->bc_->Writeblk(bno, bdata, IsDirectory() ? 0 : kBlockData)) {
                     return ERR_IO;
                 }
             }
@@ -1287,7 +1533,7 @@ mx_status_t VnodeMinfs::TruncateInternal(size_t len) {
         inode_.size = static_cast<uint32_t>(len);
     } else if (len > inode_.size) {
         // Truncate should make the file longer, filled with zeroes.
-        if (kMinfsMaxFileSize < len) {
+        if (MaxFileSize() < len) {
             return ERR_INVALID_ARGS;
         }
         char zero = 0;
@@ -1348,13 +1594,14 @@ mx_status_t VnodeMinfs::Rename(mxtl::RefPtr<fs::Vnode> _newdir, const char* oldn
     if ((newlen == 2) && (newname[0] == '.') && (newname[1] == '.'))
         return ERR_BAD_STATE;
 
+    JournalOp op(fs_->bc_);
     mx_status_t status;
     mxtl::RefPtr<VnodeMinfs> oldvn = nullptr;
     // acquire the 'oldname' node (it must exist)
     DirArgs args = DirArgs();
     args.name = oldname;
     args.len = oldlen;
-    if ((status = ForEachDirent(&args, cb_dir_find)) < 0) {
+    if ((status = ForNamedDirent(&args, cb_dir_find)) < 0) {
         return status;
     } else if ((status = fs_->VnodeGet(&oldvn, args.ino)) < 0) {
         return status;
@@ -1373,11 +1620,11 @@ mx_status_t VnodeMinfs::Rename(mxtl::RefPtr<fs::Vnode> _newdir, const char* oldn
     args.len = newlen;
     args.ino = oldvn->ino_;
     args.type = oldvn->IsDirectory() ? kMinfsTypeDir : kMinfsTypeFile;
-    status = newdir->ForEachDirent(&args, cb_dir_attempt_rename);
+    status = newdir->ForNamedDirent(&args, cb_dir_attempt_rename);
     if (status == ERR_NOT_FOUND) {
         // if 'newname' does not exist, create it
         args.reclen = static_cast<uint32_t>(DirentSize(static_cast<uint8_t>(newlen)));
-        if ((status = newdir->ForEachDirent(&args, cb_dir_append)) < 0) {
+        if ((status = newdir->AppendDirent(&args)) < 0) {
             return status;
         }
         status = NO_ERROR;
@@ -1396,7 +1643,7 @@ mx_status_t VnodeMinfs::Rename(mxtl::RefPtr<fs::Vnode> _newdir, const char* oldn
         args.name = "..";
         args.len = 2;
         args.ino = newdir->ino_;
-        if ((status = vn->ForEachDirent(&args, cb_dir_update_inode)) < 0) {
+        if ((status = vn->ForNamedDirent(&args, cb_dir_update_inode)) < 0) {
             return status;
         }
     }
@@ -1408,7 +1655,7 @@ mx_status_t VnodeMinfs::Rename(mxtl::RefPtr<fs::Vnode> _newdir, const char* oldn
     // finally, remove oldname from its original position
     args.name = oldname;
     args.len = oldlen;
-    return ForEachDirent(&args, cb_dir_force_unlink);
+    return ForNamedDirent(&args, cb_dir_force_unlink);
 }
 
 mx_status_t VnodeMinfs::Link(const char* name, size_t len, mxtl::RefPtr<fs::Vnode> _target) {
@@ -1434,18 +1681,19 @@ mx_status_t VnodeMinfs::Link(const char* name, size_t len, mxtl::RefPtr<fs::Vnod
     }
 
     // The destination should not exist
+    JournalOp op(fs_->bc_);
     DirArgs args = DirArgs();
     args.name = name;
     args.len = len;
     mx_status_t status;
-    if ((status = ForEachDirent(&args, cb_dir_find)) != ERR_NOT_FOUND) {
+    if ((status = ForNamedDirent(&args, cb_dir_find)) != ERR_NOT_FOUND) {
         return (status == NO_ERROR) ? ERR_ALREADY_EXISTS : status;
     }
 
     args.ino = target->ino_;
     args.type = kMinfsTypeFile; // We can't hard link directories
     args.reclen = static_cast<uint32_t>(DirentSize(static_cast<uint8_t>(len)));
-    if ((status = ForEachDirent(&args, cb_dir_append)) < 0) {
+    if ((status = AppendDirent(&args)) < 0) {
         return status;
     }
 
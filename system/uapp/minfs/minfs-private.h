@@ -17,6 +17,7 @@
 #endif
 #include <fs/vfs.h>
 
+#include "dir-index.h"
 #include "minfs.h"
 #include "misc.h"
 
@@ -29,7 +30,9 @@ constexpr uint32_t kMxFsSyncDefault = 0;     // default: no implicit time update
 constexpr uint32_t kMxFsSyncMtime   = (1<<0);
 constexpr uint32_t kMxFsSyncCtime   = (1<<1);
 
-constexpr uint32_t kMinfsBlockCacheSize = 64;
+constexpr uint32_t kMinfsBlockCacheSize = 256;
+// Default number of dirty blocks at which the block cache starts write-back
+constexpr uint32_t kMinfsDirtyLimit = kMinfsBlockCacheSize / 2;
 
 // Used by fsck
 struct CheckMaps {
@@ -64,6 +67,19 @@ public:
     // free ino in inode bitmap, release all blocks held by inode
     mx_status_t InoFree(const minfs_inode_t& inode, uint32_t ino);
 
+    // Clear 'count' blocks starting at 'bno' in the block bitmap, using
+    // 'bitmap_blk' as with BitmapBlockGet. The caller must BitmapBlockPut it.
+    mx_status_t BlocksFree(uint32_t bno, uint32_t count, mxtl::RefPtr<BlockNode>* bitmap_blk);
+
+    // Release every data and leaf block mapped by an extent inode.
+    mx_status_t ExtentsFree(const minfs_inode_t& inode, mxtl::RefPtr<BlockNode>* bitmap_blk);
+
+    // New inodes are extent-mapped on filesystems of revision 3 or newer.
+    bool UseExtents() const { return info_.version >= kMinfsVersionExtents; }
+
+    // The largest a directory may grow, which depends on the revision.
+    uint32_t MaxDirectorySize() const { return MinfsMaxDirectorySize(info_.version); }
+
     // Writes back an inode into the inode table on persistent storage.
     // Does not modify inode bitmap.
     mx_status_t InodeSync(uint32_t ino, const minfs_inode_t* inode);
@@ -84,6 +100,7 @@ public:
     Bcache* bc_;
     RawBitmap block_map_;
     minfs_info_t info_;
+    DirIndexCache dir_indices_;
 
 private:
     // Fsck can introspect Minfs
@@ -109,17 +126,19 @@ private:
     HashTable vnode_hash_;
 };
 
+struct DirectoryOffset {
+    size_t off;      // Offset in directory of current record
+    size_t off_prev; // Offset in directory of previous record
+};
+
 struct DirArgs {
     const char* name;
     size_t len;
     uint32_t ino;
     uint32_t type;
     uint32_t reclen;
-};
-
-struct DirectoryOffset {
-    size_t off;      // Offset in directory of current record
-    size_t off_prev; // Offset in directory of previous record
+    DirIndex* index;      // Index being built, for cb_dir_index
+    DirectoryOffset offs; // Set to the offsets at which the callback stopped
 };
 
 #define INO_HASH(ino) fnv1a_tiny(ino, kMinfsHashBits)
@@ -140,11 +159,22 @@ public:
     bool IsDirectory() const { return inode_.magic == kMinfsMagicDir; }
     bool IsDeletedDirectory() const { return flags_ & kMinfsFlagDeletedDirectory; }
     bool CanUnlink() const;
+    bool HasExtents() const { return inode_.flags & kMinfsInodeFlagExtents; }
+
+    // The largest file (and logical block) the inode's block map can address
+    uint64_t MaxFileSize() const {
+        return HasExtents() ? kMinfsMaxExtentFileSize : kMinfsMaxFileSize;
+    }
+    uint32_t MaxFileBlock() const {
+        return static_cast<uint32_t>(HasExtents() ? kMinfsMaxExtentFileBlock : kMinfsMaxFileBlock);
+    }
 
     uint32_t GetKey() const { return ino_; }
     static size_t GetHash(uint32_t key) { return INO_HASH(key); }
 
     mx_status_t UnlinkChild(mxtl::RefPtr<VnodeMinfs> child, minfs_dirent_t* de, DirectoryOffset* offs);
+    // Directories only: write a new dirent for 'args' at 'off'.
+    mx_status_t AddChild(minfs_dirent_t* de, DirArgs* args, size_t off);
     // Remove the link to a vnode (referring to inodes exclusively).
     // Has no impact on direntries (or parent inode).
     void RemoveInodeLink();
@@ -189,13 +219,32 @@ private:
 
     mx_status_t InitVmo();
 
+#ifdef __Fuchsia__
+    // Read every allocated block of the file into vmo_, queueing the reads
+    // on 'txn' when the block device has a FIFO, or one at a time otherwise.
+    mx_status_t FillVmo(BlockTxn* txn);
+
     // Read data from disk at block 'bno', into the 'nth' logical block of the file.
-    mx_status_t FillBlock(uint32_t n, uint32_t bno);
+    mx_status_t FillBlock(BlockTxn* txn, uint32_t n, uint32_t bno);
+#endif
 
     // Get the disk block 'bno' corresponding to the 'nth' logical block of the file.
     // Allocate the block if reqeusted.
     mx_status_t GetBno(uint32_t n, uint32_t* bno, bool alloc);
 
+    // Get the disk block 'bno' of the 'nth' logical block of the file, and the
+    // number of logical blocks from 'n' on which are mapped contiguously (or,
+    // if 'bno' is zero, unmapped). Never allocates.
+    mx_status_t GetBnoRun(uint32_t n, uint32_t* bno, uint32_t* run);
+
+    // Extent inodes only: map the 'nth' logical block, allocating if needed.
+    mx_status_t ExtentAlloc(uint32_t n, uint32_t* bno);
+    // Add the mapping n -> bno, converting the inode to an indexed extent
+    // map when the inline extents run out.
+    mx_status_t ExtentInsert(uint32_t n, uint32_t bno);
+    // BlocksShrink for extent inodes.
+    mx_status_t ExtentsShrink(uint32_t start);
+
     // Deletes all blocks (relateive to a file) from "start" (inclusive) to the end
     // of the file. Does not update mtime/atime.
     mx_status_t BlocksShrink(uint32_t start);
@@ -206,9 +255,26 @@ private:
     mx_status_t InodeDestroy();
 
     // Directories only
-    mx_status_t ForEachDirent(DirArgs* args,
-                              mx_status_t (*func)(mxtl::RefPtr<VnodeMinfs>, minfs_dirent_t*, DirArgs*,
-                                                  DirectoryOffset*));
+    using DirentCallback = mx_status_t (*)(mxtl::RefPtr<VnodeMinfs>, minfs_dirent_t*, DirArgs*,
+                                           DirectoryOffset*);
+    mx_status_t ForEachDirent(DirArgs* args, DirentCallback func);
+    // Call 'func' on the dirent at 'off' only, returning DIR_CB_NEXT if it
+    // moved on.
+    mx_status_t ForDirentAt(DirArgs* args, DirentCallback func, size_t off);
+    // ForEachDirent for callbacks which only act on the dirent named by
+    // 'args': visits only the dirents the directory index points at.
+    mx_status_t ForNamedDirent(DirArgs* args, DirentCallback func);
+    // Add a dirent for 'args', at the end of the directory when the index
+    // says there is little free space before it.
+    mx_status_t AppendDirent(DirArgs* args);
+    mx_status_t CallDirentFunc(DirArgs* args, DirentCallback func, minfs_dirent_t* de,
+                               DirectoryOffset* offs);
+
+    // The directory index, built if the directory is large enough to need
+    // one and it is not cached. Returns nullptr if there is none.
+    DirIndex* DirIndexGet();
+    // The index if it is cached and current, without building it.
+    DirIndex* DirIndexCached() { return fs_->dir_indices_.Get(ino_, inode_.seq_num); }
 
 #ifdef __Fuchsia__
     mx_status_t AddDispatcher(mx_handle_t h, vfs_iostate_t* cookie) final;
@@ -238,6 +304,10 @@ void minfs_sync_vnode(mxtl::RefPtr<VnodeMinfs> vn, uint32_t flags);
 mx_status_t minfs_check_info(minfs_info_t* info, uint32_t max);
 void minfs_dump_info(minfs_info_t* info);
 
+// If the volume has a journal, replay it and hand it to the block cache.
+// Must precede any other read of the volume's metadata.
+mx_status_t minfs_journal_load(Bcache* bc, minfs_info_t* info);
+
 int minfs_mkfs(Bcache* bc);
 
 mx_status_t check_inode(CheckMaps*, const Minfs*, uint32_t, uint32_t);
@@ -245,6 +315,11 @@ mx_status_t minfs_check(Bcache* bc);
 
 mx_status_t minfs_mount(mxtl::RefPtr<VnodeMinfs>* root_out, Bcache* bc);
 
+// Look up logical block 'n' of an extent inode, returning its disk block in
+// 'bno' (zero if unmapped) and the length of the run starting at 'n' in 'run'.
+mx_status_t ExtentLookup(Bcache* bc, const minfs_inode_t* inode, uint32_t n,
+                         uint32_t* bno, uint32_t* run);
+
 void minfs_dir_init(void* bdata, uint32_t ino_self, uint32_t ino_parent);
 
 } // namespace minfs
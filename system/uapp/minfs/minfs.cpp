@@ -14,6 +14,7 @@
 #include <mxtl/algorithm.h>
 #include <mxtl/unique_ptr.h>
 
+#include "journal.h"
 #include "minfs-private.h"
 
 namespace minfs {
@@ -37,6 +38,9 @@ void minfs_dump_info(minfs_info_t* info) {
     printf("minfs: inode bitmap @ %10u\n", info->ibm_block);
     printf("minfs: alloc bitmap @ %10u\n", info->abm_block);
     printf("minfs: inode table  @ %10u\n", info->ino_block);
+    if (info->version >= kMinfsVersionJournal) {
+        printf("minfs: journal      @ %10u (%u blocks)\n", info->jnl_block, info->jnl_blocks);
+    }
     printf("minfs: data blocks  @ %10u\n", info->dat_block);
 }
 
@@ -46,7 +50,7 @@ mx_status_t minfs_check_info(minfs_info_t* info, uint32_t max) {
         error("minfs: bad magic\n");
         return ERR_INVALID_ARGS;
     }
-    if (info->version != kMinfsVersion) {
+    if ((info->version < kMinfsVersionMin) || (info->version > kMinfsVersion)) {
         error("minfs: FS Version: %08x. Driver version: %08x\n", info->version,
               kMinfsVersion);
         return ERR_INVALID_ARGS;
@@ -60,10 +64,35 @@ mx_status_t minfs_check_info(minfs_info_t* info, uint32_t max) {
         error("minfs: too large for device\n");
         return ERR_INVALID_ARGS;
     }
+    if ((info->version >= kMinfsVersionJournal) && (info->jnl_blocks != 0) &&
+        ((info->jnl_blocks < 4) || (info->jnl_block < info->ino_block) ||
+         (info->jnl_block + info->jnl_blocks > info->dat_block))) {
+        error("minfs: bad journal %u+%u\n", info->jnl_block, info->jnl_blocks);
+        return ERR_INVALID_ARGS;
+    }
     //TODO: validate layout
     return 0;
 }
 
+mx_status_t minfs_journal_load(Bcache* bc, minfs_info_t* info) {
+    mx_status_t status;
+    if ((status = minfs_check_info(info, bc->Maxblk())) != NO_ERROR) {
+        return status;
+    }
+    if ((info->version < kMinfsVersionJournal) || (info->jnl_blocks == 0)) {
+        return NO_ERROR;
+    }
+    mxtl::unique_ptr<Journal> journal;
+    if ((status = Journal::Create(*info, info->block_count, &journal)) != NO_ERROR) {
+        return status;
+    }
+    if ((status = journal->Replay(bc)) != NO_ERROR) {
+        error("minfs: cannot replay journal\n");
+        return status;
+    }
+    return bc->SetJournal(mxtl::move(journal));
+}
+
 mx_status_t Minfs::InodeSync(uint32_t ino, const minfs_inode_t* inode) {
     // Obtain the offset of the inode within its containing block
     uint32_t off_of_ino = (ino % kMinfsInodesPerBlock) * kMinfsInodeSize;
@@ -107,6 +136,12 @@ mx_status_t Minfs::InoFree(const minfs_inode_t& inode, uint32_t ino) {
 
     mxtl::RefPtr<BlockNode> bitmap_blk;
 
+    if (inode.flags & kMinfsInodeFlagExtents) {
+        mx_status_t status = ExtentsFree(inode, &bitmap_blk);
+        BitmapBlockPut(bitmap_blk);
+        return status;
+    }
+
     // release all direct blocks
     for (unsigned n = 0; n < kMinfsDirect; n++) {
         if (inode.dnum[n] == 0) {
@@ -390,12 +425,8 @@ mx_status_t Minfs::Create(Minfs** out, Bcache* bc, minfs_info_t* info) {
         return status;
     }
 
-    for (uint32_t n = 0; n < inoblks; n++) {
-        void* bmdata = (void*)((uintptr_t)(fs->inode_table_->GetData()) +
-                               (uintptr_t)(kMinfsBlockSize * n));
-        if (fs->bc_->Readblk(fs->info_.ino_block + n, bmdata)) {
-            error("minfs: failed reading inode table\n");
-        }
+    if (fs->bc_->Readblks(fs->info_.ino_block, inoblks, fs->inode_table_->GetData())) {
+        error("minfs: failed reading inode table\n");
     }
 #endif
 
@@ -404,17 +435,11 @@ mx_status_t Minfs::Create(Minfs** out, Bcache* bc, minfs_info_t* info) {
 }
 
 mx_status_t Minfs::LoadBitmaps() {
-    for (uint32_t n = 0; n < abmblks_; n++) {
-        void* bmdata = GetBlock(block_map_, n);
-        if (bc_->Readblk(info_.abm_block + n, bmdata)) {
-            error("minfs: failed reading alloc bitmap\n");
-        }
+    if (bc_->Readblks(info_.abm_block, abmblks_, GetBlock(block_map_, 0))) {
+        error("minfs: failed reading alloc bitmap\n");
     }
-    for (uint32_t n = 0; n < ibmblks_; n++) {
-        void* bmdata = GetBlock(inode_map_, n);
-        if (bc_->Readblk(info_.ibm_block + n, bmdata)) {
-            error("minfs: failed reading inode bitmap\n");
-        }
+    if (bc_->Readblks(info_.ibm_block, ibmblks_, GetBlock(inode_map_, 0))) {
+        error("minfs: failed reading inode bitmap\n");
     }
     return NO_ERROR;
 }
@@ -427,6 +452,9 @@ mx_status_t minfs_mount(mxtl::RefPtr<VnodeMinfs>* out, Bcache* bc) {
         error("minfs: could not read info block\n");
         return status;
     }
+    if ((status = minfs_journal_load(bc, &info)) != NO_ERROR) {
+        return status;
+    }
 
     Minfs* fs;
     if ((status = Minfs::Create(&fs, bc, &info)) != NO_ERROR) {
@@ -490,7 +518,9 @@ int minfs_mkfs(Bcache* bc) {
     info.ibm_block = 8;
     info.abm_block = info.ibm_block + mxtl::roundup(ibmblks, 8u);
     info.ino_block = info.abm_block + mxtl::roundup(abmblks, 8u);
-    info.dat_block = info.ino_block + inoblks;
+    info.jnl_block = info.ino_block + inoblks;
+    info.jnl_blocks = kMinfsJournalBlocks;
+    info.dat_block = info.jnl_block + info.jnl_blocks;
     minfs_dump_info(&info);
 
     RawBitmap abm;
@@ -565,9 +595,19 @@ int minfs_mkfs(Bcache* bc) {
     ino[kMinfsRootIno].block_count = 1;
     ino[kMinfsRootIno].link_count = 1;
     ino[kMinfsRootIno].dirent_count = 2;
-    ino[kMinfsRootIno].dnum[0] = info.dat_block;
+    ino[kMinfsRootIno].flags = kMinfsInodeFlagExtents;
+    ino[kMinfsRootIno].extent_count = 1;
+    minfs_extent_t* ext = InodeExtents(&ino[kMinfsRootIno]);
+    ext[0].start = 0;
+    ext[0].count = 1;
+    ext[0].bno = info.dat_block;
     bc->Put(blk, kBlockDirty);
 
+    if ((status = Journal::Format(bc, info)) != NO_ERROR) {
+        error("mkfs: Failed to write journal\n");
+        return status;
+    }
+
     blk = bc->GetZero(0);
     memcpy(blk->data(), &info, sizeof(info));
     bc->Put(blk, kBlockDirty);
@@ -6,12 +6,14 @@
 
 #include <bitmap/raw-bitmap.h>
 #include <bitmap/storage.h>
+#include <mxtl/array.h>
 #include <mxtl/intrusive_double_list.h>
 #include <mxtl/intrusive_hash_table.h>
 #include <mxtl/macros.h>
 #include <mxtl/ref_counted.h>
 #include <mxtl/ref_ptr.h>
 #include <mxtl/unique_free_ptr.h>
+#include <mxtl/unique_ptr.h>
 
 #include <magenta/types.h>
 
@@ -22,6 +24,14 @@
 
 #include "misc.h"
 
+#ifdef __Fuchsia__
+#include <threads.h>
+
+#include <block-client/client.h>
+#include <fs/mapped-vmo.h>
+#include <magenta/device/block.h>
+#endif
+
 #ifdef __Fuchsia__
 using RawBitmap = bitmap::RawBitmapGeneric<bitmap::VmoStorage>;
 #else
@@ -34,7 +44,13 @@ namespace minfs {
 
 constexpr uint64_t kMinfsMagic0 = (0x002153466e694d21ULL);
 constexpr uint64_t kMinfsMagic1 = (0x385000d3d3d3d304ULL);
-constexpr uint32_t kMinfsVersion = 0x00000002;
+constexpr uint32_t kMinfsVersion = 0x00000004;
+// Oldest format revision the driver still mounts. Revision 2 volumes have no
+// extent inodes, and none are created on them; volumes before revision 4 have
+// no journal, and are updated in place.
+constexpr uint32_t kMinfsVersionMin     = 0x00000002;
+constexpr uint32_t kMinfsVersionExtents = 0x00000003;
+constexpr uint32_t kMinfsVersionJournal = 0x00000004;
 
 constexpr uint32_t kMinfsRootIno        = 1;
 constexpr uint32_t kMinfsFlagClean      = 1;
@@ -72,8 +88,41 @@ typedef struct {
     uint32_t abm_block;     // first blockno of block allocation bitmap
     uint32_t ino_block;     // first blockno of inode table
     uint32_t dat_block;     // first blockno available for file data
+    uint32_t jnl_block;     // first blockno of the metadata journal
+    uint32_t jnl_blocks;    // size of the journal (zero if there is none)
 } minfs_info_t;
 
+// The metadata journal is a ring of blocks following the inode table. Its
+// first block holds a minfs_journal_info_t; the others hold transactions.
+// A transaction is a header block listing the blocks it updates, a copy of
+// each of them, and a commit block written only once all of those are on
+// disk. Transactions from 'seq' on, starting at ring position 'start', are
+// replayed at mount until one is found incomplete.
+constexpr uint64_t kMinfsJournalMagic  = (0x6c6e724a53466e4dULL);
+constexpr uint32_t kMinfsJournalBlocks = 256;
+
+constexpr uint32_t kMinfsJournalHeader = 1;
+constexpr uint32_t kMinfsJournalCommit = 2;
+
+typedef struct {
+    uint64_t magic;
+    uint64_t seq;           // sequence number of the oldest live transaction
+    uint32_t start;         // ring position (block after the info block) of it
+    uint32_t rsvd;
+} minfs_journal_info_t;
+
+typedef struct {
+    uint64_t magic;
+    uint64_t seq;
+    uint32_t type;          // kMinfsJournalHeader or kMinfsJournalCommit
+    uint32_t count;         // blocks updated by the transaction
+    uint32_t checksum;      // covers every copy, and where it belongs
+    uint32_t bno[];         // header only: where each copy belongs
+} minfs_journal_block_t;
+
+constexpr uint32_t kMinfsJournalMaxTxnBlocks =
+    (kMinfsBlockSize - sizeof(minfs_journal_block_t)) / sizeof(uint32_t);
+
 // Notes:
 // - the ibm, abm, ino, and dat regions must be in that order
 //   and may not overlap
@@ -87,6 +136,9 @@ typedef struct {
 //     ino_block + ino / kMinfsInodesPerBlock
 //   at offset: ino % kMinfsInodesPerBlock
 // - inode 0 is never used, should be marked allocated but ignored
+// - on revision 3 volumes, new inodes map their data with extents (see
+//   minfs_extent_t); extent leaf blocks count towards block_count like
+//   indirect blocks do
 
 typedef struct {
     uint32_t magic;
@@ -98,7 +150,9 @@ typedef struct {
     uint32_t seq_num;               // bumped when modified
     uint32_t gen_num;               // bumped when deleted
     uint32_t dirent_count;          // for directories
-    uint32_t rsvd[5];
+    uint32_t flags;                 // kMinfsInodeFlag*
+    uint32_t extent_count;          // inline extents in use (extent inodes)
+    uint32_t rsvd[3];
     uint32_t dnum[kMinfsDirect];    // direct blocks
     uint32_t inum[kMinfsIndirect];  // indirect blocks
 } minfs_inode_t;
@@ -106,6 +160,41 @@ typedef struct {
 static_assert(sizeof(minfs_inode_t) == kMinfsInodeSize,
               "minfs inode size is wrong");
 
+// A run of 'count' blocks of a file, starting at logical block 'start',
+// stored on disk starting at block 'bno'.
+typedef struct {
+    uint32_t start;
+    uint32_t count;
+    uint32_t bno;
+} minfs_extent_t;
+
+// The data of an inode with kMinfsInodeFlagExtents is mapped by a sorted,
+// non-overlapping array of extents kept in place of dnum/inum. Once more
+// than kMinfsInlineExtents are needed, kMinfsInodeFlagExtentIndex is set and
+// each inline entry instead points at a leaf block ('bno') holding 'count'
+// sorted extents, the first of which starts at 'start'.
+constexpr uint32_t kMinfsInodeFlagExtents     = 0x00000001;
+constexpr uint32_t kMinfsInodeFlagExtentIndex = 0x00000002;
+
+constexpr uint32_t kMinfsInlineExtents   = (kMinfsDirect + kMinfsIndirect) * sizeof(uint32_t) /
+                                           sizeof(minfs_extent_t);
+constexpr uint32_t kMinfsExtentsPerBlock = kMinfsBlockSize / sizeof(minfs_extent_t);
+
+// Extent inodes are only limited by the 32-bit size field.
+constexpr uint64_t kMinfsMaxExtentFileSize  = UINT32_MAX & ~(kMinfsBlockSize - 1);
+constexpr uint64_t kMinfsMaxExtentFileBlock = kMinfsMaxExtentFileSize / kMinfsBlockSize;
+
+static_assert(kMinfsInlineExtents * sizeof(minfs_extent_t) <=
+              (kMinfsDirect + kMinfsIndirect) * sizeof(uint32_t),
+              "minfs inline extents do not fit in the inode");
+
+inline minfs_extent_t* InodeExtents(minfs_inode_t* inode) {
+    return reinterpret_cast<minfs_extent_t*>(inode->dnum);
+}
+inline const minfs_extent_t* InodeExtents(const minfs_inode_t* inode) {
+    return reinterpret_cast<const minfs_extent_t*>(inode->dnum);
+}
+
 typedef struct {
     uint32_t ino;                   // inode number
     uint32_t reclen;                // Low 28 bits: Length of record
@@ -124,6 +213,14 @@ constexpr uint32_t DirentSize(uint8_t namelen) {
 constexpr uint8_t kMinfsMaxNameSize       = 255;
 constexpr uint32_t kMinfsMaxDirentSize    = DirentSize(kMinfsMaxNameSize);
 constexpr uint32_t kMinfsMaxDirectorySize = (((1 << 20) - 1) & (~3));
+// Revision 3 and newer volumes allow larger directories. Older drivers
+// reject directories past kMinfsMaxDirectorySize, so older volumes keep it.
+constexpr uint32_t kMinfsMaxDirectorySizeExtents = (((1 << 24) - 1) & (~3));
+
+constexpr uint32_t MinfsMaxDirectorySize(uint32_t version) {
+    return (version >= kMinfsVersionExtents) ? kMinfsMaxDirectorySizeExtents :
+           kMinfsMaxDirectorySize;
+}
 
 static_assert(kMinfsMaxNameSize >= NAME_MAX,
               "MinFS names must be large enough to hold NAME_MAX characters");
@@ -131,13 +228,15 @@ static_assert(kMinfsMaxNameSize >= NAME_MAX,
 constexpr uint32_t kMinfsReclenMask = 0x0FFFFFFF;
 constexpr uint32_t kMinfsReclenLast = 0x80000000;
 
-constexpr uint32_t MinfsReclen(minfs_dirent_t* de, size_t off) {
+// The last record extends to 'max_dir_size', the largest a directory may
+// grow on the volume.
+constexpr uint32_t MinfsReclen(minfs_dirent_t* de, size_t off, uint32_t max_dir_size) {
     return (de->reclen & kMinfsReclenLast) ?
-           kMinfsMaxDirectorySize - static_cast<uint32_t>(off) :
+           max_dir_size - static_cast<uint32_t>(off) :
            de->reclen & kMinfsReclenMask;
 }
 
-static_assert(kMinfsMaxDirectorySize <= kMinfsReclenMask,
+static_assert(kMinfsMaxDirectorySizeExtents <= kMinfsReclenMask,
               "MinFS directory size must be smaller than reclen mask");
 
 // Notes:
@@ -161,6 +260,13 @@ static_assert(kMinfsMaxDirectorySize <= kMinfsReclenMask,
 
 // Block Cache (bcache.c)
 class Bcache;
+class Journal;
+
+// Largest run of blocks the block cache moves through its staging buffer in
+// one block FIFO request.
+constexpr uint32_t kMinfsMaxTransferBlocks = 32;
+// Blocks read ahead of a cache miss which follows the previous miss.
+constexpr uint32_t kMinfsReadaheadBlocks = 8;
 
 // Flag denoting if a block is dirty or not
 constexpr uint32_t kBlockDirty = 0x01;
@@ -171,6 +277,10 @@ constexpr uint32_t kBlockFree  = 0x08;
 
 constexpr uint32_t kBlockLLFlags = (kBlockBusy | kBlockLRU | kBlockFree);
 
+// Passed to Put along with kBlockDirty for blocks of file data, which are
+// written in place rather than through the journal.
+constexpr uint32_t kBlockData  = 0x10;
+
 constexpr uint32_t kMinfsHashBits = (8);
 constexpr uint32_t kMinfsBuckets = (1 << kMinfsHashBits);
 
@@ -218,6 +328,8 @@ public:
     void PushBack(mxtl::RefPtr<BlockNode> blk, uint32_t block_type);
     mxtl::RefPtr<BlockNode> PopFront(uint32_t block_type);
     mxtl::RefPtr<BlockNode> Erase(mxtl::RefPtr<BlockNode> blk, uint32_t block_type);
+    // Flags of the block at the front of a list, or zero if it is empty.
+    uint32_t FrontFlags(uint32_t block_type);
 
 private:
     using LinkedList = mxtl::DoublyLinkedList<mxtl::RefPtr<BlockNode>, BlockNode::TypeListTraits>;
@@ -233,14 +345,32 @@ class Bcache {
 public:
     DISALLOW_COPY_ASSIGN_AND_MOVE(Bcache);
     friend class BlockNode;
+    friend class Journal;
 
     static mx_status_t Create(Bcache** out, int fd, uint32_t blockmax, uint32_t blocksize,
                               uint32_t num);
 
-    // Raw block read functions.
-    // These do not track blocks (or attempt to access the block cache)
+    // Whole block read / write functions.
+    // These do not track blocks, but they are coherent with the write-back
+    // cache: Writeblk leaves the block dirty in the cache rather than writing
+    // it, and Readblk returns cached data before going to the device.
+    // 'flags' may hold kBlockData, as for Put.
     mx_status_t Readblk(uint32_t bno, void* data);
-    mx_status_t Writeblk(uint32_t bno, const void* data);
+    mx_status_t Writeblk(uint32_t bno, const void* data, uint32_t flags = 0);
+    // Read 'count' consecutive blocks starting at 'bno', using as few
+    // device requests as possible.
+    mx_status_t Readblks(uint32_t bno, uint32_t count, void* data);
+
+#ifdef __Fuchsia__
+    // Attach a vmo to the block device, so BlockTxn can move blocks directly
+    // in and out of it. Fails with ERR_NOT_SUPPORTED if the device was not
+    // opened with a block FIFO, in which case callers fall back to Readblk.
+    mx_status_t AttachVmo(mx_handle_t vmo, vmoid_t* out);
+    mx_status_t DetachVmo(vmoid_t vmoid);
+
+    // Send 'count' requests as a single transaction and wait for all of them.
+    mx_status_t Txn(block_fifo_request_t* requests, size_t count);
+#endif
 
     uint32_t Maxblk() const { return blockmax_; };
 
@@ -259,12 +389,33 @@ public:
     mx_status_t Read(uint32_t bno, void* data, uint32_t off, uint32_t len);
     mx_status_t Write(uint32_t bno, const void* data, uint32_t off, uint32_t len);
 
-    // drop all non-busy, non-dirty blocks
+    // write back dirty blocks, then drop all non-busy blocks
     void Invalidate();
 
+    // Write back every dirty block, and wait until the device has all of
+    // them. Blocks dirtied before a Flush reach the device before any block
+    // dirtied after it; there is no ordering between writes in between.
+    // With a journal, metadata only reaches it at the end of an operation:
+    // a Flush within one writes back file data alone.
+    mx_status_t Flush();
+    // Flush, then ask the device to make the writes durable.
     int Sync();
+    // Flush (emptying the journal) and release the device.
     int Close();
 
+    // Write metadata through 'journal' from now on. Blocks written without
+    // kBlockData are only written in place once a checkpoint finds the
+    // journal full (or at Close); until then the journal holds them.
+    mx_status_t SetJournal(mxtl::unique_ptr<Journal> journal);
+
+    // Bracket one filesystem operation (see JournalOp). Operations nest.
+    void BeginOp() { op_depth_++; }
+    void EndOp();
+
+    // Write-back starts once this many blocks are dirty.
+    void SetDirtyLimit(uint32_t blocks);
+    uint32_t DirtyCount() const { return dirty_count_; }
+
     ~Bcache();
 
 private:
@@ -272,6 +423,100 @@ private:
 
     mxtl::RefPtr<BlockNode> Get(uint32_t bno, uint32_t mode);
 
+    // Uncached single block I/O.
+    mx_status_t DevRead(uint32_t bno, void* data);
+    mx_status_t DevWrite(uint32_t bno, const void* data);
+
+    // Find a block to reuse, writing back dirty blocks first if need be.
+    mxtl::RefPtr<BlockNode> Evict();
+
+    // Start writing back every dirty block in the LRU list, sorted by block
+    // number so adjacent blocks go out as one request. The blocks are clean
+    // (and may be evicted) once this returns, even if the writes are still in
+    // flight. With a journal, metadata is committed as one transaction, but
+    // only between operations unless 'force' is set.
+    mx_status_t Writeback(bool force = false);
+    // Wait for the write-back in flight, if any. Must precede device reads,
+    // which could otherwise see data older than an evicted block.
+    mx_status_t WritebackWait();
+    // Write every block in the journal in place, leaving it empty.
+    mx_status_t CheckpointJournal();
+
+    // Write-back batches are built as a list of writes, each from one of two
+    // buffers: the staging buffer (holding copies of the dirty blocks), or
+    // the journal. A barrier makes everything before it reach the device
+    // before anything after it is sent.
+    enum WbBuffer : uint32_t {
+        kWbStaging,
+        kWbJournal,
+    };
+    struct WbWrite {
+        uint32_t buf;
+        uint32_t slot;      // First block within the buffer
+        uint32_t bno;       // First device block
+        uint32_t count;
+        bool barrier;       // Wait for this write (and all before it)
+    };
+    void* WbData(uint32_t buf, uint32_t slot) const;
+    void WbQueue(uint32_t buf, uint32_t slot, uint32_t bno);
+    void WbBarrier();
+    // Hand the batch to the write-back thread, or write it now.
+    mx_status_t WbSubmit();
+    mx_status_t WbIssue();
+
+#ifdef __Fuchsia__
+    // Set up (and tear down) the block FIFO and the staging buffer used by
+    // Readblk/Writeblk. Without them, Bcache falls back to I/O on fd_.
+    mx_status_t AttachFifo();
+    void ReleaseFifo();
+
+    // Move 'count' blocks between the device and 'data' through iobuf_.
+    // A null 'data' leaves read blocks in iobuf_ ('count' must then fit).
+    mx_status_t FifoTransfer(uint16_t opcode, uint32_t bno, uint32_t count, void* data);
+
+    // Number of blocks past 'bno', none of them cached, worth reading along
+    // with it. Non-zero only if 'bno' continues the previous miss.
+    uint32_t ReadaheadCount(uint32_t bno);
+    // Cache the 'count' blocks which follow 'bno' in iobuf_.
+    void InstallReadahead(uint32_t bno, uint32_t count);
+
+    fifo_client_t* fifo_client_ = nullptr;
+    txnid_t txnid_;
+    mxtl::unique_ptr<MappedVmo> iobuf_;
+    vmoid_t iobuf_vmoid_;
+    uint32_t last_miss_ = 0;
+
+    // Write-back runs on its own thread (and FIFO txnid) once the main
+    // thread has staged the dirty blocks in wb_buf_.
+    mx_status_t StartWritebackThread();
+    void StopWritebackThread();
+    static int WritebackThread(void* arg);
+
+    bool wb_thread_running_ = false;
+    mtx_t wb_lock_;
+    cnd_t wb_cond_;
+    // Set by Writeback() when a batch is handed to the thread, and cleared
+    // by the thread once it is written. Protected by wb_lock_, as are
+    // wb_exit_ and wb_status_.
+    bool wb_pending_ = false;
+    bool wb_exit_ = false;
+    mx_status_t wb_status_ = NO_ERROR;
+    thrd_t wb_thread_;
+    txnid_t wb_txnid_;
+    vmoid_t wb_vmoid_;
+    vmoid_t jnl_vmoid_;
+    mxtl::unique_ptr<MappedVmo> wb_buf_;
+#else
+    mxtl::unique_ptr<char[]> wb_buf_;
+#endif
+    mxtl::Array<WbWrite> wb_writes_;
+    size_t wb_count_ = 0;
+    uint32_t dirty_count_ = 0;   // Dirty blocks in the LRU list
+    uint32_t dirty_limit_;
+
+    mxtl::unique_ptr<Journal> journal_;
+    uint32_t op_depth_ = 0;
+
     using HashTableBucket = mxtl::DoublyLinkedList<mxtl::RefPtr<BlockNode>, BlockNode::TypeHashTraits>;
     using HashTable = mxtl::HashTable<uint32_t, mxtl::RefPtr<BlockNode>, HashTableBucket>;
     HashTable hash_; // Map of all 'in use' blocks, accessible by bno
@@ -281,6 +526,35 @@ private:
     uint32_t blocksize_;
 };
 
+#ifdef __Fuchsia__
+// Collects the block FIFO requests for one attached vmo, extending the last
+// request instead of adding one when both its vmo and device ranges continue
+// it. Up to MAX_TXN_MESSAGES requests go out in each transaction, so the
+// block server has all of them in flight at once.
+class BlockTxn {
+public:
+    DISALLOW_COPY_ASSIGN_AND_MOVE(BlockTxn);
+    BlockTxn(Bcache* bc, vmoid_t vmoid);
+    ~BlockTxn();
+
+    // Queue a transfer of 'nblocks' between block 'vmo_bno' of the vmo and
+    // block 'dev_bno' of the device. May send the transaction if it is full.
+    mx_status_t Enqueue(uint16_t opcode, uint32_t vmo_bno, uint32_t dev_bno, uint32_t nblocks);
+
+    // Send everything queued and wait for it to complete.
+    mx_status_t Flush();
+
+    // Drop everything queued without sending it.
+    void Cancel() { count_ = 0; }
+
+private:
+    Bcache* bc_;
+    vmoid_t vmoid_;
+    size_t count_;
+    block_fifo_request_t requests_[MAX_TXN_MESSAGES];
+};
+#endif
+
 void* GetBlock(const RawBitmap& bitmap, uint32_t blkno);
 void* GetBitBlock(const RawBitmap& bitmap, uint32_t* blkno_out, uint32_t bitno);
 
@@ -15,17 +15,22 @@ MODULE_SRCS := \
 # "libfs"
 MODULE_SRCS += \
     $(LOCAL_DIR)/bcache.cpp \
+    $(LOCAL_DIR)/journal.cpp \
 
 # minfs implementation
 MODULE_SRCS += \
     $(LOCAL_DIR)/minfs.cpp \
     $(LOCAL_DIR)/minfs-ops.cpp \
     $(LOCAL_DIR)/minfs-check.cpp \
+    $(LOCAL_DIR)/extent.cpp \
+    $(LOCAL_DIR)/dir-index.cpp \
 
 MODULE_STATIC_LIBS := \
+    system/ulib/block-client \
     system/ulib/fs \
     system/ulib/mxcpp \
     system/ulib/mxtl \
+    system/ulib/sync \
 
 MODULE_LIBS := \
     system/ulib/bitmap \
@@ -50,9 +55,12 @@ MODULE_SRCS := \
     $(LOCAL_DIR)/test.cpp \
     $(LOCAL_DIR)/host.cpp \
     $(LOCAL_DIR)/bcache.cpp \
+    $(LOCAL_DIR)/journal.cpp \
     $(LOCAL_DIR)/minfs.cpp \
     $(LOCAL_DIR)/minfs-ops.cpp \
     $(LOCAL_DIR)/minfs-check.cpp \
+    $(LOCAL_DIR)/extent.cpp \
+    $(LOCAL_DIR)/dir-index.cpp \
     system/ulib/fs/vfs.cpp \
     system/ulib/mxcpp/new.cpp \
     system/ulib/mxcpp/pure_virtual.cpp \
@@ -11,11 +11,13 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <magenta/compiler.h>
 
 #include "host.h"
+#include "minfs-private.h"
 #include "misc.h"
 
 void drop_cache();
@@ -308,6 +310,329 @@ int test_rename() {
     return 0;
 }
 
+#define CHECK(cond) ({\
+    if (!(cond)) { \
+        printf("%s:%d:check failed: %s\n", __FILE__, __LINE__, #cond); \
+        return -1; \
+    } })
+
+// Returns true if block 'bno' of 'fd' is filled with 'val'
+static bool block_is(int fd, uint32_t bno, uint8_t val) {
+    uint8_t data[minfs::kMinfsBlockSize];
+    if (pread(fd, data, sizeof(data), bno * minfs::kMinfsBlockSize) != sizeof(data)) {
+        return false;
+    }
+    for (size_t i = 0; i < sizeof(data); i++) {
+        if (data[i] != val) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Exercises the block cache directly, checking what reaches the backing file
+int test_writeback() {
+    using minfs::kMinfsBlockSize;
+    using minfs::kMinfsBlockCacheSize;
+    constexpr uint32_t kBlocks = kMinfsBlockCacheSize * 4;
+
+    char path[] = "/tmp/minfs-writeback.XXXXXX";
+    int fd = TRY(mkstemp(path));
+    unlink(path);
+    CHECK(ftruncate(fd, kBlocks * kMinfsBlockSize) == 0);
+    minfs::Bcache* bc;
+    CHECK(minfs::Bcache::Create(&bc, fd, kBlocks, kMinfsBlockSize, kMinfsBlockCacheSize) == 0);
+
+    // Writes are held in the cache, but visible through it
+    uint8_t data[kMinfsBlockSize];
+    memset(data, 0x11, sizeof(data));
+    CHECK(bc->Writeblk(7, data) == NO_ERROR);
+    CHECK(bc->DirtyCount() == 1);
+    CHECK(block_is(fd, 7, 0));
+    memset(data, 0, sizeof(data));
+    CHECK(bc->Readblk(7, data) == NO_ERROR);
+    CHECK(data[0] == 0x11 && data[kMinfsBlockSize - 1] == 0x11);
+
+    // Only the last of several writes to a block lands, once synced
+    memset(data, 0x22, sizeof(data));
+    CHECK(bc->Writeblk(7, data) == NO_ERROR);
+    CHECK(bc->DirtyCount() == 1);
+    CHECK(bc->Sync() == 0);
+    CHECK(bc->DirtyCount() == 0);
+    CHECK(block_is(fd, 7, 0x22));
+
+    // Reaching the dirty limit writes everything back
+    bc->SetDirtyLimit(4);
+    for (uint32_t bno = 10; bno < 13; bno++) {
+        memset(data, bno, sizeof(data));
+        CHECK(bc->Writeblk(bno, data) == NO_ERROR);
+    }
+    CHECK(bc->DirtyCount() == 3);
+    CHECK(block_is(fd, 10, 0));
+    memset(data, 13, sizeof(data));
+    CHECK(bc->Writeblk(13, data) == NO_ERROR);
+    CHECK(bc->DirtyCount() == 0);
+    for (uint32_t bno = 10; bno < 14; bno++) {
+        CHECK(block_is(fd, bno, static_cast<uint8_t>(bno)));
+    }
+
+    // Dirty blocks survive being pushed out of the cache
+    bc->SetDirtyLimit(kMinfsBlockCacheSize);
+    for (uint32_t bno = kBlocks - 1; bno >= kBlocks / 2; bno--) {
+        memcpy(data, &bno, sizeof(bno));
+        CHECK(bc->Writeblk(bno, data) == NO_ERROR);
+    }
+    uint32_t val;
+    for (uint32_t bno = kBlocks / 2; bno < kBlocks; bno++) {
+        CHECK(bc->Readblk(bno, data) == NO_ERROR);
+        memcpy(&val, data, sizeof(val));
+        CHECK(val == bno);
+    }
+    // ...and when they are loaded back into it
+    CHECK(bc->Read(kBlocks - 1, &val, 0, sizeof(val)) == NO_ERROR);
+    CHECK(val == kBlocks - 1);
+    CHECK(bc->Close() == 0);
+    return 0;
+}
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static bool file_exists(fs::Vnode* dir, const char* name) {
+    mxtl::RefPtr<fs::Vnode> vn;
+    return dir->Lookup(&vn, name, strlen(name)) == NO_ERROR;
+}
+
+// Times metadata operations through the journal, then checks that a
+// filesystem abandoned without unmounting comes back with every synced
+// operation (and none of the others) once the journal is replayed.
+int test_journal() {
+    using minfs::kMinfsBlockSize;
+    using minfs::kMinfsBlockCacheSize;
+    constexpr uint32_t kBlocks = 8192;
+    constexpr uint32_t kFiles = 1000;
+
+    char path[] = "/tmp/minfs-journal.XXXXXX";
+    int fd = TRY(mkstemp(path));
+    unlink(path);
+    CHECK(ftruncate(fd, kBlocks * kMinfsBlockSize) == 0);
+    minfs::Bcache* bc;
+    CHECK(minfs::Bcache::Create(&bc, dup(fd), kBlocks, kMinfsBlockSize, kMinfsBlockCacheSize) == 0);
+    CHECK(minfs_mkfs(bc) == 0);
+    CHECK(bc->Close() == 0);
+
+    CHECK(minfs::Bcache::Create(&bc, dup(fd), kBlocks, kMinfsBlockSize, kMinfsBlockCacheSize) == 0);
+    mxtl::RefPtr<minfs::VnodeMinfs> root;
+    CHECK(minfs_mount(&root, bc) == NO_ERROR);
+    fs::Vnode* dir = root.get();
+    char name[32];
+    mxtl::RefPtr<fs::Vnode> vn;
+
+    // Operations are committed in groups...
+    uint64_t start = now_ns();
+    for (uint32_t i = 0; i < kFiles; i++) {
+        snprintf(name, sizeof(name), "f%u", i);
+        CHECK(dir->Create(&vn, name, strlen(name), S_IFREG | 0644) == NO_ERROR);
+        vn.reset();
+    }
+    CHECK(bc->Sync() == 0);
+    uint64_t elapsed = now_ns() - start;
+    printf("journal: %u creates, one sync: %llu ops/sec\n", kFiles,
+           static_cast<unsigned long long>(kFiles * 1000000000ull / elapsed));
+
+    // ...unless each is synced on its own, which wraps the journal many times
+    start = now_ns();
+    for (uint32_t i = 0; i < kFiles; i += 2) {
+        snprintf(name, sizeof(name), "f%u", i);
+        CHECK(dir->Unlink(name, strlen(name), false) == NO_ERROR);
+        CHECK(bc->Sync() == 0);
+    }
+    elapsed = now_ns() - start;
+    printf("journal: %u unlinks, each synced: %llu ops/sec\n", kFiles / 2,
+           static_cast<unsigned long long>((kFiles / 2) * 1000000000ull / elapsed));
+
+    // Never synced, so lost with the rest of the cache
+    CHECK(dir->Create(&vn, "late", 4, S_IFREG | 0644) == NO_ERROR);
+    vn.reset();
+    // Abandon the filesystem as a crash would, without writing anything more
+    root.reset();
+
+    CHECK(minfs::Bcache::Create(&bc, dup(fd), kBlocks, kMinfsBlockSize, kMinfsBlockCacheSize) == 0);
+    CHECK(minfs_mount(&root, bc) == NO_ERROR);
+    for (uint32_t i = 0; i < kFiles; i++) {
+        snprintf(name, sizeof(name), "f%u", i);
+        CHECK(file_exists(root.get(), name) == (i % 2 == 1));
+    }
+    CHECK(!file_exists(root.get(), "late"));
+    CHECK(bc->Close() == 0);
+
+    CHECK(minfs::Bcache::Create(&bc, fd, kBlocks, kMinfsBlockSize, kMinfsBlockCacheSize) == 0);
+    CHECK(minfs_check(bc) == NO_ERROR);
+    return 0;
+}
+
+// Fills logical block 'n' of 'vn' with 'val'
+static mx_status_t write_block(minfs::VnodeMinfs* vn, uint32_t n, uint8_t val) {
+    uint8_t data[minfs::kMinfsBlockSize];
+    memset(data, val, sizeof(data));
+    return vn->WriteExactInternal(data, sizeof(data), n * static_cast<size_t>(sizeof(data)));
+}
+
+// Returns true if logical block 'n' of 'vn' is filled with 'val'
+static bool file_block_is(minfs::VnodeMinfs* vn, uint32_t n, uint8_t val) {
+    uint8_t data[minfs::kMinfsBlockSize];
+    if (vn->ReadExactInternal(data, sizeof(data), n * static_cast<size_t>(sizeof(data))) !=
+        NO_ERROR) {
+        return false;
+    }
+    for (size_t i = 0; i < sizeof(data); i++) {
+        if (data[i] != val) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Reads or writes inode 'ino' in place, bypassing the filesystem
+static mx_status_t inode_io(minfs::Bcache* bc, uint32_t ino, minfs::minfs_inode_t* inode, bool write) {
+    minfs::minfs_info_t info;
+    mx_status_t status;
+    if ((status = bc->Read(0, &info, 0, sizeof(info))) != NO_ERROR) {
+        return status;
+    }
+    uint32_t bno = info.ino_block + ino / minfs::kMinfsInodesPerBlock;
+    uint32_t off = (ino % minfs::kMinfsInodesPerBlock) * minfs::kMinfsInodeSize;
+    return write ? bc->Write(bno, inode, off, minfs::kMinfsInodeSize) :
+                  bc->Read(bno, inode, off, minfs::kMinfsInodeSize);
+}
+
+// Checks how the extents of revision 3 inodes are inserted, coalesced,
+// trimmed and spilled into leaf blocks, and that fsck rejects bad ones.
+int test_extents() {
+    using minfs::kMinfsBlockSize;
+    using minfs::kMinfsBlockCacheSize;
+    using minfs::kMinfsInlineExtents;
+    using minfs::kMinfsExtentsPerBlock;
+    constexpr uint32_t kBlocks = 16384;
+
+    char path[] = "/tmp/minfs-extents.XXXXXX";
+    int fd = TRY(mkstemp(path));
+    unlink(path);
+    CHECK(ftruncate(fd, kBlocks * kMinfsBlockSize) == 0);
+    minfs::Bcache* bc;
+    CHECK(minfs::Bcache::Create(&bc, dup(fd), kBlocks, kMinfsBlockSize, kMinfsBlockCacheSize) == 0);
+    CHECK(minfs_mkfs(bc) == 0);
+    CHECK(bc->Close() == 0);
+
+    CHECK(minfs::Bcache::Create(&bc, dup(fd), kBlocks, kMinfsBlockSize, kMinfsBlockCacheSize) == 0);
+    mxtl::RefPtr<minfs::VnodeMinfs> root;
+    CHECK(minfs_mount(&root, bc) == NO_ERROR);
+    fs::Vnode* dir = root.get();
+    mxtl::RefPtr<fs::Vnode> a_ref, b_ref, c_ref, s_ref;
+    CHECK(dir->Create(&a_ref, "a", 1, S_IFREG | 0644) == NO_ERROR);
+    CHECK(dir->Create(&b_ref, "b", 1, S_IFREG | 0644) == NO_ERROR);
+    auto a = static_cast<minfs::VnodeMinfs*>(a_ref.get());
+    auto b = static_cast<minfs::VnodeMinfs*>(b_ref.get());
+    const minfs::minfs_extent_t* a_ext = minfs::InodeExtents(&a->inode_);
+    CHECK(a->HasExtents());
+
+    // A block written into the hole between two extents, right between
+    // their disk blocks too, joins them into one
+    CHECK(write_block(a, 0, 1) == NO_ERROR);
+    uint32_t bno = a_ext[0].bno;
+    CHECK(write_block(b, 0, 2) == NO_ERROR);
+    CHECK(minfs::InodeExtents(&b->inode_)[0].bno == bno + 1);
+    CHECK(write_block(a, 2, 3) == NO_ERROR);
+    CHECK(a->inode_.extent_count == 2);
+    CHECK(a_ext[1].start == 2 && a_ext[1].bno == bno + 2);
+    b_ref.reset();
+    CHECK(dir->Unlink("b", 1, false) == NO_ERROR);
+    CHECK(write_block(a, 1, 4) == NO_ERROR);
+    CHECK(a->inode_.extent_count == 1);
+    CHECK(a_ext[0].start == 0 && a_ext[0].count == 3 && a_ext[0].bno == bno);
+    CHECK(a->inode_.block_count == 3);
+
+    // Rewriting the middle of an extent leaves it in place
+    CHECK(write_block(a, 1, 5) == NO_ERROR);
+    CHECK(a->inode_.extent_count == 1 && a_ext[0].count == 3 && a_ext[0].bno == bno);
+    CHECK(file_block_is(a, 0, 1) && file_block_is(a, 1, 5) && file_block_is(a, 2, 3));
+
+    // Truncating into an extent frees only its tail
+    CHECK(a_ref->Truncate(kMinfsBlockSize + 1) == NO_ERROR);
+    CHECK(a->inode_.extent_count == 1 && a_ext[0].count == 2 && a_ext[0].bno == bno);
+    CHECK(a->inode_.block_count == 2);
+    CHECK(dir->Create(&c_ref, "c", 1, S_IFREG | 0644) == NO_ERROR);
+    auto c = static_cast<minfs::VnodeMinfs*>(c_ref.get());
+    CHECK(write_block(c, 0, 6) == NO_ERROR);
+    CHECK(minfs::InodeExtents(&c->inode_)[0].bno == bno + 2);
+    CHECK(file_block_is(a, 0, 1));
+
+    // Every other block of a sparse file is its own extent; they spill into
+    // leaf blocks, which split as they fill, until the inline index is full
+    CHECK(dir->Create(&s_ref, "sparse", 6, S_IFREG | 0644) == NO_ERROR);
+    auto sp = static_cast<minfs::VnodeMinfs*>(s_ref.get());
+    uint32_t written = 0;
+    mx_status_t status;
+    while ((status = write_block(sp, written * 2, static_cast<uint8_t>(written))) == NO_ERROR) {
+        written++;
+    }
+    CHECK(written > kMinfsInlineExtents * (kMinfsExtentsPerBlock / 2));
+    CHECK(sp->inode_.flags & minfs::kMinfsInodeFlagExtentIndex);
+    CHECK(sp->inode_.extent_count == kMinfsInlineExtents);
+    CHECK(sp->inode_.block_count == written + kMinfsInlineExtents);
+    CHECK(file_block_is(sp, 0, 0) && file_block_is(sp, 1, 0));
+    CHECK(file_block_is(sp, (written - 1) * 2, static_cast<uint8_t>(written - 1)));
+
+    // Truncating it releases the leaves, and the extents left move back
+    // into the inode
+    CHECK(s_ref->Truncate(15 * kMinfsBlockSize) == NO_ERROR);
+    CHECK(!(sp->inode_.flags & minfs::kMinfsInodeFlagExtentIndex));
+    CHECK(sp->inode_.extent_count == 8);
+    CHECK(sp->inode_.block_count == 8);
+    CHECK(file_block_is(sp, 14, 7));
+    uint32_t sparse_ino = sp->ino_;
+    CHECK(bc->Close() == 0);
+
+    CHECK(minfs::Bcache::Create(&bc, dup(fd), kBlocks, kMinfsBlockSize, kMinfsBlockCacheSize) == 0);
+    CHECK(minfs_check(bc) == NO_ERROR);
+    CHECK(bc->Close() == 0);
+
+    // fsck rejects extents which overlap, or which lie past the end of
+    // the file or of the device
+    minfs::minfs_inode_t inode;
+    CHECK(minfs::Bcache::Create(&bc, dup(fd), kBlocks, kMinfsBlockSize, kMinfsBlockCacheSize) == 0);
+    CHECK(inode_io(bc, sparse_ino, &inode, false) == NO_ERROR);
+    const minfs::minfs_inode_t good = inode;
+    minfs::minfs_extent_t* ext = minfs::InodeExtents(&inode);
+    for (int corruption = 0; corruption < 3; corruption++) {
+        inode = good;
+        switch (corruption) {
+        case 0:
+            ext[2].start = ext[1].start;
+            break;
+        case 1:
+            ext[7].start = static_cast<uint32_t>(minfs::kMinfsMaxExtentFileBlock);
+            break;
+        case 2:
+            ext[7].bno = kBlocks - 1;
+            ext[7].count = 2;
+            break;
+        }
+        CHECK(inode_io(bc, sparse_ino, &inode, true) == NO_ERROR);
+        CHECK(bc->Sync() == 0);
+        minfs::Bcache* check_bc;
+        CHECK(minfs::Bcache::Create(&check_bc, dup(fd), kBlocks, kMinfsBlockSize,
+                                    kMinfsBlockCacheSize) == 0);
+        CHECK(minfs_check(check_bc) != NO_ERROR);
+        CHECK(check_bc->Close() == 0);
+    }
+    CHECK(bc->Close() == 0);
+    return 0;
+}
+
 int run_fs_tests(int argc, char** argv) {
     fprintf(stderr, "--- fs tests ---\n");
     if (argc > 0) {
@@ -323,6 +648,15 @@ int run_fs_tests(int argc, char** argv) {
         if (!strcmp(argv[0], "rename")) {
             return test_rename();
         }
+        if (!strcmp(argv[0], "writeback")) {
+            return test_writeback();
+        }
+        if (!strcmp(argv[0], "journal")) {
+            return test_journal();
+        }
+        if (!strcmp(argv[0], "extents")) {
+            return test_extents();
+        }
         fprintf(stderr, "unknown test: %s\n", argv[0]);
         return -1;
     }
@@ -212,23 +212,124 @@ mx_status_t BlockServer::Create(mx_handle_t* fifo_out, BlockServer** out) {
 
 void blockserver_fifo_complete(void* cookie, mx_status_t status) {
     block_msg_t* msg = static_cast<block_msg_t*>(cookie);
-    // Since iobuf is a RefPtr, it lives at least as long as the txn,
-    // and is not discarded underneath the block device driver.
-    msg->iobuf = nullptr;
-    msg->txn->Complete(status);
-    msg->txn = nullptr;
+    BlockServer* bs = msg->server;
+    // Every message merged into the operation shares its result.
+    while (msg != nullptr) {
+        block_msg_t* next = msg->next;
+        // Since iobuf is a RefPtr, it lives at least as long as the txn,
+        // and is not discarded underneath the block device driver.
+        msg->iobuf = nullptr;
+        // Once the txn responds, this message may be reused by the next
+        // request on it, so let go of it first.
+        mxtl::RefPtr<BlockTransaction> txn = mxtl::move(msg->txn);
+        txn->Complete(status);
+        msg = next;
+    }
+    bs->OpComplete();
 }
 
 static block_callbacks_t cb = {
     blockserver_fifo_complete,
 };
 
+mx_status_t BlockServer::ValidateRequest(const block_fifo_request_t* request) const {
+    if ((request->length % block_size_) || (request->dev_offset % block_size_)) {
+        return ERR_INVALID_ARGS;
+    }
+    uint64_t dev_size = block_count_ * block_size_;
+    if ((request->dev_offset >= dev_size) || (request->length > dev_size - request->dev_offset)) {
+        return ERR_OUT_OF_RANGE;
+    }
+    return NO_ERROR;
+}
+
+static bool Overlaps(const block_op_t* a, const block_op_t* b) {
+    return (a->dev_offset < b->dev_offset + b->length) &&
+           (b->dev_offset < a->dev_offset + a->length);
+}
+
+void BlockServer::Schedule(mx_device_t* dev, block_ops_t* ops, block_op_t* pending,
+                           size_t count) {
+    // Insertion sort: batches are at most a fifo's worth, and are often
+    // sorted already.
+    for (size_t i = 1; i < count; i++) {
+        block_op_t op = pending[i];
+        size_t j = i;
+        for (; j > 0 && pending[j - 1].dev_offset > op.dev_offset; j--) {
+            pending[j] = pending[j - 1];
+        }
+        pending[j] = op;
+    }
+
+    size_t i = 0;
+    while (i < count) {
+        block_op_t op = pending[i++];
+        while (i < count) {
+            const block_op_t* next = &pending[i];
+            if ((next->opcode != op.opcode) || (next->iobuf != op.iobuf) ||
+                (next->dev_offset != op.dev_offset + op.length) ||
+                (next->vmo_offset != op.vmo_offset + op.length) ||
+                (max_transfer_size_ != 0 && op.length + next->length > max_transfer_size_)) {
+                break;
+            }
+            op.length += next->length;
+            op.last->next = next->msgs;
+            op.last = next->last;
+            i++;
+        }
+        Issue(dev, ops, &op);
+    }
+}
+
+void BlockServer::Issue(mx_device_t* dev, block_ops_t* ops, const block_op_t* op) {
+    inflight_lock_.Acquire();
+    if ((inflight_ >= kMaxQueueDepth) && (ops->end_batch != nullptr)) {
+        // Make sure the device has seen what we're waiting on. The driver
+        // may complete requests from end_batch, which takes inflight_lock_,
+        // so it is called unlocked and the depth is checked again after.
+        inflight_lock_.Release();
+        ops->end_batch(dev);
+        inflight_lock_.Acquire();
+    }
+    while (inflight_ >= kMaxQueueDepth) {
+        cnd_wait(&inflight_cond_, inflight_lock_.GetInternal());
+    }
+    inflight_++;
+    inflight_lock_.Release();
+
+    if (op->opcode == BLOCKIO_READ) {
+        ops->read(dev, op->iobuf->io_vmo_, op->length, op->vmo_offset, op->dev_offset, op->msgs);
+    } else {
+        ops->write(dev, op->iobuf->io_vmo_, op->length, op->vmo_offset, op->dev_offset, op->msgs);
+    }
+}
+
+void BlockServer::OpComplete() {
+    mxtl::AutoLock lock(&inflight_lock_);
+    inflight_--;
+    cnd_signal(&inflight_cond_);
+}
+
+void BlockServer::Drain() {
+    mxtl::AutoLock lock(&inflight_lock_);
+    while (inflight_ > 0) {
+        cnd_wait(&inflight_cond_, inflight_lock_.GetInternal());
+    }
+}
+
 mx_status_t BlockServer::Serve(mx_device_t* dev, block_ops_t* ops) {
 
     ops->set_callbacks(dev, &cb);
 
+    block_info_t info;
+    ops->get_info(dev, &info);
+    block_size_ = info.block_size;
+    block_count_ = info.block_count;
+    max_transfer_size_ = info.max_transfer_size;
+
     mx_status_t status;
     block_fifo_request_t requests[BLOCK_FIFO_MAX_DEPTH];
+    block_op_t pending[BLOCK_FIFO_MAX_DEPTH];
     uint32_t count;
     mx_handle_t fifo;
     {
@@ -237,84 +338,129 @@ mx_status_t BlockServer::Serve(mx_device_t* dev, block_ops_t* ops) {
     }
     while (true) {
         if ((status = do_read(fifo, &requests[0], &count)) != NO_ERROR) {
+            // Completions refer back to us; wait for them before going away.
+            Drain();
             return status;
         }
 
+        // Reads and writes are gathered up and scheduled together once the
+        // whole batch has been read.
+        size_t num_pending = 0;
         for (size_t i = 0; i < count; i++) {
             bool wants_reply = requests[i].opcode & BLOCKIO_TXN_END;
             txnid_t txnid = requests[i].txnid;
             vmoid_t vmoid = requests[i].vmoid;
 
-            mxtl::AutoLock server_lock(&server_lock_);
-            auto iobuf = tree_.find(vmoid);
-            if (!iobuf.IsValid()) {
-                // Operation which is not accessing a valid vmo
-                if (wants_reply) {
-                    OutOfBandErrorRespond(fifo, ERR_IO, txnid);
+            block_op_t op;
+            op.msgs = nullptr;
+            {
+                mxtl::AutoLock server_lock(&server_lock_);
+                auto iobuf = tree_.find(vmoid);
+                if (!iobuf.IsValid()) {
+                    // Operation which is not accessing a valid vmo
+                    if (wants_reply) {
+                        OutOfBandErrorRespond(fifo, ERR_IO, txnid);
+                    }
+                    continue;
                 }
-                continue;
-            }
-            if (txnid >= MAX_TXN_COUNT || txns_[txnid] == nullptr) {
-                // Operation which is not accessing a valid txn
-                if (wants_reply) {
-                    OutOfBandErrorRespond(fifo, ERR_IO, txnid);
+                if (txnid >= MAX_TXN_COUNT || txns_[txnid] == nullptr) {
+                    // Operation which is not accessing a valid txn
+                    if (wants_reply) {
+                        OutOfBandErrorRespond(fifo, ERR_IO, txnid);
+                    }
+                    continue;
                 }
-                continue;
-            }
 
-            switch (requests[i].opcode & BLOCKIO_OP_MASK) {
-            case BLOCKIO_READ:
-            case BLOCKIO_WRITE: {
-                block_msg_t* msg;
-                status = txns_[txnid]->Enqueue(wants_reply, &msg);
-                if (status != NO_ERROR) {
+                switch (requests[i].opcode & BLOCKIO_OP_MASK) {
+                case BLOCKIO_READ:
+                case BLOCKIO_WRITE: {
+                    block_msg_t* msg;
+                    status = txns_[txnid]->Enqueue(wants_reply, &msg);
+                    if (status != NO_ERROR) {
+                        break;
+                    }
+                    msg->txn = txns_[txnid];
+                    msg->iobuf = iobuf.CopyPointer();
+                    msg->server = this;
+                    msg->next = nullptr;
+
+                    if ((status = ValidateRequest(&requests[i])) != NO_ERROR) {
+                        msg->iobuf = nullptr;
+                        mxtl::RefPtr<BlockTransaction> txn = mxtl::move(msg->txn);
+                        txn->Complete(status);
+                        break;
+                    }
+
+                    // Hack to ensure that the vmo is valid.
+                    // In the future, this code will be responsible for pinning VMO pages,
+                    // and the completion will be responsible for un-pinning those same pages.
+                    status = iobuf->ValidateVmoHack(requests[i].length, requests[i].vmo_offset);
+                    if (status != NO_ERROR) {
+                        msg->iobuf = nullptr;
+                        mxtl::RefPtr<BlockTransaction> txn = mxtl::move(msg->txn);
+                        txn->Complete(status);
+                        break;
+                    }
+
+                    op.opcode = requests[i].opcode & BLOCKIO_OP_MASK;
+                    op.iobuf = msg->iobuf.get();
+                    op.length = requests[i].length;
+                    op.vmo_offset = requests[i].vmo_offset;
+                    op.dev_offset = requests[i].dev_offset;
+                    op.msgs = msg;
+                    op.last = msg;
                     break;
                 }
-                msg->txn = txns_[txnid];
-                msg->iobuf = iobuf.CopyPointer();
-
-                // Hack to ensure that the vmo is valid.
-                // In the future, this code will be responsible for pinning VMO pages,
-                // and the completion will be responsible for un-pinning those same pages.
-                status = iobuf->ValidateVmoHack(requests[i].length, requests[i].vmo_offset);
-                if (status != NO_ERROR) {
-                    cb.complete(msg, status);
+                case BLOCKIO_SYNC: {
+                    // TODO(smklein): It might be more useful to have this on a per-vmo basis
+                    fprintf(stderr, "Warning: BLOCKIO_SYNC is currently unimplemented\n");
                     break;
                 }
-
-                if ((requests[i].opcode & BLOCKIO_OP_MASK) == BLOCKIO_READ) {
-                    ops->read(dev, iobuf->io_vmo_, requests[i].length,
-                              requests[i].vmo_offset, requests[i].dev_offset, msg);
-                } else {
-                    ops->write(dev, iobuf->io_vmo_, requests[i].length,
-                               requests[i].vmo_offset, requests[i].dev_offset, msg);
+                case BLOCKIO_CLOSE_VMO: {
+                    // Operations already gathered hold their own reference to the VMO.
+                    tree_.erase(*iobuf);
+                    if (wants_reply) {
+                        OutOfBandErrorRespond(fifo, NO_ERROR, txnid);
+                    }
+                    break;
+                }
+                default: {
+                    fprintf(stderr, "Unrecognized Block Server operation: %x\n",
+                            requests[i].opcode);
                 }
-                break;
-            }
-            case BLOCKIO_SYNC: {
-                // TODO(smklein): It might be more useful to have this on a per-vmo basis
-                fprintf(stderr, "Warning: BLOCKIO_SYNC is currently unimplemented\n");
-                break;
-            }
-            case BLOCKIO_CLOSE_VMO: {
-                tree_.erase(*iobuf);
-                if (wants_reply) {
-                    OutOfBandErrorRespond(fifo, NO_ERROR, txnid);
                 }
-                break;
             }
-            default: {
-                fprintf(stderr, "Unrecognized Block Server operation: %x\n",
-                        requests[i].opcode);
+
+            if (op.msgs == nullptr) {
+                continue;
             }
+            // Scheduling reorders the batch, which is only safe while nothing
+            // in it depends on what came before.
+            for (size_t j = 0; j < num_pending; j++) {
+                if (Overlaps(&pending[j], &op) &&
+                    (pending[j].opcode == BLOCKIO_WRITE || op.opcode == BLOCKIO_WRITE)) {
+                    Schedule(dev, ops, pending, num_pending);
+                    num_pending = 0;
+                    break;
+                }
             }
+            pending[num_pending++] = op;
+        }
+        Schedule(dev, ops, pending, num_pending);
+        if (ops->end_batch != nullptr) {
+            ops->end_batch(dev);
         }
     }
 }
 
-BlockServer::BlockServer() : fifo_(MX_HANDLE_INVALID), last_id(0) {}
+BlockServer::BlockServer() : fifo_(MX_HANDLE_INVALID), last_id(0), block_size_(0),
+    block_count_(0), max_transfer_size_(0), inflight_(0) {
+    cnd_init(&inflight_cond_);
+}
+
 BlockServer::~BlockServer() {
     ShutDown();
+    cnd_destroy(&inflight_cond_);
 }
 
 void BlockServer::ShutDown() {
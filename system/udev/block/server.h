@@ -7,6 +7,7 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <threads.h>
 
 #include <ddk/protocol/block.h>
 #include <magenta/device/block.h>
@@ -47,11 +48,33 @@ constexpr uint32_t kTxnFlagRespond = 0x00000001; // Should a reponse be sent whe
 
 class BlockTransaction;
 
-typedef struct {
+class BlockServer;
+
+typedef struct block_msg {
     mxtl::RefPtr<BlockTransaction> txn;
     mxtl::RefPtr<IoBuffer> iobuf;
+    BlockServer* server;
+    // The next message merged into the same device operation, if any.
+    struct block_msg* next;
 } block_msg_t;
 
+// A read or write on its way to the device: one request off the fifo, or
+// several whose device and VMO ranges are contiguous, merged together.
+typedef struct {
+    uint16_t opcode;
+    IoBuffer* iobuf;
+    uint64_t length;
+    uint64_t vmo_offset;
+    uint64_t dev_offset;
+    block_msg_t* msgs;
+    block_msg_t* last;
+} block_op_t;
+
+// The most device operations a single client of the server may have
+// outstanding at once. Further requests wait in the fifo, so a client
+// issuing deep queues can't take over the device's own queues.
+constexpr uint32_t kMaxQueueDepth = 32;
+
 class BlockTransaction : public mxtl::RefCounted<BlockTransaction> {
 public:
     BlockTransaction(mx_handle_t fifo, txnid_t txnid);
@@ -95,17 +118,46 @@ public:
     void ShutDown();
 
     ~BlockServer();
+
+    // Called as each device operation completes.
+    void OpComplete();
 private:
     DISALLOW_COPY_ASSIGN_AND_MOVE(BlockServer);
     BlockServer();
 
     mx_status_t FindVmoIDLocked(vmoid_t* out);
 
+    // Checks a read or write against the device geometry, so that merging it
+    // with its neighbours can't make them fail.
+    mx_status_t ValidateRequest(const block_fifo_request_t* request) const;
+
+    // Sorts the |count| operations in |pending| by device offset, merges
+    // those that line up, and issues them. No two operations in |pending|
+    // may overlap if either is a write, as their order isn't kept.
+    void Schedule(mx_device_t* dev, block_ops_t* ops, block_op_t* pending, size_t count);
+
+    // Sends one operation to the device, first waiting for the client to
+    // fall below |kMaxQueueDepth|.
+    void Issue(mx_device_t* dev, block_ops_t* ops, const block_op_t* op);
+
+    // Waits for every operation issued to complete.
+    void Drain();
+
     mxtl::Mutex server_lock_;
     mx_handle_t fifo_;
     mxtl::WAVLTree<vmoid_t, mxtl::RefPtr<IoBuffer>> tree_;
     mxtl::RefPtr<BlockTransaction> txns_[MAX_TXN_COUNT];
     vmoid_t last_id;
+
+    // The device geometry, as of the start of |Serve|.
+    uint32_t block_size_;
+    uint64_t block_count_;
+    uint32_t max_transfer_size_;
+
+    // The number of device operations issued and not yet completed.
+    mxtl::Mutex inflight_lock_;
+    cnd_t inflight_cond_;
+    uint32_t inflight_;
 };
 
 #else
@@ -8,11 +8,14 @@
 #include <hexdump/hexdump.h>
 #include <inttypes.h>
 #include <magenta/compiler.h>
+#include <magenta/new.h>
+#include <magenta/syscalls.h>
 #include <mxtl/auto_lock.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/param.h>
+#include <threads.h>
 
 #include "trace.h"
 #include "utils.h"
@@ -30,6 +33,7 @@
 #define VIRTIO_BLK_F_FLUSH    (1<<9)
 #define VIRTIO_BLK_F_TOPOLOGY (1<<10)
 #define VIRTIO_BLK_F_CONFIG_WCE (1<<11)
+#define VIRTIO_BLK_F_MQ       (1<<12)
 
 #define VIRTIO_BLK_T_IN         0
 #define VIRTIO_BLK_T_OUT        1
@@ -53,12 +57,12 @@ void BlockDevice::virtio_block_iotxn_queue(void* ctx, iotxn_t* txn) {
     switch (txn->opcode) {
     case IOTXN_OP_READ: {
         LTRACEF("READ offset %#" PRIx64 " length %#" PRIx64 "\n", txn->offset, txn->length);
-        bd->QueueReadWriteTxn(txn);
+        bd->QueueReadWriteTxn(txn, true);
         break;
     }
     case IOTXN_OP_WRITE:
         LTRACEF("WRITE offset %#" PRIx64 " length %#" PRIx64 "\n", txn->offset, txn->length);
-        bd->QueueReadWriteTxn(txn);
+        bd->QueueReadWriteTxn(txn, true);
         break;
     default:
         iotxn_complete(txn, -1, 0);
@@ -87,9 +91,7 @@ mx_status_t BlockDevice::virtio_block_ioctl(void* ctx, uint32_t op, const void*
         block_info_t* info = reinterpret_cast<block_info_t*>(reply);
         if (max < sizeof(*info))
             return ERR_BUFFER_TOO_SMALL;
-        memset(info, 0, sizeof(*info));
-        info->block_size = bd->GetBlockSize();
-        info->block_count = bd->GetSize() / bd->GetBlockSize();
+        bd->GetInfo(info);
         *out_actual = sizeof(*info);
         return NO_ERROR;
     }
@@ -102,6 +104,92 @@ mx_status_t BlockDevice::virtio_block_ioctl(void* ctx, uint32_t op, const void*
     }
 }
 
+// block core protocol, for the block fifo server
+
+void BlockDevice::virtio_block_set_callbacks(mx_device_t* dev, block_callbacks_t* cb) {
+    BlockDevice* bd = static_cast<BlockDevice*>(dev->ctx);
+    bd->callbacks_ = cb;
+}
+
+void BlockDevice::virtio_block_get_info(mx_device_t* dev, block_info_t* info) {
+    BlockDevice* bd = static_cast<BlockDevice*>(dev->ctx);
+    bd->GetInfo(info);
+}
+
+void BlockDevice::virtio_block_read(mx_device_t* dev, mx_handle_t vmo, uint64_t length,
+                                    uint64_t vmo_offset, uint64_t dev_offset, void* cookie) {
+    BlockDevice* bd = static_cast<BlockDevice*>(dev->ctx);
+    bd->FifoTxn(IOTXN_OP_READ, vmo, length, vmo_offset, dev_offset, cookie);
+}
+
+void BlockDevice::virtio_block_write(mx_device_t* dev, mx_handle_t vmo, uint64_t length,
+                                     uint64_t vmo_offset, uint64_t dev_offset, void* cookie) {
+    BlockDevice* bd = static_cast<BlockDevice*>(dev->ctx);
+    bd->FifoTxn(IOTXN_OP_WRITE, vmo, length, vmo_offset, dev_offset, cookie);
+}
+
+// the fifo server has queued everything it read at once: tell the device
+void BlockDevice::virtio_block_end_batch(mx_device_t* dev) {
+    BlockDevice* bd = static_cast<BlockDevice*>(dev->ctx);
+    for (size_t i = 0; i < bd->num_queues_; i++) {
+        Queue* q = bd->queues_[i].get();
+        mxtl::AutoLock lock(&q->lock);
+        q->ring.Kick();
+    }
+}
+
+void BlockDevice::virtio_block_fifo_complete(iotxn_t* txn, void* cookie) {
+    BlockDevice* bd;
+    memcpy(&bd, txn->extra, sizeof(bd));
+    bd->callbacks_->complete(cookie, txn->status);
+    iotxn_release(txn);
+}
+
+block_ops_t BlockDevice::block_ops_ = {
+    .set_callbacks = &virtio_block_set_callbacks,
+    .get_info = &virtio_block_get_info,
+    .read = &virtio_block_read,
+    .write = &virtio_block_write,
+    .end_batch = &virtio_block_end_batch,
+};
+
+void BlockDevice::GetInfo(block_info_t* info) {
+    memset(info, 0, sizeof(*info));
+    info->block_size = GetBlockSize();
+    info->block_count = GetSize() / GetBlockSize();
+    // fully discontiguous, and not page aligned
+    info->max_transfer_size = (uint32_t)(MAX(seg_max_ - 1, 1u) * PAGE_SIZE);
+}
+
+void BlockDevice::FifoTxn(uint32_t opcode, mx_handle_t vmo, uint64_t length, uint64_t vmo_offset,
+                          uint64_t dev_offset, void* cookie) {
+    if ((dev_offset % config_.blk_size) || (length % config_.blk_size)) {
+        callbacks_->complete(cookie, ERR_INVALID_ARGS);
+        return;
+    }
+    if ((dev_offset >= GetSize()) || (length > GetSize() - dev_offset)) {
+        callbacks_->complete(cookie, ERR_OUT_OF_RANGE);
+        return;
+    }
+
+    iotxn_t* txn;
+    mx_status_t status = iotxn_alloc_vmo(&txn, IOTXN_ALLOC_POOL, vmo, vmo_offset, length);
+    if (status != NO_ERROR) {
+        callbacks_->complete(cookie, status);
+        return;
+    }
+    txn->opcode = opcode;
+    txn->length = length;
+    txn->offset = dev_offset;
+    txn->complete_cb = &virtio_block_fifo_complete;
+    txn->cookie = cookie;
+    BlockDevice* bd = this;
+    memcpy(txn->extra, &bd, sizeof(bd));
+
+    // the server ends each batch of requests with a kick
+    QueueReadWriteTxn(txn, false);
+}
+
 BlockDevice::BlockDevice(mx_driver_t* driver, mx_device_t* bus_device)
     : Device(driver, bus_device) {
     // so that Bind() knows how much io space to allocate
@@ -118,43 +206,49 @@ mx_status_t BlockDevice::Init() {
     // reset the device
     Reset();
 
+    // ack and set the driver status bit
+    StatusAcknowledgeDriver();
+
+    // negotiate the features we use
+    uint32_t features = ReadDeviceFeatures();
+    LTRACEF("device features %#x\n", features);
+    features &= VIRTIO_BLK_F_SEG_MAX | VIRTIO_BLK_F_BLK_SIZE | VIRTIO_BLK_F_MQ |
+                (1u << VIRTIO_RING_F_INDIRECT_DESC) | (1u << VIRTIO_RING_F_EVENT_IDX);
+    mx_status_t status = WriteDriverFeatures(features);
+    if (status != NO_ERROR)
+        return status;
+
     // read our configuration
     CopyDeviceConfig(&config_, sizeof(config_));
 
+    if (!(features & VIRTIO_BLK_F_BLK_SIZE))
+        config_.blk_size = 512;
+    if (features & VIRTIO_BLK_F_SEG_MAX)
+        seg_max_ = MIN(MAX(config_.seg_max, 1u), max_segments);
+    indirect_ = features & (1u << VIRTIO_RING_F_INDIRECT_DESC);
+
     LTRACEF("capacity %#" PRIx64 "\n", config_.capacity);
     LTRACEF("size_max %#x\n", config_.size_max);
     LTRACEF("seg_max  %#x\n", config_.seg_max);
     LTRACEF("blk_size %#x\n", config_.blk_size);
 
-    // ack and set the driver status bit
-    StatusAcknowledgeDriver();
-
-    // XXX check features bits and ack/nak them
-
-    // allocate the main vring
-    auto err = vring_.Init(0, 128); // 128 matches legacy pci
-    if (err < 0) {
-        VIRTIO_ERROR("failed to allocate vring\n");
-        return err;
+    // one queue per cpu, as far as the device allows
+    size_t num_queues = 1;
+    if (features & VIRTIO_BLK_F_MQ) {
+        LTRACEF("num_queues %u\n", config_.num_queues);
+        num_queues = MIN(MIN((size_t)config_.num_queues, (size_t)mx_system_get_num_cpus()),
+                         max_queues);
+        num_queues = MAX(num_queues, (size_t)1);
     }
 
-    // allocate a queue of block requests
-    size_t size = sizeof(virtio_blk_req) * blk_req_count + sizeof(uint8_t) * blk_req_count;
-
-    mx_status_t r = map_contiguous_memory(size, (uintptr_t*)&blk_req_, &blk_req_pa_);
-    if (r < 0) {
-        VIRTIO_ERROR("cannot alloc blk_req buffers %d\n", r);
-        return r;
+    for (uint16_t i = 0; i < num_queues; i++) {
+        mx_status_t r = InitQueue(i);
+        if (r != NO_ERROR)
+            return r;
+        queues_[i]->ring.SetEventIndex(features & (1u << VIRTIO_RING_F_EVENT_IDX));
+        num_queues_++;
     }
 
-    LTRACEF("allocated blk request at %p, physical address %#" PRIxPTR "\n", blk_req_, blk_req_pa_);
-
-    // responses are 32 words at the end of the allocated block
-    blk_res_pa_ = blk_req_pa_ + sizeof(virtio_blk_req) * blk_req_count;
-    blk_res_ = (uint8_t*)((uintptr_t)blk_req_ + sizeof(virtio_blk_req) * blk_req_count);
-
-    LTRACEF("allocated blk responses at %p, physical address %#" PRIxPTR "\n", blk_res_, blk_res_pa_);
-
     // start the interrupt thread
     StartIrqThread();
 
@@ -173,9 +267,10 @@ mx_status_t BlockDevice::Init() {
     args.ctx = this;
     args.driver = driver_;
     args.ops = &device_ops_;
-    args.proto_id = MX_PROTOCOL_BLOCK;
+    args.proto_id = MX_PROTOCOL_BLOCK_CORE;
+    args.proto_ops = &block_ops_;
 
-    auto status = device_add(bus_device_, &args, &device_);
+    status = device_add(bus_device_, &args, &device_);
     if (status < 0) {
         device_ = nullptr;
         return status;
@@ -184,62 +279,95 @@ mx_status_t BlockDevice::Init() {
     return NO_ERROR;
 }
 
+mx_status_t BlockDevice::InitQueue(uint16_t index) {
+    AllocChecker ac;
+    mxtl::unique_ptr<Queue> q(new (&ac) Queue(this));
+    if (!ac.check())
+        return ERR_NO_MEMORY;
+
+    auto err = q->ring.Init(index, ring_size);
+    if (err < 0) {
+        VIRTIO_ERROR("failed to allocate vring %u\n", index);
+        return err;
+    }
+
+    // allocate the queue's block requests
+    size_t size = sizeof(blk_req_slot) * blk_req_count;
+    mx_status_t r = map_contiguous_memory(size, (uintptr_t*)&q->blk_req, &q->blk_req_pa);
+    if (r < 0) {
+        VIRTIO_ERROR("cannot alloc blk_req buffers %d\n", r);
+        return r;
+    }
+
+    LTRACEF("queue %u blk requests at %p, physical address %#" PRIxPTR "\n",
+            index, q->blk_req, q->blk_req_pa);
+
+    queues_[index] = mxtl::move(q);
+    return NO_ERROR;
+}
+
 void BlockDevice::IrqRingUpdate() {
     LTRACE_ENTRY;
 
-    // parse our descriptor chain, add back to the free queue
-    auto free_chain = [this](vring_used_elem* used_elem) {
-        uint32_t i = (uint16_t)used_elem->id;
-        struct vring_desc* desc = vring_.DescFromIndex((uint16_t)i);
-        auto head_desc = desc; // save the first element
-        for (;;) {
-            int next;
+    // there is one interrupt for every queue, so check them all
+    for (size_t i = 0; i < num_queues_; i++) {
+        Queue* q = queues_[i].get();
+        list_node done = LIST_INITIAL_VALUE(done);
+        {
+            mxtl::AutoLock lock(&q->lock);
 
+            // free each finished request's descriptors and request slot
+            auto free_chain = [q, &done](vring_used_elem* used_elem) {
+                uint16_t head = (uint16_t)used_elem->id;
 #if LOCAL_TRACE > 0
-            virtio_dump_desc(desc);
+                virtio_dump_desc(q->ring.DescFromIndex(head));
 #endif
+                q->ring.FreeDescChain(head);
 
-            if (desc->flags & VRING_DESC_F_NEXT) {
-                next = desc->next;
-            } else {
-                /* end of chain */
-                next = -1;
-            }
+                unsigned int index = q->desc_blk_req[head];
+                iotxn_t* txn = q->blk_req_txn[index];
+                q->blk_req_txn[index] = nullptr;
+                q->blk_req_free |= 1u << index;
 
-            vring_.FreeDesc((uint16_t)i);
+                LTRACEF("completes txn %p\n", txn);
+                txn->status = (q->blk_req[index].status == VIRTIO_BLK_S_OK) ? NO_ERROR : ERR_IO;
+                list_add_tail(&done, &txn->node);
+            };
 
-            if (next < 0)
-                break;
-            i = next;
-            desc = vring_.DescFromIndex((uint16_t)i);
+            // tell the ring to find free chains and hand it back to our lambda
+            q->ring.IrqRingUpdate(free_chain);
+
+            // requests held back for lack of room can go now
+            SubmitPendingLocked(q);
+            q->ring.Kick();
         }
 
-        // search our pending txn list to see if this completes it
+        // complete outside the queue lock, as completions may queue more
         iotxn_t* txn;
-        list_for_every_entry (&iotxn_list, txn, iotxn_t, node) {
-            if (txn->context == head_desc) {
-                LTRACEF("completes txn %p\n", txn);
-                list_delete(&txn->node);
-                iotxn_complete(txn, NO_ERROR, txn->length);
-                break;
-            }
+        while ((txn = list_remove_head_type(&done, iotxn_t, node)) != nullptr) {
+            iotxn_complete(txn, txn->status, txn->status == NO_ERROR ? txn->length : 0);
         }
-    };
-
-    // tell the ring to find free chains and hand it back to our lambda
-    vring_.IrqRingUpdate(free_chain);
+    }
 }
 
 void BlockDevice::IrqConfigChange() {
     LTRACE_ENTRY;
 }
 
-void BlockDevice::QueueReadWriteTxn(iotxn_t* txn) {
-    LTRACEF("txn %p\n", txn);
+BlockDevice::Queue* BlockDevice::PickQueue() {
+    if (num_queues_ == 1)
+        return queues_[0].get();
 
-    mxtl::AutoLock lock(&lock_);
+    // There's no asking which cpu we're on, so spread threads over the queues
+    // instead: a thread always submits to the same queue, and threads that
+    // are given different queues never contend for a lock.
+    uint64_t self = reinterpret_cast<uintptr_t>(thrd_current());
+    self *= 0x9e3779b97f4a7c15ull;
+    return queues_[(self >> 32) % num_queues_].get();
+}
 
-    bool write = (txn->opcode == IOTXN_OP_WRITE);
+void BlockDevice::QueueReadWriteTxn(iotxn_t* txn, bool kick) {
+    LTRACEF("txn %p\n", txn);
 
     // offset must be aligned to block size
     if (txn->offset % config_.blk_size) {
@@ -251,67 +379,129 @@ void BlockDevice::QueueReadWriteTxn(iotxn_t* txn) {
     // constrain to device capacity
     txn->length = MIN(txn->length, GetSize() - txn->offset);
 
-    // allocate and start filling out a block request
-    auto index = alloc_blk_req();
-    LTRACEF("request index %u\n", index);
-    auto req = &blk_req_[index];
-    req->type = write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
-    req->ioprio = 0;
-    req->sector = txn->offset / 512;
-    LTRACEF("blk_req type %u ioprio %u sector %" PRIu64 "\n",
-            req->type, req->ioprio, req->sector);
+    mx_status_t status = iotxn_physmap(txn);
+    if (status != NO_ERROR) {
+        iotxn_complete(txn, status, 0);
+        return;
+    }
 
-    /* put together a transfer */
-    uint16_t i;
-    auto desc = vring_.AllocDescChain(3, &i);
-    LTRACEF("after alloc chain desc %p, i %u\n", desc, i);
+    Queue* q = PickQueue();
+    mxtl::AutoLock lock(&q->lock);
 
-    /* point the iotxn at this head descriptor */
-    txn->context = desc;
+    // keep requests in order behind any that are waiting for room
+    list_add_tail(&q->pending, &txn->node);
+    SubmitPendingLocked(q);
 
-    /* set up the descriptor pointing to the head */
-    desc->addr = blk_req_pa_ + index * sizeof(virtio_blk_req);
-    desc->len = sizeof(struct virtio_blk_req);
-    desc->flags |= VRING_DESC_F_NEXT;
+    if (kick)
+        q->ring.Kick();
+}
 
-#if LOCAL_TRACE > 0
-    virtio_dump_desc(desc);
-#endif
+void BlockDevice::SubmitPendingLocked(Queue* q) {
+    iotxn_t* txn;
+    while ((txn = list_peek_head_type(&q->pending, iotxn_t, node)) != nullptr) {
+        mx_status_t status = SubmitTxnLocked(q, txn);
+        if (status == ERR_SHOULD_WAIT)
+            return;
+        list_delete(&txn->node);
+        if (status != NO_ERROR) {
+            // completing under the lock is safe: it can't have been queued
+            // anywhere the completion could reach back into
+            iotxn_complete(txn, status, 0);
+        }
+    }
+}
 
-    /* set up the descriptor pointing to the buffer */
-    desc = vring_.DescFromIndex(desc->next);
+mx_status_t BlockDevice::SubmitTxnLocked(Queue* q, iotxn_t* txn) {
+    if (q->blk_req_free == 0)
+        return ERR_SHOULD_WAIT;
 
-    iotxn_physmap(txn);
+    bool write = (txn->opcode == IOTXN_OP_WRITE);
 
-    desc->addr = (uint64_t)iotxn_phys(txn);
-    desc->len = (uint32_t)txn->length;
+    // allocate and start filling out a block request
+    unsigned int index = __builtin_ctz(q->blk_req_free);
+    LTRACEF("request index %u\n", index);
+    blk_req_slot* slot = &q->blk_req[index];
+    mx_paddr_t slot_pa = q->blk_req_pa + index * sizeof(blk_req_slot);
 
-    if (!write)
-        desc->flags |= VRING_DESC_F_WRITE; /* mark buffer as write-only if its a block read */
-    desc->flags |= VRING_DESC_F_NEXT;
+    slot->req.type = write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+    slot->req.ioprio = 0;
+    slot->req.sector = txn->offset / 512;
+    slot->status = VIRTIO_BLK_S_IOERR;
+    LTRACEF("blk_req type %u ioprio %u sector %" PRIu64 "\n",
+            slot->req.type, slot->req.ioprio, slot->req.sector);
+
+    /* build the request's descriptor table: header, data, status */
+    vring_desc* table = slot->desc;
+    size_t count = 0;
+    table[count].addr = slot_pa + offsetof(blk_req_slot, req);
+    table[count].len = sizeof(virtio_blk_req);
+    table[count].flags = 0;
+    count++;
+
+    iotxn_phys_iter_t iter;
+    iotxn_phys_iter_init(&iter, txn, 0);
+    mx_paddr_t pa;
+    size_t len;
+    while ((len = iotxn_phys_iter_next(&iter, &pa)) > 0) {
+        if (count > seg_max_) {
+            TRACEF("txn %p has more than %zu segments\n", txn, seg_max_);
+            return ERR_NOT_SUPPORTED;
+        }
+        table[count].addr = pa;
+        table[count].len = (uint32_t)len;
+        table[count].flags = write ? 0 : VRING_DESC_F_WRITE; /* a block read writes the buffer */
+        count++;
+    }
 
-#if LOCAL_TRACE > 0
-    virtio_dump_desc(desc);
-#endif
+    table[count].addr = slot_pa + offsetof(blk_req_slot, status);
+    table[count].len = 1;
+    table[count].flags = VRING_DESC_F_WRITE;
+    count++;
 
-    /* set up the descriptor pointing to the response */
-    desc = vring_.DescFromIndex(desc->next);
-    desc->addr = blk_res_pa_ + index;
-    desc->len = 1;
-    desc->flags = VRING_DESC_F_WRITE;
+    for (size_t i = 0; i + 1 < count; i++) {
+        table[i].flags |= VRING_DESC_F_NEXT;
+        table[i].next = (uint16_t)(i + 1);
+    }
+
+    /* put together a transfer */
+    uint16_t head;
+    if (indirect_) {
+        // one ring descriptor, pointing at the table
+        auto desc = q->ring.AllocDescChain(1, &head);
+        if (!desc)
+            return ERR_SHOULD_WAIT;
+        desc->addr = slot_pa + offsetof(blk_req_slot, desc);
+        desc->len = (uint32_t)(count * sizeof(vring_desc));
+        desc->flags = VRING_DESC_F_INDIRECT;
+    } else {
+        // copy the table into a chain of ring descriptors
+        auto desc = q->ring.AllocDescChain((uint16_t)count, &head);
+        if (!desc)
+            return ERR_SHOULD_WAIT;
+        for (size_t i = 0; i < count; i++) {
+            desc->addr = table[i].addr;
+            desc->len = table[i].len;
+            desc->flags = (uint16_t)((desc->flags & VRING_DESC_F_NEXT) |
+                                     (table[i].flags & VRING_DESC_F_WRITE));
+            if (desc->flags & VRING_DESC_F_NEXT)
+                desc = q->ring.DescFromIndex(desc->next);
+        }
+    }
+    LTRACEF("after alloc chain head %u\n", head);
 
 #if LOCAL_TRACE > 0
-    virtio_dump_desc(desc);
+    for (size_t i = 0; i < count; i++)
+        virtio_dump_desc(&table[i]);
 #endif
 
-    // save the iotxn in a list
-    list_add_tail(&iotxn_list, &txn->node);
+    q->blk_req_free &= ~(1u << index);
+    q->blk_req_txn[index] = txn;
+    q->desc_blk_req[head] = (uint8_t)index;
 
     /* submit the transfer */
-    vring_.SubmitChain(i);
+    q->ring.SubmitChain(head);
 
-    /* kick it off */
-    vring_.Kick();
+    return NO_ERROR;
 }
 
 } // namespace virtio
@@ -6,7 +6,13 @@
 #include "device.h"
 #include "ring.h"
 
+#include <ddk/iotxn.h>
+#include <ddk/protocol/block.h>
 #include <magenta/compiler.h>
+#include <magenta/listnode.h>
+#include <mxtl/mutex.h>
+#include <mxtl/unique_ptr.h>
+#include <stddef.h>
 #include <stdlib.h>
 
 namespace virtio {
@@ -34,10 +40,32 @@ private:
     static mx_status_t virtio_block_ioctl(void* ctx, uint32_t op, const void* in_buf, size_t in_len,
                                       void* out_buf, size_t out_len, size_t* out_actual);
 
-    void QueueReadWriteTxn(iotxn_t* txn);
-
-    // the main virtio ring
-    Ring vring_ = {this};
+    // block core protocol hooks, used by the block fifo server
+    static void virtio_block_set_callbacks(mx_device_t* dev, block_callbacks_t* cb);
+    static void virtio_block_get_info(mx_device_t* dev, block_info_t* info);
+    static void virtio_block_read(mx_device_t* dev, mx_handle_t vmo, uint64_t length,
+                                  uint64_t vmo_offset, uint64_t dev_offset, void* cookie);
+    static void virtio_block_write(mx_device_t* dev, mx_handle_t vmo, uint64_t length,
+                                   uint64_t vmo_offset, uint64_t dev_offset, void* cookie);
+    static void virtio_block_end_batch(mx_device_t* dev);
+    static void virtio_block_fifo_complete(iotxn_t* txn, void* cookie);
+
+    static block_ops_t block_ops_;
+
+    void GetInfo(block_info_t* info);
+    void FifoTxn(uint32_t opcode, mx_handle_t vmo, uint64_t length, uint64_t vmo_offset,
+                 uint64_t dev_offset, void* cookie);
+
+    // Queues a read or write. Unless |kick| is set, the device isn't told
+    // about it until the next kick of the same queue.
+    void QueueReadWriteTxn(iotxn_t* txn, bool kick);
+
+    struct Queue;
+    mx_status_t InitQueue(uint16_t index);
+    Queue* PickQueue();
+    // submits as many of the queue's pending iotxns as it has room for
+    void SubmitPendingLocked(Queue* q);
+    mx_status_t SubmitTxnLocked(Queue* q, iotxn_t* txn);
 
     // saved block device configuration out of the pci config BAR
     struct virtio_blk_config {
@@ -50,6 +78,15 @@ private:
             uint8_t sectors;
         } geometry;
         uint32_t blk_size;
+        struct virtio_blk_topology {
+            uint8_t physical_block_exp;
+            uint8_t alignment_offset;
+            uint16_t min_io_size;
+            uint32_t opt_io_size;
+        } topology;
+        uint8_t writeback;
+        uint8_t unused0;
+        uint16_t num_queues;
     } config_ __PACKED = {};
 
     struct virtio_blk_req {
@@ -58,29 +95,63 @@ private:
         uint64_t sector;
     } __PACKED;
 
-    // a queue of block request/responses
+    // the size of each virtqueue; 128 matches legacy pci
+    static const uint16_t ring_size = 128;
+
+    // the most queues we'll use, however many cpus there are
+    static const size_t max_queues = 16;
+
+    // the most physically contiguous runs of memory a single request may use
+    static const size_t max_segments = 64;
+
+    // Everything the device reads or writes for a request, apart from the
+    // data itself. |desc| is the request's descriptor table: the header, the
+    // data segments, then the status byte. With indirect descriptors, a
+    // request takes one ring slot pointing at this table; otherwise the table
+    // is copied into a chain of ring descriptors.
+    struct alignas(16) blk_req_slot {
+        virtio_blk_req req;
+        vring_desc desc[max_segments + 2];
+        uint8_t status;
+    };
+    static_assert(offsetof(blk_req_slot, desc) % 16 == 0, "descriptor tables are 16 byte aligned");
+    static_assert(sizeof(blk_req_slot) % 16 == 0, "descriptor tables are 16 byte aligned");
+
+    // the number of requests each queue may have outstanding
     static const size_t blk_req_count = 32;
 
-    mx_paddr_t blk_req_pa_ = 0;
-    virtio_blk_req* blk_req_ = nullptr;
+    // A virtqueue and its requests. Each has its own lock, so threads
+    // submitting to different queues don't contend.
+    struct Queue {
+        explicit Queue(Device* device)
+            : ring(device) {}
+
+        mxtl::Mutex lock;
+        Ring ring;
+
+        mx_paddr_t blk_req_pa = 0;
+        blk_req_slot* blk_req = nullptr;
+
+        // set bits are free request slots
+        uint32_t blk_req_free = UINT32_MAX;
+        iotxn_t* blk_req_txn[blk_req_count] = {};
 
-    mx_paddr_t blk_res_pa_ = 0;
-    uint8_t* blk_res_ = nullptr;
+        // the request slot of each in-flight descriptor chain, by head index
+        uint8_t desc_blk_req[ring_size] = {};
 
-    uint32_t blk_req_bitmap_ = 0;
+        // iotxns waiting for a request slot or ring descriptors
+        list_node pending = LIST_INITIAL_VALUE(pending);
+    };
+    static_assert(blk_req_count == 32, "blk_req_free is a 32 bit mask");
 
-    unsigned int alloc_blk_req() {
-        unsigned int i = 31 - __builtin_clz(blk_req_bitmap_);
-        blk_req_bitmap_ |= (1 << i);
-        return i;
-    }
+    mxtl::unique_ptr<Queue> queues_[max_queues];
+    size_t num_queues_ = 0;
 
-    void free_blk_req(unsigned int i) {
-        blk_req_bitmap_ &= ~(1 << i);
-    }
+    // negotiated features
+    bool indirect_ = false;
+    size_t seg_max_ = max_segments;
 
-    // pending iotxns
-    list_node iotxn_list = LIST_INITIAL_VALUE(iotxn_list);
+    block_callbacks_t* callbacks_ = nullptr;
 };
 
 } // namespace virtio
@@ -332,6 +332,49 @@ void Device::StatusAcknowledgeDriver() {
     }
 }
 
+uint32_t Device::ReadDeviceFeatures() {
+    if (trans_) {
+        if (bar0_pio_base_) {
+            return inpd((bar0_pio_base_ + VIRTIO_PCI_DEVICE_FEATURES) & 0xffff);
+        } else {
+            // XXX implement
+            assert(0);
+            return 0;
+        }
+    } else {
+        mmio_regs_.common_config->device_feature_select = 0;
+        return mmio_regs_.common_config->device_feature;
+    }
+}
+
+mx_status_t Device::WriteDriverFeatures(uint32_t features) {
+    LTRACEF("features %#x\n", features);
+    if (trans_) {
+        if (bar0_pio_base_) {
+            outpd((bar0_pio_base_ + VIRTIO_PCI_DRIVER_FEATURES) & 0xffff, features);
+        } else {
+            // XXX implement
+            assert(0);
+        }
+        return NO_ERROR;
+    }
+
+    mmio_regs_.common_config->driver_feature_select = 0;
+    mmio_regs_.common_config->driver_feature = features;
+    // non transitional devices require VERSION_1, in the second feature word
+    mmio_regs_.common_config->driver_feature_select = 1;
+    mmio_regs_.common_config->driver_feature = 1u << (VIRTIO_F_VERSION_1 - 32);
+
+    // the device clears FEATURES_OK again if it can't work with them
+    mmio_regs_.common_config->device_status |= VIRTIO_STATUS_FEATURES_OK;
+    if (!(mmio_regs_.common_config->device_status & VIRTIO_STATUS_FEATURES_OK)) {
+        printf("virtio: device did not accept features %#x\n", features);
+        mmio_regs_.common_config->device_status |= VIRTIO_STATUS_FAILED;
+        return ERR_NOT_SUPPORTED;
+    }
+    return NO_ERROR;
+}
+
 void Device::StatusDriverOK() {
     if (trans_) {
         uint8_t val = ReadConfigBar(VIRTIO_PCI_DEVICE_STATUS);
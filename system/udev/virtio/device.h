@@ -48,6 +48,12 @@ protected:
     void StatusAcknowledgeDriver();
     void StatusDriverOK();
 
+    // feature bits 0-31, which is all a transitional device has
+    uint32_t ReadDeviceFeatures();
+    // acknowledges the subset of the device's features the driver will use,
+    // failing if a non transitional device does not accept them
+    mx_status_t WriteDriverFeatures(uint32_t features);
+
     static int IrqThreadEntry(void* arg);
     void IrqWorker();
 
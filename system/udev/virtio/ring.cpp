@@ -149,14 +149,30 @@ void Ring::SubmitChain(uint16_t desc_index) {
     struct vring_avail* avail = ring_.avail;
 
     avail->ring[avail->idx & ring_.num_mask] = desc_index;
-    //mb();
-    avail->idx++;
+    // the device must see the ring entry before the new index
+    __atomic_store_n(&avail->idx, static_cast<uint16_t>(avail->idx + 1), __ATOMIC_RELEASE);
 }
 
 void Ring::Kick() {
     LTRACE_ENTRY;
 
-    device_->RingKick(index_);
+    uint16_t avail_idx = ring_.avail->idx;
+    if (avail_idx == kicked_idx_)
+        return;
+
+    // the new index must be visible before we look at what the device wants
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    bool notify;
+    if (event_idx_) {
+        notify = vring_need_event(vring_avail_event(&ring_), avail_idx, kicked_idx_);
+    } else {
+        notify = !(__atomic_load_n(&ring_.used->flags, __ATOMIC_ACQUIRE) & VRING_USED_F_NO_NOTIFY);
+    }
+    kicked_idx_ = avail_idx;
+
+    if (notify)
+        device_->RingKick(index_);
 }
 
 } // namespace virtio
@@ -25,8 +25,14 @@ public:
     uint16_t AllocDesc();
     struct vring_desc* AllocDescChain(uint16_t count, uint16_t* start_index);
     void SubmitChain(uint16_t desc_index);
+    // Notifies the device of the chains submitted since the last kick, unless
+    // it has said it doesn't need to be told about them.
     void Kick();
 
+    // With VIRTIO_RING_F_EVENT_IDX negotiated, the device and driver say which
+    // ring index they next want to be notified at, rather than using flags.
+    void SetEventIndex(bool enable) { event_idx_ = enable; }
+
     struct vring_desc* DescFromIndex(uint16_t index) {
         return &ring_.desc[index];
     }
@@ -44,6 +50,10 @@ private:
     uint16_t index_ = 0;
 
     vring ring_ = {};
+
+    bool event_idx_ = false;
+    // the avail ring index as of the last kick
+    uint16_t kicked_idx_ = 0;
 };
 
 // perform the main loop of finding free descriptor chains and passing it to a passed in function
@@ -52,18 +62,32 @@ inline void Ring::IrqRingUpdate(T free_chain) {
     //TRACEF("used flags 0x%hhx idx 0x%hhx last_used %u\n",
     //        ring_.used->flags, ring_.used->idx, ring_.last_used);
 
-    // find a new free chain of descriptors
-    unsigned int cur_idx = ring_.used->idx;
-    for (unsigned int i = ring_.last_used; i != (cur_idx & ring_.num_mask); i = (i + 1) & ring_.num_mask) {
-        //TRACEF("looking at idx %u\n", i);
-
-        struct vring_used_elem* used_elem = &ring_.used->ring[i];
-        //TRACEF("used chain id %u, len %u\n", used_elem->id, used_elem->len);
-
-        // free the chain
-        free_chain(used_elem);
-
-        ring_.last_used = ((ring_.last_used + 1) & ring_.num_mask) & 0xffff;
+    // last_used and the used ring index are free running; only the ring
+    // accesses are masked, so a completely full used ring isn't mistaken for
+    // an empty one.
+    uint16_t cur_idx = __atomic_load_n(&ring_.used->idx, __ATOMIC_ACQUIRE);
+    for (;;) {
+        // find a new free chain of descriptors
+        for (; ring_.last_used != cur_idx; ring_.last_used++) {
+            struct vring_used_elem* used_elem = &ring_.used->ring[ring_.last_used & ring_.num_mask];
+            //TRACEF("used chain id %u, len %u\n", used_elem->id, used_elem->len);
+
+            // free the chain
+            free_chain(used_elem);
+        }
+        if (!event_idx_) {
+            break;
+        }
+
+        // ask for an interrupt at the next used entry, then check that one
+        // didn't slip in before the device could see the request
+        vring_used_event(&ring_) = cur_idx;
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        uint16_t idx = __atomic_load_n(&ring_.used->idx, __ATOMIC_ACQUIRE);
+        if (idx == cur_idx) {
+            break;
+        }
+        cur_idx = idx;
     }
 }
 
@@ -56,6 +56,9 @@ static_assert(sizeof(struct virtio_mmio_config) == 0x100, "");
 #define VIRTIO_STATUS_DEVICE_NEEDS_RESET (1<<6)
 #define VIRTIO_STATUS_FAILED            (1<<7)
 
+// device independent feature bits
+#define VIRTIO_F_VERSION_1              32
+
 // PCI IO space for transitional virtio devices
 #define VIRTIO_PCI_DEVICE_FEATURES      (0x0) // 32
 #define VIRTIO_PCI_DRIVER_FEATURES      (0x4) // 32
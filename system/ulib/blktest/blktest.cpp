@@ -892,6 +892,196 @@ bool blkdev_test_fifo_bad_client_bad_vmo(void) {
     END_TEST;
 }
 
+bool blkdev_test_fifo_merged_requests(void) {
+    BEGIN_TEST;
+    uint64_t kBlockSize, blk_count;
+    int fd = get_testdev(&kBlockSize, &blk_count);
+    mx_handle_t fifo;
+    ssize_t expected = sizeof(fifo);
+    ASSERT_EQ(ioctl_block_get_fifos(fd, &fifo), expected, "Failed to get FIFO");
+    fifo_client_t* client;
+    ASSERT_EQ(block_fifo_create_client(fifo, &client), NO_ERROR, "");
+    txnid_t txnid;
+    expected = sizeof(txnid_t);
+    ASSERT_EQ(ioctl_block_alloc_txn(fd, &txnid), expected, "Failed to allocate txn");
+
+    // A VMO with a block for each message of a txn
+    const size_t blocks = MAX_TXN_MESSAGES;
+    test_vmo_object_t obj;
+    obj.vmo_size = blocks * kBlockSize;
+    ASSERT_EQ(mx_vmo_create(obj.vmo_size, 0, &obj.vmo), NO_ERROR, "Failed to create vmo");
+    AllocChecker ac;
+    obj.buf.reset(new (&ac) uint8_t[obj.vmo_size]);
+    ASSERT_TRUE(ac.check(), "");
+    fill_random(obj.buf.get(), obj.vmo_size);
+    size_t actual;
+    ASSERT_EQ(mx_vmo_write(obj.vmo, obj.buf.get(), 0, obj.vmo_size, &actual), NO_ERROR, "");
+    mx_handle_t xfer_vmo;
+    ASSERT_EQ(mx_handle_duplicate(obj.vmo, MX_RIGHT_SAME_RIGHTS, &xfer_vmo), NO_ERROR, "");
+    expected = sizeof(vmoid_t);
+    ASSERT_EQ(ioctl_block_attach_vmo(fd, &xfer_vmo, &obj.vmoid), expected, "");
+
+    // Write the blocks one request at a time, last block first. The server
+    // should sort these and merge them into a single write.
+    block_fifo_request_t requests[blocks];
+    for (size_t b = 0; b < blocks; b++) {
+        size_t block = blocks - b - 1;
+        requests[b].txnid      = txnid;
+        requests[b].vmoid      = obj.vmoid;
+        requests[b].opcode     = BLOCKIO_WRITE;
+        requests[b].length     = kBlockSize;
+        requests[b].vmo_offset = block * kBlockSize;
+        requests[b].dev_offset = block * kBlockSize;
+    }
+    ASSERT_EQ(block_fifo_txn(client, requests, blocks), NO_ERROR, "");
+
+    // Read them back with one request
+    mxtl::unique_ptr<uint8_t[]> out(new (&ac) uint8_t[obj.vmo_size]());
+    ASSERT_TRUE(ac.check(), "");
+    ASSERT_EQ(mx_vmo_write(obj.vmo, out.get(), 0, obj.vmo_size, &actual), NO_ERROR, "");
+    requests[0].opcode     = BLOCKIO_READ;
+    requests[0].length     = obj.vmo_size;
+    requests[0].vmo_offset = 0;
+    requests[0].dev_offset = 0;
+    ASSERT_EQ(block_fifo_txn(client, requests, 1), NO_ERROR, "");
+    ASSERT_EQ(mx_vmo_read(obj.vmo, out.get(), 0, obj.vmo_size, &actual), NO_ERROR, "");
+    ASSERT_EQ(memcmp(obj.buf.get(), out.get(), obj.vmo_size), 0,
+              "Read data not equal to written data");
+
+    ASSERT_TRUE(close_vmo_helper(client, &obj, txnid), "");
+    block_fifo_release_client(client);
+    ASSERT_EQ(ioctl_block_fifo_close(fd), NO_ERROR, "Failed to close fifo");
+    close(fd);
+    END_TEST;
+}
+
+// The number of reads each run of |blkdev_test_fifo_perf| makes, across all threads
+constexpr size_t kPerfOps = 4096;
+
+typedef struct {
+    fifo_client_t* client;
+    int fd;
+    vmoid_t vmoid;
+    size_t index;
+    size_t xfer_size;
+    size_t xfer_count; // the number of transfer sized slots on the device
+    size_t ops;
+    uint64_t* latencies; // ticks taken by each of this thread's |ops| reads
+} perf_thread_arg_t;
+
+int fifo_perf_thread(void* arg) {
+    perf_thread_arg_t* perfarg = static_cast<perf_thread_arg_t*>(arg);
+
+    txnid_t txnid;
+    ssize_t expected = sizeof(txnid_t);
+    ASSERT_EQ(ioctl_block_alloc_txn(perfarg->fd, &txnid), expected, "Failed to allocate txn");
+
+    unsigned int seed = static_cast<unsigned int>(perfarg->index);
+    block_fifo_request_t request;
+    request.txnid      = txnid;
+    request.vmoid      = perfarg->vmoid;
+    request.opcode     = BLOCKIO_READ;
+    request.length     = perfarg->xfer_size;
+    request.vmo_offset = perfarg->index * perfarg->xfer_size;
+    for (size_t i = 0; i < perfarg->ops; i++) {
+        request.dev_offset = (rand_r(&seed) % perfarg->xfer_count) * perfarg->xfer_size;
+        uint64_t start = mx_ticks_get();
+        ASSERT_EQ(block_fifo_txn(perfarg->client, &request, 1), NO_ERROR, "");
+        perfarg->latencies[i] = mx_ticks_get() - start;
+    }
+
+    ASSERT_EQ(ioctl_block_free_txn(perfarg->fd, &txnid), NO_ERROR, "Failed to free txn");
+    return 0;
+}
+
+static int compare_ticks(const void* a, const void* b) {
+    uint64_t x = *static_cast<const uint64_t*>(a);
+    uint64_t y = *static_cast<const uint64_t*>(b);
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+// Reports the IOPS and latency percentiles of random page sized reads, with
+// one thread (and one txn) for each outstanding read.
+bool blkdev_test_fifo_perf(void) {
+    BEGIN_TEST;
+    uint64_t kBlockSize, blk_count;
+    int fd = get_testdev(&kBlockSize, &blk_count);
+    mx_handle_t fifo;
+    ssize_t expected = sizeof(fifo);
+    ASSERT_EQ(ioctl_block_get_fifos(fd, &fifo), expected, "Failed to get FIFO");
+    fifo_client_t* client;
+    ASSERT_EQ(block_fifo_create_client(fifo, &client), NO_ERROR, "");
+
+    const size_t xfer_size = (PAGE_SIZE + kBlockSize - 1) / kBlockSize * kBlockSize;
+    const size_t xfer_count = blk_count * kBlockSize / xfer_size;
+    ASSERT_GT(xfer_count, 0u, "Device is too small");
+    const size_t kDepths[] = {1, 4, 16, 32};
+    const size_t max_depth = kDepths[countof(kDepths) - 1];
+
+    mx_handle_t vmo;
+    ASSERT_EQ(mx_vmo_create(max_depth * xfer_size, 0, &vmo), NO_ERROR, "Failed to create vmo");
+    vmoid_t vmoid;
+    expected = sizeof(vmoid_t);
+    ASSERT_EQ(ioctl_block_attach_vmo(fd, &vmo, &vmoid), expected, "Failed to attach vmo");
+
+    AllocChecker ac;
+    mxtl::Array<uint64_t> latencies(new (&ac) uint64_t[kPerfOps], kPerfOps);
+    ASSERT_TRUE(ac.check(), "");
+    mxtl::Array<thrd_t> threads(new (&ac) thrd_t[max_depth](), max_depth);
+    ASSERT_TRUE(ac.check(), "");
+    mxtl::Array<perf_thread_arg_t> args(new (&ac) perf_thread_arg_t[max_depth](), max_depth);
+    ASSERT_TRUE(ac.check(), "");
+
+    printf("\n");
+    for (size_t depth : kDepths) {
+        size_t ops = kPerfOps / depth;
+        uint64_t start = mx_ticks_get();
+        for (size_t i = 0; i < depth; i++) {
+            args[i].client = client;
+            args[i].fd = fd;
+            args[i].vmoid = vmoid;
+            args[i].index = i;
+            args[i].xfer_size = xfer_size;
+            args[i].xfer_count = xfer_count;
+            args[i].ops = ops;
+            args[i].latencies = &latencies[i * ops];
+            ASSERT_EQ(thrd_create(&threads[i], fifo_perf_thread, &args[i]), thrd_success, "");
+        }
+        for (size_t i = 0; i < depth; i++) {
+            int res;
+            ASSERT_EQ(thrd_join(threads[i], &res), thrd_success, "");
+            ASSERT_EQ(res, 0, "");
+        }
+        uint64_t ticks = mx_ticks_get() - start;
+
+        size_t total = ops * depth;
+        qsort(latencies.get(), total, sizeof(uint64_t), compare_ticks);
+        double ticks_per_us = static_cast<double>(mx_ticks_per_second()) / 1e6;
+        auto percentile = [&](size_t p) {
+            return static_cast<double>(latencies[(total - 1) * p / 1000]) / ticks_per_us;
+        };
+        double iops = static_cast<double>(total) * static_cast<double>(mx_ticks_per_second()) /
+                      static_cast<double>(ticks);
+        printf("Benchmark read %zu bytes, depth %2zu: [%9.0f] IOPS, latency us: "
+               "p50 %8.1f p90 %8.1f p99 %8.1f p99.9 %8.1f\n",
+               xfer_size, depth, iops, percentile(500), percentile(900), percentile(990),
+               percentile(999));
+    }
+
+    txnid_t txnid;
+    expected = sizeof(txnid_t);
+    ASSERT_EQ(ioctl_block_alloc_txn(fd, &txnid), expected, "Failed to allocate txn");
+    block_fifo_request_t request;
+    request.txnid = txnid;
+    request.vmoid = vmoid;
+    request.opcode = BLOCKIO_CLOSE_VMO;
+    ASSERT_EQ(block_fifo_txn(client, &request, 1), NO_ERROR, "");
+    block_fifo_release_client(client);
+    ASSERT_EQ(ioctl_block_fifo_close(fd), NO_ERROR, "Failed to close fifo");
+    close(fd);
+    END_TEST;
+}
+
 BEGIN_TEST_CASE(blkdev_tests)
 RUN_TEST(blkdev_test_simple)
 RUN_TEST(blkdev_test_bad_requests)
@@ -911,6 +1101,8 @@ RUN_TEST(blkdev_test_fifo_bad_client_vmoid)
 RUN_TEST(blkdev_test_fifo_bad_client_txnid)
 RUN_TEST(blkdev_test_fifo_bad_client_unaligned_request)
 RUN_TEST(blkdev_test_fifo_bad_client_bad_vmo)
+RUN_TEST(blkdev_test_fifo_merged_requests)
+RUN_TEST_PERFORMANCE(blkdev_test_fifo_perf)
 END_TEST_CASE(blkdev_tests)
 
 } // namespace tests
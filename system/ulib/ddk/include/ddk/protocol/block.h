@@ -23,4 +23,9 @@ typedef struct block_ops {
     // Write from the VMO to the block device
     void (*write)(mx_device_t* dev, mx_handle_t vmo, uint64_t length, uint64_t vmo_offset,
                   uint64_t dev_offset, void* cookie);
+    // Optional: called after a group of reads and writes which arrived together
+    // has been issued.  Drivers may hold back the requests in a group, and hand
+    // them all to the hardware at once when this is called.  Requests may
+    // complete before end_batch returns.
+    void (*end_batch)(mx_device_t* dev);
 } block_ops_t;
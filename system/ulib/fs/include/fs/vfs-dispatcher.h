@@ -69,6 +69,7 @@ private:
     mx_status_t Add(mx_handle_t h, void* cb, void* cookie);
     mx_status_t Start(const char* name);
     int Loop();
+    void HandlePacket(const mx_port_packet_t& packet);
     void DisconnectHandler(Handler*, bool);
 };
 
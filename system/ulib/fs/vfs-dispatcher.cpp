@@ -117,26 +117,74 @@ void VfsDispatcher::DisconnectHandler(Handler* handler, bool need_close_cb) {
     }
 }
 
-int VfsDispatcher::Loop() {
+void VfsDispatcher::HandlePacket(const mx_port_packet_t& packet) {
     mx_status_t r;
 
     // when draining queue, limit the number of messages you take
     // at once, so you don't dominate the cpu
     constexpr unsigned kMaxMessageBatchSize = 4;
+
+    xprintf("thrd_: port_wait: returns key %p effective:%#x \n",
+            (void*)packet.key, packet.signal.observed);
+
+    Handler* handler = (Handler*)(uintptr_t)packet.key;
+
+    if (packet.signal.observed & MX_CHANNEL_READABLE) {
+        // hit cb multiple times if we know multi packets available
+        for (unsigned ix = 0; ix < mxtl::min(kMaxMessageBatchSize, (unsigned)packet.signal.count); ++ix) {
+            if ((r = handler->ExecuteCallback(cb_)) != NO_ERROR) {
+                // error or close: invoke callback in case of error
+                DisconnectHandler(handler, r < 0);
+                goto free_handler;
+            }
+        }
+        // maybe more work to do: re-arm handler to fire again
+        if ((r = handler->SetAsyncCallback(ioport_))!= NO_ERROR){
+            DisconnectHandler(handler, true);
+            goto free_handler;
+        }
+    } else if (packet.signal.observed & MX_CHANNEL_PEER_CLOSED) {
+        DisconnectHandler(handler, true);
+    free_handler:
+        mtx_lock(&lock_);
+        handlers_.erase(*handler);
+        mtx_unlock(&lock_);
+
+        delete handler;
+    }
+}
+
+int VfsDispatcher::Loop() {
+    mx_status_t r;
+
+    // Packets taken per port wait. Other threads in the pool are idle
+    // meanwhile, so keep this small, and don't spin before blocking.
+    constexpr uint32_t kPacketBatchSize = 4;
     char tname[128];
     GetThreadName(tname, sizeof(tname));
 
     for (;;) {
-        mx_port_packet_t packet;
+        mx_port_packet_t packets[kPacketBatchSize];
+        uint32_t count = kPacketBatchSize;
 
-        if ((r = mx_port_wait(ioport_, MX_TIME_INFINITE, &packet, 0u)) < 0) {
+        if ((r = mx_port_wait_many(ioport_, MX_TIME_INFINITE, 0u, packets, &count)) < 0) {
             xprintf("mxio_dispatcher: port wait failed %d, worker exiting\n", r);
             return NO_ERROR;
         }
 
         xprintf("port_wait: thread %s \n", tname);
 
-        if ((packet.signal.observed & MX_EVENT_SIGNALED) != 0) {
+        bool shutdown = false;
+        for (uint32_t i = 0; i < count; ++i) {
+            if ((packets[i].signal.observed & MX_EVENT_SIGNALED) != 0) {
+                // finish the rest of the batch before exiting
+                shutdown = true;
+                continue;
+            }
+            HandlePacket(packets[i]);
+        }
+
+        if (shutdown) {
             // reset for the next thread
             r = mx_object_wait_async(shutdown_event_, ioport_, 0u,
                                      MX_EVENT_SIGNALED,
@@ -148,36 +196,6 @@ int VfsDispatcher::Loop() {
             xprintf("%s: suicide\n", tname);
             return r;
         }
-
-        xprintf("thrd_: port_wait: returns key %p effective:%#x \n",
-                (void*)packet.key, packet.signal.observed);
-
-        Handler* handler = (Handler*)(uintptr_t)packet.key;
-
-        if (packet.signal.observed & MX_CHANNEL_READABLE) {
-            // hit cb multiple times if we know multi packets available
-            for (unsigned ix = 0; ix < mxtl::min(kMaxMessageBatchSize, (unsigned)packet.signal.count); ++ix) {
-                if ((r = handler->ExecuteCallback(cb_)) != NO_ERROR) {
-                    // error or close: invoke callback in case of error
-                    DisconnectHandler(handler, r < 0);
-                    goto free_handler;
-                }
-            }
-            // maybe more work to do: re-arm handler to fire again
-            if ((r = handler->SetAsyncCallback(ioport_))!= NO_ERROR){
-                DisconnectHandler(handler, true);
-                goto free_handler;
-            }
-        } else if (packet.signal.observed & MX_CHANNEL_PEER_CLOSED) {
-            DisconnectHandler(handler, true);
-        free_handler:
-            mtx_lock(&lock_);
-            handlers_.erase(*handler);
-            mtx_unlock(&lock_);
-
-            delete handler;
-        }
-
     }
 
     // fatal error -- exiting thread
@@ -14,6 +14,8 @@
 #include <magenta/new.h>
 #include <mxtl/unique_ptr.h>
 
+#include "sha256.h"
+
 namespace merkle {
 
 Digest::Digest(const Digest& other) {
@@ -60,7 +62,29 @@ void Digest::Update(const void* buf, size_t len) {
 #ifdef USE_LIBCRYPTO
     SHA256_Update(&ctx_, buf, len);
 #else
-    clHASH_update(&ctx_, buf, static_cast<int>(len));
+    // cryptolib's update copies a byte at a time into its block buffer; only
+    // partial blocks need that, whole blocks can be compressed in place.
+    const uint8_t* p = static_cast<const uint8_t*>(buf);
+    size_t used = static_cast<size_t>(ctx_.count & 63);
+    ctx_.count += len;
+    if (used != 0) {
+        size_t n = sizeof(ctx_.buf) - used;
+        if (len < n) {
+            memcpy(ctx_.buf + used, p, len);
+            return;
+        }
+        memcpy(ctx_.buf + used, p, n);
+        Sha256Compress(ctx_.state, ctx_.buf, 1);
+        p += n;
+        len -= n;
+    }
+    size_t num_blocks = len / sizeof(ctx_.buf);
+    if (num_blocks != 0) {
+        Sha256Compress(ctx_.state, p, num_blocks);
+        p += num_blocks * sizeof(ctx_.buf);
+        len -= num_blocks * sizeof(ctx_.buf);
+    }
+    memcpy(ctx_.buf, p, len);
 #endif // USE_LIBCRYPTO
 }
 
@@ -69,7 +93,25 @@ const uint8_t* Digest::Final() {
 #ifdef USE_LIBCRYPTO
     SHA256_Final(bytes_, &ctx_);
 #else
-    memcpy(bytes_, clHASH_final(&ctx_), kLength);
+    uint64_t bits = ctx_.count * 8;
+    size_t used = static_cast<size_t>(ctx_.count & 63);
+    ctx_.buf[used++] = 0x80;
+    if (used > sizeof(ctx_.buf) - sizeof(bits)) {
+        memset(ctx_.buf + used, 0, sizeof(ctx_.buf) - used);
+        Sha256Compress(ctx_.state, ctx_.buf, 1);
+        used = 0;
+    }
+    memset(ctx_.buf + used, 0, sizeof(ctx_.buf) - sizeof(bits) - used);
+    for (size_t i = 0; i < sizeof(bits); ++i) {
+        ctx_.buf[sizeof(ctx_.buf) - 1 - i] = static_cast<uint8_t>(bits >> (i * 8));
+    }
+    Sha256Compress(ctx_.state, ctx_.buf, 1);
+    for (size_t i = 0; i < kLength / 4; ++i) {
+        bytes_[i * 4 + 0] = static_cast<uint8_t>(ctx_.state[i] >> 24);
+        bytes_[i * 4 + 1] = static_cast<uint8_t>(ctx_.state[i] >> 16);
+        bytes_[i * 4 + 2] = static_cast<uint8_t>(ctx_.state[i] >> 8);
+        bytes_[i * 4 + 3] = static_cast<uint8_t>(ctx_.state[i]);
+    }
 #endif // USE_LIBCRYPTO
     return bytes_;
 }
@@ -104,6 +104,12 @@ public:
     mx_status_t Create(const void* data, size_t data_len, void* tree,
                        size_t tree_len, Digest* digest);
 
+    // As above, but hashes the whole data nodes across up to |num_threads|
+    // threads.  Only the leaves are split up; the levels above them are a
+    // small fraction of the work and are hashed by the calling thread.
+    mx_status_t Create(const void* data, size_t data_len, void* tree,
+                       size_t tree_len, Digest* digest, size_t num_threads);
+
     // Sets the range of addresses within the tree that will need to be read to
     // fulfill a corresponding call to Verify. |offset| and |length| must
     // describe a range wholly within |data_len|. If the ranges fail to be set
@@ -119,12 +125,39 @@ public:
                        size_t tree_len, uint64_t offset, size_t length,
                        const Digest& digest);
 
-private:
+    // As above, but hashes the data nodes in the range across up to
+    // |num_threads| threads.
+    mx_status_t Verify(const void* data, size_t data_len, const void* tree,
+                       size_t tree_len, uint64_t offset, size_t length,
+                       const Digest& digest, size_t num_threads);
+
     // Sets the length of the data that this Merkle tree references.  This
     // method has the side effect of setting the geometry of the Merkle tree;
-    // this can fail due to low memory and return ERR_NO_MEMORY.
+    // this can fail due to low memory and return ERR_NO_MEMORY.  It must be
+    // called before |GetNodeOffset| and |VerifyNode|.
     mx_status_t SetLengths(size_t data_len, size_t tree_len);
 
+    // Returns the number of levels of digests above the data.  Level 0 is the
+    // data itself, and the single node of the top level is checked against the
+    // root digest.
+    size_t levels() const { return offsets_.size(); }
+
+    // Returns the offset of the |index|th node of |level|, within the data
+    // when |level| is 0 and within the tree otherwise.  The node's digest is
+    // held by node |index / (kNodeSize / Digest::kLength)| of the next level.
+    uint64_t GetNodeOffset(uint64_t level, uint64_t index) const;
+
+    // Checks a single node against the digest its parent holds for it (or the
+    // root |digest|, for the top node), without reading any other part of the
+    // data or tree.  This lets callers that load data lazily verify it one node
+    // at a time: a node can be trusted once it and every node above it have
+    // been checked, and nothing needs to be hashed twice.  Only the node in
+    // |data| (for |level| 0) or |tree|, and its digest in |tree|, are read.
+    mx_status_t VerifyNode(const void* data, const void* tree, uint64_t level,
+                           uint64_t index, const Digest& digest);
+
+private:
+
     // Calculates a digest using the data in |nodes| at given offset |off|.
     // It reads up to |kNodeSize| or until |end|, whichever comes first.  It
     // stores the resulting digest in |out|.  It returns the number of bytes
@@ -135,6 +168,13 @@ private:
     // tree and writes the digests to |tree|.
     mx_status_t HashData(const void* data, size_t length, void* tree);
 
+    // Checks the whole data nodes from |offset_| up to |finish| against their
+    // digests in |tree|, starting at |hash_offset|, hashing them across up to
+    // |num_threads| threads.  It advances |offset_| and |hash_offset| past the
+    // nodes it checked, leaving any partial last node for |HashNode|.
+    void VerifyLeaves(const void* data, const void* tree, uint64_t finish,
+                      uint64_t* hash_offset, size_t num_threads);
+
     // This method adds the given offset |off| to the appropriate list of
     // failures.
     void AddFailure();
@@ -10,14 +10,14 @@ MODULE_TYPE := userlib
 
 MODULE_SRCS += \
     $(LOCAL_DIR)/digest.cpp \
+    $(LOCAL_DIR)/sha256.cpp \
     $(LOCAL_DIR)/tree.cpp
 
 MODULE_SO_NAME := merkle
 MODULE_LIBS := system/ulib/c
 
-# TODO(aarongreen): cryptolib is FAR too slow for general purpose use.  We'll
-# need to use it to bootstrap and verify libcrypto.so before switching to
-# BoringSSL's optimized digests.
+# cryptolib only provides the SHA-256 context; the compression function is
+# sha256.cpp, which uses the SHA extensions or AVX2 when the CPU has them.
 MODULE_STATIC_LIBS := \
     third_party/ulib/cryptolib \
     system/ulib/mxcpp \
@@ -0,0 +1,294 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "sha256.h"
+
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+namespace merkle {
+namespace {
+
+const uint32_t kK[64] __attribute__((aligned(16))) = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+inline uint32_t Ror(uint32_t x, int n) {
+    return (x >> n) | (x << (32 - n));
+}
+
+inline uint32_t LoadBE32(const uint8_t* p) {
+    return (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16) |
+           (static_cast<uint32_t>(p[2]) << 8) | static_cast<uint32_t>(p[3]);
+}
+
+void CompressPortable(uint32_t state[8], const uint8_t* data, size_t num_blocks) {
+    uint32_t w[64];
+    for (; num_blocks != 0; --num_blocks, data += 64) {
+        for (int t = 0; t < 16; ++t) {
+            w[t] = LoadBE32(data + t * 4);
+        }
+        for (int t = 16; t < 64; ++t) {
+            uint32_t s0 = Ror(w[t - 15], 7) ^ Ror(w[t - 15], 18) ^ (w[t - 15] >> 3);
+            uint32_t s1 = Ror(w[t - 2], 17) ^ Ror(w[t - 2], 19) ^ (w[t - 2] >> 10);
+            w[t] = w[t - 16] + s0 + w[t - 7] + s1;
+        }
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+        uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+        for (int t = 0; t < 64; ++t) {
+            uint32_t t1 = h + (Ror(e, 6) ^ Ror(e, 11) ^ Ror(e, 25)) + ((e & f) ^ (~e & g)) +
+                          kK[t] + w[t];
+            uint32_t t2 = (Ror(a, 2) ^ Ror(a, 13) ^ Ror(a, 22)) + ((a & b) | (c & (a | b)));
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+        state[5] += f;
+        state[6] += g;
+        state[7] += h;
+    }
+}
+
+void CompressLanesPortable(uint32_t states[kSha256Lanes][8],
+                           const uint8_t* const data[kSha256Lanes], size_t num_blocks) {
+    for (size_t i = 0; i < kSha256Lanes; ++i) {
+        Sha256Compress(states[i], data[i], num_blocks);
+    }
+}
+
+#if defined(__x86_64__)
+
+// The SHA extensions do four rounds with two sha256rnds2 instructions, and
+// keep the state as ABEF and CDGH rather than ABCD and EFGH.
+__attribute__((target("sha,sse4.1")))
+void CompressShaNi(uint32_t state[8], const uint8_t* data, size_t num_blocks) {
+    const __m128i kShuffle = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    __m128i tmp = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&state[0]));
+    __m128i state1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&state[4]));
+    tmp = _mm_shuffle_epi32(tmp, 0xb1);             // CDAB
+    state1 = _mm_shuffle_epi32(state1, 0x1b);       // EFGH
+    __m128i state0 = _mm_alignr_epi8(tmp, state1, 8); // ABEF
+    state1 = _mm_blend_epi16(state1, tmp, 0xf0);    // CDGH
+
+    for (; num_blocks != 0; --num_blocks, data += 64) {
+        __m128i abef = state0;
+        __m128i cdgh = state1;
+        __m128i msgs[4];
+        for (int i = 0; i < 16; ++i) {
+            __m128i msg;
+            if (i < 4) {
+                msg = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i * 16));
+                msg = _mm_shuffle_epi8(msg, kShuffle);
+            } else {
+                msg = _mm_sha256msg1_epu32(msgs[i % 4], msgs[(i + 1) % 4]);
+                msg = _mm_add_epi32(msg, _mm_alignr_epi8(msgs[(i + 3) % 4], msgs[(i + 2) % 4], 4));
+                msg = _mm_sha256msg2_epu32(msg, msgs[(i + 3) % 4]);
+            }
+            msgs[i % 4] = msg;
+            msg = _mm_add_epi32(msg, _mm_load_si128(reinterpret_cast<const __m128i*>(&kK[i * 4])));
+            state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+            msg = _mm_shuffle_epi32(msg, 0x0e);
+            state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+        }
+        state0 = _mm_add_epi32(state0, abef);
+        state1 = _mm_add_epi32(state1, cdgh);
+    }
+
+    tmp = _mm_shuffle_epi32(state0, 0x1b);          // FEBA
+    state1 = _mm_shuffle_epi32(state1, 0xb1);       // DCHG
+    state0 = _mm_blend_epi16(tmp, state1, 0xf0);    // DCBA
+    state1 = _mm_alignr_epi8(state1, tmp, 8);       // HGFE
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(&state[0]), state0);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(&state[4]), state1);
+}
+
+// With AVX2, each 32-bit lane of a vector holds the same word of a different
+// message's state, so eight messages advance through the rounds together.
+__attribute__((target("avx2")))
+inline __m256i Ror8(__m256i x, int n) {
+    return _mm256_or_si256(_mm256_srli_epi32(x, n), _mm256_slli_epi32(x, 32 - n));
+}
+
+__attribute__((target("avx2")))
+void CompressLanesAvx2(uint32_t states[kSha256Lanes][8],
+                       const uint8_t* const data[kSha256Lanes], size_t num_blocks) {
+    static_assert(kSha256Lanes == 8, "AVX2 holds eight 32-bit lanes");
+    // Byte-swaps each 32-bit word, so big-endian message words load directly
+    const __m256i kShuffle = _mm256_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL,
+                                               0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    __m256i s[8];
+    for (int j = 0; j < 8; ++j) {
+        s[j] = _mm256_set_epi32(states[7][j], states[6][j], states[5][j], states[4][j],
+                                states[3][j], states[2][j], states[1][j], states[0][j]);
+    }
+    __m256i w[16];
+    for (size_t n = 0; n < num_blocks; ++n) {
+        __m256i a = s[0], b = s[1], c = s[2], d = s[3];
+        __m256i e = s[4], f = s[5], g = s[6], h = s[7];
+        for (int t = 0; t < 64; ++t) {
+            __m256i wt;
+            if (t < 16) {
+                const size_t off = n * 64 + t * 4;
+                uint32_t words[8];
+                for (size_t i = 0; i < 8; ++i) {
+                    memcpy(&words[i], data[i] + off, sizeof(uint32_t));
+                }
+                wt = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(words));
+                wt = _mm256_shuffle_epi8(wt, kShuffle);
+            } else {
+                __m256i w15 = w[(t - 15) % 16];
+                __m256i w2 = w[(t - 2) % 16];
+                __m256i s0 = _mm256_xor_si256(_mm256_xor_si256(Ror8(w15, 7), Ror8(w15, 18)),
+                                              _mm256_srli_epi32(w15, 3));
+                __m256i s1 = _mm256_xor_si256(_mm256_xor_si256(Ror8(w2, 17), Ror8(w2, 19)),
+                                              _mm256_srli_epi32(w2, 10));
+                wt = _mm256_add_epi32(_mm256_add_epi32(w[t % 16], s0),
+                                      _mm256_add_epi32(w[(t - 7) % 16], s1));
+            }
+            w[t % 16] = wt;
+
+            __m256i s1 = _mm256_xor_si256(_mm256_xor_si256(Ror8(e, 6), Ror8(e, 11)), Ror8(e, 25));
+            __m256i ch = _mm256_xor_si256(_mm256_and_si256(e, f), _mm256_andnot_si256(e, g));
+            __m256i t1 = _mm256_add_epi32(_mm256_add_epi32(h, s1), _mm256_add_epi32(ch, wt));
+            t1 = _mm256_add_epi32(t1, _mm256_set1_epi32(kK[t]));
+            __m256i s0 = _mm256_xor_si256(_mm256_xor_si256(Ror8(a, 2), Ror8(a, 13)), Ror8(a, 22));
+            __m256i maj = _mm256_or_si256(_mm256_and_si256(a, b),
+                                          _mm256_and_si256(c, _mm256_or_si256(a, b)));
+            __m256i t2 = _mm256_add_epi32(s0, maj);
+            h = g;
+            g = f;
+            f = e;
+            e = _mm256_add_epi32(d, t1);
+            d = c;
+            c = b;
+            b = a;
+            a = _mm256_add_epi32(t1, t2);
+        }
+        s[0] = _mm256_add_epi32(s[0], a);
+        s[1] = _mm256_add_epi32(s[1], b);
+        s[2] = _mm256_add_epi32(s[2], c);
+        s[3] = _mm256_add_epi32(s[3], d);
+        s[4] = _mm256_add_epi32(s[4], e);
+        s[5] = _mm256_add_epi32(s[5], f);
+        s[6] = _mm256_add_epi32(s[6], g);
+        s[7] = _mm256_add_epi32(s[7], h);
+    }
+    for (int j = 0; j < 8; ++j) {
+        uint32_t words[8];
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(words), s[j]);
+        for (size_t i = 0; i < 8; ++i) {
+            states[i][j] = words[i];
+        }
+    }
+}
+
+#endif // __x86_64__
+
+enum Features : int {
+    kFeaturesUnknown = -1,
+    kFeatureShaNi = 1 << 0,
+    kFeatureAvx2 = 1 << 1,
+};
+
+int gFeatures = kFeaturesUnknown;
+
+int DetectFeatures() {
+    int features = 0;
+#if defined(__x86_64__)
+    unsigned int eax, ebx, ecx, edx;
+    if (__get_cpuid_max(0, nullptr) < 7) {
+        return features;
+    }
+    __cpuid(1, eax, ebx, ecx, edx);
+    bool ssse3 = ecx & (1u << 9);
+    bool sse41 = ecx & (1u << 19);
+    // AVX2 also needs the OS to save the upper halves of the registers
+    bool ymm = false;
+    if ((ecx & (1u << 27)) && (ecx & (1u << 28))) {
+        uint32_t xcr0_lo, xcr0_hi;
+        __asm__ volatile("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+        ymm = (xcr0_lo & 0x6) == 0x6;
+    }
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+    if ((ebx & (1u << 29)) && ssse3 && sse41) {
+        features |= kFeatureShaNi;
+    }
+    if ((ebx & (1u << 5)) && ymm) {
+        features |= kFeatureAvx2;
+    }
+#endif
+    return features;
+}
+
+int Features() {
+    int features = __atomic_load_n(&gFeatures, __ATOMIC_RELAXED);
+    if (features == kFeaturesUnknown) {
+        // Racing callers all compute the same answer
+        features = DetectFeatures();
+        __atomic_store_n(&gFeatures, features, __ATOMIC_RELAXED);
+    }
+    return features;
+}
+
+} // namespace
+
+void Sha256Init(uint32_t state[8]) {
+    state[0] = 0x6a09e667;
+    state[1] = 0xbb67ae85;
+    state[2] = 0x3c6ef372;
+    state[3] = 0xa54ff53a;
+    state[4] = 0x510e527f;
+    state[5] = 0x9b05688c;
+    state[6] = 0x1f83d9ab;
+    state[7] = 0x5be0cd19;
+}
+
+void Sha256Compress(uint32_t state[8], const uint8_t* data, size_t num_blocks) {
+#if defined(__x86_64__)
+    if (Features() & kFeatureShaNi) {
+        CompressShaNi(state, data, num_blocks);
+        return;
+    }
+#endif
+    CompressPortable(state, data, num_blocks);
+}
+
+bool Sha256LanesPreferred() {
+    int features = Features();
+    return (features & kFeatureAvx2) && !(features & kFeatureShaNi);
+}
+
+void Sha256CompressLanes(uint32_t states[kSha256Lanes][8],
+                         const uint8_t* const data[kSha256Lanes], size_t num_blocks) {
+#if defined(__x86_64__)
+    if (Features() & kFeatureAvx2) {
+        CompressLanesAvx2(states, data, num_blocks);
+        return;
+    }
+#endif
+    CompressLanesPortable(states, data, num_blocks);
+}
+
+} // namespace merkle
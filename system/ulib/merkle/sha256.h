@@ -0,0 +1,39 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace merkle {
+
+// Sets |state| to the initial hash value, before any message blocks.
+void Sha256Init(uint32_t state[8]);
+
+// The SHA-256 compression function, for the digests of Digest and Tree.  The
+// fastest implementation the CPU supports is picked the first time one of
+// these is called: the SHA extensions if present, otherwise portable C.
+//
+// |state| is the eight 32-bit words of the hash state, and |data| holds
+// |num_blocks| 64-byte message blocks.  Padding is left to the caller.
+void Sha256Compress(uint32_t state[8], const uint8_t* data, size_t num_blocks);
+
+// The number of independent messages |Sha256CompressLanes| processes at once.
+constexpr size_t kSha256Lanes = 8;
+
+// Returns true if hashing |kSha256Lanes| equal-length messages together with
+// |Sha256CompressLanes| is faster than hashing them one at a time with
+// |Sha256Compress|.  This is the case when the CPU has AVX2 but no SHA
+// extensions.
+bool Sha256LanesPreferred();
+
+// Runs the compression function on |kSha256Lanes| messages at once:
+// |num_blocks| blocks of |data[i]| are mixed into |states[i]|.  Without AVX2,
+// this simply compresses each message in turn.
+void Sha256CompressLanes(uint32_t states[kSha256Lanes][8],
+                         const uint8_t* const data[kSha256Lanes],
+                         size_t num_blocks);
+
+} // namespace merkle
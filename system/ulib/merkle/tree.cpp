@@ -4,6 +4,7 @@
 
 #include <merkle/tree.h>
 
+#include <pthread.h>
 #include <string.h>
 
 #include <magenta/errors.h>
@@ -11,12 +12,146 @@
 #include <mxtl/algorithm.h>
 #include <mxtl/unique_ptr.h>
 
+#include "sha256.h"
+
 namespace merkle {
 
 constexpr size_t Tree::kNodeSize;
 const size_t kDigestsPerNode = Tree::kNodeSize / Digest::kLength;
 const size_t kMaxFailures = kDigestsPerNode;
 
+// Each thread hashes at least this many leaves, so short ranges aren't spread
+// thinner than it costs to start a thread.
+const size_t kMinLeavesPerThread = 64;
+
+// A leaf's message is its 8-byte locality followed by the node, so the node
+// starts 8 bytes into the first 64-byte SHA-256 block and ends 8 bytes into
+// the last.  The blocks between are hashed straight from the data.
+const size_t kSha256BlockSize = 64;
+const size_t kLeafHeadLen = kSha256BlockSize - sizeof(uint64_t);
+const size_t kLeafBulkBlocks = (Tree::kNodeSize - kLeafHeadLen) / kSha256BlockSize;
+static_assert(kLeafHeadLen + kLeafBulkBlocks * kSha256BlockSize + sizeof(uint64_t) ==
+                  Tree::kNodeSize, "leaves must end 8 bytes into a block");
+
+// Hashes |kSha256Lanes| whole leaves at once, starting with leaf |index|, and
+// writes their digests to |hashes|.
+static void HashLeafLanes(const uint8_t* data, uint64_t index, uint8_t* hashes) {
+    uint32_t states[kSha256Lanes][8];
+    uint8_t head[kSha256Lanes][kSha256BlockSize];
+    uint8_t tail[kSha256Lanes][kSha256BlockSize];
+    const uint8_t* heads[kSha256Lanes];
+    const uint8_t* bulk[kSha256Lanes];
+    const uint8_t* tails[kSha256Lanes];
+    const uint64_t bits = (sizeof(uint64_t) + Tree::kNodeSize) * 8;
+    for (size_t i = 0; i < kSha256Lanes; ++i) {
+        const uint8_t* node = data + (index + i) * Tree::kNodeSize;
+        uint64_t locality = (index + i) * Tree::kNodeSize;
+        Sha256Init(states[i]);
+        memcpy(head[i], &locality, sizeof(locality));
+        memcpy(head[i] + sizeof(locality), node, kLeafHeadLen);
+        memset(tail[i], 0, kSha256BlockSize);
+        memcpy(tail[i], node + Tree::kNodeSize - sizeof(uint64_t), sizeof(uint64_t));
+        tail[i][sizeof(uint64_t)] = 0x80;
+        for (size_t j = 0; j < sizeof(bits); ++j) {
+            tail[i][kSha256BlockSize - 1 - j] = static_cast<uint8_t>(bits >> (j * 8));
+        }
+        heads[i] = head[i];
+        bulk[i] = node + kLeafHeadLen;
+        tails[i] = tail[i];
+    }
+    Sha256CompressLanes(states, heads, 1);
+    Sha256CompressLanes(states, bulk, kLeafBulkBlocks);
+    Sha256CompressLanes(states, tails, 1);
+    for (size_t i = 0; i < kSha256Lanes; ++i) {
+        for (size_t j = 0; j < 8; ++j) {
+            uint8_t* out = hashes + i * Digest::kLength + j * 4;
+            out[0] = static_cast<uint8_t>(states[i][j] >> 24);
+            out[1] = static_cast<uint8_t>(states[i][j] >> 16);
+            out[2] = static_cast<uint8_t>(states[i][j] >> 8);
+            out[3] = static_cast<uint8_t>(states[i][j]);
+        }
+    }
+}
+
+// Hashes |count| whole leaves, starting with leaf |index|, and writes their
+// digests to |hashes|.  These are the same digests |HashNode| produces.
+static void HashLeaves(const uint8_t* data, uint64_t index, size_t count, uint8_t* hashes) {
+    if (Sha256LanesPreferred()) {
+        for (; count >= kSha256Lanes; count -= kSha256Lanes) {
+            HashLeafLanes(data, index, hashes);
+            index += kSha256Lanes;
+            hashes += kSha256Lanes * Digest::kLength;
+        }
+    }
+    Digest digest;
+    for (; count != 0; --count, ++index, hashes += Digest::kLength) {
+        digest.Init();
+        uint64_t locality = index * Tree::kNodeSize;
+        digest.Update(&locality, sizeof(locality));
+        digest.Update(data + index * Tree::kNodeSize, Tree::kNodeSize);
+        digest.Final();
+        digest.CopyTo(hashes, Digest::kLength);
+    }
+}
+
+struct LeafWork {
+    const uint8_t* data;
+    uint64_t index;
+    size_t count;
+    uint8_t* hashes;
+};
+
+static void* LeafWorker(void* arg) {
+    LeafWork* work = static_cast<LeafWork*>(arg);
+    HashLeaves(work->data, work->index, work->count, work->hashes);
+    return nullptr;
+}
+
+// Hashes |count| whole leaves, starting with leaf |index|, across up to
+// |num_threads| threads (including this one).  If threads can't be started,
+// their share is hashed here instead.
+static mx_status_t HashLeavesParallel(const uint8_t* data, uint64_t index, size_t count,
+                                      uint8_t* hashes, size_t num_threads) {
+    num_threads = mxtl::min(num_threads, count / kMinLeavesPerThread);
+    if (num_threads < 2) {
+        HashLeaves(data, index, count, hashes);
+        return NO_ERROR;
+    }
+    AllocChecker ac;
+    mxtl::unique_ptr<LeafWork[]> work(new (&ac) LeafWork[num_threads]);
+    if (!ac.check()) {
+        return ERR_NO_MEMORY;
+    }
+    mxtl::unique_ptr<pthread_t[]> threads(new (&ac) pthread_t[num_threads]);
+    if (!ac.check()) {
+        return ERR_NO_MEMORY;
+    }
+    // Keep each share a multiple of the lanes, so only the last has leftovers.
+    size_t share = mxtl::roundup((count + num_threads - 1) / num_threads, kSha256Lanes);
+    for (size_t i = 0; i < num_threads; ++i) {
+        size_t start = mxtl::min(i * share, count);
+        work[i].data = data;
+        work[i].index = index + start;
+        work[i].count = mxtl::min(share, count - start);
+        work[i].hashes = hashes + start * Digest::kLength;
+    }
+    // The first share is hashed by this thread.
+    size_t started = 1;
+    for (; started < num_threads; ++started) {
+        if (pthread_create(&threads[started], nullptr, LeafWorker, &work[started]) != 0) {
+            break;
+        }
+    }
+    for (size_t i = started; i < num_threads; ++i) {
+        LeafWorker(&work[i]);
+    }
+    LeafWorker(&work[0]);
+    for (size_t i = 1; i < started; ++i) {
+        pthread_join(threads[i], nullptr);
+    }
+    return NO_ERROR;
+}
+
 Tree::~Tree() {}
 
 // Public methods
@@ -110,11 +245,30 @@ mx_status_t Tree::CreateFinal(void* tree, Digest* digest) {
 
 mx_status_t Tree::Create(const void* data, size_t data_len, void* tree,
                          size_t tree_len, Digest* digest) {
+    return Create(data, data_len, tree, tree_len, digest, 1);
+}
+
+mx_status_t Tree::Create(const void* data, size_t data_len, void* tree,
+                         size_t tree_len, Digest* digest, size_t num_threads) {
     mx_status_t rc = CreateInit(data_len, tree, tree_len);
     if (rc != NO_ERROR) {
         return rc;
     }
-    rc = CreateUpdate(data, data_len, tree);
+    if (!data && data_len != 0) {
+        return ERR_INVALID_ARGS;
+    }
+    // A single node's digest is the root, so only trees with a leaf level can
+    // have their whole leaves hashed up front.  |CreateUpdate| does the rest.
+    if (data_len > kNodeSize) {
+        size_t count = data_len / kNodeSize;
+        rc = HashLeavesParallel(static_cast<const uint8_t*>(data), 0, count,
+                                static_cast<uint8_t*>(tree), num_threads);
+        if (rc != NO_ERROR) {
+            return rc;
+        }
+        offset_ = count * kNodeSize;
+    }
+    rc = CreateUpdate(static_cast<const uint8_t*>(data) + offset_, data_len - offset_, tree);
     if (rc != NO_ERROR) {
         return rc;
     }
@@ -159,6 +313,12 @@ mx_status_t Tree::SetRanges(size_t data_len, uint64_t offset, size_t length) {
 mx_status_t Tree::Verify(const void* data, size_t data_len, const void* tree,
                          size_t tree_len, uint64_t offset, size_t length,
                          const Digest& digest) {
+    return Verify(data, data_len, tree, tree_len, offset, length, digest, 1);
+}
+
+mx_status_t Tree::Verify(const void* data, size_t data_len, const void* tree,
+                         size_t tree_len, uint64_t offset, size_t length,
+                         const Digest& digest, size_t num_threads) {
     num_failures_ = 0;
     data_failures_.reset();
     tree_failures_.reset();
@@ -197,6 +357,9 @@ mx_status_t Tree::Verify(const void* data, size_t data_len, const void* tree,
             hash_offset = offsets_[level_] +
                           (offset_ - offsets_[level_ - 1]) / kDigestsPerNode;
         }
+        if (level_ == 0) {
+            VerifyLeaves(data, tree, finish, &hash_offset, num_threads);
+        }
         while (offset_ < finish) {
             HashNode(level_ == 0 ? data : tree);
             if (digest_ != hashes + hash_offset) {
@@ -208,6 +371,41 @@ mx_status_t Tree::Verify(const void* data, size_t data_len, const void* tree,
     return VerifyFinal();
 }
 
+uint64_t Tree::GetNodeOffset(uint64_t level, uint64_t index) const {
+    MX_DEBUG_ASSERT(level <= offsets_.size());
+    return (level == 0 ? 0 : offsets_[level - 1]) + index * kNodeSize;
+}
+
+mx_status_t Tree::VerifyNode(const void* data, const void* tree, uint64_t level,
+                             uint64_t index, const Digest& digest) {
+    if (level > offsets_.size() || (level == 0 && !data) ||
+        (offsets_.size() != 0 && !tree)) {
+        return ERR_INVALID_ARGS;
+    }
+    // The top level has a single node; the others end where the next begins.
+    uint64_t offset = GetNodeOffset(level, index);
+    if (level == offsets_.size()) {
+        if (index != 0) {
+            return ERR_INVALID_ARGS;
+        }
+    } else if (level == 0) {
+        if (offset >= data_len_) {
+            return ERR_INVALID_ARGS;
+        }
+    } else if (offset >= offsets_[level]) {
+        return ERR_INVALID_ARGS;
+    }
+    level_ = level;
+    offset_ = offset;
+    HashNode(level == 0 ? data : tree);
+    if (level == offsets_.size()) {
+        return digest_ == digest ? NO_ERROR : ERR_IO_DATA_INTEGRITY;
+    }
+    const uint8_t* hash =
+        static_cast<const uint8_t*>(tree) + offsets_[level] + index * Digest::kLength;
+    return digest_ == hash ? NO_ERROR : ERR_IO_DATA_INTEGRITY;
+}
+
 // Private methods
 
 static_assert(sizeof(size_t) <= sizeof(uint64_t), ">64-bit is unsupported");
@@ -315,6 +513,35 @@ mx_status_t Tree::HashData(const void* data, size_t length, void* tree) {
     return NO_ERROR;
 }
 
+void Tree::VerifyLeaves(const void* data, const void* tree, uint64_t finish,
+                        uint64_t* hash_offset, size_t num_threads) {
+    uint64_t first = offset_ / kNodeSize;
+    uint64_t last = mxtl::min(finish, static_cast<uint64_t>(data_len_)) / kNodeSize;
+    if (last <= first) {
+        return;
+    }
+    size_t count = static_cast<size_t>(last - first);
+    AllocChecker ac;
+    mxtl::unique_ptr<uint8_t[]> computed(new (&ac) uint8_t[count * Digest::kLength]);
+    // Without the memory, the caller falls back to checking nodes one by one.
+    if (!ac.check()) {
+        return;
+    }
+    if (HashLeavesParallel(static_cast<const uint8_t*>(data), first, count, computed.get(),
+                           num_threads) != NO_ERROR) {
+        return;
+    }
+    const uint8_t* hashes = static_cast<const uint8_t*>(tree) + *hash_offset;
+    for (size_t i = 0; i < count; ++i) {
+        offset_ += kNodeSize;
+        if (memcmp(computed.get() + i * Digest::kLength, hashes, Digest::kLength) != 0) {
+            AddFailure();
+        }
+        hashes += Digest::kLength;
+        *hash_offset += Digest::kLength;
+    }
+}
+
 void Tree::AddFailure() {
     mxtl::Array<uint64_t>* failures =
         (level_ == 0 ? &data_failures_ : &tree_failures_);
@@ -97,52 +97,66 @@ static void disconnect_handler(mxio_dispatcher_t* md, handler_t* handler, bool n
 #endif
 }
 
+static void mxio_dispatcher_packet(mxio_dispatcher_t* md, const mx_port_packet_t* packet) {
+    mx_status_t r;
+    handler_t* handler = (void*)(uintptr_t)packet->key;
+#if !USE_WAIT_ONCE
+    if (handler->flags & FLAG_DISCONNECTED) {
+        // handler is awaiting gc
+        // ignore events for it until we get the synthetic "destroy" event
+        if (packet->type == MX_PKT_TYPE_USER) {
+            destroy_handler(md, handler, packet->signal.observed & SIGNAL_NEEDS_CLOSE_CB);
+            printf("dispatcher: destroy %p\n", handler);
+        } else {
+            printf("dispatcher: spurious packet for %p\n", handler);
+        }
+        return;
+    }
+#endif
+    if (packet->signal.observed & MX_CHANNEL_READABLE) {
+        if ((r = handler->cb(handler->h, handler->func, handler->cookie)) != 0) {
+            if (r == ERR_DISPATCHER_NO_WORK) {
+                printf("mxio: dispatcher found no work to do!\n");
+            } else {
+                disconnect_handler(md, handler, r < 0);
+                return;
+            }
+        }
+#if USE_WAIT_ONCE
+        if ((r = mx_object_wait_async(handler->h, md->ioport, (uint64_t)(uintptr_t)handler,
+                                      MX_CHANNEL_READABLE | MX_CHANNEL_PEER_CLOSED,
+                                      MX_WAIT_ASYNC_ONCE)) < 0) {
+            printf("dispatcher: could not re-arm: %p\n", handler);
+        }
+#endif
+        return;
+    }
+    if (packet->signal.observed & MX_CHANNEL_PEER_CLOSED) {
+        // synthesize a close
+        disconnect_handler(md, handler, true);
+    }
+}
+
+// Packets taken per port wait, and how long to poll for more before
+// blocking, so a busy dispatcher enters the kernel once per batch.
+#define PACKET_BATCH 16
+#define PACKET_SPIN MX_USEC(20)
+
 static int mxio_dispatcher_thread(void* _md) {
     mxio_dispatcher_t* md = _md;
     mx_status_t r;
     xprintf("dispatcher: start %p\n", md);
 
     for (;;) {
-        mx_port_packet_t packet;
-        if ((r = mx_port_wait(md->ioport, MX_TIME_INFINITE, &packet, 0)) < 0) {
+        mx_port_packet_t packets[PACKET_BATCH];
+        uint32_t count = PACKET_BATCH;
+        if ((r = mx_port_wait_many(md->ioport, MX_TIME_INFINITE, PACKET_SPIN,
+                                   packets, &count)) < 0) {
             printf("dispatcher: ioport wait failed %d\n", r);
             break;
         }
-        handler_t* handler = (void*)(uintptr_t)packet.key;
-#if !USE_WAIT_ONCE
-        if (handler->flags & FLAG_DISCONNECTED) {
-            // handler is awaiting gc
-            // ignore events for it until we get the synthetic "destroy" event
-            if (packet.type == MX_PKT_TYPE_USER) {
-                destroy_handler(md, handler, packet.signal.observed & SIGNAL_NEEDS_CLOSE_CB);
-                printf("dispatcher: destroy %p\n", handler);
-            } else {
-                printf("dispatcher: spurious packet for %p\n", handler);
-            }
-            continue;
-        }
-#endif
-        if (packet.signal.observed & MX_CHANNEL_READABLE) {
-            if ((r = handler->cb(handler->h, handler->func, handler->cookie)) != 0) {
-                if (r == ERR_DISPATCHER_NO_WORK) {
-                    printf("mxio: dispatcher found no work to do!\n");
-                } else {
-                    disconnect_handler(md, handler, r < 0);
-                    continue;
-                }
-            }
-#if USE_WAIT_ONCE
-            if ((r = mx_object_wait_async(handler->h, md->ioport, (uint64_t)(uintptr_t)handler,
-                                          MX_CHANNEL_READABLE | MX_CHANNEL_PEER_CLOSED,
-                                          MX_WAIT_ASYNC_ONCE)) < 0) {
-                printf("dispatcher: could not re-arm: %p\n", handler);
-            }
-#endif
-            continue;
-        }
-        if (packet.signal.observed & MX_CHANNEL_PEER_CLOSED) {
-            // synthesize a close
-            disconnect_handler(md, handler, true);
+        for (uint32_t i = 0; i < count; i++) {
+            mxio_dispatcher_packet(md, &packets[i]);
         }
     }
 
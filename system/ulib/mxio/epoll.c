@@ -11,77 +11,145 @@
 
 #include <magenta/listnode.h>
 #include <magenta/syscalls.h>
+#include <magenta/syscalls/port.h>
 #include <mxio/io.h>
 #include <mxio/util.h>
 
 #include "private.h"
 #include "unistd.h"
 
-// TODO: should use a system default
-#define MAX_WAIT_EVENTS 1024
-
+// Registrations are hashed by fd into a table of buckets, which doubles
+// whenever it holds more registrations than buckets.
+#define MIN_BUCKETS 16
+
+// The most packets taken from the port per mx_port_wait_many() call.
+#define PACKET_BATCH 16
+
+// Each registration has a wait on the epoll port, keyed by its fd and a
+// generation, so packets still queued for an fd that has since been
+// modified or removed can be told apart and dropped.
+//
+// Level triggered registrations use one shot waits, which epoll_wait()
+// re-arms for the fds it reported the next time it's called, at which
+// point the kernel queues a packet straight away if the fd is still
+// ready. Edge triggered registrations use a repeating wait, which is
+// never re-armed, and EPOLLONESHOT ones a single one shot wait.
 typedef struct mxio_epoll_cookie {
     list_node_t node;
+    // on |rearm| of the epoll, if reported by the last epoll_wait()
+    list_node_t rearm_node;
     mxio_t* io;
     struct epoll_event ep_event;
     int fd;
+    uint32_t gen;
+    mx_handle_t h;
+    mx_signals_t signals;
 } mxio_epoll_cookie_t;
 
 typedef struct mxio_epoll {
     mxio_t io;
     mx_handle_t h;
-    mtx_t cookies_lock;
-    list_node_t cookies;
+    mtx_t lock;
+    list_node_t* buckets;
+    size_t num_buckets;
+    size_t num_cookies;
+    list_node_t rearm;
+    uint32_t next_gen;
 } mxio_epoll_t;
 
-static void mxio_epoll_cookie_add(mxio_epoll_t* epio,
-                                  mxio_epoll_cookie_t* cookie) {
-    mtx_lock(&epio->cookies_lock);
-    list_add_head(&epio->cookies, &cookie->node);
-    mtx_unlock(&epio->cookies_lock);
+static uint64_t mxio_epoll_cookie_key(mxio_epoll_cookie_t* cookie) {
+    return ((uint64_t)cookie->gen << 32) | (uint32_t)cookie->fd;
+}
+
+static list_node_t* mxio_epoll_bucket(mxio_epoll_t* epio, int fd) {
+    return &epio->buckets[(uint32_t)fd & (epio->num_buckets - 1)];
 }
 
-static mxio_epoll_cookie_t* mxio_epoll_cookie_get(mxio_epoll_t* epio, int fd,
-                                                  bool remove) {
-    mxio_epoll_cookie_t* cookie = NULL;
-    mxio_epoll_cookie_t* entry = NULL;
-    mtx_lock(&epio->cookies_lock);
-    list_for_every_entry(&epio->cookies, entry, mxio_epoll_cookie_t, node) {
-        // doesn't have to be _safe as we break immediately after deletion
+static mxio_epoll_cookie_t* mxio_epoll_cookie_find_locked(mxio_epoll_t* epio, int fd) {
+    mxio_epoll_cookie_t* entry;
+    list_for_every_entry(mxio_epoll_bucket(epio, fd), entry, mxio_epoll_cookie_t, node) {
         if (entry->fd == fd) {
-            if (remove) {
-                list_delete(&entry->node);
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+static mx_status_t mxio_epoll_cookie_add_locked(mxio_epoll_t* epio,
+                                                mxio_epoll_cookie_t* cookie) {
+    if (epio->num_cookies >= epio->num_buckets) {
+        size_t num_buckets = epio->num_buckets * 2;
+        list_node_t* buckets = malloc(num_buckets * sizeof(list_node_t));
+        if (buckets == NULL) {
+            return ERR_NO_MEMORY;
+        }
+        for (size_t i = 0; i < num_buckets; i++) {
+            list_initialize(&buckets[i]);
+        }
+        for (size_t i = 0; i < epio->num_buckets; i++) {
+            mxio_epoll_cookie_t* entry;
+            while ((entry = list_remove_head_type(&epio->buckets[i],
+                                                  mxio_epoll_cookie_t, node))) {
+                list_add_head(&buckets[(uint32_t)entry->fd & (num_buckets - 1)],
+                              &entry->node);
             }
-            cookie = entry;
-            break;
         }
+        free(epio->buckets);
+        epio->buckets = buckets;
+        epio->num_buckets = num_buckets;
+    }
+    list_add_head(mxio_epoll_bucket(epio, cookie->fd), &cookie->node);
+    epio->num_cookies++;
+    return NO_ERROR;
+}
+
+static void mxio_epoll_cookie_remove_locked(mxio_epoll_t* epio,
+                                            mxio_epoll_cookie_t* cookie) {
+    list_delete(&cookie->node);
+    if (list_in_list(&cookie->rearm_node)) {
+        list_delete(&cookie->rearm_node);
     }
-    mtx_unlock(&epio->cookies_lock);
-    return cookie;
+    epio->num_cookies--;
 }
 
-static mxio_epoll_cookie_t* mxio_epoll_cookie_find(mxio_epoll_t* epio, int fd) {
-    return mxio_epoll_cookie_get(epio, fd, false);
+// Starts the wait on the port for the registration's current generation.
+static mx_status_t mxio_epoll_arm(mxio_epoll_t* epio, mxio_epoll_cookie_t* cookie) {
+    uint32_t options = MX_WAIT_ASYNC_ONCE;
+    if ((cookie->ep_event.events & (EPOLLET | EPOLLONESHOT)) == EPOLLET) {
+        options = MX_WAIT_ASYNC_REPEATING;
+    }
+    return mx_object_wait_async(cookie->h, epio->h, mxio_epoll_cookie_key(cookie),
+                                cookie->signals, options);
 }
 
-static mxio_epoll_cookie_t* mxio_epoll_cookie_remove(mxio_epoll_t* epio, int fd) {
-    return mxio_epoll_cookie_get(epio, fd, true);
+// Stops the registration's wait. Any packets it already queued are
+// dropped once the generation changes.
+static void mxio_epoll_disarm(mxio_epoll_t* epio, mxio_epoll_cookie_t* cookie) {
+    mx_port_cancel(epio->h, cookie->h, mxio_epoll_cookie_key(cookie));
 }
 
 static mx_status_t mxio_epoll_close(mxio_t* io) {
     mxio_epoll_t* epio = (mxio_epoll_t*)io;
     mx_handle_t h = epio->h;
     epio->h = MX_HANDLE_INVALID;
+    // waits on a port with no handles are dropped the next time they fire
     mx_handle_close(h);
 
-    mxio_epoll_cookie_t* cookie;
-    mtx_lock(&epio->cookies_lock);
-    while ((cookie = list_remove_head_type(&epio->cookies, mxio_epoll_cookie_t,
-                                           node))) {
-        mxio_release(cookie->io);
-        free(cookie);
+    mtx_lock(&epio->lock);
+    for (size_t i = 0; i < epio->num_buckets; i++) {
+        mxio_epoll_cookie_t* cookie;
+        while ((cookie = list_remove_head_type(&epio->buckets[i],
+                                               mxio_epoll_cookie_t, node))) {
+            mxio_release(cookie->io);
+            free(cookie);
+        }
     }
-    mtx_unlock(&epio->cookies_lock);
+    free(epio->buckets);
+    epio->buckets = NULL;
+    epio->num_buckets = 0;
+    epio->num_cookies = 0;
+    list_initialize(&epio->rearm);
+    mtx_unlock(&epio->lock);
     return NO_ERROR;
 }
 
@@ -108,20 +176,30 @@ static mxio_t* mxio_epoll_create(mx_handle_t h) {
         mx_handle_close(h);
         return NULL;
     }
+    epio->buckets = malloc(MIN_BUCKETS * sizeof(list_node_t));
+    if (epio->buckets == NULL) {
+        free(epio);
+        mx_handle_close(h);
+        return NULL;
+    }
+    for (size_t i = 0; i < MIN_BUCKETS; i++) {
+        list_initialize(&epio->buckets[i]);
+    }
+    epio->num_buckets = MIN_BUCKETS;
     epio->io.ops = &mxio_epoll_ops;
     epio->io.magic = MXIO_MAGIC;
     atomic_init(&epio->io.refcount, 1);
     epio->io.flags |= MXIO_FLAG_EPOLL;
     epio->h = h;
-    mtx_init(&epio->cookies_lock, mtx_plain);
-    list_initialize(&epio->cookies);
+    mtx_init(&epio->lock, mtx_plain);
+    list_initialize(&epio->rearm);
     return &epio->io;
 }
 
 mx_status_t mxio_epoll(mxio_t** out) {
     mx_handle_t h;
     mx_status_t status;
-    if ((status = mx_waitset_create(0, &h)) < 0) {
+    if ((status = mx_port_create(MX_PORT_OPT_V2, &h)) < 0) {
         return status;
     }
     mxio_t* io;
@@ -176,64 +254,83 @@ int epoll_ctl(int epfd, int op, int fd, struct epoll_event* ep_event) {
         goto fail_no_io;
     }
 
+    mx_handle_t h = MX_HANDLE_INVALID;
+    mx_signals_t signals = 0;
+    if (op != EPOLL_CTL_DEL) {
+        io->ops->wait_begin(io, ep_event->events, &h, &signals);
+        if (h == MX_HANDLE_INVALID) {
+            // wait operation is not applicable to the handle
+            r = ERR_INVALID_ARGS;
+            goto end;
+        }
+    }
+
     mxio_epoll_cookie_t* cookie;
+    mtx_lock(&epio->lock);
     switch (op) {
     case EPOLL_CTL_ADD:
-        if (mxio_epoll_cookie_find(epio, fd) != NULL)  {
+        if (mxio_epoll_cookie_find_locked(epio, fd) != NULL)  {
             r = ERR_ALREADY_EXISTS;
-            goto end;
+            break;
         }
         // create a new cookie
         cookie = calloc(1, sizeof(mxio_epoll_cookie_t));
         if (cookie == NULL) {
             r = ERR_NO_MEMORY;
-            goto end;
+            break;
         }
-        mxio_acquire(io);
         cookie->io = io;
         cookie->fd = fd;
+        cookie->ep_event = *ep_event;
+        cookie->gen = epio->next_gen++;
+        cookie->h = h;
+        cookie->signals = signals;
+        if ((r = mxio_epoll_cookie_add_locked(epio, cookie)) < 0) {
+            free(cookie);
+            break;
+        }
+        if ((r = mxio_epoll_arm(epio, cookie)) < 0) {
+            mxio_epoll_cookie_remove_locked(epio, cookie);
+            free(cookie);
+            break;
+        }
+        mxio_acquire(io);
         break;
     case EPOLL_CTL_MOD:
-    case EPOLL_CTL_DEL:
-        // or retrieve an existing cookie and remove the current epoll event
-        cookie = mxio_epoll_cookie_remove(epio, fd);
-        if (cookie == NULL) {
+        if ((cookie = mxio_epoll_cookie_find_locked(epio, fd)) == NULL) {
             r = ERR_NOT_FOUND;
-            goto end;
-        }
-        if ((r = mx_waitset_remove(epio->h, (uint64_t)(uintptr_t)cookie)) < 0) {
-            mxio_epoll_cookie_add(epio, cookie);
-            goto end;
+            break;
         }
-        break;
-    default:
-        r = ERR_INVALID_ARGS;
-        goto end;
-    }
-
-    if (op == EPOLL_CTL_DEL) {
-        // free the cookie
-        mxio_release(cookie->io);
-        free(cookie);
-    } else {
-        // or add a new epoll event and put the cookie into the list
-        mx_handle_t h = MX_HANDLE_INVALID;
-        mx_signals_t signals = 0;
-        io->ops->wait_begin(io, ep_event->events, &h, &signals);
-        if (h == MX_HANDLE_INVALID) {
-            // wait operation is not applicable to the handle
-            r = ERR_INVALID_ARGS;
-            goto end;
+        // replace the wait with one for the new events
+        mxio_epoll_disarm(epio, cookie);
+        if (list_in_list(&cookie->rearm_node)) {
+            list_delete(&cookie->rearm_node);
         }
-
         cookie->ep_event = *ep_event;
-        if ((r = mx_waitset_add(epio->h, (uint64_t)(uintptr_t)cookie, h, signals)) < 0) {
+        cookie->gen = epio->next_gen++;
+        cookie->h = h;
+        cookie->signals = signals;
+        if ((r = mxio_epoll_arm(epio, cookie)) < 0) {
+            mxio_epoll_cookie_remove_locked(epio, cookie);
             mxio_release(cookie->io);
             free(cookie);
-            goto end;
         }
-        mxio_epoll_cookie_add(epio, cookie);
+        break;
+    case EPOLL_CTL_DEL:
+        if ((cookie = mxio_epoll_cookie_find_locked(epio, fd)) == NULL) {
+            r = ERR_NOT_FOUND;
+            break;
+        }
+        mxio_epoll_disarm(epio, cookie);
+        mxio_epoll_cookie_remove_locked(epio, cookie);
+        mxio_release(cookie->io);
+        free(cookie);
+        break;
+    default:
+        r = ERR_INVALID_ARGS;
+        break;
     }
+    mtx_unlock(&epio->lock);
 
  end:
     mxio_release(io);
@@ -250,9 +347,6 @@ int epoll_wait(int epfd, struct epoll_event* ep_events, int maxevents, int timeo
     if (ep_events == NULL) {
         return ERRNO(EFAULT);
     }
-    if (maxevents > MAX_WAIT_EVENTS) {
-        return ERRNO(EINVAL);
-    }
     mxio_t* io;
     if ((io = fd_to_io(epfd)) == NULL) {
         return ERROR(ERR_BAD_HANDLE);
@@ -263,29 +357,62 @@ int epoll_wait(int epfd, struct epoll_event* ep_events, int maxevents, int timeo
     }
     mxio_epoll_t* epio = (mxio_epoll_t*)io;
 
+    // Level triggered fds reported last time are reported again if they
+    // are still ready.
+    mxio_epoll_cookie_t* cookie;
+    mtx_lock(&epio->lock);
+    while ((cookie = list_remove_head_type(&epio->rearm, mxio_epoll_cookie_t, rearm_node))) {
+        mxio_epoll_arm(epio, cookie);
+    }
+    mtx_unlock(&epio->lock);
+
     mx_status_t r;
-    uint32_t num_results = maxevents;
-    mx_waitset_result_t results[maxevents];
     mx_time_t tmo = (timeout >= 0) ? mx_deadline_after(MX_MSEC(timeout)) : MX_TIME_INFINITE;
+    int n = 0;
+    while (n < maxevents) {
+        mx_port_packet_t packets[PACKET_BATCH];
+        uint32_t wanted = (maxevents - n < PACKET_BATCH) ? (uint32_t)(maxevents - n) : PACKET_BATCH;
+        uint32_t count = wanted;
+        // once there are events to return, only take packets already queued
+        if ((r = mx_port_wait_many(epio->h, n ? 0u : tmo, 0u, packets, &count)) < 0) {
+            if (r == ERR_TIMED_OUT) {
+                break;
+            }
+            mxio_release(io);
+            return ERROR(r);
+        }
 
-    if ((r = mx_waitset_wait(epio->h, tmo, results, &num_results)) < 0) {
-        mxio_release(io);
-        return (r == ERR_TIMED_OUT) ? 0 : ERROR(r);
-    }
-
-    for (uint32_t i = 0; i < num_results; i++) {
-        mxio_epoll_cookie_t* cookie = (mxio_epoll_cookie_t*)(uintptr_t)results[i].cookie;
-        mxio_t* io = cookie->io;
-        uint32_t events;
+        mtx_lock(&epio->lock);
+        for (uint32_t i = 0; i < count; i++) {
+            cookie = mxio_epoll_cookie_find_locked(epio, (int)(uint32_t)packets[i].key);
+            if (cookie == NULL || mxio_epoll_cookie_key(cookie) != packets[i].key) {
+                // the fd was modified or removed since the packet was queued
+                continue;
+            }
+            if (!(cookie->ep_event.events & (EPOLLET | EPOLLONESHOT)) &&
+                !list_in_list(&cookie->rearm_node)) {
+                list_add_tail(&epio->rearm, &cookie->rearm_node);
+            }
 
-        io->ops->wait_end(io, results[i].observed, &events);
-        // mask unrequested events except HUP/ERR
-        ep_events[i].events = events & (cookie->ep_event.events | EPOLLHUP | EPOLLERR);
+            uint32_t events;
+            cookie->io->ops->wait_end(cookie->io, packets[i].signal.observed, &events);
+            // mask unrequested events except HUP/ERR
+            events &= cookie->ep_event.events | EPOLLHUP | EPOLLERR;
+            if (events == 0) {
+                continue;
+            }
+            ep_events[n].events = events;
+            ep_events[n].data = cookie->ep_event.data;
+            n++;
+        }
+        mtx_unlock(&epio->lock);
 
-        ep_events[i].data = cookie->ep_event.data;
+        if (n > 0 && count < wanted) {
+            break;
+        }
     }
     mxio_release(io);
-    return (int)num_results;
+    return n;
 }
 
 int epoll_pwait(int epfd, struct epoll_event* events, int maxevents, int timeout, const sigset_t* sigmask) {
@@ -619,6 +619,90 @@ static bool CreateUmountRemountSmall(void) {
     END_TEST;
 }
 
+// Reads scattered parts of a blob which was just loaded from disk, so that
+// its Merkle tree is verified piecemeal, before reading the whole thing.
+static bool ReadRangesAfterRemount(void) {
+    BEGIN_TEST;
+    char ramdisk_path[PATH_MAX];
+    ASSERT_EQ(StartBlobstoreTest(512, 1 << 20, ramdisk_path), 0, "Mounting Blobstore");
+
+    mxtl::unique_ptr<blob_info_t> info;
+    ASSERT_TRUE(GenerateBlob((1 << 22) + 100, &info), "");
+    int fd;
+    ASSERT_TRUE(MakeBlob(info->path, info->merkle.get(), info->size_merkle,
+                         info->data.get(), info->size_data, &fd), "");
+    ASSERT_EQ(close(fd), 0, "");
+    ASSERT_EQ(umount(MOUNT_PATH), NO_ERROR, "Could not unmount blobstore");
+    ASSERT_EQ(MountBlobstore(ramdisk_path), 0, "Could not re-mount blobstore");
+
+    fd = open(info->path, O_RDWR);
+    ASSERT_GT(fd, 0, "Failed to open blob");
+    char buf[1024];
+    const size_t offsets[] = {
+        info->size_data - 50, 8192 * 300 - 512, 0, 8192 * 300 + 17, 8192 * 511,
+    };
+    for (size_t off : offsets) {
+        size_t len = mxtl::min(sizeof(buf), info->size_data - off);
+        ASSERT_EQ(lseek(fd, off, SEEK_SET), static_cast<off_t>(off), "");
+        ASSERT_EQ(read(fd, buf, sizeof(buf)), static_cast<ssize_t>(len), "");
+        ASSERT_EQ(memcmp(buf, &info->data[off], len), 0, "Read data, but it was bad");
+    }
+    ASSERT_EQ(read(fd, buf, sizeof(buf)), 0, "Expected end of blob");
+    ASSERT_TRUE(VerifyContents(fd, info->data.get(), info->size_data), "");
+    ASSERT_EQ(close(fd), 0, "Could not close blob");
+    ASSERT_EQ(unlink(info->path), 0, "");
+
+    ASSERT_EQ(EndBlobstoreTest(ramdisk_path), 0, "unmounting blobstore");
+    END_TEST;
+}
+
+// Reopens a closed blob, first from the blob cache and then (once the cache
+// has been emptied) from disk.
+static bool BlobCache(void) {
+    BEGIN_TEST;
+    char ramdisk_path[PATH_MAX];
+    ASSERT_EQ(StartBlobstoreTest(512, 1 << 20, ramdisk_path), 0, "Mounting Blobstore");
+    int dirfd = open(MOUNT_PATH "/.", O_RDONLY);
+    ASSERT_GT(dirfd, 0, "Cannot open root directory");
+
+    mxtl::unique_ptr<blob_info_t> info;
+    ASSERT_TRUE(GenerateBlob(1 << 16, &info), "");
+    int fd;
+    ASSERT_TRUE(MakeBlob(info->path, info->merkle.get(), info->size_merkle,
+                         info->data.get(), info->size_data, &fd), "");
+    ASSERT_EQ(close(fd), 0, "");
+
+    blob_cache_info_t before, after;
+    ASSERT_EQ(ioctl_blobstore_get_cache_info(dirfd, &before), sizeof(before), "");
+    ASSERT_GE(before.size, info->size_data, "Closed blob should be cached");
+    fd = open(info->path, O_RDONLY);
+    ASSERT_GT(fd, 0, "Failed to open blob");
+    ASSERT_TRUE(VerifyContents(fd, info->data.get(), info->size_data), "");
+    ASSERT_EQ(close(fd), 0, "");
+    ASSERT_EQ(ioctl_blobstore_get_cache_info(dirfd, &after), sizeof(after), "");
+    ASSERT_GT(after.hits, before.hits, "Blob should have been reopened from memory");
+    ASSERT_EQ(after.misses, before.misses, "");
+
+    // With no room for closed blobs, the next open must go to disk
+    uint64_t limit = 0;
+    ASSERT_EQ(ioctl_blobstore_set_cache_limit(dirfd, &limit), 0, "");
+    ASSERT_EQ(ioctl_blobstore_get_cache_info(dirfd, &before), sizeof(before), "");
+    ASSERT_EQ(before.size, 0, "");
+    ASSERT_GT(before.evictions, after.evictions, "");
+    fd = open(info->path, O_RDONLY);
+    ASSERT_GT(fd, 0, "Failed to open blob");
+    ASSERT_TRUE(VerifyContents(fd, info->data.get(), info->size_data), "");
+    ASSERT_EQ(close(fd), 0, "");
+    ASSERT_EQ(ioctl_blobstore_get_cache_info(dirfd, &after), sizeof(after), "");
+    ASSERT_GT(after.misses, before.misses, "Blob should have been reopened from disk");
+    ASSERT_EQ(after.size, 0, "");
+
+    ASSERT_EQ(unlink(info->path), 0, "");
+    ASSERT_EQ(close(dirfd), 0, "");
+    ASSERT_EQ(EndBlobstoreTest(ramdisk_path), 0, "unmounting blobstore");
+    END_TEST;
+}
+
 enum TestState {
     empty,
     configured,
@@ -1228,6 +1312,8 @@ RUN_TEST_MEDIUM(CorruptedBlob)
 RUN_TEST_MEDIUM(CorruptedDigest)
 RUN_TEST_MEDIUM(EdgeAllocation)
 RUN_TEST_MEDIUM(CreateUmountRemountSmall)
+RUN_TEST_MEDIUM(ReadRangesAfterRemount)
+RUN_TEST_MEDIUM(BlobCache)
 RUN_TEST_MEDIUM(EarlyRead)
 RUN_TEST_MEDIUM(WaitForRead)
 RUN_TEST_MEDIUM(WriteSeekIgnored)
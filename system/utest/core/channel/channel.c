@@ -443,6 +443,94 @@ static bool channel_may_discard(void) {
     END_TEST;
 }
 
+static bool channel_read_write_many(void) {
+    BEGIN_TEST;
+
+    mx_handle_t channel[2];
+    ASSERT_EQ(mx_channel_create(0, &channel[0], &channel[1]), NO_ERROR, "");
+
+    mx_handle_t event;
+    ASSERT_EQ(mx_event_create(0u, &event), 0, "failed to create event");
+
+    // Write three messages of different sizes, the last one carrying a handle.
+    uint32_t out[3][4] = {{1u}, {2u, 2u}, {3u, 3u, 3u}};
+    mx_handle_t dup;
+    ASSERT_EQ(mx_handle_duplicate(event, MX_RIGHT_SAME_RIGHTS, &dup), NO_ERROR, "");
+    mx_channel_msg_t msgs[4] = {
+        {out[0], NULL, 4u, 0u, 0u, 0u, 0, 0u},
+        {out[1], NULL, 8u, 0u, 0u, 0u, 0, 0u},
+        {out[2], &dup, 12u, 1u, 0u, 0u, 0, 0u},
+    };
+    uint32_t actual = 0u;
+    EXPECT_EQ(mx_channel_write_many(channel[0], 0u, msgs, 3u, &actual), NO_ERROR, "");
+    EXPECT_EQ(actual, 3u, "wrong number of messages written");
+    for (uint32_t i = 0; i < 3u; i++)
+        EXPECT_EQ(msgs[i].status, NO_ERROR, "");
+
+    // A bad handle in the second message stops the batch there.
+    mx_handle_t bad = MX_HANDLE_INVALID;
+    msgs[0] = (mx_channel_msg_t){out[0], NULL, 4u, 0u, 0u, 0u, 0, 0u};
+    msgs[1] = (mx_channel_msg_t){out[1], &bad, 8u, 1u, 0u, 0u, 0, 0u};
+    EXPECT_EQ(mx_channel_write_many(channel[0], 0u, msgs, 2u, &actual), NO_ERROR, "");
+    EXPECT_EQ(actual, 1u, "wrong number of messages written");
+    EXPECT_EQ(msgs[0].status, NO_ERROR, "");
+    EXPECT_EQ(msgs[1].status, ERR_BAD_HANDLE, "");
+
+    // A bad handle in the first message sends nothing, and still reports why.
+    msgs[0] = (mx_channel_msg_t){out[0], &bad, 4u, 1u, 0u, 0u, NO_ERROR, 0u};
+    actual = 99u;
+    EXPECT_EQ(mx_channel_write_many(channel[0], 0u, msgs, 2u, &actual), ERR_BAD_HANDLE, "");
+    EXPECT_EQ(actual, 0u, "wrong number of messages written");
+    EXPECT_EQ(msgs[0].status, ERR_BAD_HANDLE, "");
+
+    // Read them back; the third one doesn't fit and stays queued.
+    uint32_t in[4][4];
+    mx_handle_t handles[4];
+    for (uint32_t i = 0; i < 4u; i++)
+        msgs[i] = (mx_channel_msg_t){in[i], &handles[i], 16u, 1u, 0u, 0u, 0, 0u};
+    msgs[2].num_handles = 0u;
+    EXPECT_EQ(mx_channel_read_many(channel[1], 0u, msgs, 4u, &actual), NO_ERROR, "");
+    EXPECT_EQ(actual, 2u, "wrong number of messages read");
+    EXPECT_EQ(msgs[0].status, NO_ERROR, "");
+    EXPECT_EQ(msgs[0].actual_bytes, 4u, "");
+    EXPECT_EQ(in[0][0], 1u, "");
+    EXPECT_EQ(msgs[1].status, NO_ERROR, "");
+    EXPECT_EQ(msgs[1].actual_bytes, 8u, "");
+    EXPECT_EQ(in[1][1], 2u, "");
+    EXPECT_EQ(msgs[2].status, ERR_BUFFER_TOO_SMALL, "");
+    EXPECT_EQ(msgs[2].actual_bytes, 12u, "");
+    EXPECT_EQ(msgs[2].actual_handles, 1u, "");
+
+    msgs[0] = (mx_channel_msg_t){in[0], handles, 16u, 1u, 0u, 0u, 0, 0u};
+    msgs[1] = (mx_channel_msg_t){in[1], NULL, 16u, 0u, 0u, 0u, 0, 0u};
+    EXPECT_EQ(mx_channel_read_many(channel[1], 0u, msgs, 2u, &actual), NO_ERROR, "");
+    EXPECT_EQ(actual, 2u, "wrong number of messages read");
+    EXPECT_EQ(msgs[0].actual_bytes, 12u, "");
+    EXPECT_EQ(msgs[0].actual_handles, 1u, "");
+    EXPECT_EQ(in[0][2], 3u, "");
+    EXPECT_EQ(msgs[1].actual_bytes, 4u, "");
+    EXPECT_EQ(mx_handle_close(handles[0]), NO_ERROR, "");
+
+    EXPECT_EQ(mx_channel_read_many(channel[1], 0u, msgs, 2u, &actual), ERR_SHOULD_WAIT, "");
+    EXPECT_EQ(mx_channel_read_many(channel[1], 0u, msgs, MX_CHANNEL_MAX_MSGS + 1u, &actual),
+              ERR_OUT_OF_RANGE, "");
+
+    // With the peer gone nothing is written, and every message built says so.
+    EXPECT_EQ(mx_handle_close(channel[1]), NO_ERROR, "");
+    msgs[0] = (mx_channel_msg_t){out[0], NULL, 4u, 0u, 0u, 0u, NO_ERROR, 0u};
+    msgs[1] = (mx_channel_msg_t){out[1], NULL, 8u, 0u, 0u, 0u, NO_ERROR, 0u};
+    actual = 99u;
+    EXPECT_EQ(mx_channel_write_many(channel[0], 0u, msgs, 2u, &actual), ERR_PEER_CLOSED, "");
+    EXPECT_EQ(actual, 0u, "wrong number of messages written");
+    EXPECT_EQ(msgs[0].status, ERR_PEER_CLOSED, "");
+    EXPECT_EQ(msgs[1].status, ERR_PEER_CLOSED, "");
+
+    EXPECT_EQ(mx_handle_close(event), NO_ERROR, "");
+    EXPECT_EQ(mx_handle_close(channel[0]), NO_ERROR, "");
+
+    END_TEST;
+}
+
 
 static uint32_t call_test_done = 0;
 static mtx_t call_test_lock;
@@ -781,6 +869,7 @@ RUN_TEST(channel_non_transferable)
 RUN_TEST(channel_duplicate_handles)
 RUN_TEST(channel_multithread_read)
 RUN_TEST(channel_may_discard)
+RUN_TEST(channel_read_write_many)
 RUN_TEST(channel_call)
 RUN_TEST(channel_call2)
 RUN_TEST(channel_nest)
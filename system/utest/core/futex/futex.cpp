@@ -4,6 +4,7 @@
 
 #include <inttypes.h>
 #include <limits.h>
+#include <magenta/process.h>
 #include <magenta/syscalls.h>
 #include <magenta/threads.h>
 #include <unittest/unittest.h>
@@ -394,6 +395,69 @@ bool test_futex_thread_killed() {
     END_TEST;
 }
 
+// Test that futex_wake_op() applies its operation, and wakes the waiters on
+// the second futex only when the comparison passes.
+static bool test_futex_wake_op() {
+    BEGIN_TEST;
+    int wake_value = 0;
+    volatile int op_value = 5;
+    ASSERT_EQ(mx_futex_wake_op(&wake_value, 1, const_cast<int*>(&op_value), 1,
+                               MX_FUTEX_OP(MX_FUTEX_OP_ADD, 3, MX_FUTEX_OP_CMP_EQ, 5)),
+              NO_ERROR, "");
+    EXPECT_EQ(op_value, 8, "");
+    op_value = 0xff;
+    ASSERT_EQ(mx_futex_wake_op(&wake_value, 1, const_cast<int*>(&op_value), 1,
+                               MX_FUTEX_OP(MX_FUTEX_OP_ANDN, 0xf, MX_FUTEX_OP_CMP_EQ, 0)),
+              NO_ERROR, "");
+    EXPECT_EQ(op_value, 0xf0, "");
+    EXPECT_EQ(mx_futex_wake_op(&wake_value, 1, const_cast<int*>(&op_value), 1,
+                               MX_FUTEX_OP(7, 0, MX_FUTEX_OP_CMP_EQ, 0)),
+              ERR_INVALID_ARGS, "");
+
+    op_value = 1;
+    TestThread thread(&op_value);
+    // The comparison fails, so this mustn't wake the thread.
+    ASSERT_EQ(mx_futex_wake_op(&wake_value, 1, const_cast<int*>(&op_value), 1,
+                               MX_FUTEX_OP(MX_FUTEX_OP_SET, 1, MX_FUTEX_OP_CMP_NE, 1)),
+              NO_ERROR, "");
+    struct timespec wait_time = {0, 10 * 1000000 /* nanoseconds */};
+    ASSERT_EQ(nanosleep(&wait_time, NULL), 0, "Error during sleep");
+    thread.assert_thread_not_woken();
+    ASSERT_EQ(mx_futex_wake_op(&wake_value, 1, const_cast<int*>(&op_value), 1,
+                               MX_FUTEX_OP(MX_FUTEX_OP_SET, 2, MX_FUTEX_OP_CMP_EQ, 1)),
+              NO_ERROR, "");
+    thread.assert_thread_woken();
+    END_TEST;
+}
+
+// Test that futex_lock_pi() claims a free futex, waits for an owned one,
+// and that futex_unlock_pi() frees it.
+static bool test_futex_pi() {
+    BEGIN_TEST;
+    mx_handle_t self = thrd_get_mx_handle(thrd_current());
+    int futex_value = 0;
+    ASSERT_EQ(mx_futex_lock_pi(&futex_value, self, MX_TIME_INFINITE), NO_ERROR, "");
+    EXPECT_EQ(futex_value, static_cast<int>(self), "");
+    ASSERT_EQ(mx_futex_unlock_pi(&futex_value), NO_ERROR, "");
+    EXPECT_EQ(futex_value, 0, "");
+
+    EXPECT_EQ(mx_futex_lock_pi(&futex_value, 0, MX_TIME_INFINITE), ERR_INVALID_ARGS, "");
+    EXPECT_EQ(mx_futex_lock_pi(&futex_value, MX_FUTEX_PI_WAITERS, MX_TIME_INFINITE),
+              ERR_INVALID_ARGS, "");
+
+    // Owned by a thread that never runs, so this can only time out, and
+    // then it must not leave the waiters bit behind.
+    static const char kName[] = "pi-owner";
+    mx_handle_t owner;
+    ASSERT_EQ(mx_thread_create(mx_process_self(), kName, sizeof(kName), 0, &owner), NO_ERROR, "");
+    futex_value = owner;
+    EXPECT_EQ(mx_futex_lock_pi(&futex_value, self, mx_deadline_after(MX_MSEC(10))),
+              ERR_TIMED_OUT, "");
+    EXPECT_EQ(futex_value, static_cast<int>(owner), "");
+    EXPECT_EQ(mx_handle_close(owner), NO_ERROR, "");
+    END_TEST;
+}
+
 // Test that misaligned pointers cause futex syscalls to return a failure.
 static bool test_futex_misaligned() {
   BEGIN_TEST;
@@ -513,6 +577,8 @@ RUN_TEST(test_futex_requeue_same_addr);
 RUN_TEST(test_futex_requeue);
 RUN_TEST(test_futex_requeue_unqueued_on_timeout);
 RUN_TEST(test_futex_thread_killed);
+RUN_TEST(test_futex_wake_op);
+RUN_TEST(test_futex_pi);
 RUN_TEST(test_futex_misaligned);
 RUN_TEST(test_event_signaling);
 END_TEST_CASE(futex_tests)
@@ -76,6 +76,56 @@ static bool queue_and_close_test(void) {
     END_TEST;
 }
 
+static bool wait_many_test(void) {
+    BEGIN_TEST;
+    mx_status_t status;
+
+    mx_handle_t port;
+    status = mx_port_create(MX_PORT_OPT_V2, &port);
+    EXPECT_EQ(status, NO_ERROR, "could not create port v2");
+
+    mx_port_packet_t out[4] = {};
+    uint32_t count = 4u;
+    status = mx_port_wait_many(port, mx_deadline_after(MX_USEC(1)), MX_USEC(10), out, &count);
+    EXPECT_EQ(status, ERR_TIMED_OUT, "");
+
+    count = 0u;
+    status = mx_port_wait_many(port, 0ull, 0u, out, &count);
+    EXPECT_EQ(status, ERR_INVALID_ARGS, "");
+
+    for (uint64_t key = 1u; key <= 6u; ++key) {
+        const mx_port_packet_t in = {
+            key,
+            MX_PKT_TYPE_USER,
+            0,
+            { {} }
+        };
+        status = mx_port_queue(port, &in, 0u);
+        EXPECT_EQ(status, NO_ERROR, "");
+    }
+
+    // The first call takes as many as fit, in FIFO order, and the second
+    // the rest.
+    count = 4u;
+    status = mx_port_wait_many(port, MX_TIME_INFINITE, 0u, out, &count);
+    EXPECT_EQ(status, NO_ERROR, "");
+    EXPECT_EQ(count, 4u, "");
+    for (uint32_t i = 0; i < 4u; ++i)
+        EXPECT_EQ(out[i].key, i + 1u, "");
+
+    count = 4u;
+    status = mx_port_wait_many(port, MX_TIME_INFINITE, 0u, out, &count);
+    EXPECT_EQ(status, NO_ERROR, "");
+    EXPECT_EQ(count, 2u, "");
+    EXPECT_EQ(out[0].key, 5u, "");
+    EXPECT_EQ(out[1].key, 6u, "");
+
+    status = mx_handle_close(port);
+    EXPECT_EQ(status, NO_ERROR, "");
+
+    END_TEST;
+}
+
 static bool async_wait_channel_test(void) {
     BEGIN_TEST;
     mx_status_t status;
@@ -478,6 +528,7 @@ static bool threads_event_repeat() {
 BEGIN_TEST_CASE(port_tests)
 RUN_TEST(basic_test)
 RUN_TEST(queue_and_close_test)
+RUN_TEST(wait_many_test)
 RUN_TEST(async_wait_channel_test)
 RUN_TEST(async_wait_event_test_single)
 RUN_TEST(async_wait_event_test_repeat)
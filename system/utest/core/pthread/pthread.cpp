@@ -320,12 +320,118 @@ static bool pthread_getstack_other_thread_explicit_size() {
     END_TEST;
 }
 
+static const size_t kMaxContendedThreads = 64;
+
+// Shared by the threads of the contended mutex tests.
+struct contended_state {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    int loops;
+    int counter;
+};
+
+static void* contended_thread(void* arg) {
+    contended_state* state = static_cast<contended_state*>(arg);
+    for (int i = 0; i < state->loops; i++) {
+        pthread_mutex_lock(&state->mutex);
+        state->counter++;
+        if (state->counter % 64 == 0)
+            pthread_cond_signal(&state->cond);
+        pthread_mutex_unlock(&state->mutex);
+    }
+    return NULL;
+}
+
+// Runs |num_threads| threads each taking a mutex with the given protocol
+// |loops| times, and returns the elapsed ticks, or 0 on failure.
+static uint64_t run_contended(int protocol, size_t num_threads, int loops) {
+    if (num_threads > kMaxContendedThreads)
+        return 0;
+    contended_state state = {};
+    state.loops = loops;
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    if (pthread_mutexattr_setprotocol(&attr, protocol) != 0)
+        return 0;
+    pthread_mutex_init(&state.mutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+    pthread_cond_init(&state.cond, NULL);
+
+    pthread_t threads[kMaxContendedThreads];
+    uint64_t start = mx_ticks_get();
+    for (size_t i = 0; i < num_threads; i++) {
+        if (pthread_create(&threads[i], NULL, contended_thread, &state) != 0)
+            return 0;
+    }
+    for (size_t i = 0; i < num_threads; i++)
+        pthread_join(threads[i], NULL);
+    uint64_t ticks = mx_ticks_get() - start;
+
+    pthread_cond_destroy(&state.cond);
+    pthread_mutex_destroy(&state.mutex);
+    if (state.counter != static_cast<int>(num_threads) * loops)
+        return 0;
+    return ticks ? ticks : 1;
+}
+
+bool pthread_mutex_prio_inherit_test(void) {
+    BEGIN_TEST;
+
+    pthread_mutexattr_t attr;
+    int protocol;
+    ASSERT_EQ(pthread_mutexattr_init(&attr), 0, "");
+    EXPECT_EQ(pthread_mutexattr_setprotocol(&attr, PTHREAD_PRIO_PROTECT), ENOTSUP, "");
+    ASSERT_EQ(pthread_mutexattr_setprotocol(&attr, PTHREAD_PRIO_INHERIT), 0, "");
+    ASSERT_EQ(pthread_mutexattr_getprotocol(&attr, &protocol), 0, "");
+    EXPECT_EQ(protocol, PTHREAD_PRIO_INHERIT, "");
+    ASSERT_EQ(pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_ERRORCHECK), 0, "");
+
+    pthread_mutex_t m;
+    ASSERT_EQ(pthread_mutex_init(&m, &attr), 0, "");
+    ASSERT_EQ(pthread_mutex_lock(&m), 0, "");
+    EXPECT_EQ(pthread_mutex_lock(&m), EDEADLK, "");
+    EXPECT_EQ(pthread_mutex_trylock(&m), EBUSY, "");
+    ASSERT_EQ(pthread_mutex_unlock(&m), 0, "");
+    EXPECT_EQ(pthread_mutex_unlock(&m), EPERM, "");
+    pthread_mutex_destroy(&m);
+    pthread_mutexattr_destroy(&attr);
+
+    EXPECT_NEQ(run_contended(PTHREAD_PRIO_INHERIT, 4, 1000), 0u, "lost an increment");
+
+    END_TEST;
+}
+
+// Compares contended locking of ordinary and priority inheriting mutexes,
+// with more threads than there are CPUs.
+bool pthread_mutex_contended_benchmark(void) {
+    BEGIN_TEST;
+
+    constexpr int kLoops = 20000;
+    size_t num_threads = mx_system_get_num_cpus() * 2;
+    if (num_threads > kMaxContendedThreads)
+        num_threads = kMaxContendedThreads;
+    printf("\n");
+    static const int kProtocols[] = {PTHREAD_PRIO_NONE, PTHREAD_PRIO_INHERIT};
+    for (int protocol : kProtocols) {
+        uint64_t ticks = run_contended(protocol, num_threads, kLoops);
+        ASSERT_NEQ(ticks, 0u, "contended run failed");
+        double secs = static_cast<double>(ticks) / static_cast<double>(mx_ticks_per_second());
+        double rate = static_cast<double>(num_threads * kLoops) / secs;
+        printf("Benchmark %s mutex (%zu threads): [%12.1f] locks/s\n",
+               protocol == PTHREAD_PRIO_NONE ? "normal" : "prio-inherit", num_threads, rate);
+    }
+
+    END_TEST;
+}
+
 BEGIN_TEST_CASE(pthread_tests)
 RUN_TEST(pthread_test)
 RUN_TEST(pthread_self_main_thread_test)
 RUN_TEST(pthread_big_stack_size)
 RUN_TEST(pthread_getstack_main_thread)
 RUN_TEST(pthread_getstack_other_thread)
+RUN_TEST(pthread_mutex_prio_inherit_test)
+RUN_TEST_PERFORMANCE(pthread_mutex_contended_benchmark)
 END_TEST_CASE(pthread_tests)
 
 #ifndef BUILD_COMBINED_TESTS
@@ -99,6 +99,48 @@ bool benchmark_write_read(void) {
     END_TEST;
 }
 
+// Reads a file back in DataSize chunks at random (chunk aligned) offsets, for
+// comparison with the sequential reads of benchmark_write_read.
+template <size_t DataSize, size_t NumOps>
+bool benchmark_random_read(void) {
+    BEGIN_TEST;
+    int fd = open(MOUNT_POINT "/bigfile", O_CREAT | O_RDWR, 0644);
+    ASSERT_GT(fd, 0, "Cannot create file (FS benchmarks assume mounted FS exists at '/benchmark')");
+    const size_t size_mb = (DataSize * NumOps) / MB;
+    printf("\nBenchmarking Random Read (%lu MB)\n", size_mb);
+
+    AllocChecker ac;
+    mxtl::unique_ptr<uint8_t[]> data(new (&ac) uint8_t[DataSize]);
+    ASSERT_EQ(ac.check(), true, "");
+    memset(data.get(), kMagicByte, DataSize);
+
+    size_t count = NumOps;
+    while (count--) {
+        ASSERT_EQ(write(fd, data.get(), DataSize), DataSize, "");
+    }
+
+    unsigned int seed = 0;
+    for (int i = 0; i < kWriteReadCycles; i++) {
+        char str[100];
+        snprintf(str, sizeof(str), "random read %d", i);
+
+        uint64_t start = mx_ticks_get();
+        count = NumOps;
+        while (count--) {
+            off_t off = static_cast<off_t>((rand_r(&seed) % NumOps) * DataSize);
+            ASSERT_EQ(lseek(fd, off, SEEK_SET), off, "");
+            ASSERT_EQ(read(fd, data.get(), DataSize), DataSize, "");
+            ASSERT_EQ(data[0], kMagicByte, "");
+        }
+        time_end(str, start);
+    }
+
+    ASSERT_EQ(close(fd), 0, "");
+    ASSERT_EQ(unlink(MOUNT_POINT "/bigfile"), 0, "");
+
+    END_TEST;
+}
+
 #define START_STRING "/aaa"
 
 size_t constexpr cStrlen(const char* str) {
@@ -189,14 +231,55 @@ bool benchmark_path_walk(void) {
     END_TEST;
 }
 
+// Creates, stats, and then unlinks NumFiles files in a single directory, to
+// see how lookup and create scale with the size of the directory.
+template <size_t NumFiles>
+bool benchmark_large_directory(void) {
+    BEGIN_TEST;
+    printf("\nBenchmarking Large directory (%lu files)\n", NumFiles);
+    ASSERT_EQ(mkdir(MOUNT_POINT "/dir", 0755), 0, "");
+    char path[PATH_MAX];
+    uint64_t start;
+
+    start = mx_ticks_get();
+    for (size_t i = 0; i < NumFiles; i++) {
+        snprintf(path, sizeof(path), MOUNT_POINT "/dir/%06lu", i);
+        int fd = open(path, O_CREAT | O_EXCL | O_RDWR, 0644);
+        ASSERT_GT(fd, 0, "Could not create file");
+        ASSERT_EQ(close(fd), 0, "");
+    }
+    time_end("create", start);
+
+    start = mx_ticks_get();
+    for (size_t i = 0; i < NumFiles; i++) {
+        snprintf(path, sizeof(path), MOUNT_POINT "/dir/%06lu", i);
+        ASSERT_TRUE(stat_callback(path), "");
+    }
+    time_end("stat", start);
+
+    start = mx_ticks_get();
+    for (size_t i = 0; i < NumFiles; i++) {
+        snprintf(path, sizeof(path), MOUNT_POINT "/dir/%06lu", i);
+        ASSERT_EQ(unlink(path), 0, "Could not unlink file");
+    }
+    time_end("unlink", start);
+
+    ASSERT_EQ(rmdir(MOUNT_POINT "/dir"), 0, "");
+    END_TEST;
+}
+
 BEGIN_TEST_CASE(basic_benchmarks)
 RUN_TEST_PERFORMANCE((benchmark_write_read<16 * KB, 1024>))
 RUN_TEST_PERFORMANCE((benchmark_write_read<16 * KB, 2048>))
 RUN_TEST_PERFORMANCE((benchmark_write_read<16 * KB, 4096>))
 RUN_TEST_PERFORMANCE((benchmark_write_read<16 * KB, 8192>))
 RUN_TEST_PERFORMANCE((benchmark_write_read<16 * KB, 16384>))
+RUN_TEST_PERFORMANCE((benchmark_random_read<8 * KB, 4096>))
+RUN_TEST_PERFORMANCE((benchmark_random_read<64 * KB, 1024>))
 RUN_TEST_PERFORMANCE((benchmark_path_walk<125>))
 RUN_TEST_PERFORMANCE((benchmark_path_walk<250>))
 RUN_TEST_PERFORMANCE((benchmark_path_walk<500>))
 RUN_TEST_PERFORMANCE((benchmark_path_walk<1000>))
+RUN_TEST_PERFORMANCE((benchmark_large_directory<10000>))
+RUN_TEST_PERFORMANCE((benchmark_large_directory<100000>))
 END_TEST_CASE(basic_benchmarks)
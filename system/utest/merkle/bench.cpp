@@ -0,0 +1,82 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <merkle/digest.h>
+#include <merkle/tree.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <magenta/new.h>
+#include <magenta/status.h>
+#include <magenta/syscalls.h>
+#include <mxtl/unique_ptr.h>
+#include <unittest/unittest.h>
+
+namespace {
+
+using merkle::Tree;
+using merkle::Digest;
+
+constexpr size_t MB = 1 << 20;
+constexpr int kCycles = 4;
+
+// Prints the throughput of |kCycles| passes over |bytes| which took from
+// |start| until now.
+void PrintRate(const char* what, size_t num_threads, size_t bytes, uint64_t start) {
+    uint64_t ticks = mx_ticks_get() - start;
+    double secs = static_cast<double>(ticks) / static_cast<double>(mx_ticks_per_second());
+    double rate = static_cast<double>(bytes * kCycles) / static_cast<double>(MB) / secs;
+    printf("Benchmark %s (%zu MB, %zu thread%s): [%10.1f] MB/s\n", what, bytes / MB,
+           num_threads, num_threads == 1 ? "" : "s", rate);
+}
+
+// Measures |Tree::Create| and a full |Tree::Verify| of |DataSize| bytes, both
+// on one thread and on as many threads as there are CPUs.
+template <size_t DataSize>
+bool benchmark_create_verify(void) {
+    BEGIN_TEST;
+    AllocChecker ac;
+    mxtl::unique_ptr<uint8_t[]> data(new (&ac) uint8_t[DataSize]);
+    ASSERT_TRUE(ac.check(), "");
+    for (size_t i = 0; i < DataSize; ++i) {
+        data[i] = static_cast<uint8_t>(rand());
+    }
+    size_t tree_len = Tree::GetTreeLength(DataSize);
+    mxtl::unique_ptr<uint8_t[]> tree(new (&ac) uint8_t[tree_len]);
+    ASSERT_TRUE(ac.check(), "");
+    printf("\n");
+
+    const size_t num_cpus = mx_system_get_num_cpus();
+    for (size_t num_threads = 1;; num_threads = num_cpus) {
+        Tree merkleTree;
+        Digest digest;
+        uint64_t start = mx_ticks_get();
+        for (int i = 0; i < kCycles; ++i) {
+            mx_status_t rc = merkleTree.Create(data.get(), DataSize, tree.get(), tree_len,
+                                               &digest, num_threads);
+            ASSERT_EQ(rc, NO_ERROR, mx_status_get_string(rc));
+        }
+        PrintRate("create", num_threads, DataSize, start);
+
+        start = mx_ticks_get();
+        for (int i = 0; i < kCycles; ++i) {
+            mx_status_t rc = merkleTree.Verify(data.get(), DataSize, tree.get(), tree_len, 0,
+                                               DataSize, digest, num_threads);
+            ASSERT_EQ(rc, NO_ERROR, mx_status_get_string(rc));
+        }
+        PrintRate("verify", num_threads, DataSize, start);
+        if (num_threads == num_cpus) {
+            break;
+        }
+    }
+    END_TEST;
+}
+
+} // namespace
+
+BEGIN_TEST_CASE(MerkleTreeBenchmarks)
+RUN_TEST_PERFORMANCE((benchmark_create_verify<4 * MB>))
+RUN_TEST_PERFORMANCE((benchmark_create_verify<64 * MB>))
+END_TEST_CASE(MerkleTreeBenchmarks)
@@ -316,6 +316,24 @@ bool Create(void) {
     END_TEST;
 }
 
+bool CreateThreaded(void) {
+    BEGIN_TEST;
+    const size_t lengths[] = {kLarge, kUnaligned};
+    const char* digests[] = {kLargeDigest, kUnalignedDigest};
+    for (size_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); ++i) {
+        InitData(lengths[i]);
+        Tree merkleTree;
+        mx_status_t rc =
+            merkleTree.Create(gData, gDataLen, gTree, gTreeLen, &gDigest, 4);
+        ASSERT_EQ(rc, NO_ERROR, mx_status_get_string(rc));
+        Digest expected;
+        rc = expected.Parse(digests[i], strlen(digests[i]));
+        ASSERT_EQ(rc, NO_ERROR, mx_status_get_string(rc));
+        ASSERT_TRUE(gDigest == expected, "Incorrect root digest");
+    }
+    END_TEST;
+}
+
 bool CreateCWrappers(void) {
     BEGIN_TEST;
     InitData(kSmall);
@@ -585,6 +603,72 @@ bool VerifyNodeByNode(void) {
     END_TEST;
 }
 
+// Checks every node of every level on its own, as a reader that loads and
+// verifies a blob lazily would.
+bool VerifySingleNodes(void) {
+    BEGIN_TEST;
+    Tree merkleTree;
+    InitData(kUnaligned);
+    mx_status_t rc =
+        merkleTree.Create(gData, gDataLen, gTree, gTreeLen, &gDigest);
+    ASSERT_EQ(rc, NO_ERROR, mx_status_get_string(rc));
+    Tree verifier;
+    rc = verifier.SetLengths(gDataLen, gTreeLen);
+    ASSERT_EQ(rc, NO_ERROR, mx_status_get_string(rc));
+    ASSERT_EQ(verifier.levels(), 2, "Wrong number of levels");
+    size_t nodes = (gDataLen + kNodeSize - 1) / kNodeSize;
+    for (uint64_t level = 0; level <= verifier.levels(); ++level) {
+        for (uint64_t i = 0; i < nodes; ++i) {
+            rc = verifier.VerifyNode(gData, gTree, level, i, gDigest);
+            ASSERT_EQ(rc, NO_ERROR, mx_status_get_string(rc));
+        }
+        rc = verifier.VerifyNode(gData, gTree, level, nodes, gDigest);
+        ASSERT_EQ(rc, ERR_INVALID_ARGS, "Verified a node past the end");
+        nodes = (nodes * Digest::kLength + kNodeSize - 1) / kNodeSize;
+    }
+    ASSERT_EQ(verifier.GetNodeOffset(2, 0), kNodeSize * 2,
+              "Wrong offset for the top node");
+    END_TEST;
+}
+
+bool VerifySingleNodeBadLeaf(void) {
+    BEGIN_TEST;
+    Tree merkleTree;
+    InitData(kUnaligned);
+    mx_status_t rc =
+        merkleTree.Create(gData, gDataLen, gTree, gTreeLen, &gDigest);
+    ASSERT_EQ(rc, NO_ERROR, mx_status_get_string(rc));
+    // Flip the last byte of the last, partial node.
+    gData[gDataLen - 1] ^= 1;
+    uint64_t last = gDataLen / kNodeSize;
+    rc = merkleTree.VerifyNode(gData, gTree, 0, last, gDigest);
+    ASSERT_EQ(rc, ERR_IO_DATA_INTEGRITY, mx_status_get_string(rc));
+    rc = merkleTree.VerifyNode(gData, gTree, 0, last - 1, gDigest);
+    ASSERT_EQ(rc, NO_ERROR, mx_status_get_string(rc));
+    END_TEST;
+}
+
+bool VerifySingleNodeBadTree(void) {
+    BEGIN_TEST;
+    Tree merkleTree;
+    InitData(kLarge);
+    mx_status_t rc =
+        merkleTree.Create(gData, gDataLen, gTree, gTreeLen, &gDigest);
+    ASSERT_EQ(rc, NO_ERROR, mx_status_get_string(rc));
+    // The first digest of the first level: its node no longer matches the
+    // level above, and the data node it covers no longer matches it.
+    gTree[0] ^= 1;
+    rc = merkleTree.VerifyNode(gData, gTree, 1, 0, gDigest);
+    ASSERT_EQ(rc, ERR_IO_DATA_INTEGRITY, mx_status_get_string(rc));
+    rc = merkleTree.VerifyNode(gData, gTree, 0, 0, gDigest);
+    ASSERT_EQ(rc, ERR_IO_DATA_INTEGRITY, mx_status_get_string(rc));
+    rc = merkleTree.VerifyNode(gData, gTree, 1, 1, gDigest);
+    ASSERT_EQ(rc, NO_ERROR, mx_status_get_string(rc));
+    rc = merkleTree.VerifyNode(gData, gTree, 2, 0, gDigest);
+    ASSERT_EQ(rc, NO_ERROR, mx_status_get_string(rc));
+    END_TEST;
+}
+
 bool VerifyWithoutData(void) {
     BEGIN_TEST;
     Tree merkleTree;
@@ -876,6 +960,35 @@ bool VerifyBadLeaves(void) {
     END_TEST;
 }
 
+bool VerifyBadLeavesThreaded(void) {
+    BEGIN_TEST;
+    Tree merkleTree;
+    auto& data_failures = merkleTree.data_failures();
+    auto& tree_failures = merkleTree.tree_failures();
+    InitData(kUnaligned);
+    mx_status_t rc =
+        merkleTree.Create(gData, gDataLen, gTree, gTreeLen, &gDigest, 4);
+    ASSERT_EQ(rc, NO_ERROR, mx_status_get_string(rc));
+    rc = merkleTree.Verify(gData, gDataLen, gTree, gTreeLen, 0, gDataLen,
+                           gDigest, 4);
+    ASSERT_EQ(rc, NO_ERROR, mx_status_get_string(rc));
+    // Corrupt a node in the first thread's share, one in the last thread's,
+    // and the partial node at the end, which isn't hashed by the threads.
+    const uint64_t bad[] = {kNodeSize, kLarge - kNodeSize, kLarge};
+    for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); ++i) {
+        gData[bad[i]] ^= 1;
+    }
+    rc = merkleTree.Verify(gData, gDataLen, gTree, gTreeLen, 0, gDataLen,
+                           gDigest, 4);
+    ASSERT_EQ(rc, ERR_IO_DATA_INTEGRITY, mx_status_get_string(rc));
+    ASSERT_EQ(data_failures.size(), 3, "Wrong number of data_failures");
+    for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); ++i) {
+        ASSERT_EQ(data_failures[i], bad[i], "Wrong offset for data_failure");
+    }
+    ASSERT_EQ(tree_failures.size(), 0, "Wrong number of tree_failures");
+    END_TEST;
+}
+
 bool CreateAndVerifyHugePRNGData(void) {
     BEGIN_TEST;
     Tree merkleTree;
@@ -998,6 +1111,7 @@ RUN_TEST(CreateFinalWithoutTree)
 RUN_TEST(CreateFinalMissingDigest)
 RUN_TEST(CreateFinalIncompleteData)
 RUN_TEST(Create)
+RUN_TEST(CreateThreaded)
 RUN_TEST(CreateCWrappers)
 RUN_TEST(CreateByteByByte)
 RUN_TEST(CreateWithoutData)
@@ -1015,6 +1129,9 @@ RUN_TEST(SetRangesOutOfBounds)
 RUN_TEST(Verify)
 RUN_TEST(VerifyCWrapper)
 RUN_TEST(VerifyNodeByNode)
+RUN_TEST(VerifySingleNodes)
+RUN_TEST(VerifySingleNodeBadLeaf)
+RUN_TEST(VerifySingleNodeBadTree)
 RUN_TEST(VerifyWithoutData)
 RUN_TEST(VerifyWithoutTree)
 RUN_TEST(VerifyMissingData)
@@ -1032,5 +1149,6 @@ RUN_TEST(VerifyGoodPartOfBadTree)
 RUN_TEST(VerifyBadTree)
 RUN_TEST(VerifyGoodPartOfBadLeaves)
 RUN_TEST(VerifyBadLeaves)
+RUN_TEST(VerifyBadLeavesThreaded)
 RUN_TEST(CreateAndVerifyHugePRNGData)
 END_TEST_CASE(MerkleTreeTests)
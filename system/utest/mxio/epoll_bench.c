@@ -0,0 +1,87 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <stdio.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include <magenta/syscalls.h>
+#include <mxio/io.h>
+#include <mxio/limits.h>
+#include <unittest/unittest.h>
+
+#define WAIT_CYCLES 1000
+
+// Prints the rate of |count| operations which took from |start| until now.
+static void print_rate(const char* what, int num_fds, size_t count, uint64_t start) {
+    uint64_t ticks = mx_ticks_get() - start;
+    double secs = (double)ticks / (double)mx_ticks_per_second();
+    printf("Benchmark epoll %s (%d fds): [%10.1f] ops/s\n", what, num_fds,
+           (double)count / secs);
+}
+
+// Registers as many event fds as the fd table has room for, with one in a
+// hundred of them ready, and measures epoll_ctl() and epoll_wait(). The
+// cost of each epoll_wait() should follow the number of ready fds rather
+// than the number registered.
+static bool benchmark_epoll_sparse(void) {
+    BEGIN_TEST;
+    static mx_handle_t handles[MAX_MXIO_FD];
+    static int fds[MAX_MXIO_FD];
+    static struct epoll_event events[MAX_MXIO_FD];
+
+    int epollfd = epoll_create1(0);
+    ASSERT_GE(epollfd, 0, "epoll_create1() failed");
+
+    int num_fds = 0;
+    while (num_fds < MAX_MXIO_FD) {
+        mx_handle_t h;
+        ASSERT_EQ(mx_event_create(0u, &h), NO_ERROR, "mx_event_create() failed");
+        int fd = mxio_handle_fd(h, MX_USER_SIGNAL_0, MX_USER_SIGNAL_1, false);
+        if (fd < 0) {
+            mx_handle_close(h);
+            break;
+        }
+        handles[num_fds] = h;
+        fds[num_fds++] = fd;
+    }
+    ASSERT_GT(num_fds, 0, "no room for any fds");
+    printf("\n");
+
+    uint64_t start = mx_ticks_get();
+    for (int i = 0; i < num_fds; i++) {
+        struct epoll_event ev = {.events = EPOLLIN, .data.fd = fds[i]};
+        ASSERT_EQ(epoll_ctl(epollfd, EPOLL_CTL_ADD, fds[i], &ev), 0, "epoll_ctl() failed");
+    }
+    print_rate("add", num_fds, num_fds, start);
+
+    int num_ready = num_fds / 100 ? num_fds / 100 : 1;
+    for (int i = 0; i < num_ready; i++) {
+        ASSERT_EQ(mx_object_signal(handles[i * (num_fds / num_ready)], 0u, MX_USER_SIGNAL_0),
+                  NO_ERROR, "mx_object_signal() failed");
+    }
+
+    // ready fds stay ready, so every wait reports them again
+    start = mx_ticks_get();
+    for (int i = 0; i < WAIT_CYCLES; i++) {
+        ASSERT_EQ(epoll_wait(epollfd, events, num_fds, 0), num_ready, "epoll_wait() failed");
+    }
+    print_rate("wait", num_fds, WAIT_CYCLES, start);
+
+    start = mx_ticks_get();
+    for (int i = 0; i < num_fds; i++) {
+        ASSERT_EQ(epoll_ctl(epollfd, EPOLL_CTL_DEL, fds[i], NULL), 0, "epoll_ctl() failed");
+    }
+    print_rate("del", num_fds, num_fds, start);
+
+    close(epollfd);
+    for (int i = 0; i < num_fds; i++) {
+        close(fds[i]);
+    }
+    END_TEST;
+}
+
+BEGIN_TEST_CASE(epoll_benchmarks)
+RUN_TEST_PERFORMANCE(benchmark_epoll_sparse)
+END_TEST_CASE(epoll_benchmarks)
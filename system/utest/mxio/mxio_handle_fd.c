@@ -60,6 +60,68 @@ bool epoll_test(void) {
     END_TEST;
 }
 
+bool epoll_edge_oneshot_test(void) {
+    BEGIN_TEST;
+
+    mx_handle_t h = MX_HANDLE_INVALID;
+    ASSERT_EQ(NO_ERROR, mx_event_create(0u, &h), "mx_event_create() failed");
+    int fd = mxio_handle_fd(h, MX_USER_SIGNAL_0, MX_USER_SIGNAL_1, false);
+    ASSERT_GT(fd, 0, "mxio_handle_fd() failed");
+
+    mx_handle_t oneshot_h = MX_HANDLE_INVALID;
+    ASSERT_EQ(NO_ERROR, mx_event_create(0u, &oneshot_h), "mx_event_create() failed");
+    int oneshot_fd = mxio_handle_fd(oneshot_h, MX_USER_SIGNAL_0, MX_USER_SIGNAL_1, false);
+    ASSERT_GT(oneshot_fd, 0, "mxio_handle_fd() failed");
+
+    int epollfd = epoll_create(0);
+    ASSERT_GT(epollfd, 0, "epoll_create() failed");
+
+    struct epoll_event ev, events[2];
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+    ev.data.fd = fd;
+    ASSERT_EQ(0, epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &ev), "epoll_ctl() failed");
+    ev.events = EPOLLIN | EPOLLONESHOT;
+    ev.data.fd = oneshot_fd;
+    ASSERT_EQ(0, epoll_ctl(epollfd, EPOLL_CTL_ADD, oneshot_fd, &ev), "epoll_ctl() failed");
+    EXPECT_EQ(-1, epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &ev), "duplicate add should fail");
+
+    // an edge is reported once, however long the fd stays ready
+    ASSERT_EQ(NO_ERROR, mx_object_signal(h, 0u, MX_USER_SIGNAL_0), "");
+    EXPECT_EQ(1, epoll_wait(epollfd, events, 2, 0), "");
+    EXPECT_EQ((uint32_t)EPOLLIN, events[0].events, "");
+    EXPECT_EQ(fd, events[0].data.fd, "");
+    EXPECT_EQ(0, epoll_wait(epollfd, events, 2, 0), "");
+
+    ASSERT_EQ(NO_ERROR, mx_object_signal(h, 0u, MX_USER_SIGNAL_1), "");
+    EXPECT_EQ(1, epoll_wait(epollfd, events, 2, 0), "");
+    EXPECT_EQ((uint32_t)(EPOLLIN | EPOLLOUT), events[0].events, "");
+
+    // a oneshot fd is disabled after one event until it is modified
+    ASSERT_EQ(NO_ERROR, mx_object_signal(oneshot_h, 0u, MX_USER_SIGNAL_0), "");
+    EXPECT_EQ(1, epoll_wait(epollfd, events, 2, 0), "");
+    EXPECT_EQ(oneshot_fd, events[0].data.fd, "");
+    ASSERT_EQ(NO_ERROR, mx_object_signal(oneshot_h, MX_USER_SIGNAL_0, 0u), "");
+    ASSERT_EQ(NO_ERROR, mx_object_signal(oneshot_h, 0u, MX_USER_SIGNAL_0), "");
+    EXPECT_EQ(0, epoll_wait(epollfd, events, 2, 0), "");
+
+    ASSERT_EQ(0, epoll_ctl(epollfd, EPOLL_CTL_MOD, oneshot_fd, &ev), "epoll_ctl() failed");
+    EXPECT_EQ(1, epoll_wait(epollfd, events, 2, 0), "");
+    EXPECT_EQ(oneshot_fd, events[0].data.fd, "");
+
+    // nothing is reported for a removed fd
+    ASSERT_EQ(0, epoll_ctl(epollfd, EPOLL_CTL_DEL, oneshot_fd, NULL), "epoll_ctl() failed");
+    EXPECT_EQ(-1, epoll_ctl(epollfd, EPOLL_CTL_MOD, oneshot_fd, &ev), "fd should be gone");
+    ASSERT_EQ(NO_ERROR, mx_object_signal(oneshot_h, MX_USER_SIGNAL_0, 0u), "");
+    ASSERT_EQ(NO_ERROR, mx_object_signal(oneshot_h, 0u, MX_USER_SIGNAL_0), "");
+    EXPECT_EQ(0, epoll_wait(epollfd, events, 2, 0), "");
+
+    close(epollfd);
+    close(oneshot_fd);
+    close(fd);
+
+    END_TEST;
+}
+
 bool close_test(void) {
     BEGIN_TEST;
 
@@ -130,6 +192,7 @@ bool pipe_test(void) {
 
 BEGIN_TEST_CASE(mxio_handle_fd_test)
 RUN_TEST(epoll_test);
+RUN_TEST(epoll_edge_oneshot_test);
 RUN_TEST(close_test);
 RUN_TEST(pipe_test);
 END_TEST_CASE(mxio_handle_fd_test)
@@ -175,10 +175,15 @@ int pthread_cond_timedwait(pthread_cond_t* restrict c, pthread_mutex_t* restrict
         atomic_fetch_add(&m->_m_waiters, 1);
 
     /* Unlock the barrier that's holding back the next waiter, and
-     * either wake it or requeue it to the mutex. */
-    if (node.prev)
-        unlock_requeue(&node.prev->barrier, &m->_m_lock);
-    else
+     * either wake it or requeue it to the mutex.  Waiters can't be
+     * requeued onto a priority inheriting mutex, since the kernel only
+     * hands those to threads waiting in mx_futex_lock_pi(). */
+    if (node.prev) {
+        if (m->_m_type & PTHREAD_MUTEX_PRIO_INHERIT)
+            unlock(&node.prev->barrier);
+        else
+            unlock_requeue(&node.prev->barrier, &m->_m_lock);
+    } else
         atomic_fetch_sub(&m->_m_waiters, 1);
 
 done:
@@ -220,6 +225,19 @@ void __private_cond_signal(void* condvar, int n) {
         c->_c_head = 0;
     }
     c->_c_tail = p;
+
+    /* If no waiter is LEAVING, the first signaled waiter can proceed
+     * straight away.  When there are also threads waiting for _c_lock,
+     * wake both with one syscall. */
+    if (first && !atomic_load(&ref)) {
+        if (atomic_exchange(&c->_c_lock, 0) == 2)
+            _mx_futex_wake_op(&c->_c_lock, 1, &first->barrier, 1,
+                              MX_FUTEX_OP(MX_FUTEX_OP_SET, 0, MX_FUTEX_OP_CMP_EQ, 2));
+        else
+            unlock(&first->barrier);
+        return;
+    }
+
     unlock(&c->_c_lock);
 
     /* Wait for any waiters in the LEAVING state to remove
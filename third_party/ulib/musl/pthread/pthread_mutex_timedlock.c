@@ -1,7 +1,33 @@
 #include "pthread_impl.h"
 
+#include <magenta/syscalls.h>
+
+// The kernel hands a priority inheriting mutex straight to the waiter it
+// wakes, and lends the waiters' priority to the owner meanwhile.
+static int pthread_mutex_timedlock_pi(pthread_mutex_t* restrict m,
+                                      const struct timespec* restrict at) {
+    int tid = __thread_get_tid();
+    if ((m->_m_type & PTHREAD_MUTEX_MASK) == PTHREAD_MUTEX_ERRORCHECK &&
+        (atomic_load(&m->_m_lock) & PTHREAD_MUTEX_OWNED_LOCK_MASK) == tid)
+        return EDEADLK;
+
+    mx_time_t deadline;
+    int r = __timespec_to_deadline(CLOCK_REALTIME, at, &deadline);
+    if (r)
+        return r;
+
+    switch (_mx_futex_lock_pi(&m->_m_lock, tid, deadline)) {
+    case NO_ERROR:
+        return 0;
+    case ERR_TIMED_OUT:
+        return ETIMEDOUT;
+    default:
+        return EINVAL;
+    }
+}
+
 int pthread_mutex_timedlock(pthread_mutex_t* restrict m, const struct timespec* restrict at) {
-    if ((m->_m_type & PTHREAD_MUTEX_MASK) == PTHREAD_MUTEX_NORMAL &&
+    if (m->_m_type == PTHREAD_MUTEX_NORMAL &&
         !a_cas_shim(&m->_m_lock, 0, EBUSY))
         return 0;
 
@@ -11,6 +37,9 @@ int pthread_mutex_timedlock(pthread_mutex_t* restrict m, const struct timespec*
     if (r != EBUSY)
         return r;
 
+    if (m->_m_type & PTHREAD_MUTEX_PRIO_INHERIT)
+        return pthread_mutex_timedlock_pi(m, at);
+
     int spins = 100;
     while (spins-- && atomic_load(&m->_m_lock) && !atomic_load(&m->_m_waiters))
         a_spin();
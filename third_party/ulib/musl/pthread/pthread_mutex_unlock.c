@@ -13,6 +13,14 @@ int pthread_mutex_unlock(pthread_mutex_t* m) {
         if ((type & PTHREAD_MUTEX_MASK) == PTHREAD_MUTEX_RECURSIVE && m->_m_count)
             return m->_m_count--, 0;
     }
+    if (m->_m_type & PTHREAD_MUTEX_PRIO_INHERIT) {
+        // With waiters, the kernel has set MX_FUTEX_PI_WAITERS and must
+        // pick the next owner.
+        int tid = __thread_get_tid();
+        if (a_cas_shim(&m->_m_lock, tid, 0) != tid)
+            _mx_futex_unlock_pi(&m->_m_lock);
+        return 0;
+    }
     cont = atomic_exchange(&m->_m_lock, 0);
     if (waiters || cont < 0)
         __wake(&m->_m_lock, 1);
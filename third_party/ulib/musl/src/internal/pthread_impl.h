@@ -122,6 +122,9 @@ static inline struct pthread* tp_to_pthread(void* tp) {
 #define SIGTIMER_SET ((sigset_t*)(const unsigned long[_NSIG / 8 / sizeof(long)]){0x80000000})
 
 #define PTHREAD_MUTEX_MASK (PTHREAD_MUTEX_RECURSIVE | PTHREAD_MUTEX_ERRORCHECK)
+// Set in _m_type for PTHREAD_PRIO_INHERIT mutexes, whose _m_lock is a
+// priority inheriting futex holding the owner's tid.
+#define PTHREAD_MUTEX_PRIO_INHERIT 4
 // The bit used in the recursive and errorchecking cases, which track thread owners.
 #define PTHREAD_MUTEX_OWNED_LOCK_BIT 0x80000000
 #define PTHREAD_MUTEX_OWNED_LOCK_MASK 0x7fffffff
@@ -154,6 +157,11 @@ int __libc_sigprocmask(int, const sigset_t*, sigset_t*);
 int __timedwait(atomic_int*, int, clockid_t, const struct timespec*)
     ATTR_LIBC_VISIBILITY;
 
+// Converts an absolute timeout on the given clock, or no timeout if it is
+// null, to a deadline.  Returns 0, EINVAL, or ETIMEDOUT.
+int __timespec_to_deadline(clockid_t, const struct timespec*, mx_time_t*)
+    ATTR_LIBC_VISIBILITY;
+
 // Loading a library can introduce more thread_local variables. Thread
 // allocation bases bookkeeping decisions based on the current state
 // of thread_locals in the program, so thread creation needs to be
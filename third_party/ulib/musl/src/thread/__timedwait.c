@@ -8,24 +8,33 @@ int __clock_gettime(clockid_t, struct timespec*);
 
 #define NS_PER_S (1000000000ull)
 
-int __timedwait(atomic_int* futex, int val, clockid_t clk, const struct timespec* at) {
+int __timespec_to_deadline(clockid_t clk, const struct timespec* at, mx_time_t* deadline) {
     struct timespec to;
-    mx_time_t deadline = MX_TIME_INFINITE;
 
-    if (at) {
-        if (at->tv_nsec >= NS_PER_S)
-            return EINVAL;
-        if (__clock_gettime(clk, &to))
-            return EINVAL;
-        to.tv_sec = at->tv_sec - to.tv_sec;
-        if ((to.tv_nsec = at->tv_nsec - to.tv_nsec) < 0) {
-            to.tv_sec--;
-            to.tv_nsec += NS_PER_S;
-        }
-        if (to.tv_sec < 0)
-            return ETIMEDOUT;
-        deadline = _mx_deadline_after(to.tv_sec * NS_PER_S + to.tv_nsec);
+    if (!at) {
+        *deadline = MX_TIME_INFINITE;
+        return 0;
     }
+    if (at->tv_nsec >= NS_PER_S)
+        return EINVAL;
+    if (__clock_gettime(clk, &to))
+        return EINVAL;
+    to.tv_sec = at->tv_sec - to.tv_sec;
+    if ((to.tv_nsec = at->tv_nsec - to.tv_nsec) < 0) {
+        to.tv_sec--;
+        to.tv_nsec += NS_PER_S;
+    }
+    if (to.tv_sec < 0)
+        return ETIMEDOUT;
+    *deadline = _mx_deadline_after(to.tv_sec * NS_PER_S + to.tv_nsec);
+    return 0;
+}
+
+int __timedwait(atomic_int* futex, int val, clockid_t clk, const struct timespec* at) {
+    mx_time_t deadline;
+    int r = __timespec_to_deadline(clk, at, &deadline);
+    if (r)
+        return r;
 
     // mx_futex_wait will return ERR_BAD_STATE if someone modifying *addr
     // races with this call. But this is indistinguishable from